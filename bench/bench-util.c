@@ -0,0 +1,141 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "bench-util.h"
+
+#include <stdlib.h>
+
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define BENCH_HAVE_MALLINFO2 1
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+
+uint64_t bench_now_ns(void) {
+  static LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER now;
+  if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+}
+#else
+#include <time.h>
+
+uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+// Allocation counting
+// -------------------
+
+static volatile uint64_t allocation_count = 0;
+
+uint64_t bench_allocation_count(void) { return allocation_count; }
+
+#if defined(__GLIBC__) && !defined(BENCH_NO_ALLOCATION_COUNTING)
+
+// glibc lets the executable replace the malloc family and still reach the
+// real allocator through the __libc_ entry points.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+  allocation_count++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  allocation_count++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  allocation_count++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) { __libc_free(ptr); }
+
+int bench_counts_allocations(void) { return 1; }
+
+#else
+
+int bench_counts_allocations(void) { return 0; }
+
+#endif
+
+// Heap usage
+// ----------
+
+#ifdef BENCH_HAVE_MALLINFO2
+
+int bench_measures_heap(void) { return 1; }
+
+size_t bench_heap_bytes(void) {
+  const struct mallinfo2 info = mallinfo2();
+  // the small blocks plus the ones mmap()-ed on their own
+  return info.uordblks + info.hblkhd;
+}
+
+#else
+
+int bench_measures_heap(void) { return 0; }
+
+size_t bench_heap_bytes(void) { return 0; }
+
+#endif
+
+// Random numbers
+// --------------
+
+uint64_t bench_rng_next(bench_rng* rng) {
+  uint64_t x = rng->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rng->state = x;
+  return x * 2685821657736338717ull;
+}
+
+size_t bench_rng_below(bench_rng* rng, size_t bound) {
+  return bound == 0 ? 0 : (size_t)(bench_rng_next(rng) % bound);
+}
+
+// Percentiles
+// -----------
+
+static int compare_u32(const void* a, const void* b) {
+  const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+uint32_t bench_percentile(bench_samples* samples, double p) {
+  size_t idx;
+  if (samples->count == 0) return 0;
+  qsort(samples->ns, samples->count, sizeof(uint32_t), compare_u32);
+  idx = (size_t)(p / 100.0 * (double)(samples->count - 1) + 0.5);
+  return samples->ns[idx];
+}
@@ -0,0 +1,57 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returns a monotonic timestamp in nanoseconds
+uint64_t bench_now_ns(void);
+
+// Returns 1 if the allocations of the process are counted (only when the
+// malloc family can be wrapped, on glibc for now)
+int bench_counts_allocations(void);
+
+// Returns the number of malloc / calloc / realloc calls so far
+uint64_t bench_allocation_count(void);
+
+// Returns 1 if the heap in use can be measured (glibc 2.33 and later)
+int bench_measures_heap(void);
+
+// Returns the bytes of the heap in use (0 if not measured)
+size_t bench_heap_bytes(void);
+
+// A small xorshift64* generator so runs are reproducible
+typedef struct bench_rng {
+  uint64_t state;
+} bench_rng;
+
+uint64_t bench_rng_next(bench_rng* rng);
+
+// Returns a number in [0, bound)
+size_t bench_rng_below(bench_rng* rng, size_t bound);
+
+// Latency samples of a benchmark run
+typedef struct bench_samples {
+  uint32_t* ns;
+  size_t count;
+} bench_samples;
+
+// Sorts the samples and returns the p-th percentile (0..100)
+uint32_t bench_percentile(bench_samples* samples, double p);
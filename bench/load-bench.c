@@ -0,0 +1,217 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+/*
+        Measures how loading a binding config scales from 100 to 100k
+        bindings: the time to parse the CSV (and to map the compiled
+        config) and to build the routing table from the rows, and the heap
+        the loaded rows and their interned names take.
+
+        Every config has 100 hosts, and each site prefers two of them and
+        forbids two others.
+
+        Usage: palette-director-load-bench [runs]
+*/
+
+#include <mod_proxy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-util.h"
+#include "compiled-config.h"
+#include "config-loader.h"
+#include "routing-table.h"
+#include "synthetic-config.h"
+
+enum {
+  kHOST_COUNT = 100,
+  kBINDINGS_PER_SITE = 4,
+  kDEFAULT_RUNS = 5,
+};
+
+static const size_t kBINDING_COUNTS[] = {100, 1000, 10000, 100000};
+
+static const char* kCSV_PATH = "palette-director-load-bench.csv";
+static const char* kCOMPILED_PATH = "palette-director-load-bench.pdbc";
+
+typedef struct load_result {
+  size_t loaded_count;
+  // The distinct site and host names of the CSV
+  size_t name_count;
+  size_t csv_bytes;
+  size_t compiled_bytes;
+
+  // The fastest of the runs
+  double parse_ms;
+  double map_ms;
+  double build_ms;
+
+  // The heap the loaded rows and their names take
+  size_t parsed_heap_bytes;
+  size_t mapped_heap_bytes;
+
+  size_t table_bytes;
+} load_result;
+
+static double ms_since(uint64_t t0) {
+  return (double)(bench_now_ns() - t0) / 1e6;
+}
+
+static double min_ms(double a, double b) { return (a < b) ? a : b; }
+
+static size_t file_size(const char* path) {
+  FILE* f = fopen(path, "rb");
+  long size;
+  if (f == NULL) return 0;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fclose(f);
+  return size > 0 ? (size_t)size : 0;
+}
+
+// Compiles the rows into path, returns 0 on error
+static int write_compiled(const binding_rows* rows, const char* path) {
+  size_t size = 0;
+  compiled_config_header* compiled = compiled_config_build(rows, &size);
+  FILE* f;
+  int ok;
+
+  if (compiled == NULL) return 0;
+  f = fopen(path, "wb");
+  ok = f != NULL && fwrite(compiled, size, 1, f) == 1;
+  if (f != NULL) ok = (fclose(f) == 0) && ok;
+  free(compiled);
+  return ok;
+}
+
+static int run_load(size_t binding_count, size_t runs, load_result* out) {
+  const synthetic_config config = {
+      "load", binding_count / kBINDINGS_PER_SITE, kHOST_COUNT, 2, 2, 1, 0};
+  synthetic_balancer* b = synthetic_balancer_create(&config, "balancer://load");
+  proxy_balancer* balancer = &b->balancer;
+  binding_rows synthetic = synthetic_config_bindings(&config);
+  size_t run;
+
+  memset(out, 0, sizeof(*out));
+  out->parse_ms = out->map_ms = out->build_ms = 1e30;
+
+  if (synthetic_config_write_csv(&config, kCSV_PATH) == 0 ||
+      !write_compiled(&synthetic, kCOMPILED_PATH)) {
+    synthetic_free_bindings(&synthetic);
+    synthetic_balancer_free(b);
+    return 0;
+  }
+  synthetic_free_bindings(&synthetic);
+  out->csv_bytes = file_size(kCSV_PATH);
+  out->compiled_bytes = file_size(kCOMPILED_PATH);
+
+  for (run = 0; run < runs; ++run) {
+    binding_rows binding_sets[kBINDING_SET_COUNT];
+    apr_pool_t pool = {NULL};
+    binding_config parsed, mapped;
+    routing_table* table;
+    size_t heap_before;
+    uint64_t t0;
+
+    // Parse the CSV
+    heap_before = bench_heap_bytes();
+    t0 = bench_now_ns();
+    parsed = parse_csv_config(&pool, kCSV_PATH);
+    out->parse_ms = min_ms(out->parse_ms, ms_since(t0));
+    out->parsed_heap_bytes = bench_heap_bytes() - heap_before;
+    out->loaded_count = parsed.rows.count;
+    out->name_count = parsed.names.count;
+    memset(binding_sets, 0, sizeof(binding_sets));
+    binding_sets[kBINDING_SET_WORKER] = parsed.rows;
+
+    // Build the routing table from the rows
+    t0 = bench_now_ns();
+    table = routing_table_build(binding_sets, &balancer, 1, NULL);
+    out->build_ms = min_ms(out->build_ms, ms_since(t0));
+    if (table == NULL) return 0;
+    out->table_bytes = table->size;
+    routing_table_free(table);
+    apr_pool_destroy(&pool);
+
+    // Map the compiled config
+    heap_before = bench_heap_bytes();
+    t0 = bench_now_ns();
+    mapped = load_binding_config(&pool, kCOMPILED_PATH);
+    out->map_ms = min_ms(out->map_ms, ms_since(t0));
+    out->mapped_heap_bytes = bench_heap_bytes() - heap_before;
+    if (mapped.rows.count != out->loaded_count) {
+      fprintf(stderr, "The compiled config has %lu rows instead of %lu\n",
+              (unsigned long)mapped.rows.count,
+              (unsigned long)out->loaded_count);
+      return 0;
+    }
+    unload_binding_config(&mapped);
+    apr_pool_destroy(&pool);
+  }
+
+  remove(kCSV_PATH);
+  remove(kCOMPILED_PATH);
+  synthetic_balancer_free(b);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  size_t runs = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : kDEFAULT_RUNS;
+  size_t i;
+
+  if (runs == 0) runs = 1;
+
+  printf("%9s %9s %7s %9s %9s %9s %10s %9s %9s %10s %9s %10s\n",
+         "bindings", "loaded", "names", "CSV KB", "parse ms", "heap KB",
+         "pdbc KB", "map ms", "heap KB", "B/binding", "build ms", "table KB");
+
+  for (i = 0; i < sizeof(kBINDING_COUNTS) / sizeof(kBINDING_COUNTS[0]); ++i) {
+    load_result res;
+    if (!run_load(kBINDING_COUNTS[i], runs, &res)) {
+      fprintf(stderr, "Loading %lu bindings failed\n",
+              (unsigned long)kBINDING_COUNTS[i]);
+      return 2;
+    }
+
+    printf("%9lu %9lu %7lu %9.1f %9.2f ", (unsigned long)kBINDING_COUNTS[i],
+           (unsigned long)res.loaded_count, (unsigned long)res.name_count,
+           (double)res.csv_bytes / 1024.0, res.parse_ms);
+    if (bench_measures_heap()) {
+      printf("%9.1f ", (double)res.parsed_heap_bytes / 1024.0);
+    } else {
+      printf("%9s ", "n/a");
+    }
+    printf("%10.1f %9.2f ", (double)res.compiled_bytes / 1024.0, res.map_ms);
+    if (bench_measures_heap()) {
+      printf("%9.1f %10.1f ", (double)res.mapped_heap_bytes / 1024.0,
+             (double)res.parsed_heap_bytes / (double)res.loaded_count);
+    } else {
+      printf("%9s %10s ", "n/a", "n/a");
+    }
+    printf("%9.2f %10.1f\n", res.build_ms, (double)res.table_bytes / 1024.0);
+
+    if (res.loaded_count != kBINDING_COUNTS[i]) {
+      fprintf(stderr, "FAILED: loaded %lu of %lu bindings\n",
+              (unsigned long)res.loaded_count,
+              (unsigned long)kBINDING_COUNTS[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
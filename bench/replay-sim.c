@@ -0,0 +1,361 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+/*
+        Replays a request trace against a simulated VizQL cluster with each
+        worker selection mode (busyness, peak EWMA and two random choices),
+        and compares the response times the clients would have seen.
+
+        The trace mixes tile requests, queries and bootstrapSession calls.
+        Every worker runs a fixed number of requests at once and queues the
+        rest, and one of the workers is several times slower than the
+        others (a GC pause or a heavy extract refresh) while looking just as
+        idle to the busy counter. The workers are picked with the real
+        check_worker_sets() and the response times are fed back through
+        routing_counters_observe() at the simulated completion times, like
+        the log_transaction hook does.
+
+        A second run binds the site to two preferred workers (the slow one
+        and another) and compares staying on them with overflowing to the
+        rest of the cluster at a few thresholds.
+
+        Usage: palette-director-replay [requests]
+*/
+
+#include <math.h>
+#include <mod_proxy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-util.h"
+#include "routing-counters.h"
+#include "routing-table.h"
+#include "synthetic-config.h"
+#include "worker-selection.h"
+
+enum {
+  kDEFAULT_REQUESTS = 200000,
+
+  kWORKER_COUNT = 8,
+  // Requests a worker runs at the same time (the rest wait in its queue)
+  kWORKER_SLOTS = 4,
+  // The slow worker and how many times slower it is
+  kSLOW_WORKER = 0,
+  kSLOWDOWN = 5,
+
+  kDECAY_MS = 10 * 1000,
+};
+
+// The load levels replayed: the mean time between requests
+typedef struct replay_load {
+  const char* name;
+  double mean_interarrival_ms;
+} replay_load;
+
+static const replay_load kLOADS[] = {
+    {"~15% load", 40.0}, {"~30% load", 20.0}, {"~60% load", 11.0}};
+
+// How the workers are picked
+enum { kMODE_BUSYNESS, kMODE_PEAK_EWMA, kMODE_SAMPLED, kMODE_COUNT };
+
+static const char* const kMODE_NAMES[kMODE_COUNT] = {"busyness", "peak-ewma",
+                                                     "sampled"};
+
+// Workers are passed over at this many times the average busyness
+static const double kLOAD_FACTOR = 1.5;
+
+// The overflow thresholds replayed with the preferred workers (spill_busy 0
+// never spills over)
+typedef struct replay_overflow {
+  const char* name;
+  size_t spill_busy;
+  size_t return_busy;
+} replay_overflow;
+
+static const replay_overflow kOVERFLOWS[] = {
+    {"prefer", 0, 0}, {"spill 8/4", 8, 4}, {"spill 4/2", 4, 2}};
+
+// A request of the trace
+typedef struct replay_request {
+  double arrival_ms;
+  double service_ms;
+} replay_request;
+
+// A request in flight: when it completes and on which worker
+typedef struct replay_event {
+  double done_ms;
+  double arrival_ms;
+  size_t worker;
+} replay_event;
+
+// A binary min-heap of the requests in flight by completion time
+typedef struct replay_heap {
+  replay_event* events;
+  size_t count;
+} replay_heap;
+
+static void heap_push(replay_heap* h, replay_event e) {
+  size_t i = h->count++;
+  while (i > 0 && h->events[(i - 1) / 2].done_ms > e.done_ms) {
+    h->events[i] = h->events[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h->events[i] = e;
+}
+
+static replay_event heap_pop(replay_heap* h) {
+  const replay_event top = h->events[0];
+  const replay_event last = h->events[--h->count];
+  size_t i = 0;
+
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= h->count) break;
+    if (child + 1 < h->count &&
+        h->events[child + 1].done_ms < h->events[child].done_ms) {
+      child++;
+    }
+    if (last.done_ms <= h->events[child].done_ms) break;
+    h->events[i] = h->events[child];
+    i = child;
+  }
+  if (h->count > 0) h->events[i] = last;
+  return top;
+}
+
+// Returns an exponentially distributed number with the given mean
+static double rng_exponential(bench_rng* rng, double mean) {
+  const double u =
+      ((double)(bench_rng_next(rng) >> 11) + 0.5) / 9007199254740992.0;
+  return -mean * log(u);
+}
+
+// 90% tiles, 9% queries and 1% bootstrapSession calls
+static replay_request* generate_trace(size_t count,
+                                      double mean_interarrival_ms) {
+  bench_rng rng = {0x2545F4914F6CDD1Dull};
+  replay_request* trace =
+      (replay_request*)malloc(sizeof(replay_request) * count);
+  double now = 0.0;
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    const size_t roll = bench_rng_below(&rng, 100);
+    now += rng_exponential(&rng, mean_interarrival_ms);
+    trace[i].arrival_ms = now;
+    if (roll < 90) {
+      trace[i].service_ms = rng_exponential(&rng, 50.0);
+    } else if (roll < 99) {
+      trace[i].service_ms = rng_exponential(&rng, 500.0);
+    } else {
+      trace[i].service_ms = rng_exponential(&rng, 10000.0);
+    }
+  }
+  return trace;
+}
+
+typedef struct replay_result {
+  double mean_ms;
+  uint32_t p50_ms, p99_ms, p999_ms;
+  double slow_share;
+} replay_result;
+
+// Replays the trace with a selection mode. With an overflow setup the site
+// of the requests prefers two of the workers.
+static void replay(const replay_request* trace, size_t count, int mode,
+                   const replay_overflow* spill, replay_result* out) {
+  static const synthetic_config kCLUSTER = {"replay", 1, kWORKER_COUNT, 0, 0,
+                                            1, 0};
+  static const synthetic_config kPREFERRED = {"preferred", 1, kWORKER_COUNT,
+                                              2, 0, 1, 0};
+  const synthetic_config* cluster = (spill != NULL) ? &kPREFERRED : &kCLUSTER;
+  synthetic_balancer* b =
+      synthetic_balancer_create(cluster, "balancer://replay");
+  proxy_balancer* balancer = &b->balancer;
+  binding_rows binding_sets[kBINDING_SET_COUNT];
+  char site_name[64];
+  int site_idx = kROUTING_NOT_FOUND;
+  overflow_scope overflow;
+  routing_table* table;
+  uint32_t* counters;
+  double slot_free_ms[kWORKER_COUNT][kWORKER_SLOTS];
+  replay_heap in_flight;
+  // The response times (in milliseconds here)
+  bench_samples samples;
+  server_rec server = {"replay"};
+  request_rec r;
+  selection_context ctx;
+  latency_scoring scoring;
+  routing_tiers tiers;
+  double total_ms = 0.0;
+  size_t i, slow_count = 0;
+  int balancer_idx;
+
+  memset(binding_sets, 0, sizeof(binding_sets));
+  memset(slot_free_ms, 0, sizeof(slot_free_ms));
+  memset(&r, 0, sizeof(r));
+  r.server = &server;
+
+  binding_sets[kBINDING_SET_WORKER] = synthetic_config_bindings(cluster);
+  table = routing_table_build(binding_sets, &balancer, 1, NULL);
+  synthetic_free_bindings(&binding_sets[kBINDING_SET_WORKER]);
+  counters = (uint32_t*)calloc(1, routing_counters_size(table));
+  balancer_idx = routing_table_find_balancer(table, balancer);
+  if (spill != NULL) {
+    synthetic_site_name(site_name, sizeof(site_name), 0);
+    site_idx = routing_table_find_site(
+        table, site_name, strlen(site_name),
+        routing_site_hash(site_name, strlen(site_name)));
+  }
+  tiers =
+      routing_table_tiers(table, kBINDING_SET_WORKER, site_idx, balancer_idx);
+
+  in_flight.events = (replay_event*)malloc(sizeof(replay_event) * count);
+  in_flight.count = 0;
+  samples.ns = (uint32_t*)malloc(sizeof(uint32_t) * count);
+  samples.count = count;
+
+  ctx.r = &r;
+  ctx.workers = (proxy_worker**)balancer->workers->elts;
+  ctx.retry_fn = NULL;
+  ctx.health = NULL;
+  ctx.affinity_key = 0;
+  ctx.load_factor = 1.0;
+  ctx.latency = (mode == kMODE_PEAK_EWMA) ? &scoring : NULL;
+  ctx.sample_count = (mode == kMODE_SAMPLED) ? 2 : 0;
+  ctx.quota = NULL;
+  ctx.overflow = NULL;
+  if (spill != NULL && spill->spill_busy > 0) {
+    overflow.table = table;
+    overflow.counters = counters;
+    overflow.site_idx = site_idx;
+    overflow.balancer_idx = balancer_idx;
+    overflow.spill_busy = spill->spill_busy;
+    overflow.return_busy = spill->return_busy;
+    ctx.overflow = &overflow;
+  }
+  scoring.table = table;
+  scoring.counters = counters;
+  scoring.balancer_idx = balancer_idx;
+  scoring.decay_ms = kDECAY_MS;
+  scoring.load_factor = kLOAD_FACTOR;
+
+  for (i = 0; i < count; ++i) {
+    const replay_request* req = &trace[i];
+    worker_selection selection;
+    replay_event e;
+    double start_ms;
+    size_t slot, s;
+
+    // Complete everything that is done by now
+    while (in_flight.count > 0 &&
+           in_flight.events[0].done_ms <= req->arrival_ms) {
+      const replay_event done = heap_pop(&in_flight);
+      b->workers_shared[done.worker].busy--;
+      routing_counters_observe(
+          counters, table, balancer_idx, done.worker,
+          (uint32_t)((done.done_ms - done.arrival_ms) * 1000.0),
+          (uint32_t)done.done_ms, kDECAY_MS);
+    }
+
+    scoring.now_ms = (uint32_t)req->arrival_ms;
+    if (check_worker_sets(&ctx, &tiers, &selection) == NULL) {
+      fprintf(stderr, "No worker for request %lu\n", (unsigned long)i);
+      exit(2);
+    }
+
+    // The request runs on the slot of the worker that frees up first
+    slot = 0;
+    for (s = 1; s < kWORKER_SLOTS; ++s) {
+      if (slot_free_ms[selection.worker][s] <
+          slot_free_ms[selection.worker][slot]) {
+        slot = s;
+      }
+    }
+    start_ms = slot_free_ms[selection.worker][slot];
+    if (start_ms < req->arrival_ms) start_ms = req->arrival_ms;
+
+    e.arrival_ms = req->arrival_ms;
+    e.worker = selection.worker;
+    e.done_ms = start_ms + req->service_ms *
+                               (e.worker == kSLOW_WORKER ? kSLOWDOWN : 1);
+    slot_free_ms[e.worker][slot] = e.done_ms;
+    b->workers_shared[e.worker].busy++;
+    heap_push(&in_flight, e);
+
+    samples.ns[i] = (uint32_t)(e.done_ms - e.arrival_ms);
+    total_ms += e.done_ms - e.arrival_ms;
+    if (e.worker == kSLOW_WORKER) slow_count++;
+  }
+
+  out->mean_ms = total_ms / (double)count;
+  out->p50_ms = bench_percentile(&samples, 50.0);
+  out->p99_ms = bench_percentile(&samples, 99.0);
+  out->p999_ms = bench_percentile(&samples, 99.9);
+  out->slow_share = (double)slow_count / (double)count;
+
+  free(samples.ns);
+  free(in_flight.events);
+  free(counters);
+  routing_table_free(table);
+  synthetic_balancer_free(b);
+}
+
+int main(int argc, char** argv) {
+  size_t count =
+      argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : kDEFAULT_REQUESTS;
+  size_t l, o;
+  int mode;
+
+  if (count == 0) count = 1;
+
+  printf("%-10s %-10s %9s %8s %8s %9s %12s\n", "load", "mode", "mean ms",
+         "p50 ms", "p99 ms", "p99.9 ms", "slow worker");
+
+  for (l = 0; l < sizeof(kLOADS) / sizeof(kLOADS[0]); ++l) {
+    replay_request* trace =
+        generate_trace(count, kLOADS[l].mean_interarrival_ms);
+    for (mode = 0; mode < kMODE_COUNT; ++mode) {
+      replay_result res;
+      replay(trace, count, mode, NULL, &res);
+      printf("%-10s %-10s %9.1f %8u %8u %9u %11.1f%%\n", kLOADS[l].name,
+             kMODE_NAMES[mode], res.mean_ms, res.p50_ms, res.p99_ms,
+             res.p999_ms, res.slow_share * 100.0);
+    }
+    free(trace);
+  }
+
+  printf("\nWith two preferred workers (busyness):\n");
+  printf("%-10s %-10s %9s %8s %8s %9s %12s\n", "load", "overflow",
+         "mean ms", "p50 ms", "p99 ms", "p99.9 ms", "slow worker");
+
+  for (l = 0; l < sizeof(kLOADS) / sizeof(kLOADS[0]); ++l) {
+    replay_request* trace =
+        generate_trace(count, kLOADS[l].mean_interarrival_ms);
+    for (o = 0; o < sizeof(kOVERFLOWS) / sizeof(kOVERFLOWS[0]); ++o) {
+      replay_result res;
+      replay(trace, count, kMODE_BUSYNESS, &kOVERFLOWS[o], &res);
+      printf("%-10s %-10s %9.1f %8u %8u %9u %11.1f%%\n", kLOADS[l].name,
+             kOVERFLOWS[o].name, res.mean_ms, res.p50_ms, res.p99_ms,
+             res.p999_ms, res.slow_share * 100.0);
+    }
+    free(trace);
+  }
+  return 0;
+}
@@ -0,0 +1,525 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+/*
+        Measures the cost of a routing decision outside of httpd.
+
+        For each synthetic config the bindings are compiled into a routing
+        table and then the same steps find_best_bybusyness() takes (site
+        lookup, tier lookup, check_worker_sets(), counting the decision) are
+        timed over a stream of
+        requests. The bindings are also written to a CSV file to time
+        parse_csv_config() on them, and compiled to time mapping them with
+        load_binding_config().
+
+        Usage: palette-director-bench [decisions] [busyness|peak-ewma|sampled]
+                                      [scenario]
+
+        Without a scenario name all the scenarios are run. With peak-ewma
+        the workers are scored by their (seeded) peak EWMA response times
+        like a BindingScoring PeakEWMA balancer, with sampled large lists
+        are picked from with two random choices like a BindingSampling 2
+        balancer.
+
+        Exits with a non-zero status if a routing decision allocates, if a
+        bound site is not found in the table or not routed to the first
+        tier of its candidates (its preferred hosts, if it has any), or if
+        a request URL does not find its balancer by the mod_proxy hashes.
+*/
+
+#include <ctype.h>
+#include <mod_proxy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-util.h"
+#include "compiled-config.h"
+#include "config-loader.h"
+#include "routing-counters.h"
+#include "routing-table.h"
+#include "synthetic-config.h"
+#include "worker-selection.h"
+
+enum {
+  // The number of distinct requests we cycle through
+  kREQUEST_COUNT = 4096,
+
+  kWARMUP_DECISIONS = 20000,
+  kDEFAULT_DECISIONS = 500000,
+};
+
+// How the workers are picked
+enum { kMODE_BUSYNESS, kMODE_PEAK_EWMA, kMODE_SAMPLED, kMODE_COUNT };
+
+static const char* const kMODE_NAMES[kMODE_COUNT] = {"busyness", "peak-ewma",
+                                                     "sampled"};
+
+static const char* kBINDINGS_PATH = "palette-director-bench-bindings.csv";
+static const char* kCOMPILED_PATH = "palette-director-bench-bindings.pdbc";
+
+static const synthetic_config kSCENARIOS[] = {
+    {"small 10x4", 10, 4, 1, 1, 1, 0},
+    {"tableau 400x12", 400, 12, 2, 2, 1, 0},
+    {"400x12 2 lbsets", 400, 12, 2, 2, 2, 0},
+    {"400x12 2 standby", 400, 12, 2, 2, 1, 2},
+    {"allow-heavy 400x12", 400, 12, 0, 1, 1, 0},
+    {"2000x48", 2000, 48, 4, 8, 1, 0},
+    {"10000x100 lbsets+sb", 10000, 100, 4, 16, 2, 4},
+};
+
+// A request as the routing engine sees it: the :site value (or NULL)
+typedef struct bench_request {
+  const char* site_name;
+  size_t site_name_length;
+} bench_request;
+
+typedef struct bench_result {
+  size_t binding_count;
+  size_t loaded_count;
+  double load_ms;
+  double compiled_load_ms;
+  double build_ms;
+  size_t table_bytes;
+  double ns_per_decision;
+  uint32_t p50, p99;
+  double allocations_per_decision;
+  size_t no_candidate_count;
+  // The sites not found or not routed to their first tier
+  size_t misrouted_count;
+} bench_result;
+
+// ap_proxy_retry_worker stand-in: the workers never leave the error state
+static int bench_retry_worker(const char* proxy_function, proxy_worker* worker,
+                              server_rec* s) {
+  return APR_SUCCESS;
+}
+
+// Compiles the rows to a file and times loading it like the module does
+static int time_compiled_load(const binding_rows* rows, double* out_ms) {
+  size_t size = 0;
+  compiled_config_header* compiled = compiled_config_build(rows, &size);
+  apr_pool_t pool = {NULL};
+  binding_config config;
+  FILE* f;
+  uint64_t t0;
+  int ok;
+
+  if (compiled == NULL) return 0;
+  f = fopen(kCOMPILED_PATH, "wb");
+  ok = f != NULL && fwrite(compiled, size, 1, f) == 1;
+  if (f != NULL) ok = (fclose(f) == 0) && ok;
+  free(compiled);
+  if (!ok) return 0;
+
+  t0 = bench_now_ns();
+  config = load_binding_config(&pool, kCOMPILED_PATH);
+  *out_ms = (double)(bench_now_ns() - t0) / 1e6;
+  ok = config.mapping != NULL && config.rows.count == rows->count;
+
+  unload_binding_config(&config);
+  apr_pool_destroy(&pool);
+  remove(kCOMPILED_PATH);
+  return ok;
+}
+
+// The routing steps of find_best_bybusyness() (minus the logging)
+static proxy_worker* route_request(const routing_table* table,
+                                   uint32_t* counters,
+                                   const proxy_balancer* balancer,
+                                   const selection_context* ctx,
+                                   const bench_request* req) {
+  const int balancer_idx = routing_table_find_balancer(table, balancer);
+  int site_idx = kROUTING_NOT_FOUND;
+  routing_tiers tiers;
+  worker_selection selection;
+  proxy_worker* candidate;
+
+  if (req->site_name != NULL) {
+    site_idx = routing_table_find_site(
+        table, req->site_name, req->site_name_length,
+        routing_site_hash(req->site_name, req->site_name_length));
+    if (site_idx == kROUTING_NOT_FOUND) {
+      routing_counters_unknown_site(counters, table, balancer_idx);
+    }
+  } else {
+    routing_counters_no_site(counters, table, balancer_idx);
+  }
+
+  tiers = routing_table_tiers(table, kBINDING_SET_WORKER, site_idx,
+                              balancer_idx);
+  candidate = check_worker_sets(ctx, &tiers, &selection);
+  if (candidate != NULL) {
+    routing_counters_hit(counters, table, site_idx, balancer_idx,
+                         selection.worker, selection.tier);
+  } else {
+    routing_counters_no_candidate(counters, table, site_idx, balancer_idx);
+  }
+  return candidate;
+}
+
+// Moves the busy counters like real traffic would: the selected worker
+// gets a new request and a random worker finishes one.
+static void simulate_traffic(bench_rng* rng, synthetic_balancer* b,
+                             proxy_worker* selected) {
+  proxy_worker_shared* done = b->worker_ptrs[bench_rng_below(
+      rng, (size_t)b->workers_array.nelts)]->s;
+  if (selected != NULL) selected->s->busy++;
+  if (done->busy > 0) done->busy--;
+}
+
+// Mostly known sites, with some unknown sites and requests without a site
+static bench_request* generate_requests(const synthetic_config* c,
+                                        bench_rng* rng, char* names,
+                                        size_t name_size) {
+  bench_request* reqs =
+      (bench_request*)calloc(kREQUEST_COUNT, sizeof(bench_request));
+  size_t i;
+
+  for (i = 0; i < kREQUEST_COUNT; ++i) {
+    const size_t roll = bench_rng_below(rng, 100);
+    char* name = names + i * name_size;
+
+    if (roll < 5) continue;  // no :site in the request
+    if (roll < 10) {
+      snprintf(name, name_size, "Unknown-%lu", (unsigned long)i);
+    } else {
+      synthetic_site_name(name, name_size,
+                          bench_rng_below(rng, c->site_count));
+    }
+    reqs[i].site_name = name;
+    reqs[i].site_name_length = strlen(name);
+  }
+  return reqs;
+}
+
+// Gives every member a response time average to score
+static void seed_peak_ewma(uint32_t* counters, const routing_table* table,
+                           const proxy_balancer* balancer, bench_rng* rng) {
+  const int balancer_idx = routing_table_find_balancer(table, balancer);
+  size_t i;
+  for (i = 0; i < (size_t)balancer->workers->nelts; ++i) {
+    routing_counters_observe(counters, table, balancer_idx, i,
+                             (uint32_t)(1000 + bench_rng_below(rng, 50000)),
+                             0, 10000);
+  }
+}
+
+/*
+ * Routes a request of every site of the config (while every worker is idle)
+ * and returns how many of them were not found in the table or were routed
+ * outside the first tier of their candidates.
+ */
+static size_t check_routes(const synthetic_config* c,
+                           const routing_table* table,
+                           const proxy_balancer* balancer,
+                           const selection_context* ctx) {
+  const int balancer_idx = routing_table_find_balancer(table, balancer);
+  char name[64];
+  size_t i, j, misrouted = 0;
+
+  for (i = 0; i < c->site_count; ++i) {
+    size_t length;
+    int site_idx;
+    routing_tiers tiers;
+    worker_index_slice first;
+    worker_selection selection;
+    int tier = 0;
+
+    synthetic_site_name(name, sizeof(name), i);
+    length = strlen(name);
+    site_idx = routing_table_find_site(table, name, length,
+                                       routing_site_hash(name, length));
+    if (site_idx == kROUTING_NOT_FOUND) {
+      if (misrouted++ == 0) fprintf(stderr, "Site '%s' not found\n", name);
+      continue;
+    }
+    tiers = routing_table_tiers(table, kBINDING_SET_WORKER, site_idx,
+                                balancer_idx);
+    while (tier < kTIER_ALLOW && (tiers.tier_mask & (1u << tier)) == 0) {
+      ++tier;
+    }
+    if (c->prefer_per_site > 0 && tier != kTIER_PREFER) {
+      if (misrouted++ == 0) {
+        fprintf(stderr, "Site '%s' has no preferred workers\n", name);
+      }
+      continue;
+    }
+
+    first = routing_tiers_slice(&tiers, tier);
+    if (check_worker_sets(ctx, &tiers, &selection) != NULL &&
+        selection.tier == tier) {
+      for (j = 0; j < first.count; ++j) {
+        if (WORKER_INDEX_AT(first, j) == selection.worker) break;
+      }
+      if (j < first.count) continue;
+    }
+    if (misrouted++ == 0) {
+      fprintf(stderr, "Site '%s' is not routed to its tier %d\n", name, tier);
+    }
+  }
+  return misrouted;
+}
+
+// Returns the number of request URLs that do not find their balancer (or
+// find one they should not) among a few others, the way the sticky
+// session check finds the balancer of a request
+static size_t check_url_balancer(const proxy_balancer* balancer) {
+  static const char* const kOTHERS[] = {"balancer://other",
+                                        "balancer://vizqlserver-2"};
+  proxy_balancer entries[3];
+  apr_array_header_t balancers;
+  char url[128];
+  size_t i, misrouted = 0;
+
+  memset(entries, 0, sizeof(entries));
+  for (i = 0; i < 2; ++i) {
+    routing_balancer_hashes(kOTHERS[i], strlen(kOTHERS[i]),
+                            &entries[i].hash.def, &entries[i].hash.fnv);
+  }
+  entries[2] = *balancer;
+  balancers.elt_size = sizeof(proxy_balancer);
+  balancers.nelts = 3;
+  balancers.nalloc = 3;
+  balancers.elts = (char*)entries;
+
+  // the request URLs may have any case, the names are lower case
+  snprintf(url, sizeof(url), "%s/views/a", balancer->s->name);
+  for (i = 0; url[i] != '\0'; i += 2) url[i] = (char)toupper(url[i]);
+  if (routing_url_balancer(&balancers, url) != &entries[2]) {
+    fprintf(stderr, "URL '%s' does not find its balancer\n", url);
+    misrouted++;
+  }
+  if (routing_url_balancer(&balancers, balancer->s->name) != &entries[2]) {
+    fprintf(stderr, "URL '%s' does not find its balancer\n",
+            balancer->s->name);
+    misrouted++;
+  }
+  snprintf(url, sizeof(url), "%sx/views/a", balancer->s->name);
+  if (routing_url_balancer(&balancers, url) != NULL) {
+    fprintf(stderr, "URL '%s' finds a balancer\n", url);
+    misrouted++;
+  }
+  return misrouted;
+}
+
+static int run_scenario(const synthetic_config* c, size_t decisions,
+                        int mode, bench_result* out) {
+  enum { kNAME_SIZE = 64 };
+  bench_rng rng = {0x9E3779B97F4A7C15ull};
+  binding_rows binding_sets[kBINDING_SET_COUNT];
+  synthetic_balancer* b =
+      synthetic_balancer_create(c, "balancer://vizqlserver");
+  proxy_balancer* balancer = &b->balancer;
+  routing_table* table;
+  uint32_t* counters;
+  char* names = (char*)calloc(kREQUEST_COUNT, kNAME_SIZE);
+  bench_request* reqs;
+  bench_samples samples;
+  server_rec server = {"bench"};
+  request_rec r;
+  selection_context ctx;
+  worker_health health;
+  latency_scoring scoring;
+  apr_pool_t pool = {NULL};
+  uint64_t t0, allocations_before;
+  size_t i;
+
+  memset(out, 0, sizeof(*out));
+  memset(binding_sets, 0, sizeof(binding_sets));
+  memset(&r, 0, sizeof(r));
+  r.server = &server;
+
+  // Time loading the config from CSV
+  out->binding_count = synthetic_config_write_csv(c, kBINDINGS_PATH);
+  if (out->binding_count == 0) {
+    fprintf(stderr, "Cannot write '%s'\n", kBINDINGS_PATH);
+    return 0;
+  }
+
+  t0 = bench_now_ns();
+  out->loaded_count = parse_csv_config(&pool, kBINDINGS_PATH).rows.count;
+  out->load_ms = (double)(bench_now_ns() - t0) / 1e6;
+  remove(kBINDINGS_PATH);
+  apr_pool_destroy(&pool);
+
+  // Route with the complete config, even if the loader could not load all
+  binding_sets[kBINDING_SET_WORKER] = synthetic_config_bindings(c);
+
+  // Time mapping the compiled config
+  if (!time_compiled_load(&binding_sets[kBINDING_SET_WORKER],
+                          &out->compiled_load_ms)) {
+    fprintf(stderr, "Cannot compile the bindings to '%s'\n", kCOMPILED_PATH);
+    return 0;
+  }
+
+  t0 = bench_now_ns();
+  table = routing_table_build(binding_sets, &balancer, 1, NULL);
+  out->build_ms = (double)(bench_now_ns() - t0) / 1e6;
+  if (table == NULL) return 0;
+  out->table_bytes = table->size;
+  counters = (uint32_t*)calloc(1, routing_counters_size(table));
+
+  reqs = generate_requests(c, &rng, names, kNAME_SIZE);
+  samples.count = decisions;
+  samples.ns = (uint32_t*)malloc(sizeof(uint32_t) * decisions);
+
+  ctx.r = &r;
+  ctx.workers = (proxy_worker**)balancer->workers->elts;
+  ctx.retry_fn = bench_retry_worker;
+  health.table = table;
+  health.counters = counters;
+  health.balancer_idx = routing_table_find_balancer(table, balancer);
+  health.now_ms = 1000;
+  ctx.health = &health;
+  ctx.affinity_key = 0;
+  ctx.load_factor = 1.0;
+  ctx.latency = NULL;
+  ctx.sample_count = (mode == kMODE_SAMPLED) ? 2 : 0;
+  ctx.quota = NULL;
+  ctx.overflow = NULL;
+  if (mode == kMODE_PEAK_EWMA) {
+    seed_peak_ewma(counters, table, balancer, &rng);
+    scoring.table = table;
+    scoring.counters = counters;
+    scoring.balancer_idx = routing_table_find_balancer(table, balancer);
+    scoring.now_ms = 1000;
+    scoring.decay_ms = 10000;
+    scoring.load_factor = 1.5;
+    ctx.latency = &scoring;
+  }
+
+  out->misrouted_count =
+      check_routes(c, table, balancer, &ctx) + check_url_balancer(balancer);
+
+  for (i = 0; i < kWARMUP_DECISIONS; ++i) {
+    simulate_traffic(&rng, b,
+                     route_request(table, counters, balancer, &ctx,
+                                   &reqs[i % kREQUEST_COUNT]));
+  }
+
+  // Throughput (no per-decision timers)
+  t0 = bench_now_ns();
+  allocations_before = bench_allocation_count();
+  for (i = 0; i < decisions; ++i) {
+    proxy_worker* w =
+        route_request(table, counters, balancer, &ctx, &reqs[i % kREQUEST_COUNT]);
+    if (w == NULL) out->no_candidate_count++;
+    simulate_traffic(&rng, b, w);
+  }
+  out->ns_per_decision = (double)(bench_now_ns() - t0) / (double)decisions;
+  out->allocations_per_decision =
+      (double)(bench_allocation_count() - allocations_before) /
+      (double)decisions;
+
+  // Latency distribution
+  for (i = 0; i < decisions; ++i) {
+    const uint64_t start = bench_now_ns();
+    proxy_worker* w =
+        route_request(table, counters, balancer, &ctx, &reqs[i % kREQUEST_COUNT]);
+    samples.ns[i] = (uint32_t)(bench_now_ns() - start);
+    simulate_traffic(&rng, b, w);
+  }
+  out->p50 = bench_percentile(&samples, 50.0);
+  out->p99 = bench_percentile(&samples, 99.0);
+
+  free(samples.ns);
+  free(reqs);
+  free(names);
+  free(counters);
+  routing_table_free(table);
+  synthetic_free_bindings(&binding_sets[kBINDING_SET_WORKER]);
+  synthetic_balancer_free(b);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  const size_t decisions =
+      argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : kDEFAULT_DECISIONS;
+  int mode = kMODE_BUSYNESS;
+  const size_t scenario_count = sizeof(kSCENARIOS) / sizeof(kSCENARIOS[0]);
+  const char* only_scenario = argc > 3 ? argv[3] : NULL;
+  int allocated = 0, misrouted = 0;
+  size_t i;
+
+  if (argc > 2) {
+    for (mode = 0; mode < kMODE_COUNT; ++mode) {
+      if (strcmp(argv[2], kMODE_NAMES[mode]) == 0) break;
+    }
+    if (mode == kMODE_COUNT) {
+      fprintf(stderr, "Unknown mode '%s'\n", argv[2]);
+      return 2;
+    }
+  }
+  if (only_scenario != NULL) {
+    for (i = 0; i < scenario_count; ++i) {
+      if (strcmp(only_scenario, kSCENARIOS[i].name) == 0) break;
+    }
+    if (i == scenario_count) {
+      fprintf(stderr, "Unknown scenario '%s'\n", only_scenario);
+      return 2;
+    }
+  }
+
+  printf("%-22s %9s %9s %9s %9s %9s %10s %12s %8s %8s %12s\n", "scenario",
+         "bindings", "loaded", "load ms", "mmap ms", "build ms", "table KB",
+         "ns/decision", "p50 ns", "p99 ns", "allocs/dec");
+
+  for (i = 0; i < scenario_count; ++i) {
+    bench_result res;
+    if (only_scenario != NULL &&
+        strcmp(only_scenario, kSCENARIOS[i].name) != 0) {
+      continue;
+    }
+    if (!run_scenario(&kSCENARIOS[i], decisions > 0 ? decisions : 1,
+                      mode, &res)) {
+      fprintf(stderr, "Scenario '%s' failed\n", kSCENARIOS[i].name);
+      return 2;
+    }
+
+    printf("%-22s %9lu %9lu %9.2f %9.2f %9.2f %10.1f %12.1f %8u %8u ",
+           kSCENARIOS[i].name, (unsigned long)res.binding_count,
+           (unsigned long)res.loaded_count, res.load_ms,
+           res.compiled_load_ms, res.build_ms,
+           (double)res.table_bytes / 1024.0, res.ns_per_decision, res.p50,
+           res.p99);
+    if (bench_counts_allocations()) {
+      printf("%12.3f\n", res.allocations_per_decision);
+    } else {
+      printf("%12s\n", "n/a");
+    }
+
+    if (res.allocations_per_decision > 0) allocated = 1;
+    if (res.misrouted_count > 0) {
+      fprintf(stderr, "Scenario '%s': %lu of %lu sites misrouted\n",
+              kSCENARIOS[i].name, (unsigned long)res.misrouted_count,
+              (unsigned long)kSCENARIOS[i].site_count);
+      misrouted = 1;
+    }
+  }
+
+  if (allocated) {
+    fprintf(stderr, "FAILED: routing decisions must not allocate\n");
+    return 1;
+  }
+  if (misrouted) {
+    fprintf(stderr, "FAILED: bound sites must be routed by their bindings\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+/*
+        Compares site_name_scan() with the ap_getword() based site name
+        lookup the module used before it, on query strings taken from
+        Tableau Server traffic (session ids and workbook names replaced).
+
+        Both implementations have to find the same site for every query
+        string, and the scanner must not allocate.
+
+        Usage: palette-director-site-name-bench [iterations]
+*/
+
+#include <mod_proxy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-util.h"
+#include "routing-table.h"
+#include "site-name.h"
+
+enum { kDEFAULT_ITERATIONS = 200000 };
+
+typedef struct bench_url {
+  const char* name;
+  const char* args;
+} bench_url;
+
+static const bench_url kURLS[] = {
+    {"embed view",
+     ":embed=y&:showAppBanner=false&:display_count=no&:showVizHome=no"
+     "&:origin=viz_share_link&:site=Finance"},
+
+    {"bootstrap session",
+     ":embed=y&:device=desktop&:language=en&:sessionid="
+     "6F2C9A3E1B5D4F7089ABCDEF01234567-0:0&:tabs=no&:toolbar=yes"
+     "&:refresh=no&:jsdebug=false&:apiID=host0&:loadOrderID=0"
+     "&:render=true&:size=1280,1024&:site=Sales%20EMEA"},
+
+    {"tile request",
+     ":format=png&:tooltip=yes&:size=512,512&:tile=3-1-0&:zoom=1.0"
+     "&:dpi=96&:layer=0&:cache=yes&:site=Marketing&:worksheet=Overview"},
+
+    {"filtered view",
+     "Region=Central%2CEast&Category=Furniture%2COffice%20Supplies"
+     "&Order%20Date=2016-01-01~2016-12-31&Ship%20Mode=Standard%20Class"
+     "&Segment=Consumer&Customer%20Name=Aaron%20Bergman&:iid=3"
+     "&:customViews=no&:alerts=no&:subscriptions=no&:dataDetails=no"
+     "&:showShareOptions=false&:site=Operations"},
+
+    {"site first", ":site=HR&:embed=y&:toolbar=top&:tabs=yes"},
+
+    {"escaped key", "%3Aembed=y&%3Asite=Marketing&%3Atabs=no"},
+
+    {"utf-8 site",
+     ":embed=y&:showVizHome=no&:site=M%C3%BCnchen%20Vertrieb&:tabs=no"},
+
+    {"default site",
+     ":embed=y&:showAppBanner=false&:display_count=no&:showVizHome=no"
+     "&:origin=viz_share_link&:toolbar=no&:tabs=no&:refresh=yes"},
+
+    {"long command",
+     ":sessionid=0123456789ABCDEF0123456789ABCDEF-1:2&:command=tabdoc"
+     "%3Acategorical-filter&:worksheet=Sales%20by%20Region"
+     "&:dashboard=Executive%20Overview&:globalFieldName=%5BRegion%5D"
+     "&:membershipTarget=filter&:filterUpdateType=filter-replace"
+     "&:filterValues=%5B%22Central%22%2C%22East%22%2C%22West%22%5D"
+     "&:telemetryCommandId=4f9a2c&:keepDialogOpen=false&:site=Finance"},
+};
+
+enum { kURL_COUNT = sizeof(kURLS) / sizeof(kURLS[0]) };
+
+// The ap_getword() based get_site_name() the module used before the
+// scanner: copies and unescapes every key and value into the pool.
+static const char* legacy_get_site_name(const request_rec* r) {
+  const char* val = NULL;
+  const char* key = NULL;
+  const char* data = r->args;
+
+  if (r->args == NULL) {
+    return NULL;
+  }
+
+  while (*data && (val = ap_getword(r->pool, &data, '&'))) {
+    key = ap_getword(r->pool, &val, '=');
+    ap_unescape_url((char*)key);
+    ap_unescape_url((char*)val);
+
+    // If the key is ':site', then we have a site
+    if (strcmp(key, ":site") == 0) {
+      return val;
+    }
+  }
+
+  return NULL;
+}
+
+// Returns 1 if both implementations find the same site for the url
+static int results_match(request_rec* r) {
+  char buffer[kSITE_NAME_BUFFER_SIZE];
+  site_name_view view;
+  const int found =
+      site_name_scan(r->args, buffer, sizeof(buffer), &view) ==
+      kSITE_NAME_FOUND;
+  const char* legacy = legacy_get_site_name(r);
+
+  apr_pool_clear(r->pool);
+  if (legacy == NULL || !found) return legacy == NULL && !found;
+
+  return view.length == strlen(legacy) &&
+         memcmp(view.name, legacy, view.length) == 0 &&
+         view.hash == routing_site_hash(legacy, view.length);
+}
+
+int main(int argc, char** argv) {
+  const size_t iterations =
+      (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : kDEFAULT_ITERATIONS;
+  apr_pool_t pool = {NULL};
+  request_rec r;
+  size_t u, i, failures = 0;
+
+  memset(&r, 0, sizeof(r));
+  r.pool = &pool;
+
+  printf("%-18s %6s %14s %14s %9s %14s %12s\n", "url", "bytes",
+         "legacy ns/op", "scanner ns/op", "speedup", "legacy B/op",
+         "allocs/op");
+
+  for (u = 0; u < kURL_COUNT; ++u) {
+    char buffer[kSITE_NAME_BUFFER_SIZE];
+    site_name_view view;
+    volatile size_t sink = 0;
+    uint64_t t0, allocations;
+    double legacy_ns, scanner_ns, pool_bytes = 0;
+
+    r.args = (char*)kURLS[u].args;
+    if (!results_match(&r)) {
+      fprintf(stderr, "Site name mismatch for '%s'\n", kURLS[u].name);
+      failures++;
+    }
+
+    t0 = bench_now_ns();
+    for (i = 0; i < iterations; ++i) {
+      const char* name = legacy_get_site_name(&r);
+      sink += (name != NULL) ? (size_t)name[0] : 0;
+      pool_bytes += (double)pool.blocks->used;
+      apr_pool_clear(&pool);
+    }
+    legacy_ns = (double)(bench_now_ns() - t0) / (double)iterations;
+
+    allocations = bench_allocation_count();
+    t0 = bench_now_ns();
+    for (i = 0; i < iterations; ++i) {
+      if (site_name_scan(r.args, buffer, sizeof(buffer), &view) ==
+          kSITE_NAME_FOUND) {
+        sink += view.hash;
+      }
+    }
+    scanner_ns = (double)(bench_now_ns() - t0) / (double)iterations;
+    allocations = bench_allocation_count() - allocations;
+
+    printf("%-18s %6lu %14.1f %14.1f %8.1fx %14.1f ", kURLS[u].name,
+           (unsigned long)strlen(r.args), legacy_ns, scanner_ns,
+           legacy_ns / scanner_ns, pool_bytes / (double)iterations);
+    if (bench_counts_allocations()) {
+      printf("%12.3f\n", (double)allocations / (double)iterations);
+    } else {
+      printf("%12s\n", "n/a");
+    }
+
+    if (allocations > 0) {
+      fprintf(stderr, "site_name_scan() allocated for '%s'\n",
+              kURLS[u].name);
+      failures++;
+    }
+    (void)sink;
+  }
+
+  apr_pool_destroy(&pool);
+  return failures > 0 ? 1 : 0;
+}
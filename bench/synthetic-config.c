@@ -0,0 +1,172 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "synthetic-config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "routing-table.h"
+
+void synthetic_site_name(char* buffer, size_t size, size_t idx) {
+  snprintf(buffer, size, "Site-%05lu", (unsigned long)idx);
+}
+
+void synthetic_host_name(char* buffer, size_t size, size_t idx) {
+  snprintf(buffer, size, "vizql-host-%03lu.local", (unsigned long)idx);
+}
+
+// The host a site prefers / forbids in the k-th place. The stride spreads
+// the preferred hosts of neighbouring sites over the cluster.
+static size_t synthetic_host_for(const synthetic_config* c, size_t site,
+                                 size_t k) {
+  return (site * 7 + k) % c->host_count;
+}
+
+// Calls fn for each binding of the config, returns the number of bindings
+static size_t synthetic_for_each_binding(
+    const synthetic_config* c,
+    void (*fn)(void* state, const char* site, const char* host,
+               const char* kind),
+    void* state) {
+  size_t site, k, count = 0;
+  char site_name[64], host_name[64];
+
+  for (site = 0; site < c->site_count; ++site) {
+    synthetic_site_name(site_name, sizeof(site_name), site);
+
+    for (k = 0; k < c->prefer_per_site + c->forbid_per_site; ++k) {
+      if (k >= c->host_count) break;
+      synthetic_host_name(host_name, sizeof(host_name),
+                          synthetic_host_for(c, site, k));
+      fn(state, site_name, host_name,
+         k < c->prefer_per_site ? "prefer" : "forbid");
+      count++;
+    }
+  }
+  return count;
+}
+
+static void write_csv_row(void* state, const char* site, const char* host,
+                          const char* kind) {
+  fprintf((FILE*)state, "%s,%s,%s\n", site, host, kind);
+}
+
+static char* dup_string(const char* s) {
+  const size_t length = strlen(s);
+  char* o = (char*)malloc(length + 1);
+  memcpy(o, s, length + 1);
+  return o;
+}
+
+static void add_binding_row(void* state, const char* site, const char* host,
+                            const char* kind) {
+  binding_rows* rows = (binding_rows*)state;
+  binding_row* row = &rows->entries[rows->count++];
+  row->site_name = dup_string(site);
+  row->worker_host = dup_string(host);
+  row->binding_kind =
+      strcmp(kind, "prefer") == 0 ? kBINDING_PREFER : kBINDING_FORBID;
+  row->max_in_flight = 0;
+  row->site_id = kBINDING_NO_ID;
+  row->host_id = kBINDING_NO_ID;
+}
+
+size_t synthetic_config_write_csv(const synthetic_config* c,
+                                  const char* path) {
+  FILE* f = fopen(path, "wb");
+  size_t written;
+
+  if (f == NULL) return 0;
+
+  fprintf(f, "site,host,binding\n");
+  written = synthetic_for_each_binding(c, write_csv_row, f);
+
+  fclose(f);
+  return written;
+}
+
+binding_rows synthetic_config_bindings(const synthetic_config* c) {
+  const size_t per_site = c->prefer_per_site + c->forbid_per_site;
+  binding_rows rows =
+      malloc_binding_rows(c->site_count * per_site + 1);
+  rows.count = 0;
+  synthetic_for_each_binding(c, add_binding_row, &rows);
+  return rows;
+}
+
+synthetic_balancer* synthetic_balancer_create(const synthetic_config* c,
+                                              const char* name) {
+  synthetic_balancer* b =
+      (synthetic_balancer*)calloc(1, sizeof(synthetic_balancer));
+  size_t i, n = c->host_count;
+
+  b->worker_ptrs = (proxy_worker**)calloc(n, sizeof(proxy_worker*));
+  b->workers = (proxy_worker*)calloc(n, sizeof(proxy_worker));
+  b->workers_shared =
+      (proxy_worker_shared*)calloc(n, sizeof(proxy_worker_shared));
+
+  for (i = 0; i < n; ++i) {
+    proxy_worker_shared* s = &b->workers_shared[i];
+
+    synthetic_host_name(s->hostname, sizeof(s->hostname), i);
+    snprintf(s->name, sizeof(s->name), "http://%s/", s->hostname);
+    snprintf(s->route, sizeof(s->route), "route-%lu", (unsigned long)i);
+    s->status = PROXY_WORKER_INITIALIZED;
+    s->lbfactor = 1;
+    s->lbset = (int)(i % (size_t)(c->lbset_count > 0 ? c->lbset_count : 1));
+    if (i + c->standby_count >= n) s->status |= PROXY_WORKER_HOT_STANDBY;
+
+    b->workers[i].s = s;
+    b->worker_ptrs[i] = &b->workers[i];
+  }
+
+  b->workers_array.elt_size = sizeof(proxy_worker*);
+  b->workers_array.nelts = (int)n;
+  b->workers_array.nalloc = (int)n;
+  b->workers_array.elts = (char*)b->worker_ptrs;
+
+  snprintf(b->balancer_shared.name, sizeof(b->balancer_shared.name), "%s",
+           name);
+  snprintf(b->balancer_shared.sticky, sizeof(b->balancer_shared.sticky),
+           "ROUTEID");
+  // hashed like mod_proxy does
+  routing_balancer_hashes(name, strlen(name), &b->balancer.hash.def,
+                          &b->balancer.hash.fnv);
+  b->balancer_shared.hash = b->balancer.hash;
+  b->balancer.s = &b->balancer_shared;
+  b->balancer.workers = &b->workers_array;
+  return b;
+}
+
+void synthetic_balancer_free(synthetic_balancer* b) {
+  free(b->worker_ptrs);
+  free(b->workers);
+  free(b->workers_shared);
+  free(b);
+}
+
+void synthetic_free_bindings(binding_rows* rows) {
+  size_t i;
+  for (i = 0; i < rows->count; ++i) {
+    free((void*)rows->entries[i].site_name);
+    free((void*)rows->entries[i].worker_host);
+  }
+  free_binding_rows(rows);
+}
@@ -0,0 +1,74 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <mod_proxy.h>
+
+#include "palette-director-types.h"
+
+// The shape of a generated binding config and balancer
+typedef struct synthetic_config {
+  const char* name;
+
+  size_t site_count;
+  size_t host_count;
+
+  // The number of hosts each site prefers / forbids
+  size_t prefer_per_site;
+  size_t forbid_per_site;
+
+  // The balancer members are spread over this many lbsets
+  int lbset_count;
+
+  // The number of (hot standby) members at the end of the balancer
+  size_t standby_count;
+} synthetic_config;
+
+// Writes the name of the idx-th site / host into buffer
+void synthetic_site_name(char* buffer, size_t size, size_t idx);
+void synthetic_host_name(char* buffer, size_t size, size_t idx);
+
+// Writes the bindings of the config as a CSV file. Returns the number of
+// bindings written, or 0 on error.
+size_t synthetic_config_write_csv(const synthetic_config* config,
+                                  const char* path);
+
+// Returns the bindings of the config the way parse_csv_config() would
+// (free them with synthetic_free_bindings())
+binding_rows synthetic_config_bindings(const synthetic_config* config);
+
+// A balancer stand-in with one member for each host of the config
+typedef struct synthetic_balancer {
+  proxy_balancer balancer;
+  proxy_balancer_shared balancer_shared;
+  apr_array_header_t workers_array;
+
+  proxy_worker** worker_ptrs;
+  proxy_worker* workers;
+  proxy_worker_shared* workers_shared;
+} synthetic_balancer;
+
+synthetic_balancer* synthetic_balancer_create(const synthetic_config* config,
+                                              const char* name);
+
+void synthetic_balancer_free(synthetic_balancer* b);
+
+// Frees rows returned by synthetic_config_bindings() (and the strings they
+// own)
+void synthetic_free_bindings(binding_rows* rows);
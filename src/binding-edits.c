@@ -0,0 +1,167 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "binding-edits.h"
+
+#include <apr_strings.h>
+#include <string.h>
+
+// Returns 1 if the two names are the same ignoring the (ASCII) case
+static int same_name(const char* a, const char* b) {
+  for (; *a != '\0' && *b != '\0'; ++a, ++b) {
+    if (PAL__ASCII_TOLOWER(*a) != PAL__ASCII_TOLOWER(*b)) return 0;
+  }
+  return *a == *b;
+}
+
+// Copies a name into a buffer of kBINDING_EDIT_NAME_SIZE, returns 0 if it
+// is empty or does not fit
+static int copy_name(char* buffer, const char* name) {
+  const size_t length = (name != NULL) ? strlen(name) : 0;
+  if (length == 0 || length >= kBINDING_EDIT_NAME_SIZE) return 0;
+  memcpy(buffer, name, length + 1);
+  return 1;
+}
+
+// Returns 1 if the edit drains or undrains its pair instead of binding it
+static int is_drain_edit(binding_kind_t binding_kind) {
+  return binding_kind == kBINDING_DRAIN || binding_kind == kBINDING_UNDRAIN;
+}
+
+const char* binding_edit_init(binding_edit* edit, int binding_set,
+                              const char* site_name, const char* worker_host,
+                              binding_kind_t binding_kind) {
+  memset(edit, 0, sizeof(*edit));
+  if (binding_set < 0 || binding_set >= kBINDING_SET_COUNT) {
+    return "unknown binding set";
+  }
+  if (!copy_name(edit->site_name, site_name)) {
+    return "the site name is empty or too long";
+  }
+  if (!copy_name(edit->worker_host, worker_host)) {
+    return "the host name is empty or too long";
+  }
+  // the site limits are not bindings
+  if (strcmp(worker_host, kBINDING_ANY_HOST) == 0) {
+    return "the host must be a worker host";
+  }
+  if (binding_kind != kROUTING_UNBOUND && !is_drain_edit(binding_kind) &&
+      (binding_kind < kBINDING_FORBID ||
+       binding_kind > kBINDING_MAX_PRIORITY)) {
+    return "unknown binding kind";
+  }
+  edit->binding_set = binding_set;
+  edit->binding_kind = binding_kind;
+  return NULL;
+}
+
+// Returns 1 if the edit changes the binding of the row
+static int edit_matches(const binding_edit* edit, int binding_set,
+                        const char* site_name, const char* worker_host) {
+  return edit->binding_set == binding_set &&
+         same_name(edit->site_name, site_name) &&
+         same_name(edit->worker_host, worker_host);
+}
+
+void binding_edits_add(apr_array_header_t* edits, const binding_edit* edit) {
+  binding_edit* entries = (binding_edit*)edits->elts;
+  const int drain = is_drain_edit(edit->binding_kind);
+  int i;
+
+  // a drain is kept apart from the binding of its pair
+  for (i = 0; i < edits->nelts; ++i) {
+    if (is_drain_edit(entries[i].binding_kind) != drain ||
+        !edit_matches(&entries[i], edit->binding_set, edit->site_name,
+                      edit->worker_host)) {
+      continue;
+    }
+    if (edit->binding_kind == kBINDING_UNDRAIN) {
+      memmove(&entries[i], &entries[i + 1],
+              sizeof(binding_edit) * (size_t)(edits->nelts - i - 1));
+      edits->nelts--;
+    } else {
+      entries[i] = *edit;
+    }
+    return;
+  }
+  if (edit->binding_kind == kBINDING_UNDRAIN) return;
+  *(binding_edit*)apr_array_push(edits) = *edit;
+}
+
+binding_rows binding_edits_apply(const apr_array_header_t* edits,
+                                 int binding_set, binding_rows rows,
+                                 apr_pool_t* pool) {
+  const binding_edit* entries = (const binding_edit*)edits->elts;
+  binding_rows out = {NULL, 0};
+  binding_row* out_rows;
+  // Set for the edits that found a row
+  char* applied;
+  size_t i, edit_count = 0;
+  int e;
+
+  for (e = 0; e < edits->nelts; ++e) {
+    if (entries[e].binding_set == binding_set) edit_count++;
+  }
+  if (edit_count == 0) return rows;
+
+  out_rows = (binding_row*)apr_palloc(
+      pool, sizeof(binding_row) * (rows.count + edit_count));
+  applied = (char*)apr_pcalloc(pool, edits->nelts);
+
+  for (i = 0; i < rows.count; ++i) {
+    const binding_row* row = &rows.entries[i];
+    const binding_edit* edit = NULL;
+
+    for (e = 0; e < edits->nelts && row->site_name != NULL &&
+                row->worker_host != NULL;
+         ++e) {
+      if (!is_drain_edit(entries[e].binding_kind) &&
+          edit_matches(&entries[e], binding_set, row->site_name,
+                       row->worker_host)) {
+        edit = &entries[e];
+        applied[e] = 1;
+        break;
+      }
+    }
+
+    if (edit != NULL && edit->binding_kind == kROUTING_UNBOUND) continue;
+    out_rows[out.count] = *row;
+    if (edit != NULL) out_rows[out.count].binding_kind = edit->binding_kind;
+    out.count++;
+  }
+
+  // the new bindings and the drains go after the rows
+  for (e = 0; e < edits->nelts; ++e) {
+    binding_row* row;
+    if (entries[e].binding_set != binding_set || applied[e] ||
+        entries[e].binding_kind == kROUTING_UNBOUND) {
+      continue;
+    }
+    row = &out_rows[out.count++];
+    row->site_name = apr_pstrdup(pool, entries[e].site_name);
+    row->worker_host = apr_pstrdup(pool, entries[e].worker_host);
+    row->binding_kind = entries[e].binding_kind;
+    row->max_in_flight = 0;
+    // the ids are per config, the new names have none
+    row->site_id = kBINDING_NO_ID;
+    row->host_id = kBINDING_NO_ID;
+  }
+
+  out.entries = out_rows;
+  return out;
+}
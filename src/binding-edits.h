@@ -0,0 +1,78 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <apr_tables.h>
+
+#include "routing-table.h"
+
+/*
+        Runtime changes of the bindings, made through the admin API.
+
+        The admin API runs in the children, but only the parent publishes
+        routing tables: a child posts each edit to the parent through the
+        shared segment of the routing table (routing_state_post_edit()).
+        The parent patches the published table with it and keeps the edit,
+        so it survives the reloads of the binding configs. The edits are
+        lost on restart, unless they are written back into the CSV.
+*/
+
+enum {
+  // The longest site or host name of an edit (with its 0)
+  kBINDING_EDIT_NAME_SIZE = 256,
+};
+
+// The binding_kind of the edits that end the drain of a pair
+enum { kBINDING_UNDRAIN = -4 };
+
+// A change of the binding of a site / host pair in a binding set. A
+// binding_kind of kROUTING_UNBOUND removes the binding, kBINDING_DRAIN and
+// kBINDING_UNDRAIN drain the pair and end its drain (without changing its
+// binding).
+typedef struct binding_edit {
+  int binding_set;
+  binding_kind_t binding_kind;
+  char site_name[kBINDING_EDIT_NAME_SIZE];
+  char worker_host[kBINDING_EDIT_NAME_SIZE];
+} binding_edit;
+
+/*
+        Fills an edit. Returns what is wrong with it (a name that is empty
+        or too long, an unknown binding set or kind), or NULL.
+*/
+const char* binding_edit_init(binding_edit* edit, int binding_set,
+                              const char* site_name, const char* worker_host,
+                              binding_kind_t binding_kind);
+
+// Adds the edit to edits (an array of binding_edit), replacing the earlier
+// edit of the same binding. An undrain edit removes the drain of its pair.
+void binding_edits_add(apr_array_header_t* edits, const binding_edit* edit);
+
+/*
+        Returns the rows of a binding set with the edits applied, as if the
+        config file was edited by hand: the rows of a removed binding are
+        dropped (with their limits), the rows of a changed binding get the
+        new kind, and the bindings not in the rows yet are added after them,
+        followed by a kBINDING_DRAIN row for each drained pair.
+        Returns the rows themselves if no edit is for the binding set, the
+        new rows are allocated from pool.
+*/
+binding_rows binding_edits_apply(const apr_array_header_t* edits,
+                                 int binding_set, binding_rows rows,
+                                 apr_pool_t* pool);
@@ -0,0 +1,502 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "compiled-config.h"
+
+#include <mod_proxy.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "routing-table.h"
+
+enum {
+  kSECTION_ALIGNMENT = 8,
+
+  // The fewest buckets of the site index
+  kMIN_INDEX_BUCKETS = 16,
+};
+
+#define COMPILED_AT(c, type, offset) \
+  ((const type*)((const char*)(c) + (offset)))
+
+// Returns a power of 2 of buckets, at least twice the entries
+static size_t index_size_for(size_t entry_count) {
+  size_t count = kMIN_INDEX_BUCKETS;
+  while (count < entry_count * 2) count *= 2;
+  return count;
+}
+
+// The FNV-1a hash of the bytes after the header
+static uint32_t checksum_of(const void* data, size_t size) {
+  const unsigned char* p = (const unsigned char*)data;
+  uint32_t hash = PAL__FNV1A_INIT;
+  size_t i;
+  for (i = sizeof(compiled_config_header); i < size; ++i) {
+    hash = (hash ^ p[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Returns 1 if the two names are the same, ignoring the (ASCII) case if
+// fold_case is set
+static int names_equal(const char* a, const char* b, int fold_case) {
+  if (!fold_case) return strcmp(a, b) == 0;
+  for (; *a != '\0' && *b != '\0'; ++a, ++b) {
+    if (PAL__ASCII_TOLOWER(*a) != PAL__ASCII_TOLOWER(*b)) return 0;
+  }
+  return *a == *b;
+}
+
+// Building
+// --------
+
+// A temporary set of names (by their case-folded hash)
+typedef struct name_set {
+  const char** names;
+  uint32_t* hashes;
+  size_t count;
+  int fold_case;
+
+  // name index + 1, or 0 for empty buckets
+  uint32_t* buckets;
+  size_t bucket_mask;
+} name_set;
+
+static int name_set_init(name_set* set, size_t capacity, int fold_case) {
+  const size_t bucket_count = index_size_for(capacity);
+  set->names = (const char**)malloc(sizeof(const char*) * (capacity + 1));
+  set->hashes = (uint32_t*)malloc(sizeof(uint32_t) * (capacity + 1));
+  set->buckets = (uint32_t*)calloc(bucket_count, sizeof(uint32_t));
+  set->bucket_mask = bucket_count - 1;
+  set->count = 0;
+  set->fold_case = fold_case;
+  return set->names != NULL && set->hashes != NULL && set->buckets != NULL;
+}
+
+static void name_set_free(name_set* set) {
+  free((void*)set->names);
+  free(set->hashes);
+  free(set->buckets);
+}
+
+// Adds the name (if not yet added) and returns its index
+static uint32_t name_set_add(name_set* set, const char* name) {
+  const uint32_t hash = routing_site_hash(name, strlen(name));
+  size_t b = hash & set->bucket_mask;
+
+  for (;;) {
+    const uint32_t entry = set->buckets[b];
+    if (entry == 0) break;
+    if (set->hashes[entry - 1] == hash &&
+        names_equal(set->names[entry - 1], name, set->fold_case)) {
+      return entry - 1;
+    }
+    b = (b + 1) & set->bucket_mask;
+  }
+
+  set->names[set->count] = name;
+  set->hashes[set->count] = hash;
+  set->buckets[b] = (uint32_t)++set->count;
+  return (uint32_t)(set->count - 1);
+}
+
+// A limit collected from the rows, with the position of its row so the
+// first row wins
+typedef struct pending_limit {
+  compiled_limit limit;
+  size_t order;
+} pending_limit;
+
+static int pending_limit_compare(const void* p1, const void* p2) {
+  const pending_limit* a = (const pending_limit*)p1;
+  const pending_limit* b = (const pending_limit*)p2;
+  if (a->limit.site != b->limit.site) {
+    return (a->limit.site < b->limit.site) ? -1 : 1;
+  }
+  if (a->limit.host != b->limit.host) {
+    return (a->limit.host < b->limit.host) ? -1 : 1;
+  }
+  return (a->order < b->order) ? -1 : (a->order > b->order);
+}
+
+// Reserves bytes at the end of the layout and returns their offset
+static uint32_t layout_reserve(size_t* size, size_t bytes) {
+  const size_t offset = *size;
+  *size = offset + ((bytes + kSECTION_ALIGNMENT - 1) &
+                    ~(size_t)(kSECTION_ALIGNMENT - 1));
+  return (uint32_t)offset;
+}
+
+compiled_config_header* compiled_config_build(const binding_rows* rows,
+                                              size_t* out_size) {
+  compiled_config_header* c = NULL;
+  name_set sites, hosts, strings;
+  uint32_t *site_of_row = NULL, *host_of_row = NULL;
+  uint32_t *site_strings = NULL, *host_strings = NULL;
+  pending_limit* limits = NULL;
+  size_t i, limit_count = 0, unique_limits = 0, string_bytes = 0;
+  size_t size = 0;
+  const size_t capacity = rows->count * 2;
+
+  memset(&sites, 0, sizeof(sites));
+  memset(&hosts, 0, sizeof(hosts));
+  memset(&strings, 0, sizeof(strings));
+
+  site_of_row = (uint32_t*)malloc(sizeof(uint32_t) * (rows->count + 1));
+  host_of_row = (uint32_t*)malloc(sizeof(uint32_t) * (rows->count + 1));
+  limits = (pending_limit*)malloc(sizeof(pending_limit) * (rows->count + 1));
+  if (!name_set_init(&sites, rows->count, 1) ||
+      !name_set_init(&hosts, rows->count, 1) ||
+      !name_set_init(&strings, capacity, 0) || site_of_row == NULL ||
+      host_of_row == NULL || limits == NULL) {
+    goto cleanup;
+  }
+
+  // Intern the sites and hosts (the first spelling of a name is kept)
+  for (i = 0; i < rows->count; ++i) {
+    const binding_row* b = &rows->entries[i];
+    if (b->site_name == NULL || b->worker_host == NULL) continue;
+    site_of_row[i] = name_set_add(&sites, b->site_name);
+    host_of_row[i] = name_set_add(&hosts, b->worker_host);
+  }
+
+  // ... and their strings
+  site_strings = (uint32_t*)malloc(sizeof(uint32_t) * (sites.count + 1));
+  host_strings = (uint32_t*)malloc(sizeof(uint32_t) * (hosts.count + 1));
+  if (site_strings == NULL || host_strings == NULL) goto cleanup;
+  for (i = 0; i < sites.count; ++i) {
+    site_strings[i] = name_set_add(&strings, sites.names[i]);
+  }
+  for (i = 0; i < hosts.count; ++i) {
+    host_strings[i] = name_set_add(&strings, hosts.names[i]);
+  }
+  for (i = 0; i < strings.count; ++i) {
+    string_bytes += strlen(strings.names[i]) + 1;
+  }
+
+  // Collect the limits, the first row of each site / host pair wins
+  for (i = 0; i < rows->count; ++i) {
+    const binding_row* b = &rows->entries[i];
+    if (b->site_name == NULL || b->worker_host == NULL) continue;
+    if (b->max_in_flight == 0) continue;
+    limits[limit_count].limit.site = site_of_row[i];
+    limits[limit_count].limit.host = host_of_row[i];
+    limits[limit_count].limit.max_in_flight = b->max_in_flight;
+    limits[limit_count].order = i;
+    limit_count++;
+  }
+  qsort(limits, limit_count, sizeof(pending_limit), pending_limit_compare);
+  for (i = 0; i < limit_count; ++i) {
+    if (unique_limits > 0 &&
+        limits[unique_limits - 1].limit.site == limits[i].limit.site &&
+        limits[unique_limits - 1].limit.host == limits[i].limit.host) {
+      continue;
+    }
+    limits[unique_limits++] = limits[i];
+  }
+
+  // Lay out the file
+  {
+    compiled_config_header h;
+    const size_t index_size = index_size_for(sites.count);
+    uint32_t string_data_offset;
+    char* base;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, COMPILED_CONFIG_MAGIC, sizeof(h.magic));
+    h.version = kCOMPILED_CONFIG_VERSION;
+
+    layout_reserve(&size, sizeof(compiled_config_header));
+    h.string_count = (uint32_t)strings.count;
+    h.strings_offset =
+        layout_reserve(&size, sizeof(uint32_t) * strings.count);
+    string_data_offset = layout_reserve(&size, string_bytes);
+    h.site_count = (uint32_t)sites.count;
+    h.sites_offset = layout_reserve(&size, sizeof(compiled_site) * sites.count);
+    h.host_count = (uint32_t)hosts.count;
+    h.hosts_offset = layout_reserve(&size, sizeof(uint32_t) * hosts.count);
+    h.index_size = (uint32_t)index_size;
+    h.index_offset = layout_reserve(&size, sizeof(uint32_t) * index_size);
+    h.matrix_offset = layout_reserve(&size, sites.count * hosts.count);
+    h.limit_count = (uint32_t)unique_limits;
+    h.limits_offset =
+        layout_reserve(&size, sizeof(compiled_limit) * unique_limits);
+    h.size = (uint32_t)size;
+
+    if (size > UINT32_MAX) goto cleanup;
+    c = (compiled_config_header*)calloc(1, size);
+    if (c == NULL) goto cleanup;
+    base = (char*)c;
+    *c = h;
+
+    // The strings
+    {
+      uint32_t* offsets = (uint32_t*)(base + h.strings_offset);
+      uint32_t used = string_data_offset;
+      for (i = 0; i < strings.count; ++i) {
+        const size_t length = strlen(strings.names[i]);
+        offsets[i] = used;
+        memcpy(base + used, strings.names[i], length + 1);
+        used += (uint32_t)(length + 1);
+      }
+    }
+
+    // The sites, their index and the hosts
+    {
+      compiled_site* out_sites = (compiled_site*)(base + h.sites_offset);
+      uint32_t* index = (uint32_t*)(base + h.index_offset);
+      uint32_t* out_hosts = (uint32_t*)(base + h.hosts_offset);
+
+      for (i = 0; i < sites.count; ++i) {
+        size_t b = sites.hashes[i] & (index_size - 1);
+        out_sites[i].name = site_strings[i];
+        out_sites[i].hash = sites.hashes[i];
+        while (index[b] != 0) b = (b + 1) & (index_size - 1);
+        index[b] = (uint32_t)(i + 1);
+      }
+      for (i = 0; i < hosts.count; ++i) out_hosts[i] = host_strings[i];
+    }
+
+    // The binding matrix, the first row of each pair wins
+    {
+      int8_t* matrix = (int8_t*)(base + h.matrix_offset);
+      memset(matrix, kCOMPILED_NO_BINDING, sites.count * hosts.count);
+      for (i = 0; i < rows->count; ++i) {
+        const binding_row* b = &rows->entries[i];
+        int8_t* cell;
+        if (b->site_name == NULL || b->worker_host == NULL) continue;
+        cell = &matrix[site_of_row[i] * hosts.count + host_of_row[i]];
+        if (*cell == kCOMPILED_NO_BINDING) *cell = (int8_t)b->binding_kind;
+      }
+    }
+
+    // The limits
+    {
+      compiled_limit* out_limits = (compiled_limit*)(base + h.limits_offset);
+      for (i = 0; i < unique_limits; ++i) out_limits[i] = limits[i].limit;
+    }
+
+    c->checksum = checksum_of(c, size);
+    *out_size = size;
+  }
+
+cleanup:
+  name_set_free(&sites);
+  name_set_free(&hosts);
+  name_set_free(&strings);
+  free(site_of_row);
+  free(host_of_row);
+  free(site_strings);
+  free(host_strings);
+  free(limits);
+  return c;
+}
+
+// Reading
+// -------
+
+int compiled_config_is_compiled(const void* data, size_t size) {
+  return size >= sizeof(((compiled_config_header*)0)->magic) &&
+         memcmp(data, COMPILED_CONFIG_MAGIC,
+                sizeof(((compiled_config_header*)0)->magic)) == 0;
+}
+
+// Returns 1 if count entries of entry_size at offset fit into size bytes
+static int section_fits(size_t size, uint32_t offset, uint64_t count,
+                        size_t entry_size) {
+  return offset >= sizeof(compiled_config_header) &&
+         offset % kSECTION_ALIGNMENT == 0 &&
+         (uint64_t)offset + count * entry_size <= size;
+}
+
+const char* compiled_config_validate(const void* data, size_t size) {
+  const compiled_config_header* c = (const compiled_config_header*)data;
+  const char* base = (const char*)data;
+  size_t i;
+
+  if (size < sizeof(compiled_config_header) ||
+      !compiled_config_is_compiled(data, size)) {
+    return "not a compiled binding config";
+  }
+  if (c->version != kCOMPILED_CONFIG_VERSION) {
+    return "unsupported compiled config version (recompile the CSV)";
+  }
+  if (c->size != size) return "truncated compiled config";
+  if (c->checksum != checksum_of(data, size)) return "checksum mismatch";
+
+  if (!section_fits(size, c->strings_offset, c->string_count,
+                    sizeof(uint32_t)) ||
+      !section_fits(size, c->sites_offset, c->site_count,
+                    sizeof(compiled_site)) ||
+      !section_fits(size, c->hosts_offset, c->host_count, sizeof(uint32_t)) ||
+      !section_fits(size, c->index_offset, c->index_size, sizeof(uint32_t)) ||
+      !section_fits(size, c->matrix_offset,
+                    (uint64_t)c->site_count * c->host_count, 1) ||
+      !section_fits(size, c->limits_offset, c->limit_count,
+                    sizeof(compiled_limit))) {
+    return "section out of bounds";
+  }
+
+  for (i = 0; i < c->string_count; ++i) {
+    const uint32_t offset = COMPILED_AT(c, uint32_t, c->strings_offset)[i];
+    if (offset >= size || memchr(base + offset, '\0', size - offset) == NULL) {
+      return "string out of bounds";
+    }
+  }
+  for (i = 0; i < c->site_count; ++i) {
+    if (COMPILED_AT(c, compiled_site, c->sites_offset)[i].name >=
+        c->string_count) {
+      return "site name out of bounds";
+    }
+  }
+  for (i = 0; i < c->host_count; ++i) {
+    if (COMPILED_AT(c, uint32_t, c->hosts_offset)[i] >= c->string_count) {
+      return "host name out of bounds";
+    }
+  }
+
+  // the probes of a lookup must end at an empty bucket
+  if (c->index_size <= c->site_count ||
+      (c->index_size & (c->index_size - 1)) != 0) {
+    return "bad site index size";
+  }
+  for (i = 0; i < c->index_size; ++i) {
+    if (COMPILED_AT(c, uint32_t, c->index_offset)[i] > c->site_count) {
+      return "site index out of bounds";
+    }
+  }
+
+  for (i = 0; i < (size_t)c->site_count * c->host_count; ++i) {
+    const int8_t kind = COMPILED_AT(c, int8_t, c->matrix_offset)[i];
+    if (kind != kCOMPILED_NO_BINDING &&
+        (kind < kBINDING_FORBID || kind > kBINDING_MAX_PRIORITY)) {
+      return "bad binding kind";
+    }
+  }
+  for (i = 0; i < c->limit_count; ++i) {
+    const compiled_limit* l =
+        &COMPILED_AT(c, compiled_limit, c->limits_offset)[i];
+    if (l->site >= c->site_count || l->host >= c->host_count) {
+      return "limit out of bounds";
+    }
+  }
+  return NULL;
+}
+
+const char* compiled_config_string(const compiled_config_header* c,
+                                   uint32_t string_idx) {
+  return COMPILED_AT(c, char,
+                     COMPILED_AT(c, uint32_t, c->strings_offset)[string_idx]);
+}
+
+int compiled_config_find_site(const compiled_config_header* c,
+                              const char* name, size_t length) {
+  const compiled_site* sites = COMPILED_AT(c, compiled_site, c->sites_offset);
+  const uint32_t* index = COMPILED_AT(c, uint32_t, c->index_offset);
+  const uint32_t hash = routing_site_hash(name, length);
+  size_t b = hash & (c->index_size - 1);
+
+  for (; index[b] != 0; b = (b + 1) & (c->index_size - 1)) {
+    const compiled_site* site = &sites[index[b] - 1];
+    const char* site_name;
+    size_t i;
+
+    if (site->hash != hash) continue;
+    site_name = compiled_config_string(c, site->name);
+    for (i = 0; i < length && site_name[i] != '\0' &&
+                PAL__ASCII_TOLOWER(site_name[i]) ==
+                    PAL__ASCII_TOLOWER(name[i]);
+         ++i) {
+    }
+    if (i == length && site_name[i] == '\0') return (int)(index[b] - 1);
+  }
+  return -1;
+}
+
+binding_rows compiled_config_rows(const compiled_config_header* c,
+                                  apr_pool_t* pool, binding_names* names) {
+  const compiled_site* sites = COMPILED_AT(c, compiled_site, c->sites_offset);
+  const uint32_t* hosts = COMPILED_AT(c, uint32_t, c->hosts_offset);
+  const int8_t* matrix = COMPILED_AT(c, int8_t, c->matrix_offset);
+  const compiled_limit* limits =
+      COMPILED_AT(c, compiled_limit, c->limits_offset);
+  const size_t cell_count = (size_t)c->site_count * c->host_count;
+  const size_t name_count = (size_t)c->site_count + c->host_count;
+  size_t i, count = 0, next_limit = 0;
+  uint32_t site, host;
+  binding_name* out_names;
+  binding_rows rows;
+
+  names->entries = NULL;
+  names->count = 0;
+  for (i = 0; i < cell_count; ++i) {
+    if (matrix[i] != kCOMPILED_NO_BINDING) count++;
+  }
+
+  rows.entries =
+      (binding_row*)apr_palloc(pool, sizeof(binding_row) * (count + 1));
+  out_names =
+      (binding_name*)apr_palloc(pool, sizeof(binding_name) * (name_count + 1));
+  if (rows.entries == NULL || out_names == NULL) return empty_binding_rows;
+  rows.count = 0;
+
+  // the names are already interned: the sites, then the hosts
+  for (site = 0; site < c->site_count; ++site) {
+    binding_name* name = &out_names[site];
+    name->name = compiled_config_string(c, sites[site].name);
+    name->length = (uint32_t)strlen(name->name);
+    name->hash = sites[site].hash;
+  }
+  for (host = 0; host < c->host_count; ++host) {
+    binding_name* name = &out_names[c->site_count + host];
+    name->name = compiled_config_string(c, hosts[host]);
+    name->length = (uint32_t)strlen(name->name);
+    name->hash = routing_site_hash(name->name, name->length);
+  }
+  names->entries = out_names;
+  names->count = name_count;
+
+  for (site = 0; site < c->site_count; ++site) {
+    for (host = 0; host < c->host_count; ++host) {
+      const int8_t kind = matrix[(size_t)site * c->host_count + host];
+      binding_row* row;
+      if (kind == kCOMPILED_NO_BINDING) continue;
+
+      row = &rows.entries[rows.count++];
+      row->site_id = site;
+      row->host_id = c->site_count + host;
+      row->site_name = out_names[row->site_id].name;
+      row->worker_host = out_names[row->host_id].name;
+      row->binding_kind = kind;
+      row->max_in_flight = 0;
+
+      // the limits are in the same (site, host) order
+      while (next_limit < c->limit_count &&
+             (limits[next_limit].site < site ||
+              (limits[next_limit].site == site &&
+               limits[next_limit].host < host))) {
+        next_limit++;
+      }
+      if (next_limit < c->limit_count && limits[next_limit].site == site &&
+          limits[next_limit].host == host) {
+        row->max_in_flight = limits[next_limit].max_in_flight;
+      }
+    }
+  }
+  return rows;
+}
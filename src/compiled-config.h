@@ -0,0 +1,136 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include "palette-director-types.h"
+
+/*
+        Compiled binding configs.
+
+        palette-director-compile turns a binding CSV into a binary file the
+        module maps into memory instead of parsing it. Like the routing
+        table, the file is position independent (everything is an offset
+        from its start) and in the byte order of the machine that compiled
+        it:
+
+        - the header, with a magic, the format version, the size of the file
+          and a checksum of everything after the header
+        - the interned names: each site and host name once (sites compared
+          case-insensitively, like the routing table does), 0 terminated
+        - the sites (name and case-folded hash) and the hosts
+        - an open addressing hash index of the sites by their hash
+        - the site x host matrix of binding kinds (kCOMPILED_NO_BINDING
+          where the CSV has no row for the pair)
+        - the in-flight limits, sorted by site and host
+
+        Duplicate site / host rows keep the first binding and the first
+        limit, like routing_table_build() does with the CSV rows.
+*/
+
+enum {
+  kCOMPILED_CONFIG_VERSION = 1,
+
+  // The matrix cell of the site / host pairs without a binding
+  kCOMPILED_NO_BINDING = -128,
+};
+
+// The first bytes of a compiled config (a CSV file never has a 0 byte in it)
+#define COMPILED_CONFIG_MAGIC "PDBC\0\r\n\x1a"
+
+typedef struct compiled_config_header {
+  char magic[8];
+  uint32_t version;
+
+  // The size of the whole file, and the FNV-1a hash of the bytes after the
+  // header
+  uint32_t size;
+  uint32_t checksum;
+
+  // The interned names (uint32_t offsets of the 0 terminated strings)
+  uint32_t string_count;
+  uint32_t strings_offset;
+
+  // compiled_site-s, then the hosts (uint32_t string indices)
+  uint32_t site_count;
+  uint32_t sites_offset;
+  uint32_t host_count;
+  uint32_t hosts_offset;
+
+  // The hash index of the sites: a power of 2 of uint32_t buckets holding
+  // the site index + 1 (0 for empty buckets)
+  uint32_t index_size;
+  uint32_t index_offset;
+
+  // int8_t binding kinds, site_count rows of host_count
+  uint32_t matrix_offset;
+
+  // compiled_limit-s
+  uint32_t limit_count;
+  uint32_t limits_offset;
+} compiled_config_header;
+
+typedef struct compiled_site {
+  // The string index of the name and its routing_site_hash()
+  uint32_t name;
+  uint32_t hash;
+} compiled_site;
+
+typedef struct compiled_limit {
+  uint32_t site;
+  uint32_t host;
+  uint32_t max_in_flight;
+} compiled_limit;
+
+/*
+        Compiles binding rows into a new compiled config. Returns the
+        malloc()-ed file contents (and their size in out_size), or NULL if
+        out of memory.
+*/
+compiled_config_header* compiled_config_build(const binding_rows* rows,
+                                              size_t* out_size);
+
+// Returns 1 if the data starts with the magic of a compiled config
+int compiled_config_is_compiled(const void* data, size_t size);
+
+/*
+        Checks that data of size bytes is a compiled config this build can
+        read: the magic, version, size, checksum and that every offset and
+        index stays inside the data. Returns NULL if it is, or the problem.
+*/
+const char* compiled_config_validate(const void* data, size_t size);
+
+// Returns a name of a (validated) compiled config
+const char* compiled_config_string(const compiled_config_header* c,
+                                   uint32_t string_idx);
+
+// Returns the index of the site (case-insensitively) or -1
+int compiled_config_find_site(const compiled_config_header* c,
+                              const char* name, size_t length);
+
+typedef struct apr_pool_t apr_pool_t;
+
+/*
+        Returns the rows of a validated compiled config (by site, then
+        host) and their names, the way parse_csv_config() would. The rows
+        and names are allocated from the pool, the strings point into the
+        compiled config: the ids of the sites are their index, the ids of
+        the hosts follow them.
+*/
+binding_rows compiled_config_rows(const compiled_config_header* c,
+                                  apr_pool_t* pool, binding_names* names);
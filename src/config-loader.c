@@ -16,20 +16,24 @@
  * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
  * */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <mod_proxy.h>
 #include <sys/stat.h>
+#include "compiled-config.h"
 #include "config-loader.h"
 #include "csv/csv.h"
+#include "routing-table.h"
 
-/////////////////////////////////////////////////////////////////////////////
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-// Ignore the hostname resolution until we need to deal with it
-// (a DNS query inside the load balancer routing will slow down
-// all new, unrouted queries)
-enum { RESOLVE_HOSTNAMES = FALSE };
+/////////////////////////////////////////////////////////////////////////////
 
 // Loads a file into memory and returns a pointer
 static char* load_file_into_memory(FILE* f, size_t* out_size) {
@@ -41,33 +45,158 @@ static char* load_file_into_memory(FILE* f, size_t* out_size) {
   fseek(f, 0, SEEK_SET);  // same as rewind(f);
 
   string = (char*)malloc(fsize + 1);
-  fread(string, fsize, 1, f);
+  if (string == NULL) return NULL;
 
-  if (errno != 0) {
+  if (fsize > 0 && fread(string, fsize, 1, f) != 1) {
     ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
                  "File load error: '%s'", strerror(errno));
+    free(string);
     return NULL;
   }
 
-  fclose(f);
-
   *out_size = fsize;
   string[fsize] = 0;
   return string;
 }
 
-// Duplicates a string by duping num_chars chars (and a 0) only
-static const char* strndup(const char* str, size_t num_chars) {
-  // clip the length
-  const size_t copied_chars = min(num_chars, strlen(str));
-  char* o = (char*)malloc(copied_chars + 1);
+// Copies a cell into a 0 terminated buffer. Returns 0 if it does not fit.
+// The cells libcsv hands us are not zero terminated, but strcmp() and
+// strtol() need them to be.
+static int copy_cell(char* buffer, size_t size, const char* cell,
+                     size_t length) {
+  if (length >= size) return 0;
+  memcpy(buffer, cell, length);
+  buffer[length] = '\0';
+  return 1;
+}
+
+int parse_binding_kind(const char* text, binding_kind_t* kind) {
+  if (strcmp("prefer", text) == 0) {
+    *kind = kBINDING_PREFER;
+  } else if (strcmp("forbid", text) == 0) {
+    *kind = kBINDING_FORBID;
+  } else if (strcmp("allow", text) == 0) {
+    *kind = kBINDING_ALLOW;
+  } else if (*text >= '0' && *text <= '9') {
+    // a numeric priority (1 is the same as prefer)
+    char* end = NULL;
+    const long priority = strtol(text, &end, 10);
+    if (*end != '\0' || priority < kBINDING_PREFER ||
+        priority > kBINDING_MAX_PRIORITY) {
+      return 0;
+    }
+    *kind = (binding_kind_t)priority;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+// Name interning
+// --------------
+
+// The names of the config loaded so far. Each distinct name (ignoring the
+// case, like the routing table does) is copied into the pool once, the
+// rows refer to it by its id.
+typedef struct name_interner {
+  apr_pool_t* pool;
+
+  // Indexed by the id (grown by doubling)
+  binding_name* names;
+  size_t count;
+  size_t capacity;
+
+  // A power of 2 of buckets holding the id + 1 (0 for empty buckets), at
+  // most half full
+  uint32_t* buckets;
+  size_t bucket_mask;
+} name_interner;
+
+// Returns 1 if the two names are the same ignoring the (ASCII) case
+static int names_equal(const char* a, const char* b, size_t length) {
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    if (PAL__ASCII_TOLOWER(a[i]) != PAL__ASCII_TOLOWER(b[i])) return 0;
+  }
+  return 1;
+}
+
+// Returns the bucket for the name (either empty or holding the name)
+static uint32_t* interner_bucket(const name_interner* in, const char* name,
+                                 size_t length, uint32_t hash) {
+  size_t b = hash & in->bucket_mask;
+  for (;;) {
+    const binding_name* entry;
+    if (in->buckets[b] == 0) return &in->buckets[b];
+    entry = &in->names[in->buckets[b] - 1];
+    if (entry->hash == hash && entry->length == length &&
+        names_equal(entry->name, name, length)) {
+      return &in->buckets[b];
+    }
+    b = (b + 1) & in->bucket_mask;
+  }
+}
+
+// Makes room for one more name. Returns 0 if out of memory.
+static int interner_reserve(name_interner* in) {
+  size_t i;
+
+  if (in->count == in->capacity) {
+    const size_t capacity = (in->capacity > 0) ? in->capacity * 2 : 64;
+    binding_name* names =
+        (binding_name*)realloc(in->names, sizeof(binding_name) * capacity);
+    if (names == NULL) return 0;
+    in->names = names;
+    in->capacity = capacity;
+  }
+
+  if ((in->count + 1) * 2 > in->bucket_mask + 1 || in->buckets == NULL) {
+    const size_t bucket_count =
+        (in->buckets != NULL) ? (in->bucket_mask + 1) * 2 : 128;
+    uint32_t* buckets = (uint32_t*)calloc(bucket_count, sizeof(uint32_t));
+    if (buckets == NULL) return 0;
+
+    free(in->buckets);
+    in->buckets = buckets;
+    in->bucket_mask = bucket_count - 1;
+    for (i = 0; i < in->count; ++i) {
+      *interner_bucket(in, in->names[i].name, in->names[i].length,
+                       in->names[i].hash) = (uint32_t)(i + 1);
+    }
+  }
+  return 1;
+}
 
-  strncpy(o, str, copied_chars);
+// Returns the id of the name, adding it if new (kBINDING_NO_ID if out of
+// memory)
+static uint32_t intern_name(name_interner* in, const char* name,
+                            size_t length) {
+  const uint32_t hash = routing_site_hash(name, length);
+  uint32_t* bucket;
+  char* copy;
+
+  if (in->buckets != NULL) {
+    bucket = interner_bucket(in, name, length, hash);
+    if (*bucket != 0) return *bucket - 1;
+  }
 
-  // null terminate it
-  o[copied_chars] = '\0';
+  if (!interner_reserve(in)) return kBINDING_NO_ID;
+  copy = (char*)apr_palloc(in->pool, length + 1);
+  if (copy == NULL) return kBINDING_NO_ID;
+  memcpy(copy, name, length);
+  copy[length] = '\0';
+
+  in->names[in->count].name = copy;
+  in->names[in->count].length = (uint32_t)length;
+  in->names[in->count].hash = hash;
+  in->count++;
+  *interner_bucket(in, copy, length, hash) = (uint32_t)in->count;
+  return (uint32_t)(in->count - 1);
+}
 
-  return o;
+static void interner_free(name_interner* in) {
+  free(in->names);
+  free(in->buckets);
 }
 
 /////////////////////////////////////////////////////////////////
@@ -77,15 +206,25 @@ enum {
   kiDX_SITE_NAME = 0,
   kIDX_WORKER_HOST_NAME = 1,
   kIDX_BINDING_KIND = 2,
+  // optional
+  kIDX_MAX_IN_FLIGHT = 3,
 
   kIDX_INDEX_COUNT
 };
 
+// The longest binding kind or limit cell we read
+enum { kMAX_NUMBER_CELL_LENGTH = 32 };
+
 // The state of our config loader funcion
 typedef struct config_loader_state {
-  // The buffer for the rows
-  binding_row rows[kBINDINGS_BUFFER_SIZE];
+  // The rows loaded so far (grown by doubling, copied into the pool at the
+  // end)
+  binding_row* rows;
   size_t row_count;
+  size_t row_capacity;
+
+  // The site and host names of the rows
+  name_interner names;
 
   // The current binding as it builds up
   binding_row current_row;
@@ -98,13 +237,29 @@ typedef struct config_loader_state {
 
 } config_loader_state;
 
+// Sets the name of the current row from a cell (NULL if out of memory)
+static void set_row_name(config_loader_state* state, const char* cell,
+                         size_t length, const char** out_name,
+                         uint32_t* out_id) {
+  const uint32_t id = intern_name(&state->names, cell, length);
+
+  if (id == kBINDING_NO_ID) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "Out of memory loading '%.*s'", (int)length, cell);
+    *out_name = NULL;
+  } else {
+    *out_name = state->names.names[id].name;
+  }
+  *out_id = id;
+}
+
 // Handler for each cell in a CSV row
 static void on_csv_cell(void* s, size_t i, void* p) {
   // get the state
   config_loader_state* state = (config_loader_state*)p;
   int state_idx = state->state;
-  // clone the string, because all steps require a null-terminated string
-  char* tmp = (char*)strndup((char*)s, i);
+  const char* cell = (const char*)s;
+  char tmp[kMAX_NUMBER_CELL_LENGTH];
 
   // Skip the first line and dont even try to process it
   if (state->line_count == 0) {
@@ -114,34 +269,56 @@ static void on_csv_cell(void* s, size_t i, void* p) {
   // check which field we are at and handle it
   switch (state_idx) {
     case kiDX_SITE_NAME:
-      // if note, dupe the site name
-      state->current_row.site_name = tmp;
+      set_row_name(state, cell, i, &state->current_row.site_name,
+                   &state->current_row.site_id);
       break;
 
     case kIDX_WORKER_HOST_NAME:
-      state->current_row.worker_host = tmp;
+      set_row_name(state, cell, i, &state->current_row.worker_host,
+                   &state->current_row.host_id);
       break;
 
     case kIDX_BINDING_KIND: {
       // The kind of binding.
-      int binding_kind = kBINDING_ALLOW;
+      binding_kind_t binding_kind = kBINDING_ALLOW;
       //  check the kind
-      if (strcmp("prefer", tmp) == 0) {
-        binding_kind = kBINDING_PREFER;
-      } else if (strcmp("forbid", tmp) == 0) {
-        binding_kind = kBINDING_FORBID;
+      if (!copy_cell(tmp, sizeof(tmp), cell, i)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                     "Invalid binding kind '%.*s', allowing the host",
+                     (int)i, cell);
+      } else if (!parse_binding_kind(tmp, &binding_kind) && *tmp >= '0' &&
+                 *tmp <= '9') {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                     "Invalid binding priority '%s' (must be %d to %d), "
+                     "allowing the host",
+                     tmp, kBINDING_PREFER, kBINDING_MAX_PRIORITY);
       }
+      // anything else allows the host
       // update the binding from the register
       state->current_row.binding_kind = binding_kind;
-    }
-
-      free(tmp);
-      break;
+    } break;
+
+    case kIDX_MAX_IN_FLIGHT: {
+      char* end = NULL;
+      unsigned long limit;
+      if (!copy_cell(tmp, sizeof(tmp), cell, i)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                     "Invalid max in-flight limit '%.*s', ignoring it",
+                     (int)i, cell);
+        break;
+      }
+      limit = strtoul(tmp, &end, 10);
+      if (*tmp != '\0' && (*end != '\0' || limit > UINT32_MAX)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                     "Invalid max in-flight limit '%s', ignoring it", tmp);
+      } else {
+        state->current_row.max_in_flight = (uint32_t)limit;
+      }
+    } break;
 
     default:
       ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
-                   "Extra columns in the config file: '%s'", tmp);
-      free(tmp);
+                   "Extra columns in the config file: '%.*s'", (int)i, cell);
       break;
   };
 
@@ -149,49 +326,90 @@ static void on_csv_cell(void* s, size_t i, void* p) {
   state->state = state_idx;
 }
 
+// Makes room for one more row. Returns 0 if out of memory.
+static int reserve_row(config_loader_state* state) {
+  binding_row* rows;
+  size_t capacity;
+
+  if (state->row_count < state->row_capacity) return 1;
+
+  capacity = (state->row_capacity > 0) ? state->row_capacity * 2 : 64;
+  rows = (binding_row*)realloc(state->rows, sizeof(binding_row) * capacity);
+  if (rows == NULL) return 0;
+
+  state->rows = rows;
+  state->row_capacity = capacity;
+  return 1;
+}
+
+// Resets the row so every column of the next row starts out empty
+static void reset_row(binding_row* row) {
+  row->site_name = NULL;
+  row->worker_host = NULL;
+  row->binding_kind = kBINDING_ALLOW;
+  row->max_in_flight = 0;
+  row->site_id = kBINDING_NO_ID;
+  row->host_id = kBINDING_NO_ID;
+}
+
 // handler for each row in the CSV file (called after each cell in that row
 // has been added.
 static void on_csv_row_end(int c, void* p) {
   config_loader_state* state = (config_loader_state*)p;
+  binding_row* row = &state->current_row;
 
-  // Add the row to the state if its not the first one
-  if (state->line_count > 0) {
-    state->rows[state->row_count] = state->current_row;
+  if (state->line_count == 0) {
+    // the header
+  } else if (row->site_name == NULL || row->worker_host == NULL) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "Skipping binding without a site and a host on line %lu",
+                 (unsigned long)state->line_count + 1);
+  } else if (!reserve_row(state)) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "Out of memory, skipping binding: site:'%s' to: '%s'",
+                 row->site_name, row->worker_host);
+  } else {
+    // Add the row to the state if its not the first one
+    state->rows[state->row_count] = *row;
     state->row_count += 1;
 
-    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
-                 "Loaded binding: site:'%s' to: '%s'",
-                 state->current_row.site_name, state->current_row.worker_host);
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
+                 "Loaded binding: site:'%s' to: '%s'", row->site_name,
+                 row->worker_host);
   }
 
   // increment the line count so we wont skip the line next time
   state->line_count++;
 
-  // reset the state
   state->state = kiDX_SITE_NAME;
+  reset_row(row);
+}
+
+// Copies count elements of size bytes into the pool (NULL if count is 0)
+static void* pool_copy(apr_pool_t* pool, const void* data, size_t count,
+                       size_t size) {
+  void* copy;
+  if (count == 0) return NULL;
+  copy = apr_palloc(pool, count * size);
+  if (copy != NULL) memcpy(copy, data, count * size);
+  return copy;
 }
 
 /////////////////////////////////////////////////////////////////
 
-binding_rows parse_csv_config(const char* path) {
+binding_config parse_csv_config(apr_pool_t* pool, const char* path) {
+  binding_config config = {{NULL, 0}, {NULL, 0}, NULL, 0};
   FILE* fp;
-  int line_count = 1;
-  // Set the default fallback to null
-  const char* fallback_worker_host = NULL;
-  // The number of records filled in buffer
-  size_t loaded_site_count = 0;
 
   // struct stat sb;
   char* file_buffer;
   size_t file_size = 0;
 
-  printf("cmp: ==== %d\n", strcmp("", ""));
-
   // Try to open the config file
   if ((fp = fopen(path, "rb")) == NULL) {
     ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
                  "Cannot open worker bindings config file '%s'", path);
-    return empty_binding_rows;
+    return config;
   }
 
   // try to load the whole file
@@ -201,7 +419,7 @@ binding_rows parse_csv_config(const char* path) {
   if (file_buffer == NULL) {
     ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
                  "Cannot load worker bindings config file '%s'", path);
-    return empty_binding_rows;
+    return config;
   }
 
   // Parse the file as csv
@@ -210,6 +428,8 @@ binding_rows parse_csv_config(const char* path) {
     config_loader_state state = {0};
     struct csv_parser parser;
 
+    state.names.pool = pool;
+    reset_row(&state.current_row);
     csv_init(&parser, 0);
 
     // parse the CSV
@@ -224,80 +444,180 @@ binding_rows parse_csv_config(const char* path) {
     // clean up the buffer
     free(file_buffer);
 
-    // dont resolve for now
-    if (RESOLVE_HOSTNAMES) {
-      size_t i = 0;
-      ip_resolver_table rt = {0, 0, 0};
-      for (i = 0; i < state.row_count; ++i) {
-        const char* hostname = state.rows[i].worker_host;
-        printf("============= %s -> %s\n", hostname,
-               ip_resolver_lookup(&rt, hostname));
-      }
+    // the config keeps exactly what it needs in the pool
+    config.rows.entries = (binding_row*)pool_copy(
+        pool, state.rows, state.row_count, sizeof(binding_row));
+    config.names.entries = (const binding_name*)pool_copy(
+        pool, state.names.names, state.names.count, sizeof(binding_name));
+    if ((config.rows.entries != NULL || state.row_count == 0) &&
+        (config.names.entries != NULL || state.names.count == 0)) {
+      config.rows.count = state.row_count;
+      config.names.count = state.names.count;
+    } else {
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                   "Out of memory loading worker bindings config file '%s'",
+                   path);
+      config.rows.entries = NULL;
+      config.names.entries = NULL;
     }
 
-    // build the output
-    {
-      size_t bytes_to_copy = sizeof(state.rows[0]) * state.row_count;
-      // create the output
-      binding_rows output = {(binding_row*)malloc(bytes_to_copy),
-                             state.row_count};
-      // copy the rows
-      memcpy(output.entries, state.rows, bytes_to_copy);
-      return output;
-    }
+    free(state.rows);
+    interner_free(&state.names);
+    return config;
   }
 }
 
-////////////////////////////////////////////////////////////////////////////
-
-// Returns the binding kind for a sitename / host pair from the list
-// of bindings provided
-// TODO: speed this up by storing and comparing a hash (but careful with
-// upper/lower case)
-static binding_kind_t binding_kind_for(const binding_rows bindings,
-                                       const char* site_name,
-                                       const char* worker_host) {
-  size_t i, len = bindings.count;
-  // No site name? This site is allowed for this worker, thats for sure
-  if (site_name == NULL) return kBINDING_ALLOW;
-
-  for (i = 0; i < len; ++i) {
-    const binding_row b = bindings.entries[i];
-
-    // if the site name and worker host match, return the kind
-    if (strcasecmp(b.site_name, site_name) == 0 &&
-        strcasecmp(b.worker_host, worker_host) == 0) {
-      return b.binding_kind;
-    }
+/////////////////////////////////////////////////////////////////
+
+/*
+        Maps a file into memory read-only. Returns NULL if it cannot be
+        opened or is empty. Without mmap() the file is read into the heap.
+*/
+static void* map_file(const char* path, size_t* out_size) {
+#ifdef _WIN32
+  FILE* fp = fopen(path, "rb");
+  char* data;
+  if (fp == NULL) return NULL;
+  data = load_file_into_memory(fp, out_size);
+  fclose(fp);
+  if (data != NULL && *out_size == 0) {
+    free(data);
+    return NULL;
+  }
+  return data;
+#else
+  struct stat sb;
+  void* data;
+  const int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+    close(fd);
+    return NULL;
   }
-  // if no entries match, return an 'allow'
-  return kBINDING_ALLOW;
+  data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after closing the file (and after the
+  // compiler renamed a new file over it)
+  close(fd);
+  if (data == MAP_FAILED) return NULL;
+
+  *out_size = (size_t)sb.st_size;
+  return data;
+#endif
 }
 
-// Filtering workers
-// -----------------
+static void unmap_file(void* data, size_t size) {
+#ifdef _WIN32
+  free(data);
+#else
+  munmap(data, size);
+#endif
+}
+
+binding_config load_binding_config(apr_pool_t* pool, const char* path) {
+  binding_config config = {{NULL, 0}, {NULL, 0}, NULL, 0};
+  size_t size = 0;
+  void* data = map_file(path, &size);
+  const char* problem;
 
-typedef struct worker_hostname_filter_state {
-  const char* site_name;
-  binding_kind_t kind;
+  // not there, empty or a CSV
+  if (data == NULL || !compiled_config_is_compiled(data, size)) {
+    if (data != NULL) unmap_file(data, size);
+    return parse_csv_config(pool, path);
+  }
+
+  problem = compiled_config_validate(data, size);
+  if (problem != NULL) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "Cannot load compiled binding config '%s': %s", path,
+                 problem);
+    unmap_file(data, size);
+    return config;
+  }
 
-  binding_rows bindings_in;
-} worker_hostname_filter_state;
+  config.rows = compiled_config_rows((const compiled_config_header*)data,
+                                     pool, &config.names);
+  config.mapping = data;
+  config.mapping_size = size;
+  return config;
+}
 
-static int worker_by_hostname_filter_fn(const proxy_worker** w, void* state) {
-  const worker_hostname_filter_state s = *(worker_hostname_filter_state*)state;
-  const binding_kind_t b =
-      binding_kind_for(s.bindings_in, s.site_name, (*w)->s->hostname);
-  return b == s.kind;
+void unload_binding_config(binding_config* config) {
+  // the rest is in the pool
+  if (config->mapping != NULL) {
+    unmap_file(config->mapping, config->mapping_size);
+  }
+  config->rows = empty_binding_rows;
+  config->names.entries = NULL;
+  config->names.count = 0;
+  config->mapping = NULL;
+  config->mapping_size = 0;
 }
 
-proxy_worker_slice get_handling_workers_for(const binding_rows bindings_in,
-                                            const proxy_worker_slice workers_in,
-                                            const char* site_name,
-                                            const binding_kind_t with_kind) {
-  worker_hostname_filter_state filter_state = {site_name, with_kind};
-  // TODO: somehow fix this issue of const binding_rows -> binding_rows
-  filter_state.bindings_in = bindings_in;
-  return proxy_worker_slice_filter(workers_in, worker_by_hostname_filter_fn,
-                                   kBINDINGS_BUFFER_SIZE, &filter_state);
+/////////////////////////////////////////////////////////////////
+
+// Writes a binding kind the way parse_binding_kind() reads it
+static int write_binding_kind(FILE* f, binding_kind_t kind) {
+  if (kind == kBINDING_PREFER) return fputs("prefer", f) >= 0;
+  if (kind == kBINDING_FORBID) return fputs("forbid", f) >= 0;
+  if (kind > kBINDING_PREFER) return fprintf(f, "%d", kind) > 0;
+  return fputs("allow", f) >= 0;
+}
+
+static int write_csv_rows(FILE* f, const binding_rows* rows) {
+  size_t i;
+
+  if (fputs("site,host,binding,max_in_flight\n", f) < 0) return 0;
+  for (i = 0; i < rows->count; ++i) {
+    const binding_row* row = &rows->entries[i];
+    // the drains are runtime state, not bindings
+    if (row->binding_kind == kBINDING_DRAIN) continue;
+    // the names are quoted (and their quotes doubled) by libcsv
+    if (csv_fwrite(f, row->site_name, strlen(row->site_name)) != 0 ||
+        fputc(',', f) == EOF ||
+        csv_fwrite(f, row->worker_host, strlen(row->worker_host)) != 0 ||
+        fputc(',', f) == EOF || !write_binding_kind(f, row->binding_kind)) {
+      return 0;
+    }
+    if (row->max_in_flight > 0 &&
+        fprintf(f, ",%lu", (unsigned long)row->max_in_flight) < 0) {
+      return 0;
+    }
+    if (fputc('\n', f) == EOF) return 0;
+  }
+  return 1;
+}
+
+int write_csv_config(const char* path, const binding_rows* rows) {
+  const size_t path_length = strlen(path);
+  char* tmp_path = (char*)malloc(path_length + sizeof(".tmp"));
+  FILE* f;
+  int ok;
+
+  if (tmp_path == NULL) return 0;
+  memcpy(tmp_path, path, path_length);
+  memcpy(tmp_path + path_length, ".tmp", sizeof(".tmp"));
+
+  f = fopen(tmp_path, "wb");
+  if (f == NULL) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, errno, ap_server_conf,
+                 "Cannot write worker bindings config file '%s'", tmp_path);
+    free(tmp_path);
+    return 0;
+  }
+  ok = write_csv_rows(f, rows);
+  ok = (fclose(f) == 0) && ok;
+
+#ifdef _WIN32
+  // rename() does not replace an existing file on Windows
+  if (ok) remove(path);
+#endif
+  ok = ok && rename(tmp_path, path) == 0;
+  if (!ok) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, errno, ap_server_conf,
+                 "Cannot replace worker bindings config file '%s'", path);
+    remove(tmp_path);
+  }
+  free(tmp_path);
+  return ok;
 }
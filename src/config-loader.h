@@ -20,22 +20,52 @@
 
 #include "palette-director-types.h"
 
+typedef struct apr_pool_t apr_pool_t;
+
+// A binding config loaded from a CSV or a compiled config
+typedef struct binding_config {
+  // The rows and their interned names (allocated from the pool the config
+  // was loaded into)
+  binding_rows rows;
+  binding_names names;
+
+  // The compiled config the names point into (NULL if the config was
+  // parsed from a CSV)
+  void* mapping;
+  size_t mapping_size;
+} binding_config;
+
 /*
         Helper to read the configuration from a file.
 
-        Returns a bindings_setup struct. Only the successfully loaded binding
-   configs
-        are added to the return config.
+        Everything the config needs (the rows, and each distinct site and
+        host name once) is allocated from the pool, so it goes away with
+        the pool in one step. Only the successfully loaded bindings are
+        added to the returned config.
 */
-binding_rows parse_csv_config(const char* path);
+binding_config parse_csv_config(apr_pool_t* pool, const char* path);
 
 /*
-        Returns a list of workers where the bindings configuration has with_kind
-        set for kind.
+        Loads a binding config: a compiled config (see compiled-config.h) is
+        mapped into memory and checked, anything else is parsed as CSV.
+        Unmap the compiled config with unload_binding_config() before
+        clearing the pool.
+*/
+binding_config load_binding_config(apr_pool_t* pool, const char* path);
+
+void unload_binding_config(binding_config* config);
 
-        The slices in the return struct must be freed after use.
+/*
+        Parses a binding kind: "prefer", "forbid", "allow" or a priority
+        from kBINDING_PREFER to kBINDING_MAX_PRIORITY. Returns 0 if the
+        text is none of them.
+*/
+int parse_binding_kind(const char* text, binding_kind_t* kind);
+
+/*
+        Writes the rows as a binding CSV (with a header line) that
+        parse_csv_config() reads back. The file is written next to path
+        and renamed over it, so the config watcher never sees half a file.
+        The kBINDING_DRAIN rows are left out. Returns 0 on error.
 */
-proxy_worker_slice get_handling_workers_for(const binding_rows bindings_in,
-                                            const proxy_worker_slice workers_in,
-                                            const char* site_name,
-                                            const binding_kind_t with_kind);
+int write_csv_config(const char* path, const binding_rows* rows);
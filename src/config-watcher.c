@@ -0,0 +1,299 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "config-watcher.h"
+
+#include <apr_atomic.h>
+#include <apr_file_info.h>
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <mod_proxy.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define CONFIG_WATCHER_INOTIFY 1
+#endif
+
+// How often the thread wakes up to check if it should stop
+static const apr_interval_time_t kWAKEUP_INTERVAL = apr_time_from_sec(1);
+
+// What we know about a file from the last check
+typedef struct file_stamp {
+  int exists;
+  apr_time_t mtime;
+  apr_off_t size;
+} file_stamp;
+
+struct config_watcher {
+  const char** paths;
+  file_stamp* stamps;
+  size_t path_count;
+
+  apr_interval_time_t check_interval;
+  config_change_fn on_change;
+  void* baton;
+
+  // Called on every wakeup once has_poll is set
+  config_poll_fn on_poll;
+  void* poll_baton;
+  volatile apr_uint32_t has_poll;
+
+  apr_thread_t* thread;
+  volatile apr_uint32_t stop;
+  volatile apr_uint32_t reload_requested;
+
+#ifdef CONFIG_WATCHER_INOTIFY
+  int inotify_fd;
+
+  // The watch descriptor of the directory and the name of each file
+  int* watches;
+  const char** basenames;
+#endif
+};
+
+// Reads the stamp of each file, returns 1 if any of them changed
+static int refresh_stamps(config_watcher* w, apr_pool_t* pool) {
+  int changed = 0;
+  size_t i;
+
+  for (i = 0; i < w->path_count; ++i) {
+    apr_finfo_t finfo;
+    file_stamp stamp = {0, 0, 0};
+
+    if (apr_stat(&finfo, w->paths[i], APR_FINFO_MTIME | APR_FINFO_SIZE,
+                 pool) == APR_SUCCESS) {
+      stamp.exists = 1;
+      stamp.mtime = finfo.mtime;
+      stamp.size = finfo.size;
+    }
+
+    if (stamp.exists != w->stamps[i].exists ||
+        stamp.mtime != w->stamps[i].mtime || stamp.size != w->stamps[i].size) {
+      changed = 1;
+    }
+    w->stamps[i] = stamp;
+  }
+
+  apr_pool_clear(pool);
+  return changed;
+}
+
+#ifdef CONFIG_WATCHER_INOTIFY
+
+// Watches the directory of each file (editors and scripts usually replace
+// the file, which would end a watch on the file itself)
+static void inotify_start(config_watcher* w, apr_pool_t* pool) {
+  size_t i;
+
+  w->watches = (int*)apr_pcalloc(pool, sizeof(int) * w->path_count);
+  w->basenames =
+      (const char**)apr_pcalloc(pool, sizeof(const char*) * w->path_count);
+  w->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (w->inotify_fd < 0) {
+    ap_log_error(APLOG_MARK, APLOG_WARNING, errno, ap_server_conf,
+                 "Cannot use inotify, checking the bindings every %"
+                 APR_TIME_T_FMT " seconds",
+                 apr_time_sec(w->check_interval));
+    return;
+  }
+
+  for (i = 0; i < w->path_count; ++i) {
+    const char* slash = strrchr(w->paths[i], '/');
+    const char* dir = (slash == NULL)
+                          ? "."
+                          : (slash == w->paths[i])
+                                ? "/"
+                                : apr_pstrndup(pool, w->paths[i],
+                                               slash - w->paths[i]);
+
+    w->basenames[i] = (slash == NULL) ? w->paths[i] : slash + 1;
+    w->watches[i] = inotify_add_watch(w->inotify_fd, dir,
+                                      IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (w->watches[i] < 0) {
+      ap_log_error(APLOG_MARK, APLOG_WARNING, errno, ap_server_conf,
+                   "Cannot watch '%s' with inotify", dir);
+    }
+  }
+}
+
+// Waits for inotify events for up to timeout, returns 1 if one of our files
+// was written or replaced
+static int inotify_wait(config_watcher* w, apr_interval_time_t timeout) {
+  struct pollfd pfd;
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+  ssize_t length;
+
+  pfd.fd = w->inotify_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, (int)apr_time_msec(timeout)) <= 0) return 0;
+
+  while ((length = read(w->inotify_fd, events, sizeof(events))) > 0) {
+    const char* p = events;
+
+    while (p < events + length) {
+      const struct inotify_event* e = (const struct inotify_event*)p;
+      size_t i;
+
+      for (i = 0; i < w->path_count && e->len > 0; ++i) {
+        if (e->wd == w->watches[i] && strcmp(e->name, w->basenames[i]) == 0) {
+          changed = 1;
+        }
+      }
+      p += sizeof(struct inotify_event) + e->len;
+    }
+  }
+
+  return changed;
+}
+
+#endif
+
+// Calls on_change, returns 1 if it has to be called again later
+static int notify_change(config_watcher* w, apr_pool_t* pool) {
+  const apr_status_t rv = w->on_change(w->baton, pool);
+  apr_pool_clear(pool);
+  return APR_STATUS_IS_EAGAIN(rv);
+}
+
+static void* APR_THREAD_FUNC watcher_thread(apr_thread_t* thread,
+                                            void* data) {
+  config_watcher* w = (config_watcher*)data;
+  apr_pool_t* pool = NULL;
+  apr_time_t next_check = apr_time_now() + w->check_interval;
+
+  // Changed on the last check: wait for one more check without changes
+  // before reloading, so we do not load a half written file
+  int pending = 0;
+
+  apr_pool_create(&pool, apr_thread_pool_get(thread));
+  refresh_stamps(w, pool);
+
+  while (!apr_atomic_read32(&w->stop)) {
+    apr_time_t now;
+
+    if (apr_atomic_read32(&w->has_poll)) {
+      w->on_poll(w->poll_baton, pool);
+      apr_pool_clear(pool);
+    }
+
+#ifdef CONFIG_WATCHER_INOTIFY
+    if (w->inotify_fd >= 0 && inotify_wait(w, kWAKEUP_INTERVAL)) {
+      // The writer is done with the file, no need to wait for it to settle
+      refresh_stamps(w, pool);
+      pending = notify_change(w, pool);
+      continue;
+    }
+    if (w->inotify_fd < 0) apr_sleep(kWAKEUP_INTERVAL);
+#else
+    apr_sleep(kWAKEUP_INTERVAL);
+#endif
+
+    if (apr_atomic_xchg32(&w->reload_requested, 0)) {
+      pending = notify_change(w, pool);
+      continue;
+    }
+
+    now = apr_time_now();
+    if (now < next_check) continue;
+    next_check = now + w->check_interval;
+
+    if (refresh_stamps(w, pool)) {
+      pending = 1;
+    } else if (pending) {
+      pending = notify_change(w, pool);
+    }
+  }
+
+  apr_pool_destroy(pool);
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+void config_watcher_request_reload(config_watcher* w) {
+  apr_atomic_set32(&w->reload_requested, 1);
+}
+
+void config_watcher_set_poll(config_watcher* w, config_poll_fn on_poll,
+                             void* baton) {
+  w->on_poll = on_poll;
+  w->poll_baton = baton;
+  // a full barrier: the thread sees the callback before the flag
+  apr_atomic_xchg32(&w->has_poll, 1);
+}
+
+static apr_status_t config_watcher_stop(void* data) {
+  config_watcher* w = (config_watcher*)data;
+  apr_status_t thread_status;
+
+  apr_atomic_set32(&w->stop, 1);
+  apr_thread_join(&thread_status, w->thread);
+
+#ifdef CONFIG_WATCHER_INOTIFY
+  if (w->inotify_fd >= 0) close(w->inotify_fd);
+#endif
+  return APR_SUCCESS;
+}
+
+apr_status_t config_watcher_start(apr_pool_t* pool, const char* const* paths,
+                                  size_t path_count,
+                                  apr_interval_time_t check_interval,
+                                  config_change_fn on_change, void* baton,
+                                  config_watcher** out_watcher) {
+#if APR_HAS_THREADS
+  config_watcher* w =
+      (config_watcher*)apr_pcalloc(pool, sizeof(config_watcher));
+  apr_status_t rv;
+  size_t i;
+
+  w->paths = (const char**)apr_pcalloc(pool, sizeof(const char*) * path_count);
+  w->stamps = (file_stamp*)apr_pcalloc(pool, sizeof(file_stamp) * path_count);
+  for (i = 0; i < path_count; ++i) {
+    w->paths[i] = apr_pstrdup(pool, paths[i]);
+  }
+  w->path_count = path_count;
+  w->check_interval = check_interval;
+  w->on_change = on_change;
+  w->baton = baton;
+
+#ifdef CONFIG_WATCHER_INOTIFY
+  inotify_start(w, pool);
+#endif
+
+  rv = apr_thread_create(&w->thread, NULL, watcher_thread, w, pool);
+  if (rv != APR_SUCCESS) {
+#ifdef CONFIG_WATCHER_INOTIFY
+    if (w->inotify_fd >= 0) close(w->inotify_fd);
+#endif
+    return rv;
+  }
+
+  // Stop the thread before the pool (and the pool of the thread, which is
+  // a subpool of it) goes away
+  apr_pool_pre_cleanup_register(pool, w, config_watcher_stop);
+  if (out_watcher != NULL) *out_watcher = w;
+  return APR_SUCCESS;
+#else
+  return APR_ENOTIMPL;
+#endif
+}
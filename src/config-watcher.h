@@ -0,0 +1,68 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+// Called from the watcher thread when one of the watched files changed.
+// ptemp is cleared after the call returns. Returning APR_EAGAIN calls it
+// again after the next check.
+typedef apr_status_t (*config_change_fn)(void* baton, apr_pool_t* ptemp);
+
+// Called from the watcher thread on every wakeup (about once a second).
+// ptemp is cleared after the call returns.
+typedef void (*config_poll_fn)(void* baton, apr_pool_t* ptemp);
+
+typedef struct config_watcher config_watcher;
+
+/*
+        Starts a thread that watches a list of files and calls on_change when
+        any of them is replaced or rewritten (or a reload is requested).
+
+        On Linux the directories of the files are watched with inotify, so a
+        change is picked up as soon as the writer closes (or renames) the
+        file. Everywhere else (and if inotify is not available) the
+        modification time and size of the files are checked every
+        check_interval, and on_change is called once they stop changing.
+
+        The thread is stopped and joined when the pool is cleaned up. The
+        watcher is returned in out_watcher (if not NULL).
+*/
+apr_status_t config_watcher_start(apr_pool_t* pool, const char* const* paths,
+                                  size_t path_count,
+                                  apr_interval_time_t check_interval,
+                                  config_change_fn on_change, void* baton,
+                                  config_watcher** out_watcher);
+
+/*
+        Makes the watcher thread call on_change within a second, as if a
+        file changed (so the reloads of everything stay on one thread). Safe
+        to call from any thread.
+*/
+void config_watcher_request_reload(config_watcher* w);
+
+/*
+        Makes the watcher thread also call on_poll on every wakeup, so work
+        that has to run on the reload thread (the runtime binding edits) is
+        picked up within a second. Call it once, right after starting the
+        watcher.
+*/
+void config_watcher_set_poll(config_watcher* w, config_poll_fn on_poll,
+                             void* baton);
@@ -0,0 +1,397 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "host-resolver.h"
+
+#include <apr_atomic.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
+#include <mod_proxy.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "palette-macros.h"
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
+
+enum {
+  // The bucket count of the cache to start with (a power of 2)
+  kMIN_HOST_BUCKETS = 64,
+};
+
+// How often the thread wakes up to look for expired names
+static const apr_interval_time_t kWAKEUP_INTERVAL = apr_time_from_sec(1);
+
+// The addresses of a host (sorted, never changed once published)
+typedef struct address_set {
+  size_t count;
+  char addresses[kHOST_MAX_ADDRESSES][kHOST_ADDRESS_SIZE];
+
+  // The set retired before this one
+  struct address_set* next_retired;
+} address_set;
+
+// A name in the cache
+typedef struct cached_host {
+  const char* name;
+  uint32_t hash;
+  struct cached_host* next_in_bucket;
+
+  // NULL until the name is first looked up
+  address_set* addresses;
+  // When to look the name up again (0 for as soon as possible)
+  apr_time_t expires_at;
+} cached_host;
+
+struct host_resolver {
+  apr_pool_t* pool;
+  apr_interval_time_t ttl;
+  apr_interval_time_t negative_ttl;
+
+  // Guards the cache (and the pool) between the thread and the builds
+  apr_thread_mutex_t* mutex;
+
+  // Chained by hash, grown by doubling
+  cached_host** buckets;
+  size_t bucket_mask;
+  size_t count;
+
+  // The replaced address sets, freed once no build holds them
+  address_set* retired;
+  volatile apr_uint32_t holders;
+
+  host_resolver_change_fn on_change;
+  void* baton;
+  apr_thread_t* thread;
+  volatile apr_uint32_t stop;
+};
+
+// Returns the case-folded hash of a host name
+static uint32_t host_hash(const char* name) {
+  uint32_t hash = PAL__FNV1A_INIT;
+  for (; *name != '\0'; ++name) hash = PAL__FNV1A_STEP_CASEFOLD(hash, *name);
+  return hash;
+}
+
+// Returns 1 if the two host names are the same ignoring the (ASCII) case
+static int hosts_equal(const char* a, const char* b) {
+  for (; *a != '\0' && PAL__ASCII_TOLOWER(*a) == PAL__ASCII_TOLOWER(*b);
+       ++a, ++b) {
+  }
+  return PAL__ASCII_TOLOWER(*a) == PAL__ASCII_TOLOWER(*b);
+}
+
+static int address_compare(const void* a, const void* b) {
+  return strcmp((const char*)a, (const char*)b);
+}
+
+static int address_sets_equal(const address_set* a, const address_set* b) {
+  size_t i;
+  if (a->count != b->count) return 0;
+  for (i = 0; i < a->count; ++i) {
+    if (strcmp(a->addresses[i], b->addresses[i]) != 0) return 0;
+  }
+  return 1;
+}
+
+/*
+        Looks up the distinct numeric addresses of the host (this blocks).
+        Returns a new, sorted set (empty if the host cannot be resolved),
+        or NULL if out of memory.
+*/
+static address_set* resolve_host(const char* host) {
+  address_set* set = (address_set*)calloc(1, sizeof(address_set));
+  struct addrinfo hints, *info = NULL, *ai;
+  int rv;
+
+  if (set == NULL) return NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  rv = getaddrinfo(host, NULL, &hints, &info);
+  if (rv != 0) {
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf,
+                 "Failed to look up hostname: '%s' reason: '%s'", host,
+                 gai_strerror(rv));
+    return set;
+  }
+
+  for (ai = info; ai != NULL && set->count < kHOST_MAX_ADDRESSES;
+       ai = ai->ai_next) {
+    char* address = set->addresses[set->count];
+    size_t i;
+
+    if (getnameinfo(ai->ai_addr, (socklen_t)ai->ai_addrlen, address,
+                    kHOST_ADDRESS_SIZE, NULL, 0, NI_NUMERICHOST) != 0) {
+      continue;
+    }
+    for (i = 0; i < set->count; ++i) {
+      if (strcmp(set->addresses[i], address) == 0) break;
+    }
+    if (i == set->count) set->count++;
+  }
+  freeaddrinfo(info);
+
+  // round robin DNS shuffles the answers
+  qsort(set->addresses, set->count, kHOST_ADDRESS_SIZE, address_compare);
+  return set;
+}
+
+// The cache (all of these need the mutex)
+// ---------
+
+static cached_host* find_host(const host_resolver* r, const char* name,
+                              uint32_t hash) {
+  cached_host* h = r->buckets[hash & r->bucket_mask];
+  for (; h != NULL; h = h->next_in_bucket) {
+    if (h->hash == hash && hosts_equal(h->name, name)) return h;
+  }
+  return NULL;
+}
+
+// Doubles the buckets (keeps the old ones if out of memory)
+static void grow_buckets(host_resolver* r) {
+  const size_t bucket_count = (r->bucket_mask + 1) * 2;
+  cached_host** buckets =
+      (cached_host**)calloc(bucket_count, sizeof(cached_host*));
+  size_t b;
+
+  if (buckets == NULL) return;
+  for (b = 0; b <= r->bucket_mask; ++b) {
+    cached_host* h = r->buckets[b];
+    while (h != NULL) {
+      cached_host* next = h->next_in_bucket;
+      h->next_in_bucket = buckets[h->hash & (bucket_count - 1)];
+      buckets[h->hash & (bucket_count - 1)] = h;
+      h = next;
+    }
+  }
+  free(r->buckets);
+  r->buckets = buckets;
+  r->bucket_mask = bucket_count - 1;
+}
+
+static cached_host* add_host(host_resolver* r, const char* name,
+                             uint32_t hash) {
+  cached_host* h = (cached_host*)apr_pcalloc(r->pool, sizeof(cached_host));
+
+  h->name = apr_pstrdup(r->pool, name);
+  h->hash = hash;
+  h->next_in_bucket = r->buckets[hash & r->bucket_mask];
+  r->buckets[hash & r->bucket_mask] = h;
+  r->count++;
+  if (r->count > r->bucket_mask + 1) grow_buckets(r);
+  return h;
+}
+
+// Publishes the new addresses of a host, returns 1 if they changed
+static int publish_addresses(host_resolver* r, cached_host* h,
+                             address_set* set, apr_time_t now) {
+  address_set* old = h->addresses;
+  int changed;
+
+  h->expires_at = now + (set->count > 0 ? r->ttl : r->negative_ttl);
+  if (old != NULL && address_sets_equal(old, set)) {
+    free(set);
+    return 0;
+  }
+
+  // the builds so far saw no addresses for a name not looked up yet
+  changed = (old != NULL) || set->count > 0;
+  h->addresses = set;
+  if (old != NULL) {
+    old->next_retired = r->retired;
+    r->retired = old;
+  }
+  return changed;
+}
+
+// Frees the retired sets (all of them, with force)
+static void free_retired(host_resolver* r, int force) {
+  if (!force && apr_atomic_read32(&r->holders) != 0) return;
+  while (r->retired != NULL) {
+    address_set* next = r->retired->next_retired;
+    free(r->retired);
+    r->retired = next;
+  }
+}
+
+// The thread
+// ----------
+
+/*
+        Looks up the first name due (without holding the lock while it
+        waits for the DNS). Returns 0 if no name is due, otherwise 1, and
+        sets *changed if the addresses of the name changed.
+*/
+static int refresh_one(host_resolver* r, int* changed) {
+  const apr_time_t now = apr_time_now();
+  cached_host* due = NULL;
+  address_set* set;
+  size_t b;
+
+  apr_thread_mutex_lock(r->mutex);
+  free_retired(r, 0);
+  for (b = 0; b <= r->bucket_mask && due == NULL; ++b) {
+    cached_host* h;
+    for (h = r->buckets[b]; h != NULL && due == NULL; h = h->next_in_bucket) {
+      if (h->expires_at <= now) due = h;
+    }
+  }
+  apr_thread_mutex_unlock(r->mutex);
+  if (due == NULL) return 0;
+
+  // the names stay as long as the resolver
+  set = resolve_host(due->name);
+
+  apr_thread_mutex_lock(r->mutex);
+  if (set == NULL) {
+    due->expires_at = apr_time_now() + r->negative_ttl;
+  } else if (publish_addresses(r, due, set, apr_time_now())) {
+    *changed = 1;
+  }
+  apr_thread_mutex_unlock(r->mutex);
+  return 1;
+}
+
+static void* APR_THREAD_FUNC resolver_thread(apr_thread_t* thread,
+                                             void* data) {
+  host_resolver* r = (host_resolver*)data;
+
+  while (!apr_atomic_read32(&r->stop)) {
+    int changed = 0;
+
+    while (!apr_atomic_read32(&r->stop) && refresh_one(r, &changed)) {
+    }
+    if (changed && !apr_atomic_read32(&r->stop)) {
+      ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf,
+                   "The addresses of binding hosts changed");
+      r->on_change(r->baton);
+    }
+    apr_sleep(kWAKEUP_INTERVAL);
+  }
+
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+static apr_status_t host_resolver_cleanup(void* data) {
+  host_resolver* r = (host_resolver*)data;
+  size_t b;
+
+  if (r->thread != NULL) {
+    apr_status_t thread_status;
+    apr_atomic_set32(&r->stop, 1);
+    apr_thread_join(&thread_status, r->thread);
+    r->thread = NULL;
+  }
+
+  // the builds are over too
+  free_retired(r, 1);
+  for (b = 0; b <= r->bucket_mask; ++b) {
+    cached_host* h;
+    for (h = r->buckets[b]; h != NULL; h = h->next_in_bucket) {
+      free(h->addresses);
+    }
+  }
+  free(r->buckets);
+  r->buckets = NULL;
+  return APR_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+apr_status_t host_resolver_create(apr_pool_t* pool, apr_interval_time_t ttl,
+                                  apr_interval_time_t negative_ttl,
+                                  host_resolver** out) {
+  host_resolver* r = (host_resolver*)apr_pcalloc(pool, sizeof(host_resolver));
+  apr_status_t rv;
+
+  r->pool = pool;
+  r->ttl = ttl;
+  r->negative_ttl = negative_ttl;
+  r->buckets = (cached_host**)calloc(kMIN_HOST_BUCKETS, sizeof(cached_host*));
+  if (r->buckets == NULL) return APR_ENOMEM;
+  r->bucket_mask = kMIN_HOST_BUCKETS - 1;
+
+  rv = apr_thread_mutex_create(&r->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if (rv != APR_SUCCESS) {
+    free(r->buckets);
+    return rv;
+  }
+
+  // Stop the thread before the pool goes away
+  apr_pool_pre_cleanup_register(pool, r, host_resolver_cleanup);
+  *out = r;
+  return APR_SUCCESS;
+}
+
+apr_status_t host_resolver_start(host_resolver* r,
+                                 host_resolver_change_fn on_change,
+                                 void* baton) {
+#if APR_HAS_THREADS
+  apr_thread_t* thread = NULL;
+  apr_status_t rv;
+
+  r->on_change = on_change;
+  r->baton = baton;
+  rv = apr_thread_create(&thread, NULL, resolver_thread, r, r->pool);
+  if (rv == APR_SUCCESS) r->thread = thread;
+  return rv;
+#else
+  return APR_ENOTIMPL;
+#endif
+}
+
+void host_resolver_hold(host_resolver* r) { apr_atomic_inc32(&r->holders); }
+
+void host_resolver_release(host_resolver* r) {
+  apr_atomic_dec32(&r->holders);
+}
+
+size_t host_resolver_lookup(void* resolver, const char* host,
+                            const char** addresses, size_t max_count) {
+  host_resolver* r = (host_resolver*)resolver;
+  const uint32_t hash = host_hash(host);
+  const address_set* set;
+  cached_host* h;
+  size_t i = 0;
+
+  apr_thread_mutex_lock(r->mutex);
+  h = find_host(r, host, hash);
+  if (h == NULL) h = add_host(r, host, hash);
+
+  // Until the thread runs we look the name up here, after that the
+  // thread does (and calls on_change if it resolves)
+  if (h->addresses == NULL && r->thread == NULL) {
+    address_set* resolved = resolve_host(host);
+    if (resolved != NULL) publish_addresses(r, h, resolved, apr_time_now());
+  }
+
+  set = h->addresses;
+  for (; set != NULL && i < set->count && i < max_count; ++i) {
+    addresses[i] = set->addresses[i];
+  }
+  apr_thread_mutex_unlock(r->mutex);
+  return i;
+}
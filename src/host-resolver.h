@@ -0,0 +1,84 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+/*
+        Looks up the addresses of host names, so a binding host given by
+        name can match a balancer member given by IP (and the other way
+        around).
+
+        The addresses are cached by name: a resolved name for ttl, a name
+        that cannot be resolved for negative_ttl. Until the background
+        thread is started, a lookup of a name not in the cache blocks (that
+        is only ever the first table build, in post_config). Once it runs,
+        lookups never block: a name not in the cache has no addresses yet,
+        and the thread resolves it, refreshes the expired names, and calls
+        on_change whenever a name resolved for the first time or its
+        addresses changed, so the table gets rebuilt with them.
+
+        Only the table builds look up names, the requests see the results
+        through the routing table.
+*/
+
+enum {
+  // The most addresses kept for a host
+  kHOST_MAX_ADDRESSES = 8,
+
+  // The longest numeric address (IPv6) with its 0
+  kHOST_ADDRESS_SIZE = 46,
+};
+
+typedef struct host_resolver host_resolver;
+
+// Called from the resolver thread when the addresses of a name changed
+typedef void (*host_resolver_change_fn)(void* baton);
+
+/*
+        Creates a resolver that lives as long as the pool (the thread is
+        stopped when the pool is cleaned up).
+*/
+apr_status_t host_resolver_create(apr_pool_t* pool, apr_interval_time_t ttl,
+                                  apr_interval_time_t negative_ttl,
+                                  host_resolver** out);
+
+// Starts the background thread of the resolver
+apr_status_t host_resolver_start(host_resolver* r,
+                                 host_resolver_change_fn on_change,
+                                 void* baton);
+
+/*
+        Keeps the addresses returned by the lookups valid until
+        host_resolver_release(): wrap each table build with them.
+*/
+void host_resolver_hold(host_resolver* r);
+void host_resolver_release(host_resolver* r);
+
+/*
+        Stores the numeric addresses of the host into addresses (at most
+        max_count of them) and returns their count, 0 if the host cannot
+        be resolved (or is not resolved yet).
+
+        Has the signature of routing_host_resolver.resolve, with the
+        resolver as the baton.
+*/
+size_t host_resolver_lookup(void* resolver, const char* host,
+                            const char** addresses, size_t max_count);
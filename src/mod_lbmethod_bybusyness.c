@@ -17,15 +17,26 @@
  * */
 
 #include <mod_proxy.h>
+#include <util_cookies.h>
+#include <util_script.h>
 
 #include "palette-director-types.h"
 #include "status-pages.h"
 
+#include "binding-edits.h"
 #include "config-loader.h"
+#include "config-watcher.h"
+#include "host-resolver.h"
+#include "routing-counters.h"
+#include "routing-state.h"
+#include "routing-table.h"
+#include "site-name.h"
+#include "worker-selection.h"
 
 // FWD
 // ===
 static int status_page_http_handler(request_rec* r);
+static int binding_admin_http_handler(request_rec* r);
 
 // MODULE DEFINITIONS
 // ==================
@@ -42,178 +53,307 @@ static const char* PALETTE_DIRECTOR_MODULE_NAME = "lbmethod_bybusyness_module";
 // Worker matching
 // ===============
 
-// Returns the site name for the request (if there is one), or NULL if no site
-// available in the request
-static const char* get_site_name(const request_rec* r,
-                                 const binding_rows* setup) {
-  const char* val = NULL;
-  const char* key = NULL;
-  const char* site_name = NULL;
-  const char* data = r->args;
-
-  if (r->args == NULL) {
-    return NULL;
-  }
-
-  while (*data && (val = ap_getword(r->pool, &data, '&'))) {
-    key = ap_getword(r->pool, &val, '=');
-    ap_unescape_url((char*)key);
-    ap_unescape_url((char*)val);
-
-    // If the key is ':site', then we have a site
-    if (strcmp(key, ":site") == 0) {
-      return val;
-    }
+// Finds the site name of the request. Returns 1 and fills out if the request
+// has a ':site' parameter, 0 if not. buffer is only used for escaped names
+// (and falls back to the request pool for names that do not fit).
+static int get_site_name(request_rec* r, char* buffer, size_t buffer_size,
+                         site_name_view* out) {
+  int result = site_name_scan(r->args, buffer, buffer_size, out);
+
+  if (result == kSITE_NAME_TOO_LONG) {
+    const size_t args_size = strlen(r->args) + 1;
+    result = site_name_scan(r->args, (char*)apr_palloc(r->pool, args_size),
+                            args_size, out);
   }
 
-  // Check if we can actually match this site
-
-  // if no handler or even no name, return NULL
-  return NULL;
+  return result == kSITE_NAME_FOUND;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-// The bindings that will be loaded from the configuration file (since
-// these are written only on startup from a single thread, and after apache
-// boot we are only reading from them, these should be safe for access
-// from multiple threads)
-static binding_rows workerbinding_configuration = {0, 0};
-static binding_rows authoringbinding_configuration = {0, 0};
-static binding_rows backgrounderbinding_configuration = {0, 0};
+// The paths of the binding configs (NULL if not configured). Only the paths
+// are recorded while reading the config: the bindings are loaded at
+// post_config (so a graceful restart picks up edited files) and again by the
+// config watcher whenever one of the files changes.
+static const char* binding_config_paths[kBINDING_SET_COUNT] = {NULL, NULL,
+                                                               NULL};
+
+// How often the config watcher checks the binding configs for changes
+// (0 turns reloading off)
+enum { kDEFAULT_CONFIG_CHECK_SECONDS = 5 };
+static apr_interval_time_t binding_config_check_interval =
+    apr_time_from_sec(kDEFAULT_CONFIG_CHECK_SECONDS);
+
+// How long the addresses of the binding hosts are cached, and the failed
+// lookups
+enum {
+  kDEFAULT_HOST_LOOKUP_TTL_SECONDS = 300,
+  kDEFAULT_HOST_LOOKUP_NEGATIVE_TTL_SECONDS = 30
+};
+static apr_interval_time_t host_lookup_ttl =
+    apr_time_from_sec(kDEFAULT_HOST_LOOKUP_TTL_SECONDS);
+static apr_interval_time_t host_lookup_negative_ttl =
+    apr_time_from_sec(kDEFAULT_HOST_LOOKUP_NEGATIVE_TTL_SECONDS);
+
+// The resolver and the config watcher of the current config (in the parent,
+// NULL if not running)
+static host_resolver* binding_host_resolver = NULL;
+static config_watcher* binding_config_watcher = NULL;
+
+// The token the admin API takes (as "Authorization: Bearer <token>") from
+// the clients httpd did not authenticate (NULL for none)
+static const char* binding_admin_token = NULL;
+
+// Write the runtime binding edits back into the CSV binding configs
+static int binding_admin_persist = 0;
+
+// Take the sticky sessions off the hosts their site is forbidden on
+static int binding_sticky_check = 1;
+
+// The binding edits the parent took from the admin API (binding_edit
+// entries, they go away with pconf), and the table patched with them that
+// could not be published yet. Only used on the config watcher thread.
+static apr_array_header_t* binding_edits = NULL;
+static routing_table* unpublished_table = NULL;
+
+// The binding hosts matching no balancer member that were logged (const
+// char* entries, in pconf). The table is rebuilt on every reload, address
+// change and admin edit, a host is only logged again once it had a member.
+static apr_array_header_t* logged_unmatched_hosts = NULL;
+
+// What the requests of a site stick to within its preferred workers
+enum {
+  // Always pick the least busy preferred worker
+  kAFFINITY_OFF = 0,
+  // Hash the site onto the preferred workers
+  kAFFINITY_SITE = 1,
+  // Hash the site and the workbook of the request onto the preferred workers
+  kAFFINITY_WORKBOOK = 2,
+};
+static int binding_affinity = kAFFINITY_OFF;
+
+// The affine pick skips the workers this many times busier than the average
+#define DEFAULT_AFFINITY_LOAD_FACTOR 1.25
+static double binding_affinity_load_factor = DEFAULT_AFFINITY_LOAD_FACTOR;
+
+// How the workers of a balancer are picked, if not the default way
+typedef struct balancer_options {
+  const char* name;
+
+  // Score the workers by peak EWMA response time instead of busyness
+  int peak_ewma;
+
+  // Compare this many random workers of large lists instead of scanning
+  // them (0 to always scan)
+  size_t sample_count;
+} balancer_options;
+
+// The balancer_options set up in the config (NULL if none)
+static apr_array_header_t* balancer_option_sets = NULL;
+
+// How fast the response time averages forget (in milliseconds)
+enum { kDEFAULT_PEAK_EWMA_DECAY_MS = 10 * 1000 };
+static uint32_t peak_ewma_decay_ms = kDEFAULT_PEAK_EWMA_DECAY_MS;
+
+// Peak EWMA scoring passes over the workers at this many times the average
+// busyness (see bench/replay-sim.c)
+#define PEAK_EWMA_LOAD_FACTOR 1.5
+
+// The overflow thresholds of each binding set: a site spills over from its
+// preferred workers once all of them are spill_busy busy, until the least
+// busy is down to return_busy (spill_busy 0 turns overflowing off)
+typedef struct binding_overflow {
+  size_t spill_busy;
+  size_t return_busy;
+} binding_overflow;
+static binding_overflow binding_overflows[kBINDING_SET_COUNT] = {
+    {0, 0}, {0, 0}, {0, 0}};
+
+// The worker picked for a request, so it can be counted in flight until the
+// request is done and its response time can be folded into the peak EWMA
+// average
+typedef struct routing_pick {
+  uint32_t generation;
+  int site_idx;
+  int balancer_idx;
+  size_t worker_idx;
+  // The site and balancer, to find them in the tables published since
+  const char* site_name;
+  const proxy_balancer* balancer;
+  // The tier the worker was picked from
+  int tier;
+  apr_time_t picked_at;
+  // Picked with peak EWMA scoring
+  int peak_ewma;
+  // No longer counted in flight
+  int released;
+} routing_pick;
+
+// The server the balancers are collected from when reloading the bindings
+static server_rec* routing_main_server = NULL;
+
+// mod_proxy, looked up by name at post_config so we dont need to link
+// against it (NULL if not loaded)
+static module* proxy_module_found = NULL;
+
+enum {
+  // The shared memory slots of the routing table are this many times the
+  // size of the table loaded at startup...
+  kTABLE_GROWTH_FACTOR = 4,
+
+  // ...but at least this size
+  kMIN_TABLE_SLOT_SIZE = 256 * 1024,
+};
 
 // Load Balancer code
 // ==================
 
-static int (*ap_proxy_retry_worker_fn)(const char* proxy_function,
-                                       proxy_worker* worker,
-                                       server_rec* s) = NULL;
+static worker_retry_fn ap_proxy_retry_worker_fn = NULL;
 
 static int uri_matches(const request_rec* r, const char* pattern);
 
 /*
- * Helper function that searches tries a list of workers and returns a candidate
- * if there is one available.
+ * Helper to log the tiers of matched (prefered by priority, allowed) workers
  */
-static proxy_worker* find_best_bybusyness_from_list(
-    request_rec* r, proxy_worker_slice workers_matched) {
-  size_t i, workers_matched_count = workers_matched.count;
-  proxy_worker* mycandidate = NULL;
-  int cur_lbset = 0;
-  int max_lbset = 0;
-  int checking_standby;
-  int checked_standby;
-
-  int total_factor = 0;
-
-  /* First try to see if we have available candidate */
-  do {
-    checking_standby = checked_standby = 0;
-    while (!mycandidate && !checked_standby) {
-      proxy_worker** worker = workers_matched.entries;
-      for (i = 0; i < workers_matched_count; i++, worker++) {
-        // ORIGINAL LB_BYBUSYNESS METHOD
-        // =============================
-
-        if (!checking_standby) { /* first time through */
-          if ((*worker)->s->lbset > max_lbset) max_lbset = (*worker)->s->lbset;
-        }
-        if (((*worker)->s->lbset != cur_lbset) ||
-            (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker)
-                              : PROXY_WORKER_IS_STANDBY(*worker)) ||
-            (PROXY_WORKER_IS_DRAINING(*worker))) {
-          continue;
-        }
-
-        /* If the worker is in error state run
-        * retry on that worker. It will be marked as
-        * operational if the retry timeout is elapsed.
-        * The worker might still be unusable, but we try
-        * anyway.
-        */
-        if (!PROXY_WORKER_IS_USABLE(*worker)) {
-          ap_proxy_retry_worker_fn("BALANCER", *worker, r->server);
-        }
-
-        /* Take into calculation only the workers that are
-        * not in error state or not disabled.
-        */
-        if (PROXY_WORKER_IS_USABLE(*worker)) {
-          (*worker)->s->lbstatus += (*worker)->s->lbfactor;
-          total_factor += (*worker)->s->lbfactor;
-
-          if (!mycandidate || (*worker)->s->busy < mycandidate->s->busy ||
-              ((*worker)->s->busy == mycandidate->s->busy &&
-               (*worker)->s->lbstatus > mycandidate->s->lbstatus))
-            mycandidate = *worker;
-        }
-      }
+static void log_workers_matched(request_rec* r, proxy_worker** all_workers,
+                                const routing_tiers* tiers) {
+  int i;
+  for (i = 0; i <= kTIER_ALLOW; ++i) {
+    // log each non-empty tier
+    worker_index_slice workers = routing_tiers_slice(tiers, i);
+    size_t worker_idx, worker_count = workers.count;
+    if (worker_count == 0) continue;
 
-      checked_standby = checking_standby++;
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                 "==> Priority round [%d] has %lu handlers", i, worker_count);
+
+    for (worker_idx = 0; worker_idx < worker_count; ++worker_idx) {
+      proxy_worker* worker =
+          all_workers[WORKER_INDEX_AT(workers, worker_idx)];
+      ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                   "  --> worker '%s' in priority round [%d] entry #%lu",
+                   worker->s->hostname, i, worker_idx);
     }
+  }
+}
 
-    cur_lbset++;
+// Returns the binding set that routes the request
+static int request_binding_set(const request_rec* r) {
+  return uri_matches(r, "*/showAuthoring") ? kBINDING_SET_AUTHORING
+                                           : kBINDING_SET_WORKER;
+}
 
-  } while (cur_lbset <= max_lbset && !mycandidate);
+// Returns the options of the balancer (NULL for the defaults)
+static const balancer_options* find_balancer_options(const char* name) {
+  int i;
+  if (balancer_option_sets == NULL) return NULL;
+  for (i = 0; i < balancer_option_sets->nelts; ++i) {
+    const balancer_options* options =
+        &APR_ARRAY_IDX(balancer_option_sets, i, balancer_options);
+    if (strcasecmp(options->name, name) == 0) return options;
+  }
+  return NULL;
+}
 
-  if (mycandidate) {
-    mycandidate->s->lbstatus -= total_factor;
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                 APLOGNO(01212) "proxy: bybusyness selected worker \"%s\" : "
-                                "busy %" APR_SIZE_T_FMT " : lbstatus %d",
-                 mycandidate->s->name, mycandidate->s->busy,
-                 mycandidate->s->lbstatus);
+/*
+        Stops counting the pick in flight. The publish of a newer table
+        moves the count of the pick over to it, unless the pick is released
+        first: the pick is released on the table it was made on if that
+        still counts it, on the current table otherwise.
+*/
+static apr_status_t release_pick(void* data) {
+  routing_pick* pick = (routing_pick*)data;
+  const routing_table* table;
+  const routing_table* picked;
+  int site_idx, balancer_idx;
+
+  if (pick->released) return APR_SUCCESS;
+  pick->released = 1;
+
+  table = routing_state_acquire();
+  if (table == NULL) return APR_SUCCESS;
+  if (table->generation == pick->generation) {
+    routing_counters_request_done(routing_state_counters(table), table,
+                                  pick->site_idx, pick->balancer_idx,
+                                  pick->worker_idx, pick->tier);
+    routing_state_release(table);
+    return APR_SUCCESS;
   }
 
-  return mycandidate;
+  picked = routing_state_acquire_generation(pick->generation);
+  if (picked == NULL ||
+      !routing_counters_request_done(routing_state_counters(picked), picked,
+                                     pick->site_idx, pick->balancer_idx,
+                                     pick->worker_idx, pick->tier)) {
+    site_idx = routing_table_find_site(
+        table, pick->site_name, strlen(pick->site_name),
+        routing_site_hash(pick->site_name, strlen(pick->site_name)));
+    balancer_idx = routing_table_find_balancer(table, pick->balancer);
+    if (site_idx != kROUTING_NOT_FOUND &&
+        balancer_idx != kROUTING_NOT_FOUND) {
+      routing_counters_request_done(routing_state_counters(table), table,
+                                    site_idx, balancer_idx, pick->worker_idx,
+                                    pick->tier);
+    }
+  }
+  routing_state_release(picked);
+  routing_state_release(table);
+  return APR_SUCCESS;
 }
 
-/*
- * Helper that returns the first matching candidate worker from a list of worker
- * lists.
- */
-static proxy_worker* check_worker_sets(request_rec* r,
-                                       proxy_worker_slice* worker_lists_by_prio,
-                                       size_t worker_list_count) {
-  size_t i;
-  // check each entry in the list
-  for (i = 0; i < worker_list_count; ++i) {
-    proxy_worker_slice worker_list = worker_lists_by_prio[i];
-    proxy_worker* candidate = NULL;
-    // check if the list has any actual workers
-    if (worker_list.count == 0) continue;
-    // check the list
-    candidate = find_best_bybusyness_from_list(r, worker_list);
-    if (candidate != NULL) return candidate;
-  }
-
-  // If we get this far, no workers have matched, so we have
-  // to accept our faith.
-  return NULL;
+// Remembers the worker picked for the request and counts it in flight until
+// the request pool goes away (a failover pick replaces the earlier one)
+static void remember_pick(request_rec* r, const routing_table* table,
+                          const proxy_balancer* balancer, int site_idx,
+                          int balancer_idx,
+                          const worker_selection* selection, int peak_ewma,
+                          apr_time_t now) {
+  routing_pick* pick = (routing_pick*)ap_get_module_config(
+      r->request_config, &lbmethod_bybusyness_module);
+  if (pick == NULL) {
+    pick = (routing_pick*)apr_palloc(r->pool, sizeof(routing_pick));
+    ap_set_module_config(r->request_config, &lbmethod_bybusyness_module,
+                         pick);
+    apr_pool_cleanup_register(r->pool, pick, release_pick,
+                              apr_pool_cleanup_null);
+  } else {
+    release_pick(pick);
+  }
+  pick->generation = table->generation;
+  pick->site_idx = site_idx;
+  pick->balancer_idx = balancer_idx;
+  pick->site_name = (site_idx != kROUTING_NOT_FOUND)
+                        ? apr_pstrdup(r->pool,
+                                      routing_table_site_name(table, site_idx))
+                        : "";
+  pick->balancer = balancer;
+  pick->worker_idx = selection->worker;
+  pick->tier = selection->tier;
+  pick->picked_at = now;
+  pick->peak_ewma = peak_ewma;
+  pick->released = 0;
+
+  routing_counters_request_started(routing_state_counters(table), table,
+                                   site_idx, balancer_idx, selection->worker,
+                                   pick->tier);
 }
 
-/*
- * Helper to log the list of matched (allowed, prefered) workers
- */
-static void log_workers_matched(request_rec* r,
-                                proxy_worker_slice* workers_by_prio,
-                                size_t worker_list_count) {
-  size_t i;
-  for (i = 0; i < worker_list_count; ++i) {
-    // log each list
-    proxy_worker_slice workers = workers_by_prio[i];
-    size_t worker_idx, worker_count = workers.count;
+// Returns the affinity key of the request (0 for the plain bybusyness pick)
+static uint32_t affinity_key(const request_rec* r, int site_idx,
+                             const site_name_view* site_name) {
+  uint32_t key;
 
-    ap_log_error(APLOG_MARK, APLOG_INFO, 0, r->server,
-                 "==> Priority round [%lu] has %lu handlers", i, worker_count);
+  if (binding_affinity == kAFFINITY_OFF || site_idx == kROUTING_NOT_FOUND) {
+    return 0;
+  }
 
-    for (worker_idx = 0; worker_idx < worker_count; ++worker_idx) {
-      proxy_worker* worker = workers.entries[worker_idx];
-      ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                   "  --> worker '%s' in priority round [%lu] entry #%lu",
-                   worker->s->hostname, i, worker_idx);
-    }
+  key = site_name->hash;
+  if (binding_affinity == kAFFINITY_WORKBOOK) {
+    // Mix the workbook in so the workbooks of a site spread over its hosts
+    key = (key ^ workbook_name_hash(r->uri)) * 0x9e3779b1u;
   }
+  // 0 means no affinity
+  return (key != 0) ? key : 1;
 }
 
 /*
@@ -221,20 +361,32 @@ static void log_workers_matched(request_rec* r,
  */
 static proxy_worker* find_best_bybusyness(proxy_balancer* balancer,
                                           request_rec* r) {
-  const char* site_name = NULL;
-  // The matched workers list
-  //  proxy_worker_slice prefered_workers, allowed_workers;
-
-  // create a slice of workers
-  proxy_worker_slice workers_available = {
-      (proxy_worker**)balancer->workers->elts,
-      (size_t)balancer->workers->nelts};
-
-  // The output
-  proxy_worker* candidate = NULL;
-  // we have two priority rounds for routing (prefer and allow)
-  proxy_worker_slice workers_by_prio[2];
-  binding_rows* selected_binding_configuration = NULL;
+  char site_name_buffer[kSITE_NAME_BUFFER_SIZE];
+  site_name_view site_name;
+  int has_site_name;
+  // The published table, held until we return: a reload may publish a new
+  // one while we are working, but this one is not written over meanwhile
+  const routing_table* table;
+  proxy_worker** workers = (proxy_worker**)balancer->workers->elts;
+
+  // The candidate tiers for the request (a priority round for each binding
+  // priority, then the allowed workers), and their ends for balancers
+  // without routes
+  routing_tiers tiers;
+  uint16_t all_allowed_ends[kTIER_FORBID];
+  selection_context ctx;
+  worker_health health;
+  latency_scoring scoring;
+  quota_scope quota;
+  overflow_scope overflow;
+  const balancer_options* options = find_balancer_options(balancer->s->name);
+  worker_selection selection;
+  proxy_worker* candidate;
+  routing_latency* latency = routing_state_latency();
+  const apr_time_t started_at = (latency != NULL) ? apr_time_now() : 0;
+  int binding_set = kBINDING_SET_WORKER;
+  int site_idx = kROUTING_NOT_FOUND;
+  int balancer_idx = kROUTING_NOT_FOUND;
 
   // Check if we can actually handle this request
   if (!ap_proxy_retry_worker_fn) {
@@ -244,6 +396,7 @@ static proxy_worker* find_best_bybusyness(proxy_balancer* balancer,
       return NULL;
     }
   }
+  table = routing_state_acquire();
 
   ap_log_error(
       APLOG_MARK, APLOG_DEBUG, 0, r->server,
@@ -251,45 +404,134 @@ static proxy_worker* find_best_bybusyness(proxy_balancer* balancer,
       balancer->s->name);
 
   // get the site name
-  site_name = get_site_name(r, &workerbinding_configuration);
-  if (site_name == NULL) {
+  has_site_name =
+      get_site_name(r, site_name_buffer, sizeof(site_name_buffer), &site_name);
+  if (!has_site_name) {
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, r->server,
                  "Cannot find site name for uri: '%s'  -- with args '%s' ",
                  r->unparsed_uri, r->args);
 
   } else {
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                 "Got site name  '%s' for uri '%s' and args '%s'", site_name,
-                 r->unparsed_uri, r->args);
+                 "Got site name  '%.*s' for uri '%s' and args '%s'",
+                 (int)site_name.length, site_name.name, r->unparsed_uri,
+                 r->args);
   }
 
   // find out the kind of binding we care about
-  if (uri_matches(r, "*/showAuthoring")) {
+  binding_set = request_binding_set(r);
+  ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+               "Selected mode: %s for uri '%s'",
+               (binding_set == kBINDING_SET_AUTHORING) ? "AUTHORING" : "WORKER",
+               r->uri);
+
+  //////////////////////////////////////////////////////////////
+
+  // Look up the candidate tiers in the routing table. The tiers point into
+  // the table itself, so picking a worker does not allocate anything.
+  if (table != NULL) {
+    balancer_idx = routing_table_find_balancer(table, balancer);
+  }
+
+  if (balancer_idx == kROUTING_NOT_FOUND) {
+    // Without routes for the balancer every worker is allowed (the reason
+    // was logged when the table was built). A balancer too large for the
+    // table is limited to the workers the candidate indices reach.
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                 "Selected mode: AUTHORING for uri '%s'", r->uri);
-    selected_binding_configuration = &authoringbinding_configuration;
+                 "No routes compiled for BALANCER (%s), allowing all workers",
+                 balancer->s->name);
+    memset(all_allowed_ends, 0, sizeof(all_allowed_ends));
+    all_allowed_ends[kTIER_ALLOW] =
+        (balancer->workers->nelts > kROUTING_MAX_MEMBERS)
+            ? kROUTING_MAX_MEMBERS
+            : (uint16_t)balancer->workers->nelts;
+    tiers.candidates.entries = NULL;
+    tiers.candidates.count = all_allowed_ends[kTIER_ALLOW];
+    tiers.ends = all_allowed_ends;
+    tiers.tier_mask = 1u << kTIER_ALLOW;
   } else {
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                 "Selected mode: WORKER for uri '%s'", r->uri);
-    selected_binding_configuration = &workerbinding_configuration;
+    if (has_site_name) {
+      site_idx = routing_table_find_site(table, site_name.name,
+                                         site_name.length, site_name.hash);
+      if (site_idx == kROUTING_NOT_FOUND) {
+        routing_counters_unknown_site(routing_state_counters(table), table,
+                                      balancer_idx);
+      }
+    } else {
+      routing_counters_no_site(routing_state_counters(table), table,
+                               balancer_idx);
+    }
+    tiers = routing_table_tiers(table, binding_set, site_idx, balancer_idx);
   }
 
-  //////////////////////////////////////////////////////////////
-
-  // Filter the workers list down
-  workers_by_prio[0] =
-      get_handling_workers_for(*selected_binding_configuration,
-                               workers_available, site_name, kBINDING_PREFER);
-  workers_by_prio[1] =
-      get_handling_workers_for(*selected_binding_configuration,
-                               workers_available, site_name, kBINDING_ALLOW);
+  ctx.r = r;
+  ctx.workers = workers;
+  ctx.retry_fn = ap_proxy_retry_worker_fn;
+  ctx.health = NULL;
+  if (balancer_idx != kROUTING_NOT_FOUND) {
+    health.table = table;
+    health.counters = routing_state_counters(table);
+    health.balancer_idx = balancer_idx;
+    health.now_ms = (uint32_t)apr_time_as_msec(apr_time_now());
+    ctx.health = &health;
+  }
+  ctx.affinity_key = affinity_key(r, site_idx, &site_name);
+  ctx.load_factor = binding_affinity_load_factor;
+  ctx.latency = NULL;
+  ctx.sample_count = (options != NULL) ? options->sample_count : 0;
+  if (balancer_idx != kROUTING_NOT_FOUND && options != NULL &&
+      options->peak_ewma) {
+    scoring.table = table;
+    scoring.counters = routing_state_counters(table);
+    scoring.balancer_idx = balancer_idx;
+    scoring.now_ms = (uint32_t)apr_time_as_msec(apr_time_now());
+    scoring.decay_ms = peak_ewma_decay_ms;
+    scoring.load_factor = PEAK_EWMA_LOAD_FACTOR;
+    ctx.latency = &scoring;
+  }
+  ctx.quota = NULL;
+  if (balancer_idx != kROUTING_NOT_FOUND &&
+      routing_table_site_has_limits(table, site_idx)) {
+    quota.table = table;
+    quota.counters = routing_state_counters(table);
+    quota.site_idx = site_idx;
+    quota.balancer_idx = balancer_idx;
+    ctx.quota = &quota;
+  }
+  ctx.overflow = NULL;
+  if (balancer_idx != kROUTING_NOT_FOUND && site_idx != kROUTING_NOT_FOUND &&
+      binding_overflows[binding_set].spill_busy > 0) {
+    overflow.table = table;
+    overflow.counters = routing_state_counters(table);
+    overflow.site_idx = site_idx;
+    overflow.balancer_idx = balancer_idx;
+    overflow.spill_busy = binding_overflows[binding_set].spill_busy;
+    overflow.return_busy = binding_overflows[binding_set].return_busy;
+    ctx.overflow = &overflow;
+  }
 
-  log_workers_matched(r, workers_by_prio, 2);
-  candidate = check_worker_sets(r, workers_by_prio, 2);
+  log_workers_matched(r, workers, &tiers);
+  candidate = check_worker_sets(&ctx, &tiers, &selection);
+
+  // Count the decision (the tiers are in tier order)
+  if (balancer_idx != kROUTING_NOT_FOUND) {
+    uint32_t* counters = routing_state_counters(table);
+    if (candidate != NULL) {
+      routing_counters_hit(counters, table, site_idx, balancer_idx,
+                           selection.worker, selection.tier);
+      if (ctx.latency != NULL || site_idx != kROUTING_NOT_FOUND) {
+        remember_pick(r, table, balancer, site_idx, balancer_idx,
+                      &selection, ctx.latency != NULL, apr_time_now());
+      }
+    } else {
+      routing_counters_no_candidate(counters, table, site_idx, balancer_idx);
+    }
+  }
 
-  // Free the allocated data
-  free_proxy_worker_slice(&workers_by_prio[0]);
-  free_proxy_worker_slice(&workers_by_prio[1]);
+  routing_state_release(table);
+  if (latency != NULL) {
+    routing_latency_record(latency, (uint64_t)(apr_time_now() - started_at));
+  }
   return candidate;
 }
 
@@ -314,14 +556,754 @@ static apr_status_t age(proxy_balancer* balancer, server_rec* s) {
 static const proxy_balancer_method bybusyness = {
     "bybusyness", &find_best_bybusyness, NULL, &reset, &age};
 
+// ROUTING TABLE
+// =============
+
+// Returns 1 if the balancer is already in the list of balancers
+static int has_balancer(const apr_array_header_t* balancers,
+                        const proxy_balancer* balancer) {
+  int i;
+  for (i = 0; i < balancers->nelts; ++i) {
+    const proxy_balancer* b = APR_ARRAY_IDX(balancers, i, proxy_balancer*);
+    if (b->hash.def == balancer->hash.def &&
+        b->hash.fnv == balancer->hash.fnv) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+        Collects the balancers of every (virtual) server. Virtual hosts share
+        the balancers of the main server, so each balancer is only added once.
+*/
+static apr_array_header_t* collect_balancers(server_rec* s,
+                                             apr_pool_t* pool) {
+  apr_array_header_t* balancers =
+      apr_array_make(pool, 8, sizeof(proxy_balancer*));
+
+  for (; proxy_module_found != NULL && s != NULL; s = s->next) {
+    proxy_server_conf* conf = (proxy_server_conf*)ap_get_module_config(
+        s->module_config, proxy_module_found);
+    int i;
+    if (conf == NULL || conf->balancers == NULL) continue;
+
+    for (i = 0; i < conf->balancers->nelts; ++i) {
+      proxy_balancer* balancer = &APR_ARRAY_IDX(conf->balancers, i,
+                                                proxy_balancer);
+      if (!has_balancer(balancers, balancer)) {
+        APR_ARRAY_PUSH(balancers, proxy_balancer*) = balancer;
+      }
+    }
+  }
+  return balancers;
+}
+
+// The names of the binding sets for logging
+static const char* const binding_set_names[kBINDING_SET_COUNT] = {
+    "worker bindings", "authoring bindings", "backgrounder bindings"};
+
+// The names of the binding sets in the directives and the admin API
+static const char* const binding_set_keys[kBINDING_SET_COUNT] = {
+    "Worker", "Authoring", "Backgrounder"};
+
+// Returns the position of a host in logged_unmatched_hosts, or -1
+static int find_logged_unmatched_host(const char* name) {
+  const char** names = (const char**)logged_unmatched_hosts->elts;
+  int i;
+  for (i = 0; i < logged_unmatched_hosts->nelts; ++i) {
+    if (strcasecmp(names[i], name) == 0) return i;
+  }
+  return -1;
+}
+
+/*
+        Logs the binding hosts of a new table that match no member of any
+        balancer (their bindings have no effect), unless they were logged
+        for an earlier table of the config. Only called in the parent.
+*/
+static void log_unmatched_hosts(const routing_table* table,
+                                apr_pool_t* ptemp) {
+  const int32_t* member_hosts =
+      ROUTING_TABLE_AT(table, int32_t, table->member_hosts_offset);
+  char* matched = (char*)apr_pcalloc(ptemp, table->host_count + 1);
+  const char** names;
+  uint32_t m, h;
+  int logged;
+
+  for (m = 0; m < table->member_count; ++m) {
+    if (member_hosts[m] >= 0) matched[member_hosts[m]] = 1;
+  }
+
+  for (h = 0; h < table->host_count; ++h) {
+    const char* name = routing_table_host_name(table, (int)h);
+
+    logged = (logged_unmatched_hosts != NULL)
+                 ? find_logged_unmatched_host(name)
+                 : -1;
+    if (matched[h]) {
+      // log it again should it lose its members
+      if (logged >= 0) {
+        names = (const char**)logged_unmatched_hosts->elts;
+        names[logged] = names[--logged_unmatched_hosts->nelts];
+      }
+      continue;
+    }
+    if (logged >= 0) continue;
+
+    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, ap_server_conf,
+                 "Binding host '%s' is not a member of any balancer, its "
+                 "bindings have no effect",
+                 name);
+    if (logged_unmatched_hosts != NULL) {
+      APR_ARRAY_PUSH(logged_unmatched_hosts, const char*) =
+          apr_pstrdup(logged_unmatched_hosts->pool, name);
+    }
+  }
+}
+
+/*
+        Loads the binding configs (with the runtime binding edits applied)
+        and compiles them with the balancers of every (virtual) server into
+        a new routing table. The binding hosts are matched to the balancer
+        members here, by name or by address, so the requests only look up
+        indices.
+
+        The returned table must be freed with routing_table_free().
+*/
+static routing_table* load_routing_table(server_rec* s, apr_pool_t* ptemp) {
+  apr_array_header_t* balancers = collect_balancers(s, ptemp);
+  binding_config configs[kBINDING_SET_COUNT];
+  binding_rows binding_sets[kBINDING_SET_COUNT];
+  routing_host_resolver resolver = {host_resolver_lookup, NULL};
+  routing_table* table = NULL;
+  size_t i;
+
+  for (i = 0; i < kBINDING_SET_COUNT; ++i) {
+    memset(&configs[i], 0, sizeof(configs[i]));
+    if (binding_config_paths[i] != NULL) {
+      configs[i] = load_binding_config(ptemp, binding_config_paths[i]);
+      ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,
+                   "Loaded %lu %s from %s '%s'", configs[i].rows.count,
+                   binding_set_names[i],
+                   configs[i].mapping != NULL ? "compiled config" : "CSV",
+                   binding_config_paths[i]);
+    }
+    binding_sets[i] = configs[i].rows;
+    if (binding_edits != NULL) {
+      binding_sets[i] =
+          binding_edits_apply(binding_edits, (int)i, binding_sets[i], ptemp);
+    }
+  }
+
+  // match the members given by IP to the hosts given by name (and the other
+  // way around) with the cached addresses
+  resolver.baton = binding_host_resolver;
+  if (binding_host_resolver != NULL) host_resolver_hold(binding_host_resolver);
+  table = routing_table_build(binding_sets,
+                              (proxy_balancer* const*)balancers->elts,
+                              (size_t)balancers->nelts,
+                              binding_host_resolver != NULL ? &resolver : NULL);
+  if (binding_host_resolver != NULL) {
+    host_resolver_release(binding_host_resolver);
+  }
+  if (table == NULL) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "Failed to build the routing table");
+  } else {
+    log_unmatched_hosts(table, ptemp);
+  }
+
+  // everything the request threads need is in the table, the rows go away
+  // with ptemp
+  for (i = 0; i < kBINDING_SET_COUNT; ++i) {
+    unload_binding_config(&configs[i]);
+  }
+  return table;
+}
+
+// Publishes the table to the children and logs the outcome
+static apr_status_t publish_routing_table(const routing_table* table) {
+  apr_uint32_t generation = 0;
+  const apr_status_t rv = routing_state_publish(table, &generation);
+
+  if (rv == APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,
+                 "Published routing table #%u: %u sites, %u hosts, %u "
+                 "balancers with %u members (%u bytes)",
+                 generation, table->site_count, table->host_count,
+                 table->balancer_count, table->member_count, table->size);
+  } else if (rv == APR_ENOSPC) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "The routing table (%" APR_SIZE_T_FMT " bytes with the "
+                 "counters) does not fit into the shared memory, restart "
+                 "httpd to load the new bindings",
+                 routing_state_slot_size(table));
+  } else if (!APR_STATUS_IS_EAGAIN(rv)) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                 "Cannot publish the routing table");
+  }
+  return rv;
+}
+
+// Forget the settings of the previous config (a directive may be gone after
+// a graceful restart)
+static int reset_binding_config(apr_pool_t* pconf, apr_pool_t* plog,
+                                apr_pool_t* ptemp) {
+  size_t i;
+  for (i = 0; i < kBINDING_SET_COUNT; ++i) binding_config_paths[i] = NULL;
+  binding_config_check_interval =
+      apr_time_from_sec(kDEFAULT_CONFIG_CHECK_SECONDS);
+  host_lookup_ttl = apr_time_from_sec(kDEFAULT_HOST_LOOKUP_TTL_SECONDS);
+  host_lookup_negative_ttl =
+      apr_time_from_sec(kDEFAULT_HOST_LOOKUP_NEGATIVE_TTL_SECONDS);
+  // both went away with the previous pconf
+  binding_host_resolver = NULL;
+  binding_config_watcher = NULL;
+  // so did the runtime edits (and the watcher thread using them)
+  binding_admin_token = NULL;
+  binding_admin_persist = 0;
+  binding_sticky_check = 1;
+  binding_edits = NULL;
+  logged_unmatched_hosts = NULL;
+  routing_table_free(unpublished_table);
+  unpublished_table = NULL;
+  binding_affinity = kAFFINITY_OFF;
+  binding_affinity_load_factor = DEFAULT_AFFINITY_LOAD_FACTOR;
+  balancer_option_sets = NULL;
+  peak_ewma_decay_ms = kDEFAULT_PEAK_EWMA_DECAY_MS;
+  for (i = 0; i < kBINDING_SET_COUNT; ++i) {
+    binding_overflows[i].spill_busy = 0;
+    binding_overflows[i].return_busy = 0;
+  }
+  return OK;
+}
+
+// Called from the config watcher thread when a binding config (or the
+// address of a binding host) changed
+static apr_status_t on_binding_config_change(void* baton, apr_pool_t* ptemp) {
+  routing_table* table;
+  apr_status_t rv;
+
+  ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,
+               "Binding configs changed, reloading");
+
+  // Compile the table off the request path, the request threads keep
+  // using the current one until the new one is published. It has the
+  // runtime edits too, so a table patched with them is not needed any more.
+  routing_table_free(unpublished_table);
+  unpublished_table = NULL;
+  table = load_routing_table(routing_main_server, ptemp);
+  if (table == NULL) return APR_ENOMEM;
+
+  rv = publish_routing_table(table);
+  if (APR_STATUS_IS_EAGAIN(rv)) {
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf,
+                 "The previous routing table is still in use, retrying");
+  }
+  routing_table_free(table);
+  return rv;
+}
+
+// Runtime binding edits
+// =====================
+
+// The most binding edits applied at once
+enum { kMAX_EDITS_PER_POLL = 32 };
+
+// Returns the name of a binding kind for logging
+static const char* binding_kind_name(apr_pool_t* pool, binding_kind_t kind) {
+  if (kind == kROUTING_UNBOUND) return "removed";
+  if (kind == kBINDING_DRAIN) return "drained";
+  if (kind == kBINDING_UNDRAIN) return "undrained";
+  if (kind == kBINDING_PREFER) return "prefer";
+  if (kind == kBINDING_FORBID) return "forbid";
+  if (kind == kBINDING_ALLOW) return "allow";
+  return apr_psprintf(pool, "priority %d", kind);
+}
+
+/*
+        Patches an edit into the unpublished table (a copy of the published
+        table for the first edit). Returns 0 if the table has to be rebuilt
+        instead: the edit adds a site or a host to the table, removes a
+        row that may have carried a limit, or changes the drains (a list of
+        the table).
+*/
+static int patch_unpublished_table(const binding_edit* edit) {
+  const size_t site_length = strlen(edit->site_name);
+  int site_idx, host_idx;
+
+  if (edit->binding_kind == kBINDING_DRAIN ||
+      edit->binding_kind == kBINDING_UNDRAIN) {
+    return 0;
+  }
+  if (unpublished_table == NULL) {
+    const routing_table* current = routing_state_current();
+    if (current == NULL) return 0;
+    unpublished_table = (routing_table*)malloc(current->size);
+    if (unpublished_table == NULL) return 0;
+    memcpy(unpublished_table, current, current->size);
+  }
+
+  site_idx =
+      routing_table_find_site(unpublished_table, edit->site_name, site_length,
+                              routing_site_hash(edit->site_name, site_length));
+  host_idx = routing_table_find_host(unpublished_table, edit->worker_host);
+  if (site_idx == kROUTING_NOT_FOUND || host_idx == kROUTING_NOT_FOUND) {
+    return 0;
+  }
+  if (edit->binding_kind == kROUTING_UNBOUND &&
+      routing_table_site_has_limits(unpublished_table, site_idx)) {
+    return 0;
+  }
+
+  routing_table_set_binding(unpublished_table, edit->binding_set, site_idx,
+                            host_idx, edit->binding_kind);
+  return 1;
+}
+
+// Writes the runtime edits of the binding sets the edits changed into
+// their CSV configs (the drains are not written)
+static void persist_binding_edits(const binding_edit* edits, size_t count,
+                                  apr_pool_t* ptemp) {
+  int changed[kBINDING_SET_COUNT] = {0};
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (edits[i].binding_kind == kBINDING_DRAIN ||
+        edits[i].binding_kind == kBINDING_UNDRAIN) {
+      continue;
+    }
+    changed[edits[i].binding_set] = 1;
+  }
+
+  for (i = 0; i < kBINDING_SET_COUNT; ++i) {
+    const char* path = binding_config_paths[i];
+    binding_config config;
+    binding_rows rows;
+    apr_finfo_t finfo;
+
+    if (!changed[i]) continue;
+    if (path == NULL) {
+      ap_log_error(APLOG_MARK, APLOG_WARNING, 0, ap_server_conf,
+                   "No config file for the %s, the runtime changes are "
+                   "lost on restart",
+                   binding_set_names[i]);
+      continue;
+    }
+
+    config = load_binding_config(ptemp, path);
+    if (config.mapping != NULL) {
+      ap_log_error(APLOG_MARK, APLOG_WARNING, 0, ap_server_conf,
+                   "'%s' is a compiled config, the runtime changes of the "
+                   "%s are lost on restart",
+                   path, binding_set_names[i]);
+      unload_binding_config(&config);
+      continue;
+    }
+    // never replace a config we could not read with the edits alone
+    if (config.rows.count == 0 &&
+        apr_stat(&finfo, path, APR_FINFO_SIZE, ptemp) == APR_SUCCESS &&
+        finfo.size > 0) {
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                   "Cannot read '%s', the runtime changes of the %s are not "
+                   "written into it",
+                   path, binding_set_names[i]);
+      continue;
+    }
+
+    rows = binding_edits_apply(binding_edits, (int)i, config.rows, ptemp);
+    if (write_csv_config(path, &rows)) {
+      ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,
+                   "Wrote %lu %s with the runtime changes into '%s'",
+                   (unsigned long)rows.count, binding_set_names[i], path);
+    }
+  }
+}
+
+/*
+        Applies the binding edits posted by the admin API. Called on the
+        config watcher thread, so the edits and the reloads never race.
+
+        The edits of the sites and hosts the table knows patch a copy of the
+        published table in place, any other edit rebuilds the table. Either
+        way the new table is published with a new generation, and the edits
+        are kept for the later reloads.
+*/
+static void apply_binding_edits(void* baton, apr_pool_t* ptemp) {
+  binding_edit edits[kMAX_EDITS_PER_POLL];
+  const size_t count = routing_state_take_edits(edits, kMAX_EDITS_PER_POLL);
+  int rebuild = 0;
+  apr_status_t rv;
+  size_t i;
+
+  // nothing new, and nothing left to publish
+  if (count == 0 && unpublished_table == NULL) return;
+
+  for (i = 0; i < count; ++i) {
+    binding_edits_add(binding_edits, &edits[i]);
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,
+                 "Runtime change of the %s: site '%s' on '%s' %s",
+                 binding_set_names[edits[i].binding_set], edits[i].site_name,
+                 edits[i].worker_host,
+                 binding_kind_name(ptemp, edits[i].binding_kind));
+    if (!rebuild) rebuild = !patch_unpublished_table(&edits[i]);
+  }
+
+  if (rebuild) {
+    routing_table_free(unpublished_table);
+    unpublished_table = load_routing_table(routing_main_server, ptemp);
+  }
+
+  // while the previous table is still in use, keep the patched one and
+  // try again on the next wakeup
+  if (unpublished_table != NULL) {
+    rv = publish_routing_table(unpublished_table);
+    if (!APR_STATUS_IS_EAGAIN(rv)) {
+      routing_table_free(unpublished_table);
+      unpublished_table = NULL;
+    }
+  }
+
+  if (count > 0 && binding_admin_persist) {
+    persist_binding_edits(edits, count, ptemp);
+  }
+}
+
+// Starts watching the binding configs. The watcher runs in the parent, so
+// there is a single writer for all the children.
+static void start_config_watcher(apr_pool_t* pconf, server_rec* s) {
+  const char* paths[kBINDING_SET_COUNT];
+  size_t i, path_count = 0;
+  apr_status_t rv;
+
+  for (i = 0; i < kBINDING_SET_COUNT; ++i) {
+    if (binding_config_paths[i] != NULL) {
+      paths[path_count++] = binding_config_paths[i];
+    }
+  }
+  // the admin API needs the thread even without reloads
+  if (binding_config_check_interval <= 0) path_count = 0;
+  if (path_count == 0 && binding_edits == NULL) return;
+
+  rv = config_watcher_start(pconf, paths, path_count,
+                            binding_config_check_interval,
+                            on_binding_config_change, NULL,
+                            &binding_config_watcher);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "Cannot watch the binding configs, changes will only be "
+                 "picked up on restart");
+    return;
+  }
+  if (binding_edits != NULL) {
+    config_watcher_set_poll(binding_config_watcher, apply_binding_edits,
+                            NULL);
+  }
+}
+
+// Called from the resolver thread: rebuild the table on the watcher thread
+static void on_binding_host_change(void* baton) {
+  if (binding_config_watcher != NULL) {
+    config_watcher_request_reload(binding_config_watcher);
+  }
+}
+
+/*
+        Keeps the addresses of the binding hosts up to date once the table
+        is built. Only while the configs are reloaded: without reloads
+        nothing could pick up the new addresses.
+*/
+static void start_host_resolver(server_rec* s) {
+  apr_status_t rv;
+
+  if (binding_host_resolver == NULL || binding_config_watcher == NULL ||
+      binding_config_check_interval <= 0) {
+    return;
+  }
+  rv = host_resolver_start(binding_host_resolver, on_binding_host_change,
+                           NULL);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "Cannot start the binding host resolver, address changes "
+                 "will only be picked up on restart");
+  }
+}
+
+/*
+        Loads the bindings and publishes the routing table into a new shared
+        memory segment once the configuration is complete.
+*/
+static int build_routing_table(apr_pool_t* pconf, apr_pool_t* plog,
+                               apr_pool_t* ptemp, server_rec* s) {
+  routing_table* table;
+  apr_size_t slot_size;
+  apr_status_t rv;
+
+  // The first build looks the host names up itself (and may block)
+  rv = host_resolver_create(pconf, host_lookup_ttl, host_lookup_negative_ttl,
+                            &binding_host_resolver);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "Cannot create the binding host resolver, matching the "
+                 "hosts by name only");
+    binding_host_resolver = NULL;
+  }
+
+  // look up mod_proxy by name so we dont need to link against it
+  proxy_module_found = ap_find_linked_module("mod_proxy.c");
+
+  // the runtime edits start over with the config
+  binding_edits = apr_array_make(pconf, 8, sizeof(binding_edit));
+  logged_unmatched_hosts = apr_array_make(pconf, 8, sizeof(const char*));
+
+  table = load_routing_table(s, ptemp);
+  routing_main_server = s;
+  if (table == NULL) return OK;
+
+  // Leave room for the bindings to grow without a restart
+  slot_size = routing_state_slot_size(table) * kTABLE_GROWTH_FACTOR;
+  if (slot_size < kMIN_TABLE_SLOT_SIZE) slot_size = kMIN_TABLE_SLOT_SIZE;
+
+  rv = routing_state_create(pconf, slot_size);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "Cannot create %" APR_SIZE_T_FMT
+                 " bytes of shared memory for the routing table",
+                 slot_size);
+    routing_table_free(table);
+    return OK;
+  }
+
+  publish_routing_table(table);
+  routing_table_free(table);
+
+  // The first pass only checks the config, nothing to watch yet
+  if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG) {
+    start_config_watcher(pconf, s);
+    start_host_resolver(s);
+  }
+  return OK;
+}
+
+/*
+        Folds the response time of a request routed with peak EWMA scoring
+        into the average of its worker. Picks made with an earlier routing
+        table are dropped: the member indices may have changed since.
+*/
+static int observe_response_time(request_rec* r) {
+  const routing_pick* pick = NULL;
+  const routing_table* table;
+  const request_rec* rr;
+  apr_time_t now, elapsed;
+
+  // An internal redirect logs the last request of the chain
+  for (rr = r; rr != NULL && pick == NULL; rr = rr->prev) {
+    pick = (const routing_pick*)ap_get_module_config(
+        rr->request_config, &lbmethod_bybusyness_module);
+  }
+  if (pick == NULL || !pick->peak_ewma) return DECLINED;
+
+  table = routing_state_acquire();
+  if (table != NULL && table->generation == pick->generation) {
+    now = apr_time_now();
+    elapsed = now - pick->picked_at;
+    if (elapsed < 0) elapsed = 0;
+    if (elapsed > (apr_time_t)UINT32_MAX) elapsed = (apr_time_t)UINT32_MAX;
+
+    routing_counters_observe(routing_state_counters(table), table,
+                             pick->balancer_idx, pick->worker_idx,
+                             (uint32_t)elapsed,
+                             (uint32_t)apr_time_as_msec(now),
+                             peak_ewma_decay_ms);
+  }
+  routing_state_release(table);
+  return DECLINED;
+}
+
+// Sticky sessions
+// ===============
+
+// Returns the balancer a proxied request goes to (NULL if none)
+static proxy_balancer* request_balancer(request_rec* r) {
+  proxy_server_conf* conf;
+
+  if (proxy_module_found == NULL || r->filename == NULL ||
+      strncmp(r->filename, "proxy:", 6) != 0) {
+    return NULL;
+  }
+  conf = (proxy_server_conf*)ap_get_module_config(r->server->module_config,
+                                                  proxy_module_found);
+  if (conf == NULL || conf->balancers == NULL) return NULL;
+  return routing_url_balancer(conf->balancers, r->filename + 6);
+}
+
+// Returns the value of a query argument of the request (NULL if missing)
+static const char* query_argument(request_rec* r, const char* name) {
+  const size_t length = strlen(name);
+  const char* arg = r->args;
+
+  while (arg != NULL && *arg != '\0') {
+    const char* end = arg + strcspn(arg, "&;");
+    if ((size_t)(end - arg) > length && strncmp(arg, name, length) == 0 &&
+        arg[length] == '=') {
+      return apr_pstrmemdup(r->pool, arg + length + 1,
+                            (apr_size_t)(end - arg) - length - 1);
+    }
+    arg = (*end != '\0') ? end + 1 : end;
+  }
+  return NULL;
+}
+
+/*
+        Returns the route of the sticky session of the request, or NULL.
+        Like mod_proxy_balancer, the session is read from the stickysession
+        cookie (or query argument), and the route is what follows the first
+        dot. Sets from_cookie if the session is a cookie.
+*/
+static const char* sticky_route(request_rec* r, const proxy_balancer* balancer,
+                                int* from_cookie) {
+  const char* name = balancer->s->sticky;
+  const char* value = NULL;
+  const char* route;
+
+  *from_cookie = 0;
+  if (name[0] == '\0') return NULL;
+  if (ap_cookie_read(r, name, &value, 0) == APR_SUCCESS && value != NULL) {
+    *from_cookie = 1;
+  } else {
+    value = query_argument(r, name);
+  }
+  if (value == NULL) return NULL;
+  route = strchr(value, '.');
+  return (route != NULL && route[1] != '\0') ? route + 1 : NULL;
+}
+
+// Stops counting a request in flight on a drained pair
+static apr_status_t end_drained_request(void* data) {
+  routing_state_drain_done((const routing_drain_ticket*)data);
+  return APR_SUCCESS;
+}
+
+/*
+        Checks the sticky sessions against the bindings. mod_proxy_balancer
+        sends a request with a session to the member of its route without
+        asking us, so the member is looked up here the same way (through
+        the route index of the table, a hash lookup):
+
+        - a session stuck to a host its site is forbidden on is taken off
+          it: its cookie is dropped from the request, so the balancer picks
+          a worker through the normal selection and sets a new route.
+
+        - a session on a drained pair goes on (that is what a drain is
+          for), and is counted in flight, so the status pages show when the
+          drain is done.
+
+        Without the check and without drains this is a single read of the
+        table.
+*/
+static int check_sticky_session_with(request_rec* r,
+                                     const routing_table* table) {
+  char site_name_buffer[kSITE_NAME_BUFFER_SIZE];
+  site_name_view site_name;
+  proxy_balancer* balancer;
+  proxy_worker* worker;
+  routing_drain_ticket* ticket;
+  const char* route;
+  const char* value;
+  int from_cookie, worker_idx, balancer_idx, site_idx, host_idx, drain_idx;
+  int binding_set;
+
+  if (table == NULL || r->main != NULL ||
+      (!binding_sticky_check && table->drain_count == 0)) {
+    return DECLINED;
+  }
+  balancer = request_balancer(r);
+  if (balancer == NULL) return DECLINED;
+  balancer_idx = routing_table_find_balancer(table, balancer);
+  if (balancer_idx == kROUTING_NOT_FOUND) return DECLINED;
+  route = sticky_route(r, balancer, &from_cookie);
+  if (route == NULL) return DECLINED;
+
+  // the member the balancer sends the session to: an unusable one makes it
+  // pick another (never a forbidden or drained one), and a route changed
+  // since the table was built is left alone
+  worker_idx = routing_table_find_route(table, balancer_idx, route);
+  if (worker_idx == kROUTING_NOT_FOUND) return DECLINED;
+  worker = ((proxy_worker**)balancer->workers->elts)[worker_idx];
+  if (strcmp(worker->s->route, route) != 0 ||
+      !PROXY_WORKER_IS_USABLE(worker)) {
+    return DECLINED;
+  }
+
+  if (!get_site_name(r, site_name_buffer, sizeof(site_name_buffer),
+                     &site_name)) {
+    return DECLINED;
+  }
+  site_idx = routing_table_find_site(table, site_name.name, site_name.length,
+                                     site_name.hash);
+  if (site_idx == kROUTING_NOT_FOUND) return DECLINED;
+  binding_set = request_binding_set(r);
+  host_idx = routing_table_member_host(table, balancer_idx, (size_t)worker_idx);
+
+  if (binding_sticky_check &&
+      routing_table_kind(table, binding_set, site_idx, host_idx) ==
+          kBINDING_FORBID) {
+    // a session in the query cannot be taken off the request
+    if (!from_cookie) return DECLINED;
+    ap_cookie_read(r, balancer->s->sticky, &value, 1);
+    ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                  "Rerouting a session of site '%s' stuck to '%s', where "
+                  "the site is forbidden",
+                  routing_table_site_name(table, site_idx),
+                  worker->s->hostname);
+    return DECLINED;
+  }
+
+  if (!routing_table_is_drained(table, binding_set, site_idx, host_idx)) {
+    return DECLINED;
+  }
+  drain_idx = routing_table_find_drain(table, binding_set, site_idx, host_idx);
+  if (drain_idx == kROUTING_NOT_FOUND) return DECLINED;
+
+  ticket = (routing_drain_ticket*)apr_palloc(r->pool, sizeof(*ticket));
+  *ticket =
+      routing_state_drain_started(&routing_table_drains(table)[drain_idx]);
+  apr_pool_cleanup_register(r->pool, ticket, end_drained_request,
+                            apr_pool_cleanup_null);
+  return DECLINED;
+}
+
+static int check_sticky_session(request_rec* r) {
+  const routing_table* table = routing_state_acquire();
+  const int status = check_sticky_session_with(r, table);
+  routing_state_release(table);
+  return status;
+}
+
+static void init_status_pages(apr_pool_t* pchild, server_rec* s) {
+  status_pages_child_init(pchild);
+}
+
 // MAIN ENTRY POINT FOR INIT
 // =========================
 
 static void register_hook(apr_pool_t* p) {
   // Register the LBMethod
   ap_register_provider(p, PROXY_LBMETHOD, "bybusyness", "0", &bybusyness);
+  // Compile the routing table once the config is loaded
+  ap_hook_pre_config(reset_binding_config, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_post_config(build_routing_table, NULL, NULL, APR_HOOK_MIDDLE);
+  // Set up the status page cache of the children
+  ap_hook_child_init(init_status_pages, NULL, NULL, APR_HOOK_MIDDLE);
+  // Feed the response times of the peak EWMA balancers back
+  ap_hook_log_transaction(observe_response_time, NULL, NULL, APR_HOOK_MIDDLE);
+  // Check the sticky sessions before mod_proxy_balancer follows them
+  ap_hook_fixups(check_sticky_session, NULL, NULL, APR_HOOK_MIDDLE);
   // Register the status page hook
   ap_hook_handler(status_page_http_handler, NULL, NULL, APR_HOOK_FIRST);
+  // And the admin API
+  ap_hook_handler(binding_admin_http_handler, NULL, NULL, APR_HOOK_FIRST);
 }
 
 // convinience function to match part of a url and map the result to TRUE/FALSE
@@ -344,22 +1326,188 @@ static int status_page_http_handler(request_rec* r) {
     const int requires_style =
         (r->args != NULL) && (strcmp(r->args, "with-style") == 0);
 
+    // Writing the page may block, so keep the table alive until we are done
+    const routing_table* table = routing_state_acquire();
+    const uint32_t* counters =
+        (table != NULL) ? routing_state_counters(table) : NULL;
+    int status = OK;
+
     // Check for content-types.
     // Start with HTML with optional style
     if (uri_matches(r, "*html"))
-      status_page_html(r, &workerbinding_configuration,
-                       &authoringbinding_configuration,
-                       &backgrounderbinding_configuration, requires_style);
+      status = status_page_html(r, table, requires_style);
+    // The routing decisions
+    else if (uri_matches(r, "*decisions"))
+      status_page_decisions(r, table, counters);
+    // Prometheus metrics
+    else if (uri_matches(r, "*metrics")) {
+      apr_array_header_t* balancers =
+          collect_balancers(routing_main_server, r->pool);
+      status_page_metrics(r, table, counters,
+                          (proxy_balancer* const*)balancers->elts,
+                          (size_t)balancers->nelts);
+    }
     // JSON
-    else if (uri_matches(r, "*json"))
-      status_page_json(r, &workerbinding_configuration);
+    else if (uri_matches(r, "*json")) {
+      apr_array_header_t* balancers =
+          collect_balancers(routing_main_server, r->pool);
+      status_page_json(r, table, counters,
+                       (proxy_balancer* const*)balancers->elts,
+                       (size_t)balancers->nelts);
+    }
     // The fallback is HTML without style for now
     else
-      status_page_html(r, &workerbinding_configuration,
-                       &authoringbinding_configuration,
-                       &backgrounderbinding_configuration, TRUE);
-    return OK;
+      status = status_page_html(r, table, TRUE);
+
+    routing_state_release(table);
+    return status;
+  }
+}
+
+// The largest admin API request body we read
+enum { kMAX_ADMIN_FORM_SIZE = 4096 };
+
+// Compares a token in constant time, so it cannot be guessed by timing
+static int token_equals(const char* given, const char* expected) {
+  const size_t given_length = strlen(given);
+  const size_t expected_length = strlen(expected);
+  unsigned char diff = (given_length != expected_length);
+  size_t i;
+
+  for (i = 0; i < expected_length; ++i) {
+    diff |= (unsigned char)(given[i < given_length ? i : 0] ^ expected[i]);
+  }
+  return diff == 0;
+}
+
+// Returns 1 if the request may change the bindings: httpd authenticated
+// its user, or it has the admin token
+static int admin_request_allowed(const request_rec* r) {
+  const char* authorization;
+
+  if (r->user != NULL) return TRUE;
+  if (binding_admin_token == NULL) return FALSE;
+
+  authorization = apr_table_get(r->headers_in, "Authorization");
+  return authorization != NULL && strncmp(authorization, "Bearer ", 7) == 0 &&
+         token_equals(authorization + 7, binding_admin_token);
+}
+
+// Returns the value of a form field (NULL if missing)
+static const char* form_value(request_rec* r, const apr_array_header_t* form,
+                              const char* name) {
+  const ap_form_pair_t* pairs = (const ap_form_pair_t*)form->elts;
+  int i;
+
+  for (i = 0; i < form->nelts; ++i) {
+    apr_off_t length = 0;
+    apr_size_t size;
+    char* value;
+
+    if (strcmp(pairs[i].name, name) != 0) continue;
+    apr_brigade_length(pairs[i].value, 1, &length);
+    size = (apr_size_t)length;
+    value = (char*)apr_palloc(r->pool, size + 1);
+    apr_brigade_flatten(pairs[i].value, value, &size);
+    value[size] = '\0';
+    return value;
   }
+  return NULL;
+}
+
+// Sends a plain text answer of the admin API
+static int admin_response(request_rec* r, int status, const char* message) {
+  r->status = status;
+  ap_set_content_type(r, "text/plain; charset=utf-8");
+  ap_rputs(message, r);
+  ap_rputs("\n", r);
+  return OK;
+}
+
+/*
+        Handler of the admin API: a POST with the form fields set (Worker,
+        Authoring or Backgrounder), site, host and binding (prefer, allow,
+        forbid, a priority or remove) changes a binding at runtime. A
+        binding of drain (or undrain) drains the pair instead (or ends its
+        drain), and keeps its binding.
+
+        The edit is queued for the parent, which applies it to the routing
+        table within a second and publishes it to every child with a new
+        generation.
+*/
+static int binding_admin_http_handler(request_rec* r) {
+  apr_array_header_t* form = NULL;
+  const char *set_name, *site, *host, *kind_name, *problem;
+  binding_kind_t kind = kBINDING_ALLOW;
+  binding_edit edit;
+  int set;
+  apr_status_t rv;
+
+  if (!r->handler || strcmp(r->handler, PALETTE_DIRECTOR_ADMIN_HANDLER)) {
+    return (DECLINED);
+  }
+
+  if (!admin_request_allowed(r)) {
+    ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                  "Refused a binding change without the admin token or an "
+                  "authenticated user");
+    return HTTP_FORBIDDEN;
+  }
+  if (r->method_number != M_POST) {
+    r->allowed = AP_METHOD_BIT << M_POST;
+    return HTTP_METHOD_NOT_ALLOWED;
+  }
+
+  if (ap_parse_form_data(r, NULL, &form, -1, kMAX_ADMIN_FORM_SIZE) != OK ||
+      form == NULL) {
+    return HTTP_BAD_REQUEST;
+  }
+  set_name = form_value(r, form, "set");
+  site = form_value(r, form, "site");
+  host = form_value(r, form, "host");
+  kind_name = form_value(r, form, "binding");
+
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    if (set_name != NULL && strcasecmp(set_name, binding_set_keys[set]) == 0) {
+      break;
+    }
+  }
+  if (kind_name != NULL && strcmp(kind_name, "remove") == 0) {
+    kind = kROUTING_UNBOUND;
+  } else if (kind_name != NULL && strcmp(kind_name, "drain") == 0) {
+    kind = kBINDING_DRAIN;
+  } else if (kind_name != NULL && strcmp(kind_name, "undrain") == 0) {
+    kind = kBINDING_UNDRAIN;
+  } else if (kind_name == NULL || !parse_binding_kind(kind_name, &kind)) {
+    return admin_response(r, HTTP_BAD_REQUEST,
+                          "binding must be prefer, allow, forbid, a priority, "
+                          "remove, drain or undrain");
+  }
+
+  problem = binding_edit_init(&edit, set, site, host, kind);
+  if (problem != NULL) return admin_response(r, HTTP_BAD_REQUEST, problem);
+
+  rv = routing_state_post_edit(&edit);
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "Cannot queue the binding change of site '%s' on '%s'",
+                  edit.site_name, edit.worker_host);
+    return admin_response(r, HTTP_SERVICE_UNAVAILABLE,
+                          APR_STATUS_IS_EAGAIN(rv)
+                              ? "too many binding changes queued, try again"
+                              : "no routing table to change");
+  }
+
+  ap_log_rerror(APLOG_MARK, APLOG_NOTICE, 0, r,
+                "%s queued a change of the %s: site '%s' on '%s' %s",
+                r->user != NULL ? r->user : "The admin token",
+                binding_set_names[set], edit.site_name, edit.worker_host,
+                binding_kind_name(r->pool, kind));
+  return admin_response(
+      r, HTTP_ACCEPTED,
+      apr_psprintf(r->pool,
+                   "queued, applied with the routing table after #%u",
+                   routing_state_generation()));
 }
 
 // APACHE CONFIG FILE
@@ -368,31 +1516,201 @@ static int status_page_http_handler(request_rec* r) {
 // Set up the config readers / parsers
 // TODO: use a macro+shared function instead of pure macro
 
-#define BINDING_CONFIG_LOADER(key, name)                                       \
+#define BINDING_CONFIG_LOADER(key, set)                                        \
   \
 static const char* key##binding_set_config_path(cmd_parms* cmd, void* cfg,     \
                                                 const char* arg) \
 {          \
-    if (key##binding_configuration.count == 0) {                               \
-      key##binding_configuration = parse_csv_config(arg);                      \
-      ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,                \
-                   "Loaded %lu " name " from '%s'",                            \
-                   key##binding_configuration.count, arg);                     \
+    if (binding_config_paths[set] == NULL) {                                   \
+      binding_config_paths[set] = apr_pstrdup(cmd->pool, arg);                 \
     } else {                                                                   \
-      ap_log_error(                                                            \
-          APLOG_MARK, APLOG_ERR, 0, ap_server_conf,                            \
-          "Bindings config already loaded for " name " from file '%s'.", arg); \
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,                   \
+                   "Bindings config already set for %s from file '%s'.",       \
+                   binding_set_names[set], binding_config_paths[set]);         \
     }                                                                          \
     return NULL;                                                               \
   \
 }
 
-BINDING_CONFIG_LOADER(worker, "worker bindings")
-BINDING_CONFIG_LOADER(authoring, "authoring bindings")
-BINDING_CONFIG_LOADER(backgrounder, "backgrounder bindings")
+BINDING_CONFIG_LOADER(worker, kBINDING_SET_WORKER)
+BINDING_CONFIG_LOADER(authoring, kBINDING_SET_AUTHORING)
+BINDING_CONFIG_LOADER(backgrounder, kBINDING_SET_BACKGROUNDER)
 
 #undef BINDING_CONFIG_LOADER
 
+static const char* binding_config_check_interval_config(cmd_parms* cmd,
+                                                        void* cfg,
+                                                        const char* arg) {
+  char* end = NULL;
+  const long seconds = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || seconds < 0) {
+    return "BindingConfigCheckInterval must be a number of seconds (0 turns "
+           "reloading off)";
+  }
+  binding_config_check_interval = apr_time_from_sec(seconds);
+  return NULL;
+}
+
+static const char* binding_host_lookup_ttl_config(cmd_parms* cmd, void* cfg,
+                                                  const char* ttl,
+                                                  const char* negative_ttl) {
+  char* end = NULL;
+  long seconds = strtol(ttl, &end, 10);
+  if (end == ttl || *end != '\0' || seconds <= 0) {
+    return "BindingHostLookupTTL must be a number of seconds";
+  }
+  host_lookup_ttl = apr_time_from_sec(seconds);
+
+  if (negative_ttl != NULL) {
+    seconds = strtol(negative_ttl, &end, 10);
+    if (end == negative_ttl || *end != '\0' || seconds <= 0) {
+      return "The negative TTL of BindingHostLookupTTL must be a number of "
+             "seconds";
+    }
+    host_lookup_negative_ttl = apr_time_from_sec(seconds);
+  }
+  return NULL;
+}
+
+static const char* binding_admin_token_config(cmd_parms* cmd, void* cfg,
+                                              const char* arg) {
+  if (*arg == '\0') return "BindingAdminToken must not be empty";
+  binding_admin_token = apr_pstrdup(cmd->pool, arg);
+  return NULL;
+}
+
+static const char* binding_admin_persist_config(cmd_parms* cmd, void* cfg,
+                                                int flag) {
+  binding_admin_persist = flag;
+  return NULL;
+}
+
+static const char* binding_sticky_check_config(cmd_parms* cmd, void* cfg,
+                                               int flag) {
+  binding_sticky_check = flag;
+  return NULL;
+}
+
+static const char* binding_affinity_config(cmd_parms* cmd, void* cfg,
+                                           const char* arg) {
+  if (strcasecmp(arg, "off") == 0) {
+    binding_affinity = kAFFINITY_OFF;
+  } else if (strcasecmp(arg, "site") == 0) {
+    binding_affinity = kAFFINITY_SITE;
+  } else if (strcasecmp(arg, "workbook") == 0) {
+    binding_affinity = kAFFINITY_WORKBOOK;
+  } else {
+    return "BindingAffinity must be one of Off, Site or Workbook";
+  }
+  return NULL;
+}
+
+static const char* binding_affinity_load_factor_config(cmd_parms* cmd,
+                                                       void* cfg,
+                                                       const char* arg) {
+  char* end = NULL;
+  const double factor = strtod(arg, &end);
+  if (end == arg || *end != '\0' || !(factor >= 1.0)) {
+    return "BindingAffinityLoadFactor must be a number not less than 1.0";
+  }
+  binding_affinity_load_factor = factor;
+  return NULL;
+}
+
+// Returns the options of a balancer for the config to fill in
+static balancer_options* balancer_options_config(cmd_parms* cmd,
+                                                 const char* name) {
+  balancer_options* options =
+      (balancer_options*)find_balancer_options(name);
+  if (options != NULL) return options;
+
+  if (balancer_option_sets == NULL) {
+    balancer_option_sets =
+        apr_array_make(cmd->pool, 2, sizeof(balancer_options));
+  }
+  options = (balancer_options*)apr_array_push(balancer_option_sets);
+  options->name = apr_pstrdup(cmd->pool, name);
+  options->peak_ewma = 0;
+  options->sample_count = 0;
+  return options;
+}
+
+static const char* binding_scoring_config(cmd_parms* cmd, void* cfg,
+                                          const char* balancer,
+                                          const char* scoring) {
+  if (strcasecmp(scoring, "PeakEWMA") == 0) {
+    balancer_options_config(cmd, balancer)->peak_ewma = 1;
+  } else if (strcasecmp(scoring, "Busyness") == 0) {
+    balancer_options_config(cmd, balancer)->peak_ewma = 0;
+  } else {
+    return "BindingScoring must be Busyness or PeakEWMA";
+  }
+  return NULL;
+}
+
+static const char* binding_sampling_config(cmd_parms* cmd, void* cfg,
+                                           const char* balancer,
+                                           const char* count) {
+  char* end = NULL;
+  const long samples = strtol(count, &end, 10);
+  if (end == count || *end != '\0' || samples == 1 || samples < 0 ||
+      samples > kMAX_SAMPLE_COUNT) {
+    return apr_psprintf(cmd->pool,
+                        "BindingSampling must be 0 (scan every worker) or "
+                        "the number of workers to compare (2 to %d)",
+                        (int)kMAX_SAMPLE_COUNT);
+  }
+  balancer_options_config(cmd, balancer)->sample_count = (size_t)samples;
+  return NULL;
+}
+
+static const char* peak_ewma_decay_config(cmd_parms* cmd, void* cfg,
+                                          const char* arg) {
+  char* end = NULL;
+  const double seconds = strtod(arg, &end);
+  if (end == arg || *end != '\0' || !(seconds > 0.0) || seconds > 3600.0) {
+    return "BindingPeakEWMADecay must be a number of seconds (at most 3600)";
+  }
+  peak_ewma_decay_ms = (uint32_t)(seconds * 1000.0);
+  return NULL;
+}
+
+static const char* binding_overflow_config(cmd_parms* cmd, void* cfg,
+                                           const char* set_name,
+                                           const char* spill,
+                                           const char* back) {
+  char* end = NULL;
+  long spill_busy, return_busy;
+  size_t set;
+
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    if (strcasecmp(set_name, binding_set_keys[set]) == 0) break;
+  }
+  if (set == kBINDING_SET_COUNT) {
+    return "BindingOverflow must start with Worker, Authoring or "
+           "Backgrounder";
+  }
+
+  spill_busy = strtol(spill, &end, 10);
+  if (end == spill || *end != '\0' || spill_busy < 0) {
+    return "BindingOverflow needs the busyness to spill over at (0 turns "
+           "overflowing off)";
+  }
+  return_busy = spill_busy / 2;
+  if (back != NULL) {
+    return_busy = strtol(back, &end, 10);
+    if (end == back || *end != '\0' || return_busy < 0 ||
+        (spill_busy > 0 && return_busy >= spill_busy)) {
+      return "The return busyness of BindingOverflow must be below the "
+             "busyness to spill over at";
+    }
+  }
+
+  binding_overflows[set].spill_busy = (size_t)spill_busy;
+  binding_overflows[set].return_busy = (size_t)return_busy;
+  return NULL;
+}
+
 // Declare the config file directives
 
 #define BINDING_CONFIG_DIRECTIVE(key, directive_name, description)             \
@@ -407,6 +1725,52 @@ static const command_rec workerbinding_directives[] = {
                              "The path to the authoring binding config"),
     BINDING_CONFIG_DIRECTIVE(backgrounder, "BackgrounderBindingConfigPath",
                              "The path to the backgrounder config"),
+    AP_INIT_TAKE1("BindingConfigCheckInterval",
+                  binding_config_check_interval_config, NULL, RSRC_CONF,
+                  "Seconds between checks of the binding configs for changes "
+                  "(0 turns reloading off)"),
+    AP_INIT_TAKE12("BindingHostLookupTTL", binding_host_lookup_ttl_config,
+                   NULL, RSRC_CONF,
+                   "Seconds the addresses of the binding hosts are cached "
+                   "(default 300), and optionally the failed lookups "
+                   "(default 30)"),
+    AP_INIT_TAKE1("BindingAdminToken", binding_admin_token_config, NULL,
+                  RSRC_CONF,
+                  "The bearer token the admin API takes from the clients "
+                  "httpd did not authenticate"),
+    AP_INIT_FLAG("BindingAdminPersist", binding_admin_persist_config, NULL,
+                 RSRC_CONF,
+                 "Write the binding changes of the admin API into the CSV "
+                 "binding configs (default Off)"),
+    AP_INIT_FLAG("BindingStickyCheck", binding_sticky_check_config, NULL,
+                 RSRC_CONF,
+                 "Take the sticky sessions off the hosts their site is "
+                 "forbidden on (default On)"),
+    AP_INIT_TAKE1("BindingAffinity", binding_affinity_config, NULL, RSRC_CONF,
+                  "What the requests of a site stick to within its preferred "
+                  "workers: Off, Site or Workbook"),
+    AP_INIT_TAKE1("BindingAffinityLoadFactor",
+                  binding_affinity_load_factor_config, NULL, RSRC_CONF,
+                  "How many times busier than the average a preferred worker "
+                  "may get before the affine pick skips it (default 1.25)"),
+    AP_INIT_TAKE2("BindingScoring", binding_scoring_config, NULL, RSRC_CONF,
+                  "A balancer name and how its workers are compared: "
+                  "Busyness (default) or PeakEWMA"),
+    AP_INIT_TAKE2("BindingSampling", binding_sampling_config, NULL,
+                  RSRC_CONF,
+                  "A balancer name and how many random workers of its large "
+                  "candidate lists to compare instead of scanning them all "
+                  "(0 scans, the default)"),
+    AP_INIT_TAKE1("BindingPeakEWMADecay", peak_ewma_decay_config, NULL,
+                  RSRC_CONF,
+                  "Seconds over which the PeakEWMA response time averages "
+                  "decay (default 10)"),
+    AP_INIT_TAKE23("BindingOverflow", binding_overflow_config, NULL,
+                   RSRC_CONF,
+                   "A binding set (Worker, Authoring or Backgrounder), the "
+                   "busyness of the least busy preferred worker at which a "
+                   "site spills over to its fallback workers, and the one it "
+                   "returns at (default half of it)"),
     {NULL}};
 
 #undef BINDING_CONFIG_DIRECTIVE
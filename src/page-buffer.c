@@ -0,0 +1,182 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "page-buffer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Makes sure there is room for size more bytes, returns 0 if there is not
+static int page_reserve(page_buffer* b, size_t size) {
+  size_t capacity = b->capacity;
+  char* data;
+
+  if (b->failed) return 0;
+  if (b->length + size <= b->capacity) return 1;
+
+  if (b->flush != NULL) {
+    page_buffer_flush(b);
+    // (larger appends are flushed directly by page_append)
+    return size <= b->capacity;
+  }
+
+  while (b->length + size > capacity) capacity *= 2;
+  if (b->pool != NULL) {
+    data = (char*)apr_palloc(b->pool, capacity);
+    if (data != NULL && b->length > 0) memcpy(data, b->data, b->length);
+  } else {
+    data = (char*)realloc(b->data, capacity);
+  }
+
+  if (data == NULL) {
+    b->failed = 1;
+    return 0;
+  }
+  b->data = data;
+  b->capacity = capacity;
+  return 1;
+}
+
+void page_buffer_init(page_buffer* b, apr_pool_t* pool, size_t capacity) {
+  b->pool = pool;
+  b->data = NULL;
+  b->length = 0;
+  b->capacity = 0;
+  b->failed = 0;
+  b->flush = NULL;
+  b->flush_baton = NULL;
+
+  if (capacity < 64) capacity = 64;
+  b->data = (pool != NULL) ? (char*)apr_palloc(pool, capacity)
+                           : (char*)malloc(capacity);
+  if (b->data == NULL) {
+    b->failed = 1;
+  } else {
+    b->capacity = capacity;
+  }
+}
+
+void page_buffer_init_streaming(page_buffer* b, apr_pool_t* pool,
+                                size_t capacity, page_flush_fn flush,
+                                void* baton) {
+  page_buffer_init(b, pool, capacity);
+  b->flush = flush;
+  b->flush_baton = baton;
+}
+
+void page_buffer_flush(page_buffer* b) {
+  if (b->flush == NULL || b->length == 0) return;
+  b->flush(b->data, b->length, b->flush_baton);
+  b->length = 0;
+}
+
+void page_buffer_free(page_buffer* b) {
+  if (b->pool == NULL) free(b->data);
+  b->data = NULL;
+  b->length = b->capacity = 0;
+}
+
+void page_append(page_buffer* b, const char* s, size_t length) {
+  if (b->flush != NULL && !b->failed && length > b->capacity) {
+    page_buffer_flush(b);
+    b->flush(s, length, b->flush_baton);
+    return;
+  }
+  if (!page_reserve(b, length)) return;
+  memcpy(b->data + b->length, s, length);
+  b->length += length;
+}
+
+void page_printf(page_buffer* b, const char* format, ...) {
+  va_list args;
+  int needed;
+
+  // try with the room we have, then once more with enough room
+  va_start(args, format);
+  needed = vsnprintf(b->failed ? NULL : b->data + b->length,
+                     b->failed ? 0 : b->capacity - b->length, format, args);
+  va_end(args);
+  if (needed < 0 || b->failed) return;
+
+  if ((size_t)needed >= b->capacity - b->length) {
+    if (!page_reserve(b, (size_t)needed + 1)) return;
+    va_start(args, format);
+    vsnprintf(b->data + b->length, (size_t)needed + 1, format, args);
+    va_end(args);
+  }
+  b->length += (size_t)needed;
+}
+
+void page_html(page_buffer* b, const char* s) {
+  const char* start = s;
+
+  for (; *s != '\0'; ++s) {
+    const char* entity = NULL;
+    switch (*s) {
+      case '<':
+        entity = "&lt;";
+        break;
+      case '>':
+        entity = "&gt;";
+        break;
+      case '&':
+        entity = "&amp;";
+        break;
+      case '"':
+        entity = "&quot;";
+        break;
+      case '\'':
+        entity = "&#39;";
+        break;
+    }
+    if (entity == NULL) continue;
+
+    page_append(b, start, (size_t)(s - start));
+    page_append(b, entity, strlen(entity));
+    start = s + 1;
+  }
+  page_append(b, start, (size_t)(s - start));
+}
+
+void page_json_string(page_buffer* b, const char* s) {
+  const char* start;
+
+  if (s == NULL) {
+    PAGE_LITERAL(b, "null");
+    return;
+  }
+
+  PAGE_LITERAL(b, "\"");
+  for (start = s; *s != '\0'; ++s) {
+    const unsigned char c = (unsigned char)*s;
+    if (c != '"' && c != '\\' && c >= 0x20) continue;
+
+    page_append(b, start, (size_t)(s - start));
+    if (c == '"' || c == '\\') {
+      const char escaped[2] = {'\\', (char)c};
+      page_append(b, escaped, 2);
+    } else {
+      page_printf(b, "\\u%04x", c);
+    }
+    start = s + 1;
+  }
+  page_append(b, start, (size_t)(s - start));
+  PAGE_LITERAL(b, "\"");
+}
@@ -0,0 +1,73 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <apr_pools.h>
+#include <stddef.h>
+
+/*
+        A growing output buffer the status pages are rendered into, so a page
+        is written to the client with a single call (or cached).
+
+        The buffer is allocated from pool, or with malloc() if pool is NULL
+        (free it with page_buffer_free() then). If an allocation fails the
+        buffer stops growing and failed is set.
+
+        A streaming buffer (page_buffer_init_streaming()) never grows: when it
+        is full its contents are handed to the flush function, so the memory
+        used does not depend on the size of the page.
+*/
+typedef void (*page_flush_fn)(const char* data, size_t length, void* baton);
+
+typedef struct page_buffer {
+  apr_pool_t* pool;
+  char* data;
+  size_t length;
+  size_t capacity;
+  int failed;
+
+  // Set for streaming buffers
+  page_flush_fn flush;
+  void* flush_baton;
+} page_buffer;
+
+void page_buffer_init(page_buffer* b, apr_pool_t* pool, size_t capacity);
+
+void page_buffer_init_streaming(page_buffer* b, apr_pool_t* pool,
+                                size_t capacity, page_flush_fn flush,
+                                void* baton);
+
+// Hands the contents of a streaming buffer to the flush function
+void page_buffer_flush(page_buffer* b);
+
+// Frees a malloc()-ed buffer
+void page_buffer_free(page_buffer* b);
+
+void page_append(page_buffer* b, const char* s, size_t length);
+
+// Appends a string literal
+#define PAGE_LITERAL(b, s) page_append((b), (s), sizeof(s) - 1)
+
+void page_printf(page_buffer* b, const char* format, ...);
+
+// Appends a string with the HTML special characters escaped
+void page_html(page_buffer* b, const char* s);
+
+// Appends a string as a quoted and escaped JSON string (or null if NULL)
+void page_json_string(page_buffer* b, const char* s);
@@ -23,25 +23,30 @@
 
 #include "palette-macros.h"
 
-enum {
-  // The size of the stack buffers we'll use in storing temporary bindings
-  kBINDINGS_BUFFER_SIZE = 512,
-
-  // The size of the stack buffer for the workers lists
-  kWORKERS_BUFFER_SIZE = 256,
-
-  // The buffer size for each substring we'll be reading from a line
-  kCONFIG_MAX_STRING_SIZE = 256,
-};
-
 // The handler name we'll use to display the status pages
 static const char* PALETTE_DIRECTOR_STATUS_HANDLER = "palette-director-status";
 
+// The handler name of the admin API that changes the bindings at runtime
+static const char* PALETTE_DIRECTOR_ADMIN_HANDLER = "palette-director-admin";
+
 // The binding kind 'enum' type
 typedef int binding_kind_t;
 
-// The possible values for the binding_kind_t
-enum { kBINDING_FORBID = -1, kBINDING_ALLOW = 0, kBINDING_PREFER = 1 };
+// The possible values for the binding_kind_t. A binding may also be a numeric
+// priority from kBINDING_PREFER (the same as "prefer") to
+// kBINDING_MAX_PRIORITY: lower priorities are tried first, and the allowed
+// hosts after all of them.
+enum {
+  kBINDING_FORBID = -1,
+  kBINDING_ALLOW = 0,
+  kBINDING_PREFER = 1,
+  kBINDING_MAX_PRIORITY = 8
+};
+
+// The kind of the rows that drain a site / host pair: the host gets no new
+// requests of the site, but its sticky sessions go on. Not a binding of its
+// own (the pair keeps its binding), and only ever set through the admin API.
+enum { kBINDING_DRAIN = -3 };
 
 // Maps a sitename + worker_host pair to a binding kind
 typedef struct binding_row {
@@ -54,23 +59,41 @@ typedef struct binding_row {
   // Prefer, allow or forbid this host/site combo?
   binding_kind_t binding_kind;
 
+  // The most requests of the site the host may have in flight (0 for no
+  // limit). On a kBINDING_ANY_HOST row this limits the requests of the site
+  // in flight on its preferred hosts together.
+  uint32_t max_in_flight;
+
+  // The ids of the site and the host name if the loader interned them (the
+  // same id for the same name of a config, ignoring the case), or
+  // kBINDING_NO_ID
+  uint32_t site_id;
+  uint32_t host_id;
+
 } binding_row;
 
-// FWD-declare the proxy worker struct
-typedef struct proxy_worker proxy_worker;
+// The name id of the rows whose names were not interned
+static const uint32_t kBINDING_NO_ID = 0xffffffffu;
 
-typedef struct ip_resolver_table {
-  const char* hostname[kWORKERS_BUFFER_SIZE];
-  const char* ip_addr[kWORKERS_BUFFER_SIZE];
+// A name interned by the loader: stored once per config, with its length
+// and routing_site_hash()
+typedef struct binding_name {
+  const char* name;
+  uint32_t length;
+  uint32_t hash;
+} binding_name;
 
+// The interned names of a config, indexed by their id
+typedef struct binding_names {
+  const binding_name* entries;
   size_t count;
-} ip_resolver_table;
+} binding_names;
+
+// The worker_host of the rows that set the limit of a whole site
+static const char* const kBINDING_ANY_HOST = "*";
+
+// FWD-declare the proxy worker struct
+typedef struct proxy_worker proxy_worker;
 
 // The slice types we'll use more often
 PAL__SLICE_TYPE(binding_row, binding_rows);
-PAL__SLICE_TYPE(proxy_worker*, proxy_worker_slice);
-
-// Returns the ip address stored (or tries to look it up).
-// If it cannot resolve the name to an ip, returns NULL and does
-// not retry it until restart
-const char* ip_resolver_lookup(ip_resolver_table* r, const char* hostname);
@@ -18,24 +18,113 @@
 
 #pragma once
 
-#define PAL__SLICE_TYPE(type, entity_name)                                     \
-  typedef struct entity_name {                                                 \
-    type* entries;                                                             \
-    size_t count;                                                              \
-  } entity_name;                                                               \
-                                                                               \
-  entity_name malloc_##entity_name(size_t count);                              \
-                                                                               \
-  void free_##entity_name(entity_name* e);                                     \
-                                                                               \
-  entity_name entity_name##_from_array(type* arr, size_t count);               \
-                                                                               \
-  typedef int (*entity_name##_filter_fn)(const type* e, void* state);          \
-                                                                               \
-  entity_name entity_name##_filter(const entity_name e,                        \
-                                   entity_name##_filter_fn filter_fn,          \
-                                   const size_t max_buffer_size, void* state); \
-                                                                               \
+/*
+
+        Case-folded (ASCII only) FNV-1a hashing, used for the site lookups
+
+*/
+
+#define PAL__ASCII_TOLOWER(c) (((c) >= 'A' && (c) <= 'Z') ? ((c) | 0x20) : (c))
+
+#define PAL__FNV1A_INIT 2166136261u
+
+#define PAL__FNV1A_STEP_CASEFOLD(hash, c)                     \
+  (((hash) ^ (uint32_t)(unsigned char)PAL__ASCII_TOLOWER(c)) * \
+   16777619u)
+
+/*
+
+        Thread local storage (for per-thread state that must not be shared
+        between the threads of a worker MPM)
+
+*/
+
+#if defined(_MSC_VER)
+#define PAL__THREAD_LOCAL __declspec(thread)
+#else
+#define PAL__THREAD_LOCAL __thread
+#endif
+
+/*
+
+        Statistics counters shared between threads and processes: relaxed
+        atomic increments and loads, nothing is ordered around them. The
+        bit operations and the compare-and-swap serve the flags and claims
+        kept with the counters.
+
+*/
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PAL__COUNTER_INC(p) ((void)_InterlockedIncrement((volatile long*)(p)))
+#define PAL__COUNTER_DEC(p) ((void)_InterlockedDecrement((volatile long*)(p)))
+#define PAL__COUNTER_READ(p) (*(const volatile uint32_t*)(p))
+#define PAL__COUNTER_STORE(p, v) (*(volatile uint32_t*)(p) = (v))
+#define PAL__COUNTER_ADD64(p, v) \
+  ((void)_InterlockedExchangeAdd64((volatile __int64*)(p), (__int64)(v)))
+#define PAL__COUNTER_READ64(p) \
+  ((uint64_t)_InterlockedCompareExchange64((volatile __int64*)(p), 0, 0))
+#define PAL__COUNTER_ADD(p, v) \
+  ((void)_InterlockedExchangeAdd((volatile long*)(p), (long)(v)))
+#define PAL__COUNTER_XCHG(p, v) \
+  ((uint32_t)_InterlockedExchange((volatile long*)(p), (long)(v)))
+#define PAL__COUNTER_OR(p, v) \
+  ((void)_InterlockedOr((volatile long*)(p), (long)(v)))
+#define PAL__COUNTER_AND(p, v) \
+  ((void)_InterlockedAnd((volatile long*)(p), (long)(v)))
+// Returns non-zero if *p was expected and is now desired
+#define PAL__COUNTER_CAS(p, expected, desired)                          \
+  (_InterlockedCompareExchange((volatile long*)(p), (long)(desired),    \
+                               (long)(expected)) == (long)(expected))
+#else
+#define PAL__COUNTER_INC(p) \
+  ((void)__atomic_fetch_add((p), 1u, __ATOMIC_RELAXED))
+#define PAL__COUNTER_DEC(p) \
+  ((void)__atomic_fetch_sub((p), 1u, __ATOMIC_RELAXED))
+#define PAL__COUNTER_READ(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define PAL__COUNTER_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define PAL__COUNTER_ADD64(p, v) \
+  ((void)__atomic_fetch_add((p), (uint64_t)(v), __ATOMIC_RELAXED))
+#define PAL__COUNTER_READ64(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define PAL__COUNTER_ADD(p, v) \
+  ((void)__atomic_fetch_add((p), (v), __ATOMIC_RELAXED))
+#define PAL__COUNTER_XCHG(p, v) __atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#define PAL__COUNTER_OR(p, v) \
+  ((void)__atomic_fetch_or((p), (v), __ATOMIC_RELAXED))
+#define PAL__COUNTER_AND(p, v) \
+  ((void)__atomic_fetch_and((p), (v), __ATOMIC_RELAXED))
+// Returns non-zero if *p was expected and is now desired
+#define PAL__COUNTER_CAS(p, expected, desired) \
+  __sync_bool_compare_and_swap((p), (expected), (desired))
+#endif
+
+/*
+
+        The index of the lowest set bit of a non-zero mask
+
+*/
+
+#if defined(_MSC_VER)
+static __forceinline int pal__lowest_bit(unsigned long mask) {
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return (int)idx;
+}
+#define PAL__LOWEST_BIT(mask) pal__lowest_bit(mask)
+#else
+#define PAL__LOWEST_BIT(mask) __builtin_ctz(mask)
+#endif
+
+#define PAL__SLICE_TYPE(type, entity_name)                \
+  typedef struct entity_name {                            \
+    type* entries;                                        \
+    size_t count;                                         \
+  } entity_name;                                          \
+                                                          \
+  entity_name malloc_##entity_name(size_t count);         \
+                                                          \
+  void free_##entity_name(entity_name* e);                \
+                                                          \
   extern const entity_name empty_##entity_name;
 
 /*
@@ -52,29 +141,4 @@
                                                                   \
   void free_##entity_name(entity_name* e) { free(e->entries); }   \
                                                                   \
-  entity_name entity_name##_from_array(type* arr, size_t count) { \
-    entity_name o = malloc_##entity_name(count);                  \
-    memcpy(o.entries, arr, sizeof(type) * count);                 \
-    return o;                                                     \
-  }                                                               \
-                                                                  \
-  entity_name entity_name##_filter(                               \
-      const entity_name e, entity_name##_filter_fn filter_fn,     \
-      const size_t max_buffer_size, void* state) {                \
-    type* buffer = (type*)malloc(sizeof(type) * max_buffer_size); \
-    size_t i, len = e.count, buffer_size = 0;                     \
-    entity_name out = empty_##entity_name;                        \
-    for (i = 0; i < len; ++i) {                                   \
-      type entry = e.entries[i];                                  \
-      if (filter_fn(&entry, state) != 0) {                        \
-        buffer[buffer_size] = entry;                              \
-        buffer_size++;                                            \
-      }                                                           \
-    }                                                             \
-                                                                  \
-    out = entity_name##_from_array(buffer, buffer_size);          \
-    free(buffer);                                                 \
-    return out;                                                   \
-  }                                                               \
-                                                                  \
   const entity_name empty_##entity_name = {NULL, 0};
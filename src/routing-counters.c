@@ -0,0 +1,413 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "routing-counters.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "palette-macros.h"
+
+const uint32_t kLATENCY_BUCKET_BOUNDS_US[kLATENCY_BUCKET_COUNT] = {
+    1, 2, 5, 10, 25, 50, 100, 250, 500, 1000};
+
+// The row of a site (requests without a known site use the last row)
+static size_t site_row(const routing_table* t, int site_idx) {
+  return (site_idx == kROUTING_NOT_FOUND) ? t->site_count : (size_t)site_idx;
+}
+
+static const routing_balancer* balancer_at(const routing_table* t,
+                                           int balancer_idx) {
+  return ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset) +
+         balancer_idx;
+}
+
+// The offsets of the counter arrays in the block (in uint32_t-s)
+static size_t hits_offset(const routing_table* t, int site_idx,
+                          int balancer_idx, size_t worker_idx) {
+  const size_t member = balancer_at(t, balancer_idx)->first_member + worker_idx;
+  return (site_row(t, site_idx) * t->member_count + member) *
+         kDECISION_KIND_COUNT;
+}
+
+static size_t no_candidates_offset(const routing_table* t, int site_idx,
+                                   int balancer_idx) {
+  return (t->site_count + 1) * t->member_count * kDECISION_KIND_COUNT +
+         site_row(t, site_idx) * t->balancer_count + balancer_idx;
+}
+
+static size_t unknown_sites_offset(const routing_table* t, int balancer_idx) {
+  return no_candidates_offset(t, 0, 0) +
+         (t->site_count + 1) * t->balancer_count + balancer_idx;
+}
+
+static size_t no_sites_offset(const routing_table* t, int balancer_idx) {
+  return unknown_sites_offset(t, 0) + t->balancer_count + balancer_idx;
+}
+
+// The peak EWMA of each member: the average (us) and when it was updated (ms)
+enum { kEWMA_AVERAGE = 0, kEWMA_STAMP = 1, kEWMA_FIELD_COUNT };
+
+static size_t ewma_base_offset(const routing_table* t) {
+  return no_sites_offset(t, (int)t->balancer_count);
+}
+
+static size_t ewma_offset(const routing_table* t, int balancer_idx,
+                          size_t worker_idx) {
+  const size_t member = balancer_at(t, balancer_idx)->first_member + worker_idx;
+  return ewma_base_offset(t) + member * kEWMA_FIELD_COUNT;
+}
+
+// The in-flight requests of each site on its preferred members, then of each
+// site on each member
+static size_t site_in_flight_offset(const routing_table* t, int site_idx) {
+  return ewma_base_offset(t) + t->member_count * kEWMA_FIELD_COUNT +
+         (size_t)site_idx;
+}
+
+static size_t member_in_flight_offset(const routing_table* t, int site_idx,
+                                      int balancer_idx, size_t worker_idx) {
+  const size_t member = balancer_at(t, balancer_idx)->first_member + worker_idx;
+  return site_in_flight_offset(t, (int)t->site_count) +
+         (size_t)site_idx * t->member_count + member;
+}
+
+// The overflow state of each site on each balancer and the overflows started
+enum { kOVERFLOW_STATE = 0, kOVERFLOW_COUNT = 1, kOVERFLOW_FIELD_COUNT };
+
+static size_t overflow_offset(const routing_table* t, int site_idx,
+                              int balancer_idx) {
+  return site_in_flight_offset(t, (int)t->site_count) +
+         t->site_count * t->member_count +
+         ((size_t)site_idx * t->balancer_count + balancer_idx) *
+             kOVERFLOW_FIELD_COUNT;
+}
+
+// When each member was last retried (ms, 0 if never), then the down bits of
+// the members
+static size_t retry_offset(const routing_table* t, int balancer_idx,
+                           size_t worker_idx) {
+  const size_t member = balancer_at(t, balancer_idx)->first_member + worker_idx;
+  return overflow_offset(t, (int)t->site_count, 0) + member;
+}
+
+static size_t down_base_offset(const routing_table* t) {
+  return overflow_offset(t, (int)t->site_count, 0) + t->member_count;
+}
+
+// The weight the old average keeps after elapsed_ms
+static double ewma_decay(uint32_t elapsed_ms, uint32_t decay_ms) {
+  if (decay_ms == 0) return 0.0;
+  return exp(-(double)elapsed_ms / (double)decay_ms);
+}
+
+void routing_latency_record(routing_latency* latency, uint64_t us) {
+  size_t i = 0;
+  while (i < kLATENCY_BUCKET_COUNT && us > kLATENCY_BUCKET_BOUNDS_US[i]) ++i;
+  PAL__COUNTER_INC(&latency->buckets[i]);
+  PAL__COUNTER_ADD64(&latency->sum_us, us);
+}
+
+size_t routing_counters_size(const routing_table* t) {
+  return sizeof(uint32_t) *
+         (down_base_offset(t) + (t->member_count + 31) / 32);
+}
+
+void routing_counters_hit(uint32_t* counters, const routing_table* t,
+                          int site_idx, int balancer_idx, size_t worker_idx,
+                          int tier) {
+  const int kind =
+      (tier == kTIER_PREFER) ? kDECISION_PREFERRED : kDECISION_FALLBACK;
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return;
+  PAL__COUNTER_INC(
+      &counters[hits_offset(t, site_idx, balancer_idx, worker_idx) + kind]);
+}
+
+void routing_counters_no_candidate(uint32_t* counters, const routing_table* t,
+                                   int site_idx, int balancer_idx) {
+  PAL__COUNTER_INC(
+      &counters[no_candidates_offset(t, site_idx, balancer_idx)]);
+}
+
+void routing_counters_unknown_site(uint32_t* counters, const routing_table* t,
+                                   int balancer_idx) {
+  PAL__COUNTER_INC(&counters[unknown_sites_offset(t, balancer_idx)]);
+}
+
+void routing_counters_no_site(uint32_t* counters, const routing_table* t,
+                              int balancer_idx) {
+  PAL__COUNTER_INC(&counters[no_sites_offset(t, balancer_idx)]);
+}
+
+void routing_counters_request_started(uint32_t* counters,
+                                      const routing_table* t, int site_idx,
+                                      int balancer_idx, size_t worker_idx,
+                                      int tier) {
+  if (site_idx == kROUTING_NOT_FOUND) return;
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return;
+  PAL__COUNTER_INC(
+      &counters[member_in_flight_offset(t, site_idx, balancer_idx, worker_idx)]);
+  if (tier == kTIER_PREFER) {
+    PAL__COUNTER_INC(&counters[site_in_flight_offset(t, site_idx)]);
+  }
+}
+
+// Decrements a count unless it is 0, returns 0 if it was
+static int counter_dec_to_zero(uint32_t* p) {
+  uint32_t value = PAL__COUNTER_READ(p);
+  while (value != 0) {
+    if (PAL__COUNTER_CAS(p, value, value - 1)) return 1;
+    value = PAL__COUNTER_READ(p);
+  }
+  return 0;
+}
+
+int routing_counters_request_done(uint32_t* counters, const routing_table* t,
+                                  int site_idx, int balancer_idx,
+                                  size_t worker_idx, int tier) {
+  int counted;
+
+  if (site_idx == kROUTING_NOT_FOUND) return 1;
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return 1;
+  counted = counter_dec_to_zero(
+      &counters[member_in_flight_offset(t, site_idx, balancer_idx, worker_idx)]);
+  if (tier == kTIER_PREFER) {
+    counter_dec_to_zero(&counters[site_in_flight_offset(t, site_idx)]);
+  }
+  return counted;
+}
+
+// Adds the count at from to the one at to, and leaves 0 at from
+static void move_count(uint32_t* to, uint32_t* from) {
+  const uint32_t value = PAL__COUNTER_XCHG(from, 0u);
+  if (value != 0) PAL__COUNTER_ADD(to, value);
+}
+
+// Returns the index of the balancer of from_t in to_t (or
+// kROUTING_NOT_FOUND)
+static int same_balancer(const routing_table* to_t,
+                         const routing_table* from_t, int balancer_idx) {
+  const routing_balancer* balancer = balancer_at(from_t, balancer_idx);
+  uint32_t i;
+
+  for (i = 0; i < to_t->balancer_count; ++i) {
+    const routing_balancer* b = balancer_at(to_t, (int)i);
+    if (b->hash_def == balancer->hash_def &&
+        b->hash_fnv == balancer->hash_fnv) {
+      return (int)i;
+    }
+  }
+  return kROUTING_NOT_FOUND;
+}
+
+void routing_counters_move_in_flight(uint32_t* to, const routing_table* to_t,
+                                     uint32_t* from,
+                                     const routing_table* from_t) {
+  uint32_t site, balancer;
+  size_t worker;
+
+  for (site = 0; site < from_t->site_count; ++site) {
+    const char* name = routing_table_site_name(from_t, (int)site);
+    const size_t length = strlen(name);
+    const int to_site = routing_table_find_site(
+        to_t, name, length, routing_site_hash(name, length));
+    if (to_site == kROUTING_NOT_FOUND) continue;
+
+    move_count(&to[site_in_flight_offset(to_t, to_site)],
+               &from[site_in_flight_offset(from_t, (int)site)]);
+    for (balancer = 0; balancer < from_t->balancer_count; ++balancer) {
+      const int to_balancer = same_balancer(to_t, from_t, (int)balancer);
+      size_t member_count;
+      if (to_balancer == kROUTING_NOT_FOUND) continue;
+
+      member_count = balancer_at(from_t, (int)balancer)->member_count;
+      if (balancer_at(to_t, to_balancer)->member_count < member_count) {
+        member_count = balancer_at(to_t, to_balancer)->member_count;
+      }
+      for (worker = 0; worker < member_count; ++worker) {
+        move_count(&to[member_in_flight_offset(to_t, to_site, to_balancer,
+                                               worker)],
+                   &from[member_in_flight_offset(from_t, (int)site,
+                                                 (int)balancer, worker)]);
+      }
+    }
+  }
+}
+
+uint32_t routing_counters_site_in_flight(const uint32_t* counters,
+                                         const routing_table* t,
+                                         int site_idx) {
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  return PAL__COUNTER_READ(&counters[site_in_flight_offset(t, site_idx)]);
+}
+
+uint32_t routing_counters_member_in_flight(const uint32_t* counters,
+                                           const routing_table* t,
+                                           int site_idx, int balancer_idx,
+                                           size_t worker_idx) {
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  return PAL__COUNTER_READ(&counters[member_in_flight_offset(
+      t, site_idx, balancer_idx, worker_idx)]);
+}
+
+uint32_t routing_counters_host_in_flight(const uint32_t* counters,
+                                         const routing_table* t, int site_idx,
+                                         int host_idx) {
+  const routing_balancer* balancers =
+      ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset);
+  uint32_t b, m, total = 0;
+
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  for (b = 0; b < t->balancer_count; ++b) {
+    for (m = 0; m < balancers[b].member_count; ++m) {
+      if (routing_table_member_host(t, (int)b, m) != host_idx) continue;
+      total += routing_counters_member_in_flight(counters, t, site_idx,
+                                                 (int)b, m);
+    }
+  }
+  return total;
+}
+
+int routing_counters_overflowing(const uint32_t* counters,
+                                 const routing_table* t, int site_idx,
+                                 int balancer_idx) {
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  return PAL__COUNTER_READ(&counters[overflow_offset(t, site_idx,
+                                                     balancer_idx) +
+                                     kOVERFLOW_STATE]) != 0;
+}
+
+void routing_counters_set_overflowing(uint32_t* counters,
+                                      const routing_table* t, int site_idx,
+                                      int balancer_idx, int overflowing) {
+  uint32_t* overflow;
+
+  if (site_idx == kROUTING_NOT_FOUND) return;
+  overflow = &counters[overflow_offset(t, site_idx, balancer_idx)];
+  PAL__COUNTER_STORE(&overflow[kOVERFLOW_STATE], overflowing ? 1u : 0u);
+  if (overflowing) PAL__COUNTER_INC(&overflow[kOVERFLOW_COUNT]);
+}
+
+uint32_t routing_counters_overflows(const uint32_t* counters,
+                                    const routing_table* t, int site_idx,
+                                    int balancer_idx) {
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  return PAL__COUNTER_READ(
+      &counters[overflow_offset(t, site_idx, balancer_idx) + kOVERFLOW_COUNT]);
+}
+
+int routing_counters_member_down(const uint32_t* counters,
+                                 const routing_table* t, int balancer_idx,
+                                 size_t worker_idx) {
+  const size_t member = balancer_at(t, balancer_idx)->first_member + worker_idx;
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return 0;
+  return (PAL__COUNTER_READ(&counters[down_base_offset(t) + member / 32]) &
+          (1u << (member % 32))) != 0;
+}
+
+void routing_counters_set_member_down(uint32_t* counters,
+                                      const routing_table* t,
+                                      int balancer_idx, size_t worker_idx,
+                                      int down) {
+  const size_t member = balancer_at(t, balancer_idx)->first_member + worker_idx;
+  uint32_t* bits;
+
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return;
+  bits = &counters[down_base_offset(t) + member / 32];
+  if (down) {
+    PAL__COUNTER_OR(bits, 1u << (member % 32));
+  } else {
+    PAL__COUNTER_AND(bits, ~(1u << (member % 32)));
+  }
+}
+
+int routing_counters_claim_retry(uint32_t* counters, const routing_table* t,
+                                 int balancer_idx, size_t worker_idx,
+                                 uint32_t now_ms, uint32_t interval_ms) {
+  uint32_t* retried_at;
+  uint32_t last;
+
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return 1;
+  retried_at = &counters[retry_offset(t, balancer_idx, worker_idx)];
+  last = PAL__COUNTER_READ(retried_at);
+  // the clocks of the processes may be a bit apart: a claim from the
+  // future is still running
+  if (last != 0 && (int32_t)(now_ms - last) < (int32_t)interval_ms) return 0;
+  // 0 means never retried
+  return PAL__COUNTER_CAS(retried_at, last, (now_ms != 0) ? now_ms : 1u);
+}
+
+void routing_counters_observe(uint32_t* counters, const routing_table* t,
+                              int balancer_idx, size_t worker_idx,
+                              uint32_t response_us, uint32_t now_ms,
+                              uint32_t decay_ms) {
+  uint32_t* ewma;
+  uint32_t average;
+
+  if (worker_idx >= balancer_at(t, balancer_idx)->member_count) return;
+  ewma = &counters[ewma_offset(t, balancer_idx, worker_idx)];
+  average = PAL__COUNTER_READ(&ewma[kEWMA_AVERAGE]);
+
+  if (response_us > average) {
+    average = response_us;
+  } else {
+    const double w = ewma_decay(
+        now_ms - PAL__COUNTER_READ(&ewma[kEWMA_STAMP]), decay_ms);
+    average = (uint32_t)(average * w + response_us * (1.0 - w));
+  }
+
+  PAL__COUNTER_STORE(&ewma[kEWMA_AVERAGE], average);
+  PAL__COUNTER_STORE(&ewma[kEWMA_STAMP], now_ms);
+}
+
+uint32_t routing_counters_peak_ewma(const uint32_t* counters,
+                                    const routing_table* t, int balancer_idx,
+                                    size_t worker_idx, uint32_t now_ms,
+                                    uint32_t decay_ms) {
+  const uint32_t* ewma = &counters[ewma_offset(t, balancer_idx, worker_idx)];
+  const uint32_t average = PAL__COUNTER_READ(&ewma[kEWMA_AVERAGE]);
+  if (average == 0) return 0;
+  return (uint32_t)(average *
+                    ewma_decay(now_ms - PAL__COUNTER_READ(&ewma[kEWMA_STAMP]),
+                               decay_ms));
+}
+
+uint32_t routing_counters_hits(const uint32_t* counters,
+                               const routing_table* t, int site_idx,
+                               int balancer_idx, size_t worker_idx, int kind) {
+  return PAL__COUNTER_READ(
+      &counters[hits_offset(t, site_idx, balancer_idx, worker_idx) + kind]);
+}
+
+uint32_t routing_counters_no_candidates(const uint32_t* counters,
+                                        const routing_table* t, int site_idx,
+                                        int balancer_idx) {
+  return PAL__COUNTER_READ(
+      &counters[no_candidates_offset(t, site_idx, balancer_idx)]);
+}
+
+uint32_t routing_counters_unknown_sites(const uint32_t* counters,
+                                        const routing_table* t,
+                                        int balancer_idx) {
+  return PAL__COUNTER_READ(&counters[unknown_sites_offset(t, balancer_idx)]);
+}
+
+uint32_t routing_counters_no_sites(const uint32_t* counters,
+                                   const routing_table* t, int balancer_idx) {
+  return PAL__COUNTER_READ(&counters[no_sites_offset(t, balancer_idx)]);
+}
@@ -0,0 +1,221 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include "routing-table.h"
+
+/*
+        Counters of the routing decisions made with a routing table.
+
+        The counters are a block of uint32_t-s laid out after the dimensions
+        of the table they belong to (and reset with each new table):
+
+        - the hits of each site on each balancer member, by the tier the
+          member was picked from (preferred or fallback). Requests without a
+          known site are counted in an extra row after the sites.
+        - the requests of each site (and the extra row) on each balancer for
+          which no candidate was usable
+        - the requests of each balancer with a :site that is not in the
+          table, and without a :site
+        - the peak EWMA response time of each balancer member
+        - the requests of each site in flight on each balancer member, and
+          on the preferred members of the site altogether
+        - whether each site spills over from its preferred members on each
+          balancer, and how many times it started to
+        - when each balancer member was last retried, and a bit for each
+          member known to be down
+
+        They are updated with relaxed atomic increments from every thread of
+        every process: a decision costs a single uncontended add (unless the
+        same site / member pair is hot on many cores), and readers may see a
+        slightly stale picture. The counters wrap at 2^32.
+*/
+
+// The picks counted for each site / balancer member
+enum {
+  kDECISION_PREFERRED = 0,
+  kDECISION_FALLBACK = 1,
+
+  kDECISION_KIND_COUNT
+};
+
+// Returns the size of the counter block of a table in bytes
+size_t routing_counters_size(const routing_table* t);
+
+// Counts a pick of member worker_idx of a balancer from tier (kTIER_PREFER to
+// kTIER_ALLOW). site_idx may be kROUTING_NOT_FOUND.
+void routing_counters_hit(uint32_t* counters, const routing_table* t,
+                          int site_idx, int balancer_idx, size_t worker_idx,
+                          int tier);
+
+// Counts a request for which no candidate was usable
+void routing_counters_no_candidate(uint32_t* counters, const routing_table* t,
+                                   int site_idx, int balancer_idx);
+
+// Counts a request with a :site that is not in the table
+void routing_counters_unknown_site(uint32_t* counters, const routing_table* t,
+                                   int balancer_idx);
+
+// Counts a request without a :site
+void routing_counters_no_site(uint32_t* counters, const routing_table* t,
+                              int balancer_idx);
+
+/*
+        In-flight requests of the sites. A request is counted from the pick
+        (routing_counters_request_started()) until it is done
+        (routing_counters_request_done() with the same arguments), and on
+        the preferred tier count of its site if it was picked from tier
+        kTIER_PREFER. Requests without a known site are not counted.
+
+        The counts never go below 0: routing_counters_request_done() returns
+        0 if the member count of the request was already 0 (the count moved
+        on to a newer table).
+*/
+void routing_counters_request_started(uint32_t* counters,
+                                      const routing_table* t, int site_idx,
+                                      int balancer_idx, size_t worker_idx,
+                                      int tier);
+int routing_counters_request_done(uint32_t* counters, const routing_table* t,
+                                  int site_idx, int balancer_idx,
+                                  size_t worker_idx, int tier);
+
+/*
+        Moves the in-flight counts of the sites and balancers of a table
+        that are also in the next one (by name, the members by their index
+        in the balancer) over to the next table, and leaves 0 behind. The
+        requests counted on the old table after the move are released
+        there.
+*/
+void routing_counters_move_in_flight(uint32_t* to, const routing_table* to_t,
+                                     uint32_t* from,
+                                     const routing_table* from_t);
+
+// Returns the requests of a site in flight on its preferred members
+uint32_t routing_counters_site_in_flight(const uint32_t* counters,
+                                         const routing_table* t,
+                                         int site_idx);
+
+// Returns the requests of a site in flight on a balancer member
+uint32_t routing_counters_member_in_flight(const uint32_t* counters,
+                                           const routing_table* t,
+                                           int site_idx, int balancer_idx,
+                                           size_t worker_idx);
+
+// Returns the requests of a site in flight on the members of a binding host
+// (on every balancer)
+uint32_t routing_counters_host_in_flight(const uint32_t* counters,
+                                         const routing_table* t, int site_idx,
+                                         int host_idx);
+
+/*
+        Overflow state of the sites on each balancer: set while the site
+        spills over from its saturated preferred members to the fallback
+        tiers. Setting it counts the start of an overflow.
+*/
+int routing_counters_overflowing(const uint32_t* counters,
+                                 const routing_table* t, int site_idx,
+                                 int balancer_idx);
+void routing_counters_set_overflowing(uint32_t* counters,
+                                      const routing_table* t, int site_idx,
+                                      int balancer_idx, int overflowing);
+
+// Returns how many times a site started to spill over on a balancer
+uint32_t routing_counters_overflows(const uint32_t* counters,
+                                    const routing_table* t, int site_idx,
+                                    int balancer_idx);
+
+/*
+        Health of the balancer members. A member is marked down once a
+        request finds it unusable, and up again once a retry brings it
+        back, so the requests skip the members known to be down without
+        reading their shared state. A new table starts with every member
+        up (the next request that meets a dead one marks it again).
+
+        The retries of a member are single-flight across all the processes:
+        routing_counters_claim_retry() lets one caller retry the member and
+        turns the others away for interval_ms.
+*/
+int routing_counters_member_down(const uint32_t* counters,
+                                 const routing_table* t, int balancer_idx,
+                                 size_t worker_idx);
+void routing_counters_set_member_down(uint32_t* counters,
+                                      const routing_table* t,
+                                      int balancer_idx, size_t worker_idx,
+                                      int down);
+
+// Returns 1 if the caller may retry the member now (and starts its
+// interval), 0 if it was retried within interval_ms
+int routing_counters_claim_retry(uint32_t* counters, const routing_table* t,
+                                 int balancer_idx, size_t worker_idx,
+                                 uint32_t now_ms, uint32_t interval_ms);
+
+/*
+        Peak EWMA response times of the balancer members.
+
+        A response slower than the current average replaces it at once (the
+        peak), faster ones are folded in with a weight that grows with the
+        time since the last sample, so the average decays towards the recent
+        response times over about decay_ms. Times are in microseconds and
+        the timestamps are milliseconds (only their differences are used, so
+        they may wrap).
+
+        The average and its timestamp are two relaxed stores: racing updates
+        may lose a sample, which only makes the average slightly less exact.
+*/
+void routing_counters_observe(uint32_t* counters, const routing_table* t,
+                              int balancer_idx, size_t worker_idx,
+                              uint32_t response_us, uint32_t now_ms,
+                              uint32_t decay_ms);
+
+// Returns the response time average of a member decayed to now_ms (0 if the
+// member has no samples yet)
+uint32_t routing_counters_peak_ewma(const uint32_t* counters,
+                                    const routing_table* t, int balancer_idx,
+                                    size_t worker_idx, uint32_t now_ms,
+                                    uint32_t decay_ms);
+
+/*
+        Histogram of the time spent selecting a worker. Unlike the decision
+        counters it is not tied to a table and survives reloads.
+*/
+enum { kLATENCY_BUCKET_COUNT = 10 };
+
+// The upper bounds of the buckets in microseconds (a last, unbounded bucket
+// follows them)
+extern const uint32_t kLATENCY_BUCKET_BOUNDS_US[kLATENCY_BUCKET_COUNT];
+
+typedef struct routing_latency {
+  uint32_t buckets[kLATENCY_BUCKET_COUNT + 1];
+  uint64_t sum_us;
+} routing_latency;
+
+void routing_latency_record(routing_latency* latency, uint64_t us);
+
+// Readers of the counters (site_idx may be kROUTING_NOT_FOUND)
+uint32_t routing_counters_hits(const uint32_t* counters,
+                               const routing_table* t, int site_idx,
+                               int balancer_idx, size_t worker_idx, int kind);
+uint32_t routing_counters_no_candidates(const uint32_t* counters,
+                                        const routing_table* t, int site_idx,
+                                        int balancer_idx);
+uint32_t routing_counters_unknown_sites(const uint32_t* counters,
+                                        const routing_table* t,
+                                        int balancer_idx);
+uint32_t routing_counters_no_sites(const uint32_t* counters,
+                                   const routing_table* t, int balancer_idx);
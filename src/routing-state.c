@@ -0,0 +1,401 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "routing-state.h"
+
+#include <apr_atomic.h>
+#include <apr_shm.h>
+#include <apr_thread_proc.h>
+#include <string.h>
+
+#include "routing-counters.h"
+
+enum {
+  // The table slots of the segment: the active one, and the retired ones
+  // still read by a slow request or status page while the next table is
+  // written into a free one
+  kSLOT_COUNT = 4,
+
+  // The alignment of the slots inside the segment
+  kSLOT_ALIGNMENT = 64,
+
+  // The binding edits waiting for the parent
+  kEDIT_QUEUE_SIZE = 32,
+
+  // The drained pairs counted in flight at the same time
+  kDRAIN_SLOT_COUNT = 64,
+};
+
+// Set in the reader count of a slot while the writer fills it: the readers
+// that look at the slot meanwhile back off
+static const apr_uint32_t kSLOT_WRITING = 0x80000000u;
+
+typedef struct routing_slot {
+  // Offset of the table from the start of the segment
+  apr_size_t offset;
+
+  // The number of readers using the table (and kSLOT_WRITING while it is
+  // written)
+  volatile apr_uint32_t readers;
+} routing_slot;
+
+// The requests in flight on a drained pair. The epoch changes each time the
+// slot is handed to another pair, so the requests of the earlier pair are
+// not taken off the count of the new one.
+typedef struct routing_drain_slot {
+  volatile apr_uint32_t in_flight;
+  volatile apr_uint32_t epoch;
+} routing_drain_slot;
+
+// The header at the start of the segment
+typedef struct routing_segment {
+  volatile apr_uint32_t generation;
+
+  // The index of the active slot plus one, 0 before the first publish.
+  // Written with an atomic exchange (which is a full barrier, so the table
+  // is complete before it is visible).
+  volatile apr_uint32_t active;
+
+  apr_size_t slot_size;
+  routing_slot slots[kSLOT_COUNT];
+
+  apr_time_t created_at;
+  volatile apr_time_t published_at;
+
+  routing_latency latency;
+
+  // The binding edits posted by the children for the parent: a ring of
+  // kEDIT_QUEUE_SIZE, guarded by edits_lock
+  volatile apr_uint32_t edits_lock;
+  apr_uint32_t edits_posted;
+  apr_uint32_t edits_taken;
+  binding_edit edits[kEDIT_QUEUE_SIZE];
+
+  // The counters of the drained pairs of the published tables. A pair
+  // keeps its slot while it stays drained, the search for a free one
+  // starts after the last slot handed out.
+  routing_drain_slot drain_slots[kDRAIN_SLOT_COUNT];
+  apr_uint32_t next_drain_slot;
+} routing_segment;
+
+// The segment of this process (inherited from the parent by the children)
+static routing_segment* segment = NULL;
+
+static apr_size_t align_up(apr_size_t size, apr_size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static routing_table* slot_table(const routing_segment* seg, apr_uint32_t i) {
+  return (routing_table*)((char*)seg + seg->slots[i].offset);
+}
+
+static apr_status_t routing_state_detach(void* data) {
+  segment = NULL;
+  return APR_SUCCESS;
+}
+
+apr_status_t routing_state_create(apr_pool_t* pconf, apr_size_t slot_size) {
+  const apr_size_t header_size =
+      align_up(sizeof(routing_segment), kSLOT_ALIGNMENT);
+  apr_shm_t* shm = NULL;
+  routing_segment* seg;
+  apr_status_t rv;
+  apr_uint32_t i;
+
+  slot_size = align_up(slot_size, kSLOT_ALIGNMENT);
+
+  // Anonymous memory is inherited by the children forked after this
+  rv = apr_shm_create(&shm, header_size + kSLOT_COUNT * slot_size, NULL,
+                      pconf);
+  if (rv != APR_SUCCESS) return rv;
+
+  seg = (routing_segment*)apr_shm_baseaddr_get(shm);
+  memset(seg, 0, header_size);
+  seg->slot_size = slot_size;
+  seg->created_at = apr_time_now();
+  for (i = 0; i < kSLOT_COUNT; ++i) {
+    seg->slots[i].offset = header_size + i * slot_size;
+  }
+
+  segment = seg;
+
+  // The segment is destroyed with the pool (on restart), forget it first
+  apr_pool_pre_cleanup_register(pconf, NULL, routing_state_detach);
+  return APR_SUCCESS;
+}
+
+// Returns 1 if the drains of the two tables are for the same pair
+static int same_drain(const routing_table* a, const routing_drain* drain_a,
+                      const routing_table* b, const routing_drain* drain_b) {
+  return drain_a->binding_set == drain_b->binding_set &&
+         strcasecmp(routing_table_site_name(a, drain_a->site),
+                    routing_table_site_name(b, drain_b->site)) == 0 &&
+         strcasecmp(routing_table_host_name(a, drain_a->host),
+                    routing_table_host_name(b, drain_b->host)) == 0;
+}
+
+/*
+        Hands a drain slot to each drain of the table about to be published:
+        the pairs drained in the current table keep their slot (and their
+        count), the others get a free one, counting from 0. The drains left
+        without a free slot are not counted.
+*/
+static void assign_drain_slots(routing_segment* seg, routing_table* table,
+                               const routing_table* current) {
+  routing_drain* drains =
+      ROUTING_TABLE_AT(table, routing_drain, table->drains_offset);
+  char used[kDRAIN_SLOT_COUNT];
+  uint32_t i, j, n;
+
+  memset(used, 0, sizeof(used));
+  for (i = 0; i < table->drain_count; ++i) {
+    const routing_drain* kept =
+        (current != NULL) ? routing_table_drains(current) : NULL;
+    drains[i].slot = kROUTING_NO_DRAIN_SLOT;
+    for (j = 0; current != NULL && j < current->drain_count; ++j) {
+      if (kept[j].slot != kROUTING_NO_DRAIN_SLOT &&
+          same_drain(table, &drains[i], current, &kept[j])) {
+        drains[i].slot = kept[j].slot;
+        used[kept[j].slot] = 1;
+        break;
+      }
+    }
+  }
+
+  for (i = 0; i < table->drain_count; ++i) {
+    if (drains[i].slot != kROUTING_NO_DRAIN_SLOT) continue;
+    for (n = 0; n < kDRAIN_SLOT_COUNT; ++n) {
+      const apr_uint32_t slot = (seg->next_drain_slot + n) % kDRAIN_SLOT_COUNT;
+      if (used[slot]) continue;
+      used[slot] = 1;
+      seg->next_drain_slot = slot + 1;
+      apr_atomic_inc32(&seg->drain_slots[slot].epoch);
+      apr_atomic_set32(&seg->drain_slots[slot].in_flight, 0);
+      drains[i].slot = slot;
+      break;
+    }
+  }
+}
+
+// Takes a slot other than the active one that no reader uses for writing
+// the next table (kSLOT_COUNT if all of them are in use)
+static apr_uint32_t lock_free_slot(routing_segment* seg, apr_uint32_t active) {
+  apr_uint32_t n;
+
+  for (n = 0; n < kSLOT_COUNT; ++n) {
+    // start after the active slot, so the slots take turns
+    const apr_uint32_t i = (active + n) % kSLOT_COUNT;
+    if (i + 1 == active) continue;
+    if (apr_atomic_cas32(&seg->slots[i].readers, kSLOT_WRITING, 0) == 0) {
+      return i;
+    }
+  }
+  return kSLOT_COUNT;
+}
+
+apr_status_t routing_state_publish(const routing_table* table,
+                                   apr_uint32_t* generation) {
+  routing_segment* seg = segment;
+  apr_uint32_t active, next;
+  routing_table* copy;
+
+  if (seg == NULL) return APR_ENOSHMAVAIL;
+  if (routing_state_slot_size(table) > seg->slot_size) return APR_ENOSPC;
+
+  // Every other slot still holds a table someone is using
+  active = apr_atomic_read32(&seg->active);
+  next = lock_free_slot(seg, active);
+  if (next == kSLOT_COUNT) return APR_EAGAIN;
+
+  copy = slot_table(seg, next);
+  memcpy(copy, table, table->size);
+  memset(routing_state_counters(copy), 0, routing_counters_size(copy));
+  assign_drain_slots(seg, copy,
+                     (active != 0) ? slot_table(seg, active - 1) : NULL);
+  copy->generation = apr_atomic_read32(&seg->generation) + 1;
+  seg->published_at = apr_time_now();
+
+  apr_atomic_xchg32(&seg->active, next + 1);
+  apr_atomic_set32(&seg->generation, copy->generation);
+  apr_atomic_sub32(&seg->slots[next].readers, kSLOT_WRITING);
+
+  // The requests picked with the previous table go on, and so do their
+  // counts (moved once the new picks are counted on the new table)
+  if (active != 0) {
+    const routing_table* previous = slot_table(seg, active - 1);
+    routing_counters_move_in_flight(routing_state_counters(copy), copy,
+                                    routing_state_counters(previous),
+                                    previous);
+  }
+
+  if (generation != NULL) *generation = copy->generation;
+  return APR_SUCCESS;
+}
+
+const routing_table* routing_state_current(void) {
+  const routing_segment* seg = segment;
+  apr_uint32_t active;
+
+  if (seg == NULL) return NULL;
+  active = seg->active;
+  return (active == 0) ? NULL : slot_table(seg, active - 1);
+}
+
+const routing_table* routing_state_acquire(void) {
+  routing_segment* seg = segment;
+
+  if (seg == NULL) return NULL;
+
+  for (;;) {
+    const apr_uint32_t active = apr_atomic_read32(&seg->active);
+    if (active == 0) return NULL;
+
+    // Only keep the reference if the slot was not retired meanwhile (a
+    // retired slot may be written again as soon as it has no readers)
+    apr_atomic_inc32(&seg->slots[active - 1].readers);
+    if (apr_atomic_read32(&seg->active) == active) {
+      return slot_table(seg, active - 1);
+    }
+    apr_atomic_dec32(&seg->slots[active - 1].readers);
+  }
+}
+
+const routing_table* routing_state_acquire_generation(
+    apr_uint32_t generation) {
+  routing_segment* seg = segment;
+  apr_uint32_t i;
+
+  if (seg == NULL) return NULL;
+  for (i = 0; i < kSLOT_COUNT; ++i) {
+    // a slot being written is not read, one with a reader is not written
+    if ((apr_atomic_inc32(&seg->slots[i].readers) & kSLOT_WRITING) == 0 &&
+        slot_table(seg, i)->generation == generation) {
+      return slot_table(seg, i);
+    }
+    apr_atomic_dec32(&seg->slots[i].readers);
+  }
+  return NULL;
+}
+
+void routing_state_release(const routing_table* table) {
+  routing_segment* seg = segment;
+  apr_uint32_t i;
+
+  if (seg == NULL || table == NULL) return;
+  for (i = 0; i < kSLOT_COUNT; ++i) {
+    if (slot_table(seg, i) == table) {
+      apr_atomic_dec32(&seg->slots[i].readers);
+      return;
+    }
+  }
+}
+
+uint32_t* routing_state_counters(const routing_table* table) {
+  return (uint32_t*)((char*)table + align_up(table->size, kSLOT_ALIGNMENT));
+}
+
+apr_size_t routing_state_slot_size(const routing_table* table) {
+  return align_up(table->size, kSLOT_ALIGNMENT) + routing_counters_size(table);
+}
+
+apr_uint32_t routing_state_generation(void) {
+  return (segment == NULL) ? 0 : apr_atomic_read32(&segment->generation);
+}
+
+routing_latency* routing_state_latency(void) {
+  return (segment == NULL) ? NULL : &segment->latency;
+}
+
+apr_time_t routing_state_created_at(void) {
+  return (segment == NULL) ? 0 : segment->created_at;
+}
+
+apr_time_t routing_state_published_at(void) {
+  return (segment == NULL) ? 0 : segment->published_at;
+}
+
+// The edit queue is only locked to copy an edit in or out, so spinning is
+// cheaper than a process mutex (which the children would have to reopen)
+static void lock_edits(routing_segment* seg) {
+  while (apr_atomic_cas32(&seg->edits_lock, 1, 0) != 0) apr_thread_yield();
+}
+
+static void unlock_edits(routing_segment* seg) {
+  apr_atomic_xchg32(&seg->edits_lock, 0);
+}
+
+apr_status_t routing_state_post_edit(const binding_edit* edit) {
+  routing_segment* seg = segment;
+  apr_status_t rv = APR_SUCCESS;
+
+  if (seg == NULL) return APR_ENOSHMAVAIL;
+
+  lock_edits(seg);
+  if (seg->edits_posted - seg->edits_taken >= kEDIT_QUEUE_SIZE) {
+    rv = APR_EAGAIN;
+  } else {
+    seg->edits[seg->edits_posted % kEDIT_QUEUE_SIZE] = *edit;
+    seg->edits_posted++;
+  }
+  unlock_edits(seg);
+  return rv;
+}
+
+size_t routing_state_take_edits(binding_edit* edits, size_t max_count) {
+  routing_segment* seg = segment;
+  size_t count = 0;
+
+  if (seg == NULL) return 0;
+
+  lock_edits(seg);
+  while (count < max_count && seg->edits_taken != seg->edits_posted) {
+    edits[count++] = seg->edits[seg->edits_taken % kEDIT_QUEUE_SIZE];
+    seg->edits_taken++;
+  }
+  unlock_edits(seg);
+  return count;
+}
+
+routing_drain_ticket routing_state_drain_started(const routing_drain* drain) {
+  routing_segment* seg = segment;
+  routing_drain_ticket ticket = {kROUTING_NO_DRAIN_SLOT, 0};
+
+  if (seg == NULL || drain->slot >= kDRAIN_SLOT_COUNT) return ticket;
+  ticket.slot = drain->slot;
+  ticket.epoch = apr_atomic_read32(&seg->drain_slots[drain->slot].epoch);
+  apr_atomic_inc32(&seg->drain_slots[drain->slot].in_flight);
+  return ticket;
+}
+
+void routing_state_drain_done(const routing_drain_ticket* ticket) {
+  routing_segment* seg = segment;
+  routing_drain_slot* slot;
+
+  if (seg == NULL || ticket->slot >= kDRAIN_SLOT_COUNT) return;
+  slot = &seg->drain_slots[ticket->slot];
+  // the slot went to another pair meanwhile (and was zeroed)
+  if (apr_atomic_read32(&slot->epoch) != ticket->epoch) return;
+  if (apr_atomic_read32(&slot->in_flight) > 0) {
+    apr_atomic_dec32(&slot->in_flight);
+  }
+}
+
+apr_uint32_t routing_state_drain_in_flight(const routing_drain* drain) {
+  if (segment == NULL || drain->slot >= kDRAIN_SLOT_COUNT) return 0;
+  return apr_atomic_read32(&segment->drain_slots[drain->slot].in_flight);
+}
@@ -0,0 +1,138 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+#include "binding-edits.h"
+#include "routing-counters.h"
+#include "routing-table.h"
+
+/*
+        The routing table published to the request threads of every child
+        process.
+
+        The table lives in a shared memory segment created by the parent at
+        post_config (and inherited by the children), so there is one copy
+        for all the children and every child sees the same version. The
+        segment has a few slots for tables: the writer (the parent, which
+        reloads the bindings) copies the new table into a slot no reader
+        uses and publishes it by switching the active slot and bumping the
+        generation. The tables only hold offsets, so they work wherever the
+        segment is mapped. Each table is followed by its decision counters
+        (see routing-counters.h).
+
+        Every reader holds a reference to the table it uses
+        (routing_state_acquire() / routing_state_release()), and a slot is
+        only written again once its table is retired and has no readers
+        left. The request threads hold theirs for a few microseconds (two
+        atomic adds per request), the status pages while they write to the
+        client, which may block: a publish only has to wait if every
+        retired slot is still read.
+*/
+
+/*
+        Creates the shared segment with room for tables of up to slot_size
+        bytes. The segment is destroyed with the pool.
+
+        Must be called from the parent before the children are started.
+*/
+apr_status_t routing_state_create(apr_pool_t* pconf, apr_size_t slot_size);
+
+/*
+        Copies the table into the shared segment (with zeroed counters) and
+        publishes it. The in-flight counts of the current table move over
+        to the sites and members that are in both tables. The drains of
+        the table get their in-flight counters, the pairs that were drained
+        in the current table keep theirs. Stores
+        the generation of the published table in generation.
+
+        Returns APR_ENOSPC if the table does not fit into a slot and
+        APR_EAGAIN if every slot but the active one is still read (try
+        again later).
+
+        Only one thread may publish (the post_config hook and the reload
+        thread of the parent never run at the same time).
+*/
+apr_status_t routing_state_publish(const routing_table* table,
+                                   apr_uint32_t* generation);
+
+// Returns the current table (or NULL) without a reference: only for the
+// writer, whose own tables are never written over under it
+const routing_table* routing_state_current(void);
+
+// Returns the current table (or NULL) and keeps it alive until it is
+// released
+const routing_table* routing_state_acquire(void);
+void routing_state_release(const routing_table* table);
+
+// Returns the table of a generation (or NULL if its slot was written over
+// since) and keeps it alive until it is released
+const routing_table* routing_state_acquire_generation(
+    apr_uint32_t generation);
+
+// Returns the decision counters of a table returned by
+// routing_state_current() or routing_state_acquire()
+uint32_t* routing_state_counters(const routing_table* table);
+
+// Returns the bytes a slot needs for the table and its counters
+apr_size_t routing_state_slot_size(const routing_table* table);
+
+// Returns the selection time histogram of the segment (or NULL)
+routing_latency* routing_state_latency(void);
+
+// Returns the generation of the current table (0 before the first publish)
+apr_uint32_t routing_state_generation(void);
+
+// Returns when the segment was created (0 if there is none): tables of
+// different segments may have the same generation
+apr_time_t routing_state_created_at(void);
+
+// Returns when the current table was published (0 before the first publish)
+apr_time_t routing_state_published_at(void);
+
+/*
+        Queues a binding edit for the parent (from any process). Returns
+        APR_EAGAIN if the queue is full (the parent takes the edits once a
+        second) and APR_ENOSHMAVAIL if there is no segment.
+*/
+apr_status_t routing_state_post_edit(const binding_edit* edit);
+
+// Takes up to max_count of the queued edits, in the order they were posted,
+// and returns their count. Only the parent takes the edits.
+size_t routing_state_take_edits(binding_edit* edits, size_t max_count);
+
+// A request counted in flight on a drained pair
+typedef struct routing_drain_ticket {
+  apr_uint32_t slot;
+  apr_uint32_t epoch;
+} routing_drain_ticket;
+
+/*
+        Counts a request in flight on a drained pair of the current table
+        until routing_state_drain_done(). The count outlives the table: it
+        goes on in the tables published later, as long as the pair stays
+        drained.
+*/
+routing_drain_ticket routing_state_drain_started(const routing_drain* drain);
+void routing_state_drain_done(const routing_drain_ticket* ticket);
+
+// Returns the requests in flight on a drained pair of a published table
+apr_uint32_t routing_state_drain_in_flight(const routing_drain* drain);
@@ -0,0 +1,1136 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "routing-table.h"
+
+#include <ctype.h>
+#include <mod_proxy.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  // The alignment of the arrays inside the table
+  kTABLE_ALIGNMENT = 8,
+
+  // The smallest number of buckets in the site hash index (and in the
+  // member route index)
+  kMIN_SITE_BUCKETS = 16,
+
+  // The most addresses of a host compared when matching by address
+  kMAX_MATCHED_ADDRESSES = 8,
+};
+
+uint32_t routing_site_hash(const char* name, size_t length) {
+  uint32_t hash = PAL__FNV1A_INIT;
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    hash = PAL__FNV1A_STEP_CASEFOLD(hash, name[i]);
+  }
+  return hash;
+}
+
+// Returns 1 if the two names are the same ignoring the (ASCII) case
+static int names_equal(const char* a, const char* b, size_t length) {
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    if (PAL__ASCII_TOLOWER(a[i]) != PAL__ASCII_TOLOWER(b[i])) return 0;
+  }
+  return 1;
+}
+
+// Returns the smallest power of two bucket count for entry_count entries
+// that keeps the load factor of the index at or under 50%.
+static size_t bucket_count_for(size_t entry_count) {
+  size_t count = kMIN_SITE_BUCKETS;
+  while (count < entry_count * 2) count *= 2;
+  return count;
+}
+
+// Name interning
+// --------------
+
+// A temporary, case-insensitive set of names used while building the table
+typedef struct name_index {
+  const char** names;
+  size_t* lengths;
+  uint32_t* hashes;
+  size_t count;
+
+  // site index + 1, or 0 for empty buckets
+  uint32_t* buckets;
+  size_t bucket_mask;
+} name_index;
+
+static int name_index_init(name_index* idx, size_t capacity) {
+  const size_t bucket_count = bucket_count_for(capacity);
+  idx->names = (const char**)malloc(sizeof(const char*) * (capacity + 1));
+  idx->lengths = (size_t*)malloc(sizeof(size_t) * (capacity + 1));
+  idx->hashes = (uint32_t*)malloc(sizeof(uint32_t) * (capacity + 1));
+  idx->buckets = (uint32_t*)calloc(bucket_count, sizeof(uint32_t));
+  idx->bucket_mask = bucket_count - 1;
+  idx->count = 0;
+
+  return idx->names != NULL && idx->lengths != NULL && idx->hashes != NULL &&
+         idx->buckets != NULL;
+}
+
+static void name_index_free(name_index* idx) {
+  free((void*)idx->names);
+  free(idx->lengths);
+  free(idx->hashes);
+  free(idx->buckets);
+}
+
+// Returns the bucket for the name (either empty or holding the name)
+static uint32_t* name_index_bucket(const name_index* idx, const char* name,
+                                   size_t length, uint32_t hash) {
+  size_t b = hash & idx->bucket_mask;
+  for (;;) {
+    const uint32_t entry = idx->buckets[b];
+    if (entry == 0) return &idx->buckets[b];
+    if (idx->hashes[entry - 1] == hash && idx->lengths[entry - 1] == length &&
+        names_equal(idx->names[entry - 1], name, length)) {
+      return &idx->buckets[b];
+    }
+    b = (b + 1) & idx->bucket_mask;
+  }
+}
+
+// Adds the name (if not yet added) and returns its index
+static int name_index_add(name_index* idx, const char* name) {
+  const size_t length = strlen(name);
+  const uint32_t hash = routing_site_hash(name, length);
+  uint32_t* bucket = name_index_bucket(idx, name, length, hash);
+
+  if (*bucket == 0) {
+    idx->names[idx->count] = name;
+    idx->lengths[idx->count] = length;
+    idx->hashes[idx->count] = hash;
+    idx->count++;
+    *bucket = (uint32_t)idx->count;
+  }
+
+  return (int)(*bucket - 1);
+}
+
+// Returns the index of the name or kROUTING_NOT_FOUND
+static int name_index_find(const name_index* idx, const char* name) {
+  const size_t length = strlen(name);
+  const uint32_t* bucket = name_index_bucket(
+      idx, name, length, routing_site_hash(name, length));
+  return (*bucket == 0) ? kROUTING_NOT_FOUND : (int)(*bucket - 1);
+}
+
+// Table layout
+// ------------
+
+// Reserves bytes at the end of the layout and returns their offset
+static uint32_t layout_reserve(size_t* size, size_t bytes) {
+  const size_t offset = *size;
+  *size = offset + ((bytes + kTABLE_ALIGNMENT - 1) & ~(kTABLE_ALIGNMENT - 1));
+  return (uint32_t)offset;
+}
+
+// Copies a name into the string area and returns its offset
+static uint32_t store_string(routing_table* t, uint32_t* strings_used,
+                             const char* s, size_t length) {
+  const uint32_t offset = t->strings_offset + *strings_used;
+  memcpy(ROUTING_TABLE_AT(t, char, offset), s, length);
+  *ROUTING_TABLE_AT(t, char, offset + length) = '\0';
+  *strings_used += (uint32_t)(length + 1);
+  return offset;
+}
+
+// Returns the first bucket of a member route in the route index
+static uint32_t route_bucket(const routing_table* t, int balancer_idx,
+                             uint32_t hash) {
+  return (hash ^ ((uint32_t)balancer_idx * 0x9e3779b1u)) &
+         t->route_bucket_mask;
+}
+
+/*
+        Adds the routes of the members of a balancer to the route index. For
+        a route shared by members the first one wins, like in
+        mod_proxy_balancer.
+*/
+static void index_member_routes(routing_table* t, int balancer_idx) {
+  const routing_balancer* balancer =
+      ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset) +
+      balancer_idx;
+  const routing_member_route* routes =
+      ROUTING_TABLE_AT(t, routing_member_route, t->member_routes_offset);
+  uint32_t* buckets = ROUTING_TABLE_AT(t, uint32_t, t->route_buckets_offset);
+  uint32_t m;
+
+  for (m = 0; m < balancer->member_count; ++m) {
+    const routing_member_route* route = &routes[balancer->first_member + m];
+    if (route->name_offset == 0 ||
+        routing_table_find_route(
+            t, balancer_idx,
+            ROUTING_TABLE_AT(t, const char, route->name_offset)) !=
+            kROUTING_NOT_FOUND) {
+      continue;
+    }
+    {
+      uint32_t b = route_bucket(t, balancer_idx, route->hash);
+      while (buckets[b] != 0) b = (b + 1) & t->route_bucket_mask;
+      buckets[b] = balancer->first_member + m + 1;
+    }
+  }
+}
+
+// Maps a binding kind to the tier its workers are tried in
+static int tier_for_kind(binding_kind_t kind) {
+  if (kind >= kBINDING_PREFER && kind <= kBINDING_MAX_PRIORITY) {
+    return kTIER_PREFER + (kind - kBINDING_PREFER);
+  }
+  if (kind == kBINDING_FORBID) return kTIER_FORBID;
+  return kTIER_ALLOW;
+}
+
+// A member of a balancer and its place inside the tiers of the routes: by
+// lbset, then the standby members after the others, so the selection usually
+// meets the workers it picks from first
+typedef struct ordered_member {
+  int64_t order;
+  uint32_t member;
+} ordered_member;
+
+// Sorting helper for the ordered_members (equal orders keep the member order)
+static int ordered_member_compare(const void* p1, const void* p2) {
+  const ordered_member* a = (const ordered_member*)p1;
+  const ordered_member* b = (const ordered_member*)p2;
+  if (a->order != b->order) return (a->order < b->order) ? -1 : 1;
+  return (a->member < b->member) ? -1 : (a->member > b->member);
+}
+
+// The site row of the default routes, which allow every member
+static const size_t kDEFAULT_SITE_ROW = (size_t)-1;
+
+// Returns 1 if the bit of the bitmap is set
+static int bit_is_set(const uint8_t* bits, size_t bit) {
+  return (bits[bit >> 3] >> (bit & 7)) & 1;
+}
+
+/*
+        Returns the tier of a member of a balancer for a site. site_row is
+        binding_set * site_count + site_idx (the row of the site in the
+        kinds and the drained bits), or kDEFAULT_SITE_ROW. A drained member
+        is not a candidate, whatever its binding.
+*/
+static int member_tier(const routing_table* t, size_t site_row,
+                       const routing_balancer* balancer, size_t member) {
+  const int32_t host =
+      ROUTING_TABLE_AT(t, int32_t, t->member_hosts_offset)[balancer->first_member +
+                                                           member];
+  size_t cell;
+
+  if (host < 0 || site_row == kDEFAULT_SITE_ROW) return kTIER_ALLOW;
+  cell = site_row * t->host_count + (size_t)host;
+  if (bit_is_set(ROUTING_TABLE_AT(t, uint8_t, t->drained_offset), cell)) {
+    return kTIER_FORBID;
+  }
+  return tier_for_kind(ROUTING_TABLE_AT(t, int8_t, t->kinds_offset)[cell]);
+}
+
+/*
+        Fills the candidates of a route from the binding kinds of the members
+        for the site row (see member_tier()). by_order lists the members of
+        the balancer by lbset, and the members keep that order inside their
+        tiers. Every route takes room for all the members of its balancer,
+        so it can be rebuilt in place when a binding changes.
+*/
+static void build_route(routing_table* t, routing_route* route,
+                        uint32_t* candidates_used, size_t site_row,
+                        const routing_balancer* balancer,
+                        const uint16_t* by_order) {
+  uint16_t* candidates = ROUTING_TABLE_AT(t, uint16_t, t->candidates_offset) +
+                         *candidates_used;
+  uint16_t next[kTIER_FORBID];
+  size_t i;
+  int tier;
+
+  route->candidates_offset = *candidates_used;
+  route->tier_mask = 0;
+  memset(route->ends, 0, sizeof(route->ends));
+
+  // count the members of each tier, so each tier gets a continous range
+  for (i = 0; i < balancer->member_count; ++i) {
+    tier = member_tier(t, site_row, balancer, i);
+    if (tier != kTIER_FORBID) route->ends[tier]++;
+  }
+  for (tier = 0; tier < kTIER_FORBID; ++tier) {
+    if (route->ends[tier] > 0) route->tier_mask |= (uint16_t)(1u << tier);
+    next[tier] = (tier > 0) ? route->ends[tier - 1] : 0;
+    route->ends[tier] = (uint16_t)(next[tier] + route->ends[tier]);
+  }
+  for (i = 0; i < balancer->member_count; ++i) {
+    tier = member_tier(t, site_row, balancer, by_order[i]);
+    if (tier != kTIER_FORBID) candidates[next[tier]++] = by_order[i];
+  }
+  *candidates_used += balancer->member_count;
+}
+
+// Returns 1 if the row sets the limit of a whole site
+static int is_site_limit_row(const binding_row* b) {
+  return strcmp(b->worker_host, kBINDING_ANY_HOST) == 0;
+}
+
+// Returns the index of a name of a row: the rows the loader interned map
+// their id to it, so each name is hashed once instead of for every row
+static int32_t intern_row_name(name_index* idx, int32_t* id_indices,
+                               uint32_t id, const char* name) {
+  if (id == kBINDING_NO_ID || id_indices == NULL) {
+    return name_index_add(idx, name);
+  }
+  if (id_indices[id] < 0) id_indices[id] = name_index_add(idx, name);
+  return id_indices[id];
+}
+
+/*
+        Interns the names of the rows of all the binding sets, and stores
+        the site and host index of every row (over all the binding sets)
+        into row_sites and row_hosts. Site limit rows have no host, and
+        rows without a site or a host neither (kROUTING_NOT_FOUND). Returns
+        0 if out of memory.
+*/
+static int index_rows(const binding_rows* binding_sets, name_index* sites,
+                      name_index* hosts, int32_t* row_sites,
+                      int32_t* row_hosts) {
+  size_t set, i, row = 0;
+
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    const binding_rows* rows = &binding_sets[set];
+    // the ids are per config, so the indices of their names are too
+    int32_t* id_indices = NULL;
+    size_t id_count = 0;
+
+    for (i = 0; i < rows->count; ++i) {
+      const binding_row* b = &rows->entries[i];
+      if (b->site_id != kBINDING_NO_ID && b->site_id >= id_count) {
+        id_count = (size_t)b->site_id + 1;
+      }
+      if (b->host_id != kBINDING_NO_ID && b->host_id >= id_count) {
+        id_count = (size_t)b->host_id + 1;
+      }
+    }
+    if (id_count > 0) {
+      // the site and the host indices of each id
+      id_indices = (int32_t*)malloc(sizeof(int32_t) * id_count * 2);
+      if (id_indices == NULL) return 0;
+      memset(id_indices, 0xff, sizeof(int32_t) * id_count * 2);
+    }
+
+    for (i = 0; i < rows->count; ++i, ++row) {
+      const binding_row* b = &rows->entries[i];
+      row_sites[row] = row_hosts[row] = kROUTING_NOT_FOUND;
+      if (b->site_name == NULL || b->worker_host == NULL) continue;
+
+      row_sites[row] =
+          intern_row_name(sites, id_indices, b->site_id, b->site_name);
+      if (!is_site_limit_row(b)) {
+        row_hosts[row] = intern_row_name(
+            hosts, id_indices != NULL ? id_indices + id_count : NULL,
+            b->host_id, b->worker_host);
+      }
+    }
+    free(id_indices);
+  }
+  return 1;
+}
+
+// In-flight limits
+// ----------------
+
+// A site / host limit collected from the rows while building the table
+typedef struct pending_limit {
+  int site;
+  int host;
+  // the position of the row over all binding sets, so the first row wins
+  size_t order;
+  uint32_t max_in_flight;
+} pending_limit;
+
+static int pending_limit_compare(const void* p1, const void* p2) {
+  const pending_limit* a = (const pending_limit*)p1;
+  const pending_limit* b = (const pending_limit*)p2;
+  if (a->site != b->site) return (a->site < b->site) ? -1 : 1;
+  if (a->host != b->host) return (a->host < b->host) ? -1 : 1;
+  return (a->order < b->order) ? -1 : (a->order > b->order);
+}
+
+/*
+        Collects the in-flight limits of the binding sets (with the site
+        and host indices of every row from index_rows()): the site limits
+        into site_limits (indexed by site) and the site / host limits,
+        ordered by site and without duplicates, into the returned array
+        (free() it). For duplicate limits the first row over the binding
+        sets wins. Returns NULL if there are no site / host limits.
+*/
+static pending_limit* collect_limits(const binding_rows* binding_sets,
+                                     const int32_t* row_sites,
+                                     const int32_t* row_hosts,
+                                     uint32_t* site_limits,
+                                     size_t* limit_count) {
+  pending_limit* limits = NULL;
+  size_t set, i, count = 0, order = 0, unique = 0;
+
+  *limit_count = 0;
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    for (i = 0; i < binding_sets[set].count; ++i) {
+      const binding_row* b = &binding_sets[set].entries[i];
+      if (b->site_name == NULL || b->worker_host == NULL) continue;
+      if (b->max_in_flight > 0 && !is_site_limit_row(b)) count++;
+    }
+  }
+  if (count > 0) {
+    limits = (pending_limit*)malloc(sizeof(pending_limit) * count);
+    if (limits == NULL) return NULL;
+  }
+
+  count = 0;
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    for (i = 0; i < binding_sets[set].count; ++i, ++order) {
+      const binding_row* b = &binding_sets[set].entries[i];
+      int site;
+      if (b->site_name == NULL || b->worker_host == NULL) continue;
+      if (b->max_in_flight == 0) continue;
+
+      site = row_sites[order];
+      if (is_site_limit_row(b)) {
+        if (site_limits[site] == 0) site_limits[site] = b->max_in_flight;
+        continue;
+      }
+
+      limits[count].site = site;
+      limits[count].host = row_hosts[order];
+      limits[count].order = order;
+      limits[count].max_in_flight = b->max_in_flight;
+      count++;
+    }
+  }
+
+  if (count == 0) return limits;
+
+  qsort(limits, count, sizeof(pending_limit), pending_limit_compare);
+  for (i = 0; i < count; ++i) {
+    if (unique > 0 && limits[unique - 1].site == limits[i].site &&
+        limits[unique - 1].host == limits[i].host) {
+      continue;
+    }
+    limits[unique++] = limits[i];
+  }
+
+  *limit_count = unique;
+  return limits;
+}
+
+// Member matching
+// ---------------
+
+// Returns 1 if the two address lists have an address in common
+static int addresses_overlap(const char* const* a, size_t a_count,
+                             const char* const* b, size_t b_count) {
+  size_t i, j;
+  for (i = 0; i < a_count; ++i) {
+    for (j = 0; j < b_count; ++j) {
+      if (strcmp(a[i], b[j]) == 0) return 1;
+    }
+  }
+  return 0;
+}
+
+// Matches the members that no binding host names to a binding host by their
+// addresses (with a resolver)
+static void match_members_by_address(routing_table* t,
+                                     proxy_balancer* const* balancers,
+                                     const name_index* hosts,
+                                     const routing_host_resolver* resolver) {
+  int32_t* member_hosts = ROUTING_TABLE_AT(t, int32_t, t->member_hosts_offset);
+  const routing_balancer* out_balancers =
+      ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset);
+  size_t b, m, h, unmatched_members = 0;
+
+  for (m = 0; m < t->member_count; ++m) {
+    if (member_hosts[m] < 0) unmatched_members++;
+  }
+
+  // without a resolver only the names match
+  if (resolver == NULL) unmatched_members = 0;
+
+  for (b = 0; unmatched_members > 0 && b < t->balancer_count; ++b) {
+    const routing_balancer* balancer = &out_balancers[b];
+    proxy_worker** workers = (proxy_worker**)balancers[b]->workers->elts;
+
+    for (m = 0; m < balancer->member_count; ++m) {
+      const char* member_addresses[kMAX_MATCHED_ADDRESSES];
+      size_t member_address_count;
+      if (member_hosts[balancer->first_member + m] >= 0) continue;
+
+      member_address_count =
+          resolver->resolve(resolver->baton, workers[m]->s->hostname,
+                            member_addresses, kMAX_MATCHED_ADDRESSES);
+      for (h = 0; member_address_count > 0 && h < hosts->count; ++h) {
+        const char* host_addresses[kMAX_MATCHED_ADDRESSES];
+        const size_t host_address_count =
+            resolver->resolve(resolver->baton, hosts->names[h],
+                              host_addresses, kMAX_MATCHED_ADDRESSES);
+        if (!addresses_overlap(member_addresses, member_address_count,
+                               host_addresses, host_address_count)) {
+          continue;
+        }
+
+        member_hosts[balancer->first_member + m] = (int32_t)h;
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf,
+                     "Matched member '%s' of '%s' to binding host '%s' by "
+                     "address",
+                     workers[m]->s->hostname, balancers[b]->s->name,
+                     hosts->names[h]);
+        break;
+      }
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+routing_table* routing_table_build(const binding_rows* binding_sets,
+                                   proxy_balancer* const* all_balancers,
+                                   size_t all_balancer_count,
+                                   const routing_host_resolver* resolver) {
+  name_index sites, hosts;
+  routing_table* t = NULL;
+  // The balancers small enough for the table
+  proxy_balancer** balancers = NULL;
+  size_t balancer_count = 0;
+  uint32_t* site_limits = NULL;
+  pending_limit* host_limits = NULL;
+  // The site and host index of every row
+  int32_t* row_sites = NULL;
+  int32_t* row_hosts = NULL;
+  // The members of each balancer in the order of the tiers
+  uint16_t* members_by_order = NULL;
+  ordered_member* ordered = NULL;
+  size_t i, set, row, row_count = 0, member_count = 0, strings_size = 0;
+  size_t host_limit_count = 0, drain_row_count = 0;
+
+  memset(&sites, 0, sizeof(sites));
+  memset(&hosts, 0, sizeof(hosts));
+
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    row_count += binding_sets[set].count;
+    for (i = 0; i < binding_sets[set].count; ++i) {
+      if (binding_sets[set].entries[i].binding_kind == kBINDING_DRAIN) {
+        drain_row_count++;
+      }
+    }
+  }
+
+  // the candidate indices of the routes are 16 bits
+  balancers = (proxy_balancer**)malloc(sizeof(proxy_balancer*) *
+                                       (all_balancer_count + 1));
+  if (balancers == NULL) goto cleanup;
+  for (i = 0; i < all_balancer_count; ++i) {
+    const size_t count = (size_t)all_balancers[i]->workers->nelts;
+    if (count > kROUTING_MAX_MEMBERS) {
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                   "Balancer '%s' has %lu members, more than the %d a "
+                   "routing table holds, it is left out of the table",
+                   all_balancers[i]->s->name, count, kROUTING_MAX_MEMBERS);
+      continue;
+    }
+    balancers[balancer_count++] = all_balancers[i];
+  }
+
+  for (i = 0; i < balancer_count; ++i) {
+    proxy_worker** workers = (proxy_worker**)balancers[i]->workers->elts;
+    const size_t count = (size_t)balancers[i]->workers->nelts;
+    size_t m;
+
+    member_count += count;
+    strings_size += strlen(balancers[i]->s->name) + 1;
+    for (m = 0; m < count; ++m) {
+      strings_size += strlen(workers[m]->s->route) + 1;
+    }
+  }
+
+  // Intern the site and host names of all the binding sets
+  row_sites = (int32_t*)malloc(sizeof(int32_t) * (row_count + 1));
+  row_hosts = (int32_t*)malloc(sizeof(int32_t) * (row_count + 1));
+  if (!name_index_init(&sites, row_count) ||
+      !name_index_init(&hosts, row_count) || row_sites == NULL ||
+      row_hosts == NULL ||
+      !index_rows(binding_sets, &sites, &hosts, row_sites, row_hosts)) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                 "Cannot allocate the routing table index for %lu bindings",
+                 row_count);
+    goto cleanup;
+  }
+
+  site_limits = (uint32_t*)calloc(sites.count + 1, sizeof(uint32_t));
+  members_by_order = (uint16_t*)malloc(sizeof(uint16_t) * (member_count + 1));
+  ordered =
+      (ordered_member*)malloc(sizeof(ordered_member) * (member_count + 1));
+  if (site_limits == NULL || members_by_order == NULL || ordered == NULL) {
+    goto cleanup;
+  }
+  host_limits = collect_limits(binding_sets, row_sites, row_hosts,
+                               site_limits, &host_limit_count);
+
+  for (i = 0; i < sites.count; ++i) strings_size += sites.lengths[i] + 1;
+  for (i = 0; i < hosts.count; ++i) strings_size += hosts.lengths[i] + 1;
+
+  // Lay out and allocate the table
+  {
+    routing_table layout = {0};
+    const size_t bucket_count = bucket_count_for(sites.count);
+    const size_t route_bucket_count = bucket_count_for(member_count);
+    const size_t route_count =
+        kBINDING_SET_COUNT * sites.count * balancer_count;
+    // every route has room for each member once, plus the default routes
+    const size_t candidate_count =
+        (kBINDING_SET_COUNT * sites.count + 1) * member_count;
+    const size_t cell_count = kBINDING_SET_COUNT * sites.count * hosts.count;
+    size_t size = 0;
+
+    layout_reserve(&size, sizeof(routing_table));
+    layout.sites_offset =
+        layout_reserve(&size, sizeof(routing_site) * sites.count);
+    layout.site_buckets_offset =
+        layout_reserve(&size, sizeof(uint32_t) * bucket_count);
+    layout.hosts_offset =
+        layout_reserve(&size, sizeof(routing_host) * hosts.count);
+    layout.balancers_offset =
+        layout_reserve(&size, sizeof(routing_balancer) * balancer_count);
+    layout.member_hosts_offset =
+        layout_reserve(&size, sizeof(int32_t) * member_count);
+    layout.member_routes_offset =
+        layout_reserve(&size, sizeof(routing_member_route) * member_count);
+    layout.route_buckets_offset =
+        layout_reserve(&size, sizeof(uint32_t) * route_bucket_count);
+    layout.kinds_offset = layout_reserve(&size, cell_count);
+    layout.drained_offset = layout_reserve(&size, (cell_count + 7) / 8);
+    layout.routes_offset =
+        layout_reserve(&size, sizeof(routing_route) * route_count);
+    layout.candidates_offset =
+        layout_reserve(&size, sizeof(uint16_t) * candidate_count);
+    layout.host_limits_offset =
+        layout_reserve(&size, sizeof(routing_host_limit) * host_limit_count);
+    // room for a drain per drain row, the duplicates are left out
+    layout.drains_offset =
+        layout_reserve(&size, sizeof(routing_drain) * drain_row_count);
+    layout.strings_offset = layout_reserve(&size, strings_size);
+
+    // the offsets inside the table are 32 bits
+    if (size > UINT32_MAX) {
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                   "The routing table would take %lu bytes, more than the "
+                   "4 GB a table holds",
+                   size);
+      goto cleanup;
+    }
+    layout.size = (uint32_t)size;
+    layout.site_count = (uint32_t)sites.count;
+    layout.host_count = (uint32_t)hosts.count;
+    layout.balancer_count = (uint32_t)balancer_count;
+    layout.member_count = (uint32_t)member_count;
+    layout.host_limit_count = (uint32_t)host_limit_count;
+    layout.site_bucket_mask = (uint32_t)(bucket_count - 1);
+    layout.route_bucket_mask = (uint32_t)(route_bucket_count - 1);
+
+    t = (routing_table*)calloc(1, size);
+    if (t == NULL) {
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                   "Cannot allocate %lu bytes for the routing table", size);
+      goto cleanup;
+    }
+    *t = layout;
+  }
+
+  // Fill the sites, hosts and balancers
+  {
+    routing_site* out_sites =
+        ROUTING_TABLE_AT(t, routing_site, t->sites_offset);
+    routing_host* out_hosts =
+        ROUTING_TABLE_AT(t, routing_host, t->hosts_offset);
+    routing_balancer* out_balancers =
+        ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset);
+    int32_t* member_hosts =
+        ROUTING_TABLE_AT(t, int32_t, t->member_hosts_offset);
+    routing_member_route* member_routes =
+        ROUTING_TABLE_AT(t, routing_member_route, t->member_routes_offset);
+    routing_host_limit* out_limits =
+        ROUTING_TABLE_AT(t, routing_host_limit, t->host_limits_offset);
+    uint32_t strings_used = 0, first_member = 0, candidates_used = 0;
+
+    for (i = 0; i < sites.count; ++i) {
+      out_sites[i].name_offset =
+          store_string(t, &strings_used, sites.names[i], sites.lengths[i]);
+      out_sites[i].name_length = (uint32_t)sites.lengths[i];
+      out_sites[i].hash = sites.hashes[i];
+      out_sites[i].max_in_flight = site_limits[i];
+    }
+
+    // the host limits are ordered by site, so each site has a range
+    for (i = 0; i < host_limit_count; ++i) {
+      routing_site* site = &out_sites[host_limits[i].site];
+      if (site->host_limit_count == 0) site->first_host_limit = (uint32_t)i;
+      site->host_limit_count++;
+      out_limits[i].host = host_limits[i].host;
+      out_limits[i].max_in_flight = host_limits[i].max_in_flight;
+    }
+    // the interning index has a bucket for every row, the table only one
+    // for every two sites: insert them again with the same hashes
+    {
+      uint32_t* buckets =
+          ROUTING_TABLE_AT(t, uint32_t, t->site_buckets_offset);
+      for (i = 0; i < sites.count; ++i) {
+        uint32_t b = sites.hashes[i] & t->site_bucket_mask;
+        while (buckets[b] != 0) b = (b + 1) & t->site_bucket_mask;
+        buckets[b] = (uint32_t)(i + 1);
+      }
+    }
+
+    for (i = 0; i < hosts.count; ++i) {
+      out_hosts[i].name_offset =
+          store_string(t, &strings_used, hosts.names[i], hosts.lengths[i]);
+      out_hosts[i].name_length = (uint32_t)hosts.lengths[i];
+    }
+
+    for (i = 0; i < balancer_count; ++i) {
+      const proxy_balancer* balancer = balancers[i];
+      routing_balancer* out = &out_balancers[i];
+      proxy_worker** workers = (proxy_worker**)balancer->workers->elts;
+      size_t m;
+
+      out->name_offset = store_string(t, &strings_used, balancer->s->name,
+                                      strlen(balancer->s->name));
+      out->hash_def = balancer->hash.def;
+      out->hash_fnv = balancer->hash.fnv;
+      out->member_count = (uint32_t)balancer->workers->nelts;
+      out->first_member = first_member;
+
+      // map the members to the hosts of the bindings
+      for (m = 0; m < out->member_count; ++m) {
+        const char* route = workers[m]->s->route;
+        const size_t route_length = strlen(route);
+
+        member_hosts[first_member + m] =
+            name_index_find(&hosts, workers[m]->s->hostname);
+        if (route_length > 0) {
+          member_routes[first_member + m].name_offset =
+              store_string(t, &strings_used, route, route_length);
+          member_routes[first_member + m].hash =
+              routing_site_hash(route, route_length);
+        }
+        ordered[m].order = (int64_t)workers[m]->s->lbset * 2 +
+                           (PROXY_WORKER_IS_STANDBY(workers[m]) ? 1 : 0);
+        ordered[m].member = (uint32_t)m;
+      }
+      qsort(ordered, out->member_count, sizeof(ordered_member),
+            ordered_member_compare);
+      for (m = 0; m < out->member_count; ++m) {
+        members_by_order[first_member + m] = (uint16_t)ordered[m].member;
+      }
+      first_member += out->member_count;
+      index_member_routes(t, (int)i);
+
+      // the default route allows everything
+      build_route(t, &out->default_route, &candidates_used,
+                  kDEFAULT_SITE_ROW, out,
+                  members_by_order + out->first_member);
+    }
+
+    // the site routes need every member matched
+    match_members_by_address(t, balancers, &hosts, resolver);
+
+    // Fill the binding kinds. The rows are added in reverse, so for
+    // duplicate site / host pairs the first row in the file wins.
+    memset(ROUTING_TABLE_AT(t, int8_t, t->kinds_offset), kROUTING_UNBOUND,
+           kBINDING_SET_COUNT * t->site_count * t->host_count);
+    for (set = 0, row = 0; set < kBINDING_SET_COUNT; ++set) {
+      int8_t* kinds = ROUTING_TABLE_AT(t, int8_t, t->kinds_offset) +
+                      set * t->site_count * t->host_count;
+      row += binding_sets[set].count;
+      for (i = binding_sets[set].count; i-- > 0;) {
+        const binding_row* b = &binding_sets[set].entries[i];
+        const size_t r = row - binding_sets[set].count + i;
+        // no site, no host or a site limit
+        if (row_hosts[r] == kROUTING_NOT_FOUND) continue;
+        if (b->binding_kind == kBINDING_DRAIN) continue;
+        kinds[row_sites[r] * t->host_count + row_hosts[r]] =
+            (int8_t)b->binding_kind;
+      }
+    }
+
+    // Set the drained bits, with a drain for each pair
+    for (set = 0, row = 0; set < kBINDING_SET_COUNT; ++set) {
+      uint8_t* drained = ROUTING_TABLE_AT(t, uint8_t, t->drained_offset);
+      routing_drain* drains =
+          ROUTING_TABLE_AT(t, routing_drain, t->drains_offset);
+      for (i = 0; i < binding_sets[set].count; ++i, ++row) {
+        size_t cell;
+        if (binding_sets[set].entries[i].binding_kind != kBINDING_DRAIN ||
+            row_hosts[row] == kROUTING_NOT_FOUND) {
+          continue;
+        }
+        cell = (set * t->site_count + row_sites[row]) * t->host_count +
+               row_hosts[row];
+        if (bit_is_set(drained, cell)) continue;
+        drained[cell >> 3] |= (uint8_t)(1u << (cell & 7));
+
+        drains[t->drain_count].binding_set = (uint32_t)set;
+        drains[t->drain_count].site = row_sites[row];
+        drains[t->drain_count].host = row_hosts[row];
+        drains[t->drain_count].slot = kROUTING_NO_DRAIN_SLOT;
+        t->drain_count++;
+      }
+    }
+
+    // Build the routes
+    for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+      size_t site, b;
+      for (site = 0; site < t->site_count; ++site) {
+        const size_t site_row = set * t->site_count + site;
+        routing_route* routes =
+            ROUTING_TABLE_AT(t, routing_route, t->routes_offset) +
+            site_row * t->balancer_count;
+
+        for (b = 0; b < balancer_count; ++b) {
+          build_route(t, &routes[b], &candidates_used, site_row,
+                      &out_balancers[b],
+                      members_by_order + out_balancers[b].first_member);
+        }
+      }
+    }
+  }
+
+cleanup:
+  free(balancers);
+  free(row_sites);
+  free(row_hosts);
+  free(ordered);
+  free(members_by_order);
+  free(site_limits);
+  free(host_limits);
+  name_index_free(&sites);
+  name_index_free(&hosts);
+  return t;
+}
+
+void routing_table_free(routing_table* table) { free(table); }
+
+void routing_table_set_binding(routing_table* table, int binding_set,
+                               int site_idx, int host_idx,
+                               binding_kind_t kind) {
+  const size_t site_row = (size_t)binding_set * table->site_count + site_idx;
+  int8_t* site_kinds = ROUTING_TABLE_AT(table, int8_t, table->kinds_offset) +
+                       site_row * table->host_count;
+  routing_route* routes =
+      ROUTING_TABLE_AT(table, routing_route, table->routes_offset) +
+      site_row * table->balancer_count;
+  const routing_balancer* balancers =
+      ROUTING_TABLE_AT(table, routing_balancer, table->balancers_offset);
+  const uint16_t* candidates =
+      ROUTING_TABLE_AT(table, uint16_t, table->candidates_offset);
+  uint32_t b;
+
+  site_kinds[host_idx] = (int8_t)kind;
+
+  // the default route lists every member by lbset, in the order the routes
+  // were built with
+  for (b = 0; b < table->balancer_count; ++b) {
+    uint32_t offset = routes[b].candidates_offset;
+    build_route(table, &routes[b], &offset, site_row, &balancers[b],
+                candidates + balancers[b].default_route.candidates_offset);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+int routing_table_find_site(const routing_table* table, const char* name,
+                            size_t length, uint32_t hash) {
+  const uint32_t* buckets =
+      ROUTING_TABLE_AT(table, uint32_t, table->site_buckets_offset);
+  const routing_site* sites =
+      ROUTING_TABLE_AT(table, routing_site, table->sites_offset);
+  uint32_t b = hash & table->site_bucket_mask;
+
+  for (;;) {
+    const uint32_t entry = buckets[b];
+    const routing_site* site;
+    if (entry == 0) return kROUTING_NOT_FOUND;
+
+    site = &sites[entry - 1];
+    if (site->hash == hash && site->name_length == length &&
+        names_equal(ROUTING_TABLE_AT(table, char, site->name_offset), name,
+                    length)) {
+      return (int)(entry - 1);
+    }
+
+    b = (b + 1) & table->site_bucket_mask;
+  }
+}
+
+int routing_table_find_host(const routing_table* table, const char* name) {
+  const routing_host* hosts =
+      ROUTING_TABLE_AT(table, routing_host, table->hosts_offset);
+  const size_t length = strlen(name);
+  uint32_t i;
+
+  for (i = 0; i < table->host_count; ++i) {
+    if (hosts[i].name_length == length &&
+        names_equal(ROUTING_TABLE_AT(table, char, hosts[i].name_offset), name,
+                    length)) {
+      return (int)i;
+    }
+  }
+  return kROUTING_NOT_FOUND;
+}
+
+int routing_table_find_balancer(const routing_table* table,
+                                const proxy_balancer* balancer) {
+  const routing_balancer* balancers =
+      ROUTING_TABLE_AT(table, routing_balancer, table->balancers_offset);
+  uint32_t i;
+
+  for (i = 0; i < table->balancer_count; ++i) {
+    if (balancers[i].hash_def == balancer->hash.def &&
+        balancers[i].hash_fnv == balancer->hash.fnv) {
+      return (int)i;
+    }
+  }
+  return kROUTING_NOT_FOUND;
+}
+
+void routing_balancer_hashes(const char* name, size_t length,
+                             unsigned int* def, unsigned int* fnv) {
+  size_t i;
+
+  *def = 0;
+  *fnv = 0;
+  for (i = 0; i < length; ++i) {
+    // mod_proxy hashes (signed) chars
+    const char c = (char)tolower((unsigned char)name[i]);
+    *def = c + (*def << 6) + (*def << 16) - *def;
+    *fnv *= 0x811C9DC5u;
+    *fnv ^= c;
+  }
+}
+
+proxy_balancer* routing_url_balancer(const apr_array_header_t* balancers,
+                                     const char* url) {
+  static const char kSCHEME[] = "balancer://";
+  proxy_balancer* entries = (proxy_balancer*)balancers->elts;
+  unsigned int def, fnv;
+  size_t length;
+  int i;
+
+  if (strncasecmp(url, kSCHEME, sizeof(kSCHEME) - 1) != 0) return NULL;
+  length = sizeof(kSCHEME) - 1 + strcspn(url + sizeof(kSCHEME) - 1, "/");
+  routing_balancer_hashes(url, length, &def, &fnv);
+
+  for (i = 0; i < balancers->nelts; ++i) {
+    if (entries[i].hash.def == def && entries[i].hash.fnv == fnv) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+routing_tiers routing_table_tiers(const routing_table* table,
+                                  int binding_set, int site_idx,
+                                  int balancer_idx) {
+  const routing_route* route =
+      &ROUTING_TABLE_AT(table, routing_balancer,
+                        table->balancers_offset)[balancer_idx]
+           .default_route;
+  routing_tiers out;
+
+  if (site_idx != kROUTING_NOT_FOUND) {
+    route = ROUTING_TABLE_AT(table, routing_route, table->routes_offset) +
+            ((size_t)binding_set * table->site_count + site_idx) *
+                table->balancer_count +
+            balancer_idx;
+  }
+
+  out.candidates.entries =
+      ROUTING_TABLE_AT(table, uint16_t, table->candidates_offset) +
+      route->candidates_offset;
+  out.candidates.count = route->ends[kTIER_FORBID - 1];
+  out.ends = route->ends;
+  out.tier_mask = route->tier_mask;
+  return out;
+}
+
+worker_index_slice routing_tiers_slice(const routing_tiers* tiers, int tier) {
+  const size_t begin = (tier > 0) ? tiers->ends[tier - 1] : 0;
+  worker_index_slice out;
+
+  // a slice of all workers has no entries to offset, and only ever fills
+  // the allow tier (every tier before it is empty)
+  out.entries = (tiers->candidates.entries != NULL)
+                    ? tiers->candidates.entries + begin
+                    : NULL;
+  out.count = tiers->ends[tier] - begin;
+  return out;
+}
+
+// Returns the stored kind of a site / host pair (or kROUTING_UNBOUND)
+static binding_kind_t stored_kind(const routing_table* table, int binding_set,
+                                  int site_idx, int host_idx) {
+  const int8_t* kinds = ROUTING_TABLE_AT(table, int8_t, table->kinds_offset);
+  if (site_idx == kROUTING_NOT_FOUND || host_idx == kROUTING_NOT_FOUND) {
+    return kROUTING_UNBOUND;
+  }
+  return kinds[((size_t)binding_set * table->site_count + site_idx) *
+                   table->host_count +
+               host_idx];
+}
+
+binding_kind_t routing_table_kind(const routing_table* table, int binding_set,
+                                  int site_idx, int host_idx) {
+  const binding_kind_t kind =
+      stored_kind(table, binding_set, site_idx, host_idx);
+  return (kind == kROUTING_UNBOUND) ? kBINDING_ALLOW : kind;
+}
+
+int routing_table_is_bound(const routing_table* table, int binding_set,
+                           int site_idx, int host_idx) {
+  return stored_kind(table, binding_set, site_idx, host_idx) !=
+         kROUTING_UNBOUND;
+}
+
+int routing_table_is_drained(const routing_table* table, int binding_set,
+                             int site_idx, int host_idx) {
+  if (site_idx == kROUTING_NOT_FOUND || host_idx < 0) return 0;
+  return bit_is_set(
+      ROUTING_TABLE_AT(table, uint8_t, table->drained_offset),
+      ((size_t)binding_set * table->site_count + site_idx) *
+              table->host_count +
+          host_idx);
+}
+
+int routing_table_find_drain(const routing_table* table, int binding_set,
+                             int site_idx, int host_idx) {
+  const routing_drain* drains = routing_table_drains(table);
+  uint32_t i;
+
+  for (i = 0; i < table->drain_count; ++i) {
+    if (drains[i].binding_set == (uint32_t)binding_set &&
+        drains[i].site == site_idx && drains[i].host == host_idx) {
+      return (int)i;
+    }
+  }
+  return kROUTING_NOT_FOUND;
+}
+
+const routing_drain* routing_table_drains(const routing_table* table) {
+  return ROUTING_TABLE_AT(table, routing_drain, table->drains_offset);
+}
+
+int routing_table_site_has_limits(const routing_table* table, int site_idx) {
+  const routing_site* site;
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  site = ROUTING_TABLE_AT(table, routing_site, table->sites_offset) + site_idx;
+  return site->max_in_flight > 0 || site->host_limit_count > 0;
+}
+
+uint32_t routing_table_site_limit(const routing_table* table, int site_idx) {
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  return ROUTING_TABLE_AT(table, routing_site, table->sites_offset)[site_idx]
+      .max_in_flight;
+}
+
+uint32_t routing_table_member_limit(const routing_table* table, int site_idx,
+                                    int balancer_idx, size_t worker_idx) {
+  const routing_site* site;
+  const routing_host_limit* limits;
+  int32_t host;
+  uint32_t i;
+
+  if (site_idx == kROUTING_NOT_FOUND) return 0;
+  site = ROUTING_TABLE_AT(table, routing_site, table->sites_offset) + site_idx;
+  if (site->host_limit_count == 0) return 0;
+
+  host = ROUTING_TABLE_AT(table, int32_t, table->member_hosts_offset)
+      [ROUTING_TABLE_AT(table, routing_balancer,
+                        table->balancers_offset)[balancer_idx]
+           .first_member +
+       worker_idx];
+  limits = ROUTING_TABLE_AT(table, routing_host_limit,
+                            table->host_limits_offset) +
+           site->first_host_limit;
+  for (i = 0; i < site->host_limit_count; ++i) {
+    if (limits[i].host == host) return limits[i].max_in_flight;
+  }
+  return 0;
+}
+
+int routing_table_find_route(const routing_table* table, int balancer_idx,
+                             const char* route) {
+  const uint32_t* buckets =
+      ROUTING_TABLE_AT(table, uint32_t, table->route_buckets_offset);
+  const routing_member_route* routes = ROUTING_TABLE_AT(
+      table, routing_member_route, table->member_routes_offset);
+  const routing_balancer* balancer =
+      ROUTING_TABLE_AT(table, routing_balancer, table->balancers_offset) +
+      balancer_idx;
+  const uint32_t hash = routing_site_hash(route, strlen(route));
+  uint32_t b = route_bucket(table, balancer_idx, hash);
+
+  for (;;) {
+    const uint32_t entry = buckets[b];
+    const routing_member_route* member;
+    if (entry == 0) return kROUTING_NOT_FOUND;
+
+    member = &routes[entry - 1];
+    if (member->hash == hash && entry - 1 >= balancer->first_member &&
+        entry - 1 < balancer->first_member + balancer->member_count &&
+        strcmp(ROUTING_TABLE_AT(table, const char, member->name_offset),
+               route) == 0) {
+      return (int)(entry - 1 - balancer->first_member);
+    }
+
+    b = (b + 1) & table->route_bucket_mask;
+  }
+}
+
+int routing_table_member_host(const routing_table* table, int balancer_idx,
+                              size_t worker_idx) {
+  const routing_balancer* balancer =
+      ROUTING_TABLE_AT(table, routing_balancer, table->balancers_offset) +
+      balancer_idx;
+  if (worker_idx >= balancer->member_count) return -1;
+  return ROUTING_TABLE_AT(table, int32_t, table->member_hosts_offset)
+      [balancer->first_member + worker_idx];
+}
+
+const char* routing_table_site_name(const routing_table* table, int site_idx) {
+  return ROUTING_TABLE_AT(
+      table, const char,
+      ROUTING_TABLE_AT(table, routing_site, table->sites_offset)[site_idx]
+          .name_offset);
+}
+
+const char* routing_table_host_name(const routing_table* table, int host_idx) {
+  return ROUTING_TABLE_AT(
+      table, const char,
+      ROUTING_TABLE_AT(table, routing_host, table->hosts_offset)[host_idx]
+          .name_offset);
+}
@@ -0,0 +1,385 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include "palette-director-types.h"
+
+// FWD-declare the proxy balancer struct
+typedef struct proxy_balancer proxy_balancer;
+typedef struct apr_array_header_t apr_array_header_t;
+
+// The binding sets compiled into a routing table
+enum {
+  kBINDING_SET_WORKER = 0,
+  kBINDING_SET_AUTHORING = 1,
+  kBINDING_SET_BACKGROUNDER = 2,
+
+  kBINDING_SET_COUNT
+};
+
+// The candidate tiers of a route, in the order they are tried: one for each
+// binding priority (kTIER_PREFER holds priority 1), then the allowed and the
+// forbidden workers
+enum {
+  kTIER_PREFER = 0,
+  kTIER_ALLOW = kBINDING_MAX_PRIORITY,
+  kTIER_FORBID = kTIER_ALLOW + 1,
+  kTIER_COUNT
+};
+
+// Site / balancer index returned when the lookup finds nothing
+enum { kROUTING_NOT_FOUND = -1 };
+
+// The binding kind stored for site / host pairs that have no binding in a
+// binding set (routed like kBINDING_ALLOW)
+enum { kROUTING_UNBOUND = -2 };
+
+// The largest balancer a table holds candidate indices for, the balancers
+// with more members are left out of the table
+enum { kROUTING_MAX_MEMBERS = 0xFFFF };
+
+// The candidate workers of a site on a balancer. The members of each tier
+// are stored after each other in the candidate pool of the table (by
+// priority, then the allowed ones), and by lbset within each tier. The
+// forbidden members are left out, but their room is kept, so a route can be
+// rebuilt in place.
+typedef struct routing_route {
+  // Offset of the first candidate (an uint16_t index into balancer->workers)
+  uint32_t candidates_offset;
+
+  // The position after the last candidate of each tier (a tier starts where
+  // the one before it ends)
+  uint16_t ends[kTIER_FORBID];
+
+  // Bit t is set if tier t has any candidates
+  uint16_t tier_mask;
+} routing_route;
+
+// A site known by any of the binding sets
+typedef struct routing_site {
+  // The name as it first appeared in the config (zero terminated)
+  uint32_t name_offset;
+  uint32_t name_length;
+
+  // The case-folded hash of the name
+  uint32_t hash;
+
+  // The most requests of the site in flight on its preferred hosts (0 for
+  // no limit)
+  uint32_t max_in_flight;
+
+  // The per-host limits of the site: a range of the host limit array
+  uint32_t first_host_limit;
+  uint32_t host_limit_count;
+} routing_site;
+
+// The most requests of a site a host may have in flight
+typedef struct routing_host_limit {
+  int32_t host;
+  uint32_t max_in_flight;
+} routing_host_limit;
+
+// A site / host pair drained in a binding set: the members of the host are
+// left out of the routes of the site (as if forbidden), but the sticky
+// sessions on them go on
+typedef struct routing_drain {
+  uint32_t binding_set;
+  int32_t site;
+  int32_t host;
+
+  // The counter of the requests in flight on the pair, assigned when the
+  // table is published (see routing-state.h)
+  uint32_t slot;
+} routing_drain;
+
+// The slot of a drain that has no counter
+static const uint32_t kROUTING_NO_DRAIN_SLOT = 0xffffffffu;
+
+// A worker host known by any of the binding sets
+typedef struct routing_host {
+  uint32_t name_offset;
+  uint32_t name_length;
+} routing_host;
+
+// The sticky session route of a balancer member (the route= of the worker)
+typedef struct routing_member_route {
+  // The zero terminated route, 0 if the member has none
+  uint32_t name_offset;
+  uint32_t hash;
+} routing_member_route;
+
+// A balancer the table has routes for
+typedef struct routing_balancer {
+  uint32_t name_offset;
+
+  // The name hashes mod_proxy calculated for the balancer
+  uint32_t hash_def;
+  uint32_t hash_fnv;
+
+  // The number of members when the table was built
+  uint32_t member_count;
+
+  // The index of the first member of this balancer in the member arrays
+  uint32_t first_member;
+
+  // Route for requests without a (known) site: every member is allowed
+  routing_route default_route;
+} routing_balancer;
+
+/*
+        The compiled routing table.
+
+        The table is a single block of memory: the header is followed by the
+        arrays it references, and every reference is an offset from the
+        start of the table, so it can be freed with a single free() call or
+        copied as-is (into shared memory for example).
+*/
+typedef struct routing_table {
+  // Total size of the table in bytes (header included)
+  uint32_t size;
+
+  // Incremented each time a new table is published
+  uint32_t generation;
+
+  uint32_t site_count;
+  uint32_t host_count;
+  uint32_t balancer_count;
+
+  // The number of balancer members over all balancers
+  uint32_t member_count;
+
+  // The number of site / host in-flight limits
+  uint32_t host_limit_count;
+
+  // The number of drained site / host pairs over all binding sets
+  uint32_t drain_count;
+
+  // The bucket count of the site hash index minus one
+  uint32_t site_bucket_mask;
+
+  // The bucket count of the member route index minus one
+  uint32_t route_bucket_mask;
+
+  // routing_site[site_count]
+  uint32_t sites_offset;
+  // uint32_t[site_bucket_mask + 1]: site index + 1, 0 for empty buckets
+  uint32_t site_buckets_offset;
+  // routing_host[host_count]
+  uint32_t hosts_offset;
+  // routing_balancer[balancer_count]
+  uint32_t balancers_offset;
+  // int32_t[member_count]: the host index of each member or -1
+  uint32_t member_hosts_offset;
+  // routing_member_route[member_count]
+  uint32_t member_routes_offset;
+  // uint32_t[route_bucket_mask + 1]: the index of a member (over all the
+  // balancers) + 1, 0 for empty buckets
+  uint32_t route_buckets_offset;
+  // int8_t[kBINDING_SET_COUNT][site_count][host_count]: binding kinds or
+  // kROUTING_UNBOUND
+  uint32_t kinds_offset;
+  // uint8_t bitmap over [kBINDING_SET_COUNT][site_count][host_count]: the
+  // drained site / host pairs
+  uint32_t drained_offset;
+  // routing_route[kBINDING_SET_COUNT][site_count][balancer_count]
+  uint32_t routes_offset;
+  // uint16_t candidate pool referenced by the routes
+  uint32_t candidates_offset;
+  // routing_host_limit[host_limit_count], ordered by site
+  uint32_t host_limits_offset;
+  // routing_drain[drain_count]
+  uint32_t drains_offset;
+  // The zero terminated names of the sites, hosts and balancers
+  uint32_t strings_offset;
+} routing_table;
+
+// Returns a pointer to the data at offset inside the table
+#define ROUTING_TABLE_AT(table, type, offset) \
+  ((type*)((const char*)(table) + (offset)))
+
+// A list of candidate workers stored as indices into balancer->workers.
+// A slice with NULL entries and a non-zero count stands for all workers
+// from 0 to count-1.
+typedef struct worker_index_slice {
+  const uint16_t* entries;
+  size_t count;
+} worker_index_slice;
+
+// Returns the balancer->workers index of the i-th entry of the slice
+#define WORKER_INDEX_AT(slice, i) \
+  ((slice).entries != NULL ? (size_t)(slice).entries[i] : (size_t)(i))
+
+// The candidate workers for a request: every worker that may be picked in the
+// order of the tiers they are tried in (the forbidden ones are left out)
+typedef struct routing_tiers {
+  worker_index_slice candidates;
+
+  // The position in candidates after the last worker of each tier
+  const uint16_t* ends;
+
+  // Bit t is set if tier t has any candidates
+  unsigned tier_mask;
+} routing_tiers;
+
+// Returns the candidates of a single tier (below kTIER_FORBID)
+worker_index_slice routing_tiers_slice(const routing_tiers* tiers, int tier);
+
+// Looks up the addresses of the hosts while building a routing table
+typedef struct routing_host_resolver {
+  /*
+          Stores the numeric addresses of the host into addresses (at most
+          max_count, valid until the build returns) and returns their
+          count, 0 if the host cannot be resolved.
+  */
+  size_t (*resolve)(void* baton, const char* host, const char** addresses,
+                    size_t max_count);
+  void* baton;
+} routing_host_resolver;
+
+/*
+        Compiles the bindings (one binding_rows for each binding set) and the
+        members of the balancers into a routing table.
+
+        The kBINDING_DRAIN rows drain their pair on top of its binding.
+
+        The members are matched to the binding hosts by their host name
+        (ignoring the case). With a resolver, the members and binding
+        hosts left without a match are matched by their addresses, so a
+        host may be given by name on one side and by IP on the other. The
+        binding hosts that match no member stay in the table without
+        members (the caller logs them).
+
+        The balancers with more than kROUTING_MAX_MEMBERS members are left
+        out, and NULL is returned for a table larger than 4 GB.
+
+        The returned table must be freed with routing_table_free().
+*/
+routing_table* routing_table_build(const binding_rows* binding_sets,
+                                   proxy_balancer* const* balancers,
+                                   size_t balancer_count,
+                                   const routing_host_resolver* resolver);
+
+void routing_table_free(routing_table* table);
+
+/*
+        Changes the binding kind of a site / host pair (kROUTING_UNBOUND
+        removes the binding) and rebuilds the routes of the site in place,
+        so a single binding changes without compiling the whole table.
+
+        Only patch a table that is not published yet (a copy of the
+        published one): the request threads do not expect it to change.
+*/
+void routing_table_set_binding(routing_table* table, int binding_set,
+                               int site_idx, int host_idx,
+                               binding_kind_t kind);
+
+// Returns the case-folded hash of a site name
+uint32_t routing_site_hash(const char* name, size_t length);
+
+/*
+        Returns the index of the site in the table, or kROUTING_NOT_FOUND.
+
+        hash must be the routing_site_hash() of the name.
+*/
+int routing_table_find_site(const routing_table* table, const char* name,
+                            size_t length, uint32_t hash);
+
+// Returns the index of the host (ignoring the case), or kROUTING_NOT_FOUND.
+// A linear scan: for the admin API, not for the requests.
+int routing_table_find_host(const routing_table* table, const char* name);
+
+// Returns the index of the balancer in the table, or kROUTING_NOT_FOUND.
+int routing_table_find_balancer(const routing_table* table,
+                                const proxy_balancer* balancer);
+
+/*
+        Hashes the lower case of a balancer name the way mod_proxy hashes
+        the (lower case) balancer names it defines with ap_proxy_hashfunc():
+        SDBM for the default hash, FNV for the other one.
+*/
+void routing_balancer_hashes(const char* name, size_t length,
+                             unsigned int* def, unsigned int* fnv);
+
+/*
+        Returns the balancer of a "balancer://name/..." URL (ignoring the
+        case of the name) from balancers, an array of proxy_balancer like
+        the balancers of proxy_server_conf, or NULL. Like
+        ap_proxy_get_balancer() the balancers are compared by their hashes.
+*/
+proxy_balancer* routing_url_balancer(const apr_array_header_t* balancers,
+                                     const char* url);
+
+/*
+        Returns the candidate tiers of a site on a balancer.
+
+        If site_idx is kROUTING_NOT_FOUND, every member of the balancer is in
+        the allow tier.
+*/
+routing_tiers routing_table_tiers(const routing_table* table,
+                                  int binding_set, int site_idx,
+                                  int balancer_idx);
+
+// Returns the binding kind of a site / host pair
+binding_kind_t routing_table_kind(const routing_table* table, int binding_set,
+                                  int site_idx, int host_idx);
+
+// Returns 1 if the binding set has a binding for the site / host pair
+int routing_table_is_bound(const routing_table* table, int binding_set,
+                           int site_idx, int host_idx);
+
+// Returns 1 if the site / host pair is drained in the binding set (a single
+// bit of the table)
+int routing_table_is_drained(const routing_table* table, int binding_set,
+                             int site_idx, int host_idx);
+
+// Returns the index of the drain of a site / host pair, or
+// kROUTING_NOT_FOUND. A linear scan: only look up drained pairs.
+int routing_table_find_drain(const routing_table* table, int binding_set,
+                             int site_idx, int host_idx);
+
+// Returns the drains of the table (drain_count of them)
+const routing_drain* routing_table_drains(const routing_table* table);
+
+// Returns 1 if the site has any in-flight limit
+int routing_table_site_has_limits(const routing_table* table, int site_idx);
+
+// Returns the in-flight limit of a site on its preferred hosts (0 for none)
+uint32_t routing_table_site_limit(const routing_table* table, int site_idx);
+
+// Returns the in-flight limit of a site on a balancer member (0 for none)
+uint32_t routing_table_member_limit(const routing_table* table, int site_idx,
+                                    int balancer_idx, size_t worker_idx);
+
+/*
+        Returns the index of the member of a balancer with the sticky
+        session route (compared like mod_proxy_balancer does, case
+        sensitive), or kROUTING_NOT_FOUND. A hash lookup: the routes of the
+        members are indexed when the table is built.
+*/
+int routing_table_find_route(const routing_table* table, int balancer_idx,
+                             const char* route);
+
+// Returns the host index of a balancer member (-1 if it matches no binding
+// host, or was added after the table was built)
+int routing_table_member_host(const routing_table* table, int balancer_idx,
+                              size_t worker_idx);
+
+// Returns the zero terminated name of a site / host of the table
+const char* routing_table_site_name(const routing_table* table, int site_idx);
+const char* routing_table_host_name(const routing_table* table, int host_idx);
@@ -0,0 +1,164 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "site-name.h"
+
+#include <string.h>
+
+#include "palette-macros.h"
+
+// The key we are looking for in the query string
+static const char kSITE_KEY[] = ":site";
+enum { kSITE_KEY_LENGTH = sizeof(kSITE_KEY) - 1 };
+
+// Returns the value of a hex digit, or -1 if c is not one
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Decodes the character at *p (a %XX sequence or a single character) and
+// moves *p past it
+static char decode_char(const char** p) {
+  const char* s = *p;
+  if (s[0] == '%') {
+    const int hi = hex_value(s[1]);
+    const int lo = (hi < 0) ? -1 : hex_value(s[2]);
+    if (lo >= 0) {
+      *p = s + 3;
+      return (char)((hi << 4) | lo);
+    }
+  }
+  *p = s + 1;
+  return s[0];
+}
+
+// Returns 1 if the (escaped) key running from *p up to the next '=' or '&'
+// is ':site' and leaves *p at the end of the key. Gives up at the first
+// character that does not match. An escaped zero ends the key like it ended
+// the key string of ap_unescape_url().
+static int scan_key(const char** p) {
+  const char* s = *p;
+  size_t matched = 0;
+
+  while (*s != '\0' && *s != '&' && *s != '=') {
+    const char c = decode_char(&s);
+
+    if (c == '\0') {
+      // Skip the rest of the key, only the part before the zero counts
+      while (*s != '\0' && *s != '&' && *s != '=') ++s;
+      break;
+    }
+    if (matched == kSITE_KEY_LENGTH || c != kSITE_KEY[matched]) return 0;
+    matched++;
+  }
+
+  *p = s;
+  return matched == kSITE_KEY_LENGTH;
+}
+
+// Scans the value at p up to the next '&', unescaping it into the buffer
+// only once the first '%' shows up.
+static int scan_value(const char* p, char* buffer, size_t buffer_size,
+                      site_name_view* out) {
+  const char* start = p;
+  uint32_t hash = PAL__FNV1A_INIT;
+  size_t length;
+
+  // The common case: no escapes, the view points into the query string
+  while (*p != '\0' && *p != '&' && *p != '%') {
+    hash = PAL__FNV1A_STEP_CASEFOLD(hash, *p);
+    ++p;
+  }
+
+  length = (size_t)(p - start);
+  out->name = start;
+
+  if (*p == '%') {
+    if (length >= buffer_size) return kSITE_NAME_TOO_LONG;
+    memcpy(buffer, start, length);
+    out->name = buffer;
+
+    while (*p != '\0' && *p != '&') {
+      const char c = decode_char(&p);
+
+      // An escaped zero ended the value for strcmp() / strlen() before
+      if (c == '\0') break;
+      if (length + 1 >= buffer_size) return kSITE_NAME_TOO_LONG;
+
+      buffer[length++] = c;
+      hash = PAL__FNV1A_STEP_CASEFOLD(hash, c);
+    }
+  }
+
+  out->length = length;
+  out->hash = hash;
+  return kSITE_NAME_FOUND;
+}
+
+int site_name_scan(const char* args, char* buffer, size_t buffer_size,
+                   site_name_view* out) {
+  const char* p = args;
+
+  if (args == NULL) return kSITE_NAME_NOT_FOUND;
+
+  while (*p != '\0') {
+    // Only keys starting with ':' or an escape can decode to ':site'
+    if ((*p == ':' || *p == '%') && scan_key(&p)) {
+      // A ':site' without a value is an empty name. Like ap_getword(), skip
+      // repeated '=' characters.
+      while (*p == '=') ++p;
+      return scan_value(p, buffer, buffer_size, out);
+    }
+
+    // Skip to the next parameter
+    p = strchr(p, '&');
+    if (p == NULL) break;
+    while (*p == '&') ++p;
+  }
+
+  return kSITE_NAME_NOT_FOUND;
+}
+
+// The path segments the workbook name follows in VizQL and view URIs
+static const char* const kWORKBOOK_MARKERS[] = {"/w/", "/views/"};
+
+uint32_t workbook_name_hash(const char* uri) {
+  size_t i;
+
+  if (uri == NULL) return 0;
+
+  for (i = 0; i < sizeof(kWORKBOOK_MARKERS) / sizeof(kWORKBOOK_MARKERS[0]);
+       ++i) {
+    const char* p = strstr(uri, kWORKBOOK_MARKERS[i]);
+    uint32_t hash = PAL__FNV1A_INIT;
+
+    if (p == NULL) continue;
+    p += strlen(kWORKBOOK_MARKERS[i]);
+    if (*p == '\0' || *p == '/') continue;
+
+    for (; *p != '\0' && *p != '/'; ++p) {
+      hash = PAL__FNV1A_STEP_CASEFOLD(hash, *p);
+    }
+    return hash;
+  }
+
+  return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  // The size of the stack buffer find_best_bybusyness() unescapes the site
+  // name into (only used when the name has %-escapes in it)
+  kSITE_NAME_BUFFER_SIZE = 256,
+};
+
+// The results of site_name_scan()
+enum {
+  kSITE_NAME_NOT_FOUND = 0,
+  kSITE_NAME_FOUND = 1,
+
+  // The :site value is escaped and does not fit the buffer. Unescaping never
+  // makes a value longer, so a buffer of strlen(args) + 1 bytes is enough.
+  kSITE_NAME_TOO_LONG = 2,
+};
+
+// The (unescaped) :site value of a request. The name is not zero terminated:
+// it points either into the query string itself or into the buffer passed
+// to site_name_scan().
+typedef struct site_name_view {
+  const char* name;
+  size_t length;
+
+  // The routing_site_hash() of the name
+  uint32_t hash;
+} site_name_view;
+
+/*
+        Finds the value of the first ':site' parameter in a query string in a
+        single pass, without copying or allocating.
+
+        Keys and values are unescaped the way ap_unescape_url() does it (only
+        %XX sequences, a '%' without two hex digits is kept as is), but only
+        the key being compared and the :site value are ever decoded. Only an
+        escaped value is copied into the buffer, every other value is
+        returned as a view into args.
+
+        Returns one of kSITE_NAME_NOT_FOUND, kSITE_NAME_FOUND or
+        kSITE_NAME_TOO_LONG.
+*/
+int site_name_scan(const char* args, char* buffer, size_t buffer_size,
+                   site_name_view* out);
+
+/*
+        Returns the case-folded hash of the workbook name in a VizQL
+        ("/vizql/w/<workbook>/v/<view>/...") or views
+        (".../views/<workbook>/<view>") URI, or 0 if the URI has none.
+
+        The name is hashed as it appears in the URI (escapes are not decoded):
+        the hash only has to be the same for every request of the workbook.
+*/
+uint32_t workbook_name_hash(const char* uri);
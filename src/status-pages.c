@@ -20,70 +20,96 @@
 
 #include <mod_proxy.h>
 
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+#ifdef PALETTE_DIRECTOR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "page-buffer.h"
+#include "palette-macros.h"
+#include "routing-counters.h"
+#include "routing-state.h"
+#include "routing-table.h"
+
 // STATUS PAGE HANDLER
 // ===================
 
 enum { kNO_MAPPING_AS_PRIORITY = -123456 };
 
 // Prints a single cell in a status table
-static void status_table_cell(request_rec* r, const int prio) {
+static void status_table_cell(page_buffer* b, const int prio) {
   // print the cell preamble
-  ap_rprintf(r,
-             "<td class='tb-data-grid-separator-row ng-scope'><div "
-             "class='tb-lr-padded-wide tb-worker-statuses-container'><span "
-             "class='ng-scope ng-isolate-scope'><span "
-             "class='tb-data-grid-icon tb-status-legend-item'>");
+  PAGE_LITERAL(b,
+               "<td class='tb-data-grid-separator-row ng-scope'><div "
+               "class='tb-lr-padded-wide tb-worker-statuses-container'><span "
+               "class='ng-scope ng-isolate-scope'><span "
+               "class='tb-data-grid-icon tb-status-legend-item'>");
 
   switch (prio) {
     case kBINDING_ALLOW:
-      ap_rprintf(r,
-                 "<span title='Active' class='tb-icon-process-status "
-                 "tb-icon-process-status-busy'><small style='margin-left: "
-                 "25px;'><em>Fallback</em></small></span>");
+      PAGE_LITERAL(b,
+                   "<span title='Active' class='tb-icon-process-status "
+                   "tb-icon-process-status-busy'><small style='margin-left: "
+                   "25px;'><em>Fallback</em></small></span>");
       break;
 
     case kBINDING_FORBID:
-      ap_rprintf(r,
-                 "<span title='Active' class='tb-icon-process-status "
-                 "tb-icon-process-status-down'><small style='margin-left: "
-                 "25px;'><em>Forbidden</em></small></span>");
+      PAGE_LITERAL(b,
+                   "<span title='Active' class='tb-icon-process-status "
+                   "tb-icon-process-status-down'><small style='margin-left: "
+                   "25px;'><em>Forbidden</em></small></span>");
       break;
 
     case kBINDING_PREFER:
-      ap_rprintf(r,
-                 "<span title='Active' class='tb-icon-process-status "
-                 "tb-icon-process-status-active'><small style='margin-left: "
-                 "25px;'><em>Prefer</em></small></span>");
+      PAGE_LITERAL(b,
+                   "<span title='Active' class='tb-icon-process-status "
+                   "tb-icon-process-status-active'><small style='margin-left: "
+                   "25px;'><em>Prefer</em></small></span>");
+      break;
+
+    default:
+      // the numeric priorities after prefer
+      if (prio > kBINDING_PREFER && prio <= kBINDING_MAX_PRIORITY) {
+        page_printf(b,
+                    "<span title='Active' class='tb-icon-process-status "
+                    "tb-icon-process-status-active'><small "
+                    "style='margin-left: 25px;'><em>Priority "
+                    "%d</em></small></span>",
+                    prio);
+      }
       break;
   }
 
   // close the cell
-  ap_rprintf(r, "</span></span></div></td>");
+  PAGE_LITERAL(b, "</span></span></div></td>");
 }
 
-static void add_style_header(request_rec* r) {
-  ap_rprintf(r, "<html>");
+static void add_style_header(page_buffer* b) {
+  PAGE_LITERAL(b, "<html>");
 
   // head
-  ap_rprintf(r, "<head>");
+  PAGE_LITERAL(b, "<head>");
 
-  ap_rprintf(r, "<title>Palette Director Workerbinding Status</title>");
-  ap_rprintf(r,
-             "<link rel='stylesheet' type='text/css' href='/vizportal.css' />");
+  PAGE_LITERAL(b, "<title>Palette Director Workerbinding Status</title>");
+  PAGE_LITERAL(
+      b, "<link rel='stylesheet' type='text/css' href='/vizportal.css' />");
 
   // body
-  ap_rprintf(r, "</head><body class='tb-app'>");
+  PAGE_LITERAL(b, "</head><body class='tb-app'>");
 }
 
-static void add_style_footer(request_rec* r) {
-  ap_rprintf(r, "</body>");
-  ap_rprintf(r, "</html>");
+static void add_style_footer(page_buffer* b) {
+  PAGE_LITERAL(b, "</body>");
+  PAGE_LITERAL(b, "</html>");
 }
 
-static void add_table_legend(request_rec* r, size_t hosts_count) {
+static void add_table_legend(page_buffer* b, size_t hosts_count) {
   // Print the legend
-  ap_rprintf(
-      r,
+  page_printf(
+      b,
       "<tr>"
       "<th colspan='%d' style='font-size: 0.8em; text-align:right; "
       "padding-top:20px; color: #aaa;' class='tb-settings-msg'>"
@@ -92,7 +118,8 @@ static void add_table_legend(request_rec* r, size_t hosts_count) {
       "<span class='tb-icon-process-status "
       "tb-icon-process-status-active'></span>"
       "<span translate='workerStatus_active' "
-      "class='tb-status-legend-item-label'>Prefered</span></span><span "
+      "class='tb-status-legend-item-label'>Prefered (by "
+      "priority)</span></span><span "
       "class='tb-status-legend-item ng-scope'>"
       "<span class='tb-icon-process-status tb-icon-process-status-busy'></span>"
       "<span translate='workerStatus_busy' "
@@ -104,71 +131,309 @@ static void add_table_legend(request_rec* r, size_t hosts_count) {
       "class='tb-status-legend-item ng-scope'>"
       "</th>"
       "</tr>",
-      hosts_count + 1);
+      (int)hosts_count + 1);
 }
 
+// A site or host of the routing table with its name
+typedef struct named_index {
+  const char* name;
+  int idx;
+} named_index;
+
 // Sorting helper that forwards to strcmp
-static int string_qsort_compare(const void* p1, const void* p2) {
-  return strcmp(*(char* const*)p1, *(char* const*)p2);
+static int named_index_qsort_compare(const void* p1, const void* p2) {
+  return strcmp(((const named_index*)p1)->name,
+                ((const named_index*)p2)->name);
 }
 
-typedef const char* (*key_extractor_fn)(const void* o);
+/*
+        Finds the sites (or hosts if hosts is not 0) that have a binding in
+        the binding set, sorted by name. The output is allocated from pool.
+*/
+static size_t find_all_bound(apr_pool_t* pool, const routing_table* t,
+                             int binding_set, int hosts, named_index** output) {
+  const int outer_count = (int)(hosts ? t->host_count : t->site_count);
+  const int inner_count = (int)(hosts ? t->site_count : t->host_count);
+  size_t output_count = 0;
+  int i, j;
 
-static const char* extract_host_fn(const void* o) {
-  return ((const binding_row*)o)->worker_host;
-}
+  *output = (named_index*)apr_palloc(
+      pool, sizeof(named_index) * (outer_count > 0 ? outer_count : 1));
+
+  for (i = 0; i < outer_count; ++i) {
+    for (j = 0; j < inner_count; ++j) {
+      const int bound = hosts ? routing_table_is_bound(t, binding_set, j, i)
+                              : routing_table_is_bound(t, binding_set, i, j);
+      if (!bound) continue;
+
+      (*output)[output_count].name = hosts ? routing_table_host_name(t, i)
+                                           : routing_table_site_name(t, i);
+      (*output)[output_count].idx = i;
+      output_count++;
+      break;
+    }
+  }
 
-static const char* extract_site_name_fn(const void* o) {
-  return ((const binding_row*)o)->site_name;
+  qsort(*output, output_count, sizeof(named_index), named_index_qsort_compare);
+  return output_count;
 }
 
-static void find_all_hosts(const binding_rows* b, key_extractor_fn extractor_fn,
-                           const char** output, size_t* output_count) {
-  size_t i;
+static void status_page_html_table(page_buffer* b, apr_pool_t* ptemp,
+                                   const char* title, const routing_table* t,
+                                   int binding_set) {
+  named_index* host_buf = NULL;
+  size_t host_buf_size = 0;
 
-  const char* buffer[kCONFIG_MAX_STRING_SIZE];
+  named_index* sites_buf = NULL;
+  size_t sites_buf_size = 0;
 
-  for (i = 0; i < b->count; ++i) {
-    buffer[i] = extractor_fn(&b->entries[i]);
+  // find all site and host names
+  if (t != NULL) {
+    sites_buf_size = find_all_bound(ptemp, t, binding_set, 0, &sites_buf);
+    host_buf_size = find_all_bound(ptemp, t, binding_set, 1, &host_buf);
   }
 
-  // sort the list of strings so we can unique them
-  qsort((char**)buffer, b->count, sizeof(buffer[0]), string_qsort_compare);
+  PAGE_LITERAL(b, "<div class='tb-settings-section'>");
+  page_printf(b, "<div class='tb-settings-group-name'>%s</div>", title);
+  // table
+  PAGE_LITERAL(b,
+               "<table class='tb-static-grid-table "
+               "tb-static-grid-table-settings-min-width'>");
+
+  // HOSTS TABLE HEADER
+  // ------------------
 
+  PAGE_LITERAL(b, "<thead>");
+  // list the sites as header
   {
-    const char* current_str = NULL;
-    size_t output_idx = 0;
-
-    for (i = 0; i < b->count; ++i) {
-      const char* s = buffer[i];
-      // if the string differs, add it to the array
-      if (current_str == NULL || strcmp(current_str, s) != 0) {
-        output[output_idx] = s;
-        current_str = s;
-        output_idx++;
+    size_t i;
+
+    PAGE_LITERAL(b, "<tr><th></th>");
+    for (i = 0; i < host_buf_size; ++i) {
+      PAGE_LITERAL(b,
+                   "<th class='tb-data-grid-headers-line "
+                   "tb-data-grid-headers-line-multiline'><div "
+                   "class='tb-data-grid-header-text'>");
+      page_html(b, host_buf[i].name);
+      PAGE_LITERAL(b, "</div></th>");
+    }
+    PAGE_LITERAL(b, "</tr>");
+  }
+  PAGE_LITERAL(b, "</thead>");
+  PAGE_LITERAL(b, "<tbody>");
+
+  // HOSTS TABLE BODY
+  // ----------------
+  {
+    size_t row, col;
+
+    // output normal hosts
+    for (row = 0; row < sites_buf_size; ++row) {
+      PAGE_LITERAL(b, "<tr>");
+      PAGE_LITERAL(b,
+                   "<td class='tb-data-grid-separator-row'><span "
+                   "class='tb-data-grid-cell-text tb-lr-padded-wide "
+                   "ng-scope'>");
+      page_html(b, sites_buf[row].name);
+      PAGE_LITERAL(b, "</span></td>");
+
+      for (col = 0; col < host_buf_size; ++col) {
+        status_table_cell(b, routing_table_kind(t, binding_set,
+                                                sites_buf[row].idx,
+                                                host_buf[col].idx));
       }
+
+      PAGE_LITERAL(b, "</tr>");
     }
+  }
+
+  // Print the legend
+  add_table_legend(b, host_buf_size);
+
+  PAGE_LITERAL(b, "</tbody>");
+  PAGE_LITERAL(b, "</table>");
+  PAGE_LITERAL(b, "</div>");
+}
+
+// Renders the binding tables of the routing table
+static void render_binding_tables(page_buffer* b, apr_pool_t* ptemp,
+                                  const routing_table* t, int add_style) {
+  status_page_html_table(b, ptemp, "Interactor bindings", t,
+                         kBINDING_SET_WORKER);
+  status_page_html_table(b, ptemp, "Authoring bindings", t,
+                         kBINDING_SET_AUTHORING);
+  status_page_html_table(b, ptemp, "Backgrounder bindings", t,
+                         kBINDING_SET_BACKGROUNDER);
 
-    *output_count = output_idx;
+  // close style and html wrap if needed
+  if (add_style) {
+    add_style_footer(b);
   }
 }
 
-// Return 1 if there is a mapping for this site-host combo
-static int mapping_priority_for(const binding_rows* b, const char* site_name,
-                                const char* worker_host) {
-  size_t i, len = b->count;
-  for (i = 0; i < len; ++i) {
-    const binding_row br = b->entries[i];
-    if (strcmp(br.site_name, site_name) == 0 &&
-        strcmp(br.worker_host, worker_host) == 0) {
-      return br.binding_kind;
+// CACHED BINDING TABLES
+// =====================
+
+/*
+        The binding tables only change with the routing table, so each child
+        renders them once per table generation (for each style variant) and
+        serves the cached page, with an ETag and optionally gzipped.
+
+        Cached pages are reference counted: a page replaced by a newer one is
+        freed once the requests still writing it are done.
+*/
+typedef struct cached_page {
+  apr_uint32_t generation;
+
+  page_buffer html;
+  // empty if gzip is not available
+  page_buffer gzip;
+
+  // The ETag of the page (the gzipped ETag has a "-gz" suffix)
+  char etag[64];
+  char gzip_etag[64];
+
+  // The cache and the requests writing the page hold references
+  size_t refs;
+} cached_page;
+
+enum {
+  // The cached variants: without and with the style footer
+  kCACHED_VARIANT_COUNT = 2,
+
+  // The estimated size of a binding table cell
+  kHTML_CELL_ESTIMATE = 320,
+};
+
+static cached_page* cached_pages[kCACHED_VARIANT_COUNT] = {NULL, NULL};
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t* cache_mutex = NULL;
+#define CACHE_LOCK() \
+  if (cache_mutex != NULL) apr_thread_mutex_lock(cache_mutex)
+#define CACHE_UNLOCK() \
+  if (cache_mutex != NULL) apr_thread_mutex_unlock(cache_mutex)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
+void status_pages_child_init(apr_pool_t* pchild) {
+#if APR_HAS_THREADS
+  apr_thread_mutex_create(&cache_mutex, APR_THREAD_MUTEX_DEFAULT, pchild);
+#endif
+}
+
+static void cached_page_free(cached_page* page) {
+  page_buffer_free(&page->html);
+  page_buffer_free(&page->gzip);
+  free(page);
+}
+
+// Drops a reference to the page (with the cache locked)
+static void cached_page_unref(cached_page* page) {
+  if (--page->refs == 0) cached_page_free(page);
+}
+
+#ifdef PALETTE_DIRECTOR_HAVE_ZLIB
+// Gzips the page once, so clients that accept gzip get it without
+// compressing on every hit
+static void cached_page_gzip(cached_page* page) {
+  z_stream z;
+  uLong bound;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return;
+  }
+
+  bound = deflateBound(&z, (uLong)page->html.length);
+  page_buffer_init(&page->gzip, NULL, (size_t)bound);
+  if (!page->gzip.failed) {
+    z.next_in = (Bytef*)page->html.data;
+    z.avail_in = (uInt)page->html.length;
+    z.next_out = (Bytef*)page->gzip.data;
+    z.avail_out = (uInt)page->gzip.capacity;
+    if (deflate(&z, Z_FINISH) == Z_STREAM_END) {
+      page->gzip.length = (size_t)z.total_out;
     }
   }
-  return kBINDING_ALLOW;
+  deflateEnd(&z);
+}
+#endif
+
+// Renders the binding tables of the routing table into a new cached page
+static cached_page* cached_page_render(request_rec* r, const routing_table* t,
+                                       int add_style) {
+  cached_page* page = (cached_page*)calloc(1, sizeof(cached_page));
+  const apr_uint32_t generation = (t != NULL) ? t->generation : 0;
+  size_t estimate = 16 * 1024;
+
+  if (page == NULL) return NULL;
+
+  if (t != NULL) {
+    estimate += (size_t)t->site_count * t->host_count * kHTML_CELL_ESTIMATE;
+  }
+  page_buffer_init(&page->html, NULL, estimate);
+  render_binding_tables(&page->html, r->pool, t, add_style);
+  if (page->html.failed) {
+    cached_page_free(page);
+    return NULL;
+  }
+
+#ifdef PALETTE_DIRECTOR_HAVE_ZLIB
+  cached_page_gzip(page);
+#endif
+
+  page->generation = generation;
+  apr_snprintf(page->etag, sizeof(page->etag),
+               "\"pd-%" APR_TIME_T_FMT "-%u-%d\"", routing_state_created_at(),
+               generation, add_style);
+  apr_snprintf(page->gzip_etag, sizeof(page->gzip_etag),
+               "\"pd-%" APR_TIME_T_FMT "-%u-%d-gz\"",
+               routing_state_created_at(), generation, add_style);
+  page->refs = 1;
+  return page;
 }
 
-static void status_page_html_table(const char* title, request_rec* r,
-                                   const binding_rows* b, const int add_style);
+// Returns the page for the generation of the table (rendering it if the
+// cached one is older) with a reference held for the caller
+static cached_page* cached_page_get(request_rec* r, const routing_table* t,
+                                    int add_style) {
+  const apr_uint32_t generation = (t != NULL) ? t->generation : 0;
+  const int variant = add_style ? 1 : 0;
+  cached_page* page;
+
+  CACHE_LOCK();
+  page = cached_pages[variant];
+  if (page != NULL && page->generation == generation) {
+    page->refs++;
+    CACHE_UNLOCK();
+    return page;
+  }
+  CACHE_UNLOCK();
+
+  // Render without the lock (at worst a few threads render the same page)
+  page = cached_page_render(r, t, add_style);
+  if (page == NULL) return NULL;
+
+  CACHE_LOCK();
+  if (cached_pages[variant] == NULL ||
+      cached_pages[variant]->generation != generation) {
+    if (cached_pages[variant] != NULL) cached_page_unref(cached_pages[variant]);
+    cached_pages[variant] = page;
+    page->refs++;
+  }
+  CACHE_UNLOCK();
+  return page;
+}
+
+static void cached_page_release(cached_page* page) {
+  CACHE_LOCK();
+  cached_page_unref(page);
+  CACHE_UNLOCK();
+}
 
 /*
         Builds an HTML status page.
@@ -176,112 +441,714 @@ static void status_page_html_table(const char* title, request_rec* r,
         If add_style is not 0, then add the styling css and other style data.
 
 */
-void status_page_html(request_rec* r, const binding_rows* vizql_b,
-                      const binding_rows* authoring_b,
-                      const binding_rows* backgrounder_b, const int add_style) {
+int status_page_html(request_rec* r, const routing_table* t,
+                     const int add_style) {
+  cached_page* page = cached_page_get(r, t, add_style);
+  const char* accept_encoding = apr_table_get(r->headers_in, "Accept-Encoding");
+  const page_buffer* body;
+  int status = OK;
+
+  if (page == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+
+  body = &page->html;
+  if (page->gzip.length > 0 && accept_encoding != NULL &&
+      ap_find_token(r->pool, accept_encoding, "gzip")) {
+    body = &page->gzip;
+    apr_table_setn(r->headers_out, "Content-Encoding", "gzip");
+  }
+
   ap_set_content_type(r, "text/html");
+  apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+  apr_table_set(r->headers_out, "ETag",
+                body == &page->gzip ? page->gzip_etag : page->etag);
 
-  status_page_html_table("Interactor bindings", r, vizql_b, add_style);
-  status_page_html_table("Authoring bindings", r, authoring_b, add_style);
-  status_page_html_table("Backgrounder bindings", r, backgrounder_b, add_style);
+  if (ap_meets_conditions(r) == HTTP_NOT_MODIFIED) {
+    status = HTTP_NOT_MODIFIED;
+  } else {
+    ap_set_content_length(r, (apr_off_t)body->length);
+    if (!r->header_only) ap_rwrite(body->data, (int)body->length, r);
+  }
+
+  cached_page_release(page);
+  return status;
 }
 
-static void status_page_html_table(const char* title, request_rec* r,
-                                   const binding_rows* b, const int add_style) {
-  const char* host_buf[256];
-  size_t host_buf_size = 0;
+// DECISIONS PAGE
+// ==============
 
-  const char* sites_buf[256];
-  size_t sites_buf_size = 0;
+// Returns the number of decisions (and requests in flight) counted for a site
+// (or the requests without a known site) on a balancer
+static uint32_t site_decision_count(const routing_table* t,
+                                    const uint32_t* counters, int site_idx,
+                                    int balancer_idx,
+                                    const routing_balancer* balancer) {
+  uint32_t total =
+      routing_counters_no_candidates(counters, t, site_idx, balancer_idx);
+  size_t m;
+  int kind;
 
-  const size_t binding_count = b->count;
+  for (m = 0; m < balancer->member_count; ++m) {
+    total += routing_counters_member_in_flight(counters, t, site_idx,
+                                               balancer_idx, m);
+    for (kind = 0; kind < kDECISION_KIND_COUNT; ++kind) {
+      total += routing_counters_hits(counters, t, site_idx, balancer_idx, m,
+                                     kind);
+    }
+  }
+  return total;
+}
 
-  // find all host names
-  find_all_hosts(b, extract_site_name_fn, sites_buf, &sites_buf_size);
-  find_all_hosts(b, extract_host_fn, host_buf, &host_buf_size);
+// Prints a row of decision counts for a site (or the requests without a
+// known site) on a balancer
+static void status_decisions_row(page_buffer* b, const routing_table* t,
+                                 const uint32_t* counters, int site_idx,
+                                 int balancer_idx,
+                                 const routing_balancer* balancer) {
+  size_t m;
 
-  ap_rprintf(r, "<div class='tb-settings-section'>");
-  ap_rprintf(r, "<div class='tb-settings-group-name'>%s</div>", title);
-  // table
-  ap_rprintf(r,
-             "<table class='tb-static-grid-table "
-             "tb-static-grid-table-settings-min-width'>");
+  PAGE_LITERAL(b,
+               "<tr><td class='tb-data-grid-separator-row'><span "
+               "class='tb-data-grid-cell-text tb-lr-padded-wide "
+               "ng-scope'>");
+  if (site_idx == kROUTING_NOT_FOUND) {
+    PAGE_LITERAL(b, "<em>No / unknown site</em>");
+  } else {
+    const uint32_t limit = routing_table_site_limit(t, site_idx);
+    page_html(b, routing_table_site_name(t, site_idx));
+    page_printf(b, "<br/><small>%u", routing_counters_site_in_flight(
+                                         counters, t, site_idx));
+    if (limit > 0) page_printf(b, " / %u", limit);
+    PAGE_LITERAL(b, " in flight on preferred hosts");
+    if (routing_counters_overflowing(counters, t, site_idx, balancer_idx)) {
+      PAGE_LITERAL(b, ", <strong>overflowing</strong>");
+    }
+    page_printf(b, ", overflowed %u times</small>",
+                routing_counters_overflows(counters, t, site_idx,
+                                           balancer_idx));
+  }
+  PAGE_LITERAL(b, "</span></td>");
 
-  // HOSTS TABLE HEADER
-  // ------------------
+  for (m = 0; m < balancer->member_count; ++m) {
+    const uint32_t limit =
+        routing_table_member_limit(t, site_idx, balancer_idx, m);
+    page_printf(b, "<td class='tb-data-grid-separator-row'>%u / %u (%u",
+                routing_counters_hits(counters, t, site_idx, balancer_idx, m,
+                                      kDECISION_PREFERRED),
+                routing_counters_hits(counters, t, site_idx, balancer_idx, m,
+                                      kDECISION_FALLBACK),
+                routing_counters_member_in_flight(counters, t, site_idx,
+                                                  balancer_idx, m));
+    if (limit > 0) page_printf(b, " / %u", limit);
+    PAGE_LITERAL(b, ")</td>");
+  }
 
-  ap_rprintf(r, "<thead>");
-  // list the sites as header
-  {
-    size_t i;
+  page_printf(b, "<td class='tb-data-grid-separator-row'>%u</td></tr>",
+              routing_counters_no_candidates(counters, t, site_idx,
+                                             balancer_idx));
+}
 
-    ap_rprintf(r, "<tr><th></th>");
-    for (i = 0; i < host_buf_size; ++i) {
-      // const binding_row p = b->entries[i];
-      ap_rprintf(r,
-                 "<th class='tb-data-grid-headers-line "
-                 "tb-data-grid-headers-line-multiline'><div "
-                 "class='tb-data-grid-header-text'>%s</div></th>",
-                 host_buf[i]);
-    }
-    ap_rprintf(r, "</tr>");
+// The names of the binding sets on the pages
+static const char* const binding_set_keys[kBINDING_SET_COUNT] = {
+    "worker", "authoring", "backgrounder"};
+
+// Returns the requests of a drained pair still in flight: the ones picked
+// for the host before the drain began and its sticky sessions
+static uint32_t drain_in_flight(const routing_table* t,
+                                const uint32_t* counters,
+                                const routing_drain* drain) {
+  uint32_t total = routing_state_drain_in_flight(drain);
+  if (counters != NULL) {
+    total += routing_counters_host_in_flight(counters, t, drain->site,
+                                             drain->host);
   }
-  ap_rprintf(r, "</thead>");
-  ap_rprintf(r, "<tbody>");
+  return total;
+}
 
-  // HOSTS TABLE BODY
-  // ----------------
-  {
-    size_t row, col;
+// Prints the drained site / host pairs with their requests in flight
+static void status_drains(page_buffer* b, const routing_table* t,
+                          const uint32_t* counters) {
+  const routing_drain* drains = routing_table_drains(t);
+  uint32_t i;
 
-    // output normal hosts
-    for (row = 0; row < sites_buf_size; ++row) {
-      ap_rprintf(r, "<tr>");
-      ap_rprintf(r,
-                 "<td class='tb-data-grid-separator-row'><span "
-                 "class='tb-data-grid-cell-text tb-lr-padded-wide "
-                 "ng-scope'>%s</span></td>",
-                 sites_buf[row]);
+  PAGE_LITERAL(b, "<div class='tb-settings-section'>");
+  PAGE_LITERAL(b,
+               "<div class='tb-settings-group-name'>Drained sites</div>"
+               "<table class='tb-static-grid-table "
+               "tb-static-grid-table-settings-min-width'><thead><tr>"
+               "<th>Bindings</th><th>Site</th><th>Host</th>"
+               "<th>Requests in flight</th></tr></thead><tbody>");
+  for (i = 0; i < t->drain_count; ++i) {
+    page_printf(b, "<tr><td class='tb-data-grid-separator-row'>%s</td>",
+                binding_set_keys[drains[i].binding_set]);
+    PAGE_LITERAL(b, "<td class='tb-data-grid-separator-row'>");
+    page_html(b, routing_table_site_name(t, drains[i].site));
+    PAGE_LITERAL(b, "</td><td class='tb-data-grid-separator-row'>");
+    page_html(b, routing_table_host_name(t, drains[i].host));
+    page_printf(b, "</td><td class='tb-data-grid-separator-row'>%u</td></tr>",
+                drain_in_flight(t, counters, &drains[i]));
+  }
+  PAGE_LITERAL(b, "</tbody></table></div>");
+}
 
-      for (col = 0; col < host_buf_size; ++col) {
-        status_table_cell(
-            r, mapping_priority_for(b, sites_buf[row], host_buf[col]));
+/*
+        Builds the HTML page of the routing decisions counted for each
+        balancer: the preferred / fallback picks of each member by site with
+        the requests in flight (and their limits), and the requests without
+        a usable candidate. Sites without decisions are left out. The
+        drained pairs are listed first, with their requests in flight.
+*/
+void status_page_decisions(request_rec* r, const routing_table* t,
+                           const uint32_t* counters) {
+  page_buffer page;
+  int bi, site;
+
+  page_buffer_init(&page, r->pool, 16 * 1024);
+  ap_set_content_type(r, "text/html");
+
+  if (t != NULL && t->drain_count > 0) status_drains(&page, t, counters);
+
+  for (bi = 0; t != NULL && counters != NULL && bi < (int)t->balancer_count;
+       ++bi) {
+    const routing_balancer* balancer =
+        ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset) + bi;
+    const int32_t* member_hosts =
+        ROUTING_TABLE_AT(t, int32_t, t->member_hosts_offset);
+    size_t m;
+
+    PAGE_LITERAL(&page, "<div class='tb-settings-section'>");
+    PAGE_LITERAL(&page,
+                 "<div class='tb-settings-group-name'>Routing decisions on ");
+    page_html(&page, ROUTING_TABLE_AT(t, const char, balancer->name_offset));
+    page_printf(&page,
+                " (%u requests with unknown site, %u without site)</div>",
+                routing_counters_unknown_sites(counters, t, bi),
+                routing_counters_no_sites(counters, t, bi));
+    PAGE_LITERAL(&page,
+                 "<table class='tb-static-grid-table "
+                 "tb-static-grid-table-settings-min-width'>");
+
+    // the members as header (preferred / fallback picks in each cell)
+    PAGE_LITERAL(&page, "<thead><tr><th></th>");
+    for (m = 0; m < balancer->member_count; ++m) {
+      const int32_t host = member_hosts[balancer->first_member + m];
+      PAGE_LITERAL(&page,
+                   "<th class='tb-data-grid-headers-line "
+                   "tb-data-grid-headers-line-multiline'><div "
+                   "class='tb-data-grid-header-text'>");
+      if (host < 0) {
+        PAGE_LITERAL(&page, "<em>unbound member</em>");
+      } else {
+        page_html(&page, routing_table_host_name(t, host));
       }
+      PAGE_LITERAL(&page,
+                   "<br/><small>preferred / fallback (in flight)</small>"
+                   "</div></th>");
+    }
+    PAGE_LITERAL(&page,
+                 "<th class='tb-data-grid-headers-line'><div "
+                 "class='tb-data-grid-header-text'>No candidate</div></th>"
+                 "</tr></thead><tbody>");
 
-      ap_rprintf(r, "</tr>");
+    for (site = 0; site < (int)t->site_count; ++site) {
+      if (site_decision_count(t, counters, site, bi, balancer) == 0) continue;
+      status_decisions_row(&page, t, counters, site, bi, balancer);
+    }
+    if (site_decision_count(t, counters, kROUTING_NOT_FOUND, bi, balancer) !=
+        0) {
+      status_decisions_row(&page, t, counters, kROUTING_NOT_FOUND, bi,
+                           balancer);
     }
+
+    PAGE_LITERAL(&page, "</tbody></table></div>");
   }
 
-  // Print the legend
-  add_table_legend(r, host_buf_size);
+  ap_rwrite(page.data, (int)page.length, r);
+}
 
-  ap_rprintf(r, "</tbody>");
-  ap_rprintf(r, "</table>");
-  ap_rprintf(r, "</div>");
+// JSON STATUS PAGE
+// ================
 
-  // close style and html wrap if needed
-  if (add_style) {
-    add_style_footer(r);
+enum {
+  // The estimated size of a balancer member / a site in the output
+  kJSON_MEMBER_ESTIMATE = 256,
+  kJSON_SITE_ESTIMATE = 48,
+};
+
+static void json_bool(page_buffer* b, int value) {
+  if (value) {
+    PAGE_LITERAL(b, "true");
+  } else {
+    PAGE_LITERAL(b, "false");
+  }
+}
+
+static const char* binding_kind_name(binding_kind_t kind) {
+  switch (kind) {
+    case kBINDING_PREFER:
+      return "prefer";
+    case kBINDING_FORBID:
+      return "forbid";
+    default:
+      return "allow";
   }
 }
 
+// Writes the bindings of a binding set as a list of site / host / binding
+static void json_binding_set(page_buffer* b, const routing_table* t,
+                             int binding_set) {
+  int site, host, first = 1;
+  binding_kind_t kind;
+
+  PAGE_LITERAL(b, "[");
+  for (site = 0; t != NULL && site < (int)t->site_count; ++site) {
+    for (host = 0; host < (int)t->host_count; ++host) {
+      if (!routing_table_is_bound(t, binding_set, site, host)) continue;
+
+      if (!first) PAGE_LITERAL(b, ",");
+      first = 0;
+
+      PAGE_LITERAL(b, "{\"site\":");
+      page_json_string(b, routing_table_site_name(t, site));
+      PAGE_LITERAL(b, ",\"host\":");
+      page_json_string(b, routing_table_host_name(t, host));
+      PAGE_LITERAL(b, ",\"binding\":");
+      kind = routing_table_kind(t, binding_set, site, host);
+      if (kind > kBINDING_PREFER) {
+        // the numeric priorities as they are in the config
+        page_printf(b, "\"%d\"", kind);
+      } else {
+        page_json_string(b, binding_kind_name(kind));
+      }
+      PAGE_LITERAL(b, "}");
+    }
+  }
+  PAGE_LITERAL(b, "]");
+}
+
+// Writes the decision counts of a site (or of the requests without a known
+// site) on a balancer
+static void json_site_decisions(page_buffer* b, const routing_table* t,
+                                const uint32_t* counters, int site_idx,
+                                int balancer_idx,
+                                const routing_balancer* balancer) {
+  size_t m;
+
+  PAGE_LITERAL(b, "{\"site\":");
+  page_json_string(b, site_idx == kROUTING_NOT_FOUND
+                          ? NULL
+                          : routing_table_site_name(t, site_idx));
+  if (site_idx != kROUTING_NOT_FOUND) {
+    page_printf(b,
+                ",\"preferred_in_flight\":%u,\"max_in_flight\":%u,"
+                "\"overflowing\":%s,\"overflows\":%u",
+                routing_counters_site_in_flight(counters, t, site_idx),
+                routing_table_site_limit(t, site_idx),
+                routing_counters_overflowing(counters, t, site_idx,
+                                             balancer_idx)
+                    ? "true"
+                    : "false",
+                routing_counters_overflows(counters, t, site_idx,
+                                           balancer_idx));
+  }
+  PAGE_LITERAL(b, ",\"members\":[");
+  for (m = 0; m < balancer->member_count; ++m) {
+    page_printf(
+        b,
+        "%s{\"preferred\":%u,\"fallback\":%u,\"in_flight\":%u,"
+        "\"max_in_flight\":%u}",
+        m > 0 ? "," : "",
+        routing_counters_hits(counters, t, site_idx, balancer_idx, m,
+                              kDECISION_PREFERRED),
+        routing_counters_hits(counters, t, site_idx, balancer_idx, m,
+                              kDECISION_FALLBACK),
+        routing_counters_member_in_flight(counters, t, site_idx, balancer_idx,
+                                          m),
+        routing_table_member_limit(t, site_idx, balancer_idx, m));
+  }
+  page_printf(b, "],\"no_candidate\":%u}",
+              routing_counters_no_candidates(counters, t, site_idx,
+                                             balancer_idx));
+}
+
+// Writes a balancer with the live state of its members and the decisions
+// counted for it
+static void json_balancer(page_buffer* b, const routing_table* t,
+                          const uint32_t* counters,
+                          const proxy_balancer* balancer) {
+  proxy_worker** workers = (proxy_worker**)balancer->workers->elts;
+  const int balancer_idx =
+      (t != NULL) ? routing_table_find_balancer(t, balancer)
+                  : kROUTING_NOT_FOUND;
+  int i;
+
+  PAGE_LITERAL(b, "{\"name\":");
+  page_json_string(b, balancer->s->name);
+
+  PAGE_LITERAL(b, ",\"members\":[");
+  for (i = 0; i < balancer->workers->nelts; ++i) {
+    const proxy_worker* w = workers[i];
+
+    if (i > 0) PAGE_LITERAL(b, ",");
+    PAGE_LITERAL(b, "{\"name\":");
+    page_json_string(b, w->s->name);
+    PAGE_LITERAL(b, ",\"host\":");
+    page_json_string(b, w->s->hostname);
+    page_printf(b,
+                ",\"busy\":%" APR_SIZE_T_FMT
+                ",\"lbstatus\":%d,\"lbfactor\":%d,\"lbset\":%d",
+                w->s->busy, w->s->lbstatus, w->s->lbfactor, w->s->lbset);
+    PAGE_LITERAL(b, ",\"usable\":");
+    json_bool(b, PROXY_WORKER_IS_USABLE(w));
+    PAGE_LITERAL(b, ",\"draining\":");
+    json_bool(b, PROXY_WORKER_IS_DRAINING(w));
+    PAGE_LITERAL(b, ",\"standby\":");
+    json_bool(b, PROXY_WORKER_IS_STANDBY(w));
+    PAGE_LITERAL(b, "}");
+  }
+  PAGE_LITERAL(b, "]");
+
+  // The decisions (sites without decisions are left out)
+  if (balancer_idx != kROUTING_NOT_FOUND && counters != NULL) {
+    const routing_balancer* routed =
+        ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset) +
+        balancer_idx;
+    int site, first = 1;
+
+    page_printf(b, ",\"unknown_site\":%u,\"no_site\":%u,\"decisions\":[",
+                routing_counters_unknown_sites(counters, t, balancer_idx),
+                routing_counters_no_sites(counters, t, balancer_idx));
+    for (site = kROUTING_NOT_FOUND; site < (int)t->site_count; ++site) {
+      if (site_decision_count(t, counters, site, balancer_idx, routed) == 0) {
+        continue;
+      }
+      if (!first) PAGE_LITERAL(b, ",");
+      first = 0;
+      json_site_decisions(b, t, counters, site, balancer_idx, routed);
+    }
+    PAGE_LITERAL(b, "]");
+  }
+
+  PAGE_LITERAL(b, "}");
+}
+
 /* Builds an JSON status page*/
-void status_page_json(request_rec* r, const binding_rows* b) {
-  // TODO: implement me again
-  return;
-
-  // ap_set_content_type(r, "application/json");
-  // ap_rprintf(r, "{\"fallback\": \"%s\", \"sites\":{",
-  // b->fallback_worker_host);
-  //{
-  //    size_t i;
-  //    for(i=0; i < b->binding_count; ++i) {
-  //        const config_path p = b->bindings[i];
-  //        // Add a comma before all but the first
-  //        if (i != 0)	{ ap_rprintf(r, ", "); }
-  //        // and print the pair
-  //        ap_rprintf(r, "\"%s\": \"%s\"", p.site_name, p.target_worker_host);
-  //    }
-  //}
-  // ap_rprintf(r, "}}");
+void status_page_json(request_rec* r, const routing_table* t,
+                      const uint32_t* counters,
+                      proxy_balancer* const* balancers,
+                      size_t balancer_count) {
+  page_buffer b;
+  size_t i, capacity;
+  int set;
+
+  // Size the buffer from the table (which holds all the names) and the
+  // balancer members, so it rarely has to grow
+  capacity = 4096;
+  if (t != NULL) {
+    capacity += (size_t)t->size * 2 + (size_t)t->site_count * kJSON_SITE_ESTIMATE;
+  }
+  for (i = 0; i < balancer_count; ++i) {
+    capacity += (size_t)balancers[i]->workers->nelts * kJSON_MEMBER_ESTIMATE;
+  }
+  page_buffer_init(&b, r->pool, capacity);
+
+  page_printf(&b, "{\"generation\":%u,\"binding_sets\":{",
+              (t != NULL) ? t->generation : 0u);
+  for (set = 0; set < kBINDING_SET_COUNT; ++set) {
+    if (set > 0) PAGE_LITERAL(&b, ",");
+    page_json_string(&b, binding_set_keys[set]);
+    PAGE_LITERAL(&b, ":");
+    json_binding_set(&b, t, set);
+  }
+
+  PAGE_LITERAL(&b, "},\"drains\":[");
+  for (i = 0; t != NULL && i < t->drain_count; ++i) {
+    const routing_drain* drain = &routing_table_drains(t)[i];
+    if (i > 0) PAGE_LITERAL(&b, ",");
+    PAGE_LITERAL(&b, "{\"set\":");
+    page_json_string(&b, binding_set_keys[drain->binding_set]);
+    PAGE_LITERAL(&b, ",\"site\":");
+    page_json_string(&b, routing_table_site_name(t, drain->site));
+    PAGE_LITERAL(&b, ",\"host\":");
+    page_json_string(&b, routing_table_host_name(t, drain->host));
+    page_printf(&b, ",\"in_flight\":%u}",
+                drain_in_flight(t, counters, drain));
+  }
+
+  PAGE_LITERAL(&b, "],\"balancers\":[");
+  for (i = 0; i < balancer_count; ++i) {
+    if (i > 0) PAGE_LITERAL(&b, ",");
+    json_balancer(&b, t, counters, balancers[i]);
+  }
+  PAGE_LITERAL(&b, "]}");
+
+  ap_set_content_type(r, "application/json");
+  ap_rwrite(b.data, (int)b.length, r);
+}
+
+// METRICS PAGE
+// ============
+
+enum {
+  // The metrics page is streamed through a buffer of this size
+  kMETRICS_BUFFER_SIZE = 16 * 1024,
+};
+
+static void metrics_flush(const char* data, size_t length, void* baton) {
+  ap_rwrite(data, (int)length, (request_rec*)baton);
+}
+
+// Appends a label value with the characters the text format needs escaped
+static void metrics_label(page_buffer* b, const char* s) {
+  const char* start = s;
+
+  for (; *s != '\0'; ++s) {
+    if (*s != '\\' && *s != '"' && *s != '\n') continue;
+    page_append(b, start, (size_t)(s - start));
+    if (*s == '\n') {
+      PAGE_LITERAL(b, "\\n");
+    } else {
+      const char escaped[2] = {'\\', *s};
+      page_append(b, escaped, 2);
+    }
+    start = s + 1;
+  }
+  page_append(b, start, (size_t)(s - start));
+}
+
+static void metrics_header(page_buffer* b, const char* name, const char* type,
+                           const char* help) {
+  page_printf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Writes a per-member gauge of every balancer
+static void metrics_members(page_buffer* b, const char* name,
+                            const char* help,
+                            proxy_balancer* const* balancers,
+                            size_t balancer_count, int value_kind) {
+  size_t i;
+  int m;
+
+  metrics_header(b, name, "gauge", help);
+  for (i = 0; i < balancer_count; ++i) {
+    proxy_worker** workers = (proxy_worker**)balancers[i]->workers->elts;
+    for (m = 0; m < balancers[i]->workers->nelts; ++m) {
+      const proxy_worker* w = workers[m];
+      page_printf(b, "%s{balancer=\"", name);
+      metrics_label(b, balancers[i]->s->name);
+      PAGE_LITERAL(b, "\",worker=\"");
+      metrics_label(b, w->s->name);
+      PAGE_LITERAL(b, "\"} ");
+      switch (value_kind) {
+        case 0:
+          page_printf(b, "%" APR_SIZE_T_FMT "\n", w->s->busy);
+          break;
+        case 1:
+          page_printf(b, "%d\n", w->s->lbstatus);
+          break;
+        default:
+          page_printf(b, "%d\n", PROXY_WORKER_IS_USABLE(w) ? 1 : 0);
+          break;
+      }
+    }
+  }
+}
+
+// Writes the balancer / site labels of a decision counter
+static void metrics_site_labels(page_buffer* b, const routing_table* t,
+                                const routing_balancer* balancer,
+                                int site_idx) {
+  PAGE_LITERAL(b, "{balancer=\"");
+  metrics_label(b, ROUTING_TABLE_AT(t, const char, balancer->name_offset));
+  PAGE_LITERAL(b, "\",site=\"");
+  if (site_idx != kROUTING_NOT_FOUND) {
+    metrics_label(b, routing_table_site_name(t, site_idx));
+  }
+  PAGE_LITERAL(b, "\"");
+}
+
+// Writes the decision counters of the table (zero counters are left out)
+static void metrics_decisions(page_buffer* b, const routing_table* t,
+                              const uint32_t* counters) {
+  static const char* const kind_names[kDECISION_KIND_COUNT] = {"preferred",
+                                                              "fallback"};
+  const routing_balancer* balancers =
+      ROUTING_TABLE_AT(t, routing_balancer, t->balancers_offset);
+  const int32_t* member_hosts =
+      ROUTING_TABLE_AT(t, int32_t, t->member_hosts_offset);
+  int bi, site, kind;
+  size_t m;
+  uint32_t i;
+
+  metrics_header(b, "palette_director_decisions_total", "counter",
+                 "Workers picked for a site, by the tier they were picked "
+                 "from (since the last reload)");
+  for (bi = 0; bi < (int)t->balancer_count; ++bi) {
+    for (site = kROUTING_NOT_FOUND; site < (int)t->site_count; ++site) {
+      for (m = 0; m < balancers[bi].member_count; ++m) {
+        const int32_t host = member_hosts[balancers[bi].first_member + m];
+        for (kind = 0; kind < kDECISION_KIND_COUNT; ++kind) {
+          const uint32_t count =
+              routing_counters_hits(counters, t, site, bi, m, kind);
+          if (count == 0) continue;
+
+          PAGE_LITERAL(b, "palette_director_decisions_total");
+          metrics_site_labels(b, t, &balancers[bi], site);
+          page_printf(b, ",member=\"%u\",host=\"", (unsigned)m);
+          if (host >= 0) metrics_label(b, routing_table_host_name(t, host));
+          page_printf(b, "\",tier=\"%s\"} %u\n", kind_names[kind], count);
+        }
+      }
+    }
+  }
+
+  metrics_header(b, "palette_director_in_flight", "gauge",
+                 "Requests of a site in flight on a worker");
+  for (bi = 0; bi < (int)t->balancer_count; ++bi) {
+    for (site = 0; site < (int)t->site_count; ++site) {
+      for (m = 0; m < balancers[bi].member_count; ++m) {
+        const int32_t host = member_hosts[balancers[bi].first_member + m];
+        const uint32_t count =
+            routing_counters_member_in_flight(counters, t, site, bi, m);
+        if (count == 0) continue;
+
+        PAGE_LITERAL(b, "palette_director_in_flight");
+        metrics_site_labels(b, t, &balancers[bi], site);
+        page_printf(b, ",member=\"%u\",host=\"", (unsigned)m);
+        if (host >= 0) metrics_label(b, routing_table_host_name(t, host));
+        page_printf(b, "\"} %u\n", count);
+      }
+    }
+  }
+
+  metrics_header(b, "palette_director_overflows_total", "counter",
+                 "Times a site started to spill over from its saturated "
+                 "preferred workers (since the last reload)");
+  for (bi = 0; bi < (int)t->balancer_count; ++bi) {
+    for (site = 0; site < (int)t->site_count; ++site) {
+      const uint32_t count = routing_counters_overflows(counters, t, site, bi);
+      if (count == 0) continue;
+
+      PAGE_LITERAL(b, "palette_director_overflows_total");
+      metrics_site_labels(b, t, &balancers[bi], site);
+      page_printf(b, "} %u\n", count);
+    }
+  }
+
+  metrics_header(b, "palette_director_no_candidate_total", "counter",
+                 "Requests without a usable worker (since the last reload)");
+  for (bi = 0; bi < (int)t->balancer_count; ++bi) {
+    for (site = kROUTING_NOT_FOUND; site < (int)t->site_count; ++site) {
+      const uint32_t count =
+          routing_counters_no_candidates(counters, t, site, bi);
+      if (count == 0) continue;
+
+      PAGE_LITERAL(b, "palette_director_no_candidate_total");
+      metrics_site_labels(b, t, &balancers[bi], site);
+      page_printf(b, "} %u\n", count);
+    }
+  }
+
+  metrics_header(b, "palette_director_drain_in_flight", "gauge",
+                 "Requests of a drained site in flight on its host");
+  for (i = 0; i < t->drain_count; ++i) {
+    const routing_drain* drain = &routing_table_drains(t)[i];
+    PAGE_LITERAL(b, "palette_director_drain_in_flight{set=\"");
+    metrics_label(b, binding_set_keys[drain->binding_set]);
+    PAGE_LITERAL(b, "\",site=\"");
+    metrics_label(b, routing_table_site_name(t, drain->site));
+    PAGE_LITERAL(b, "\",host=\"");
+    metrics_label(b, routing_table_host_name(t, drain->host));
+    page_printf(b, "\"} %u\n", drain_in_flight(t, counters, drain));
+  }
+
+  metrics_header(b, "palette_director_unknown_site_total", "counter",
+                 "Requests with a site that has no bindings (since the last "
+                 "reload)");
+  for (bi = 0; bi < (int)t->balancer_count; ++bi) {
+    PAGE_LITERAL(b, "palette_director_unknown_site_total{balancer=\"");
+    metrics_label(b, ROUTING_TABLE_AT(t, const char,
+                                      balancers[bi].name_offset));
+    page_printf(b, "\"} %u\n", routing_counters_unknown_sites(counters, t, bi));
+  }
+
+  metrics_header(b, "palette_director_no_site_total", "counter",
+                 "Requests without a :site parameter (since the last reload)");
+  for (bi = 0; bi < (int)t->balancer_count; ++bi) {
+    PAGE_LITERAL(b, "palette_director_no_site_total{balancer=\"");
+    metrics_label(b, ROUTING_TABLE_AT(t, const char,
+                                      balancers[bi].name_offset));
+    page_printf(b, "\"} %u\n", routing_counters_no_sites(counters, t, bi));
+  }
+}
+
+// Writes the selection time histogram
+static void metrics_latency(page_buffer* b, const routing_latency* latency) {
+  uint64_t cumulative = 0;
+  size_t i;
+
+  metrics_header(b, "palette_director_selection_duration_seconds",
+                 "histogram", "Time spent selecting a worker");
+  for (i = 0; i <= kLATENCY_BUCKET_COUNT; ++i) {
+    cumulative += PAL__COUNTER_READ(&latency->buckets[i]);
+    if (i < kLATENCY_BUCKET_COUNT) {
+      page_printf(b,
+                  "palette_director_selection_duration_seconds_bucket{le=\""
+                  "%g\"} %" APR_UINT64_T_FMT "\n",
+                  kLATENCY_BUCKET_BOUNDS_US[i] / 1e6, cumulative);
+    } else {
+      page_printf(b,
+                  "palette_director_selection_duration_seconds_bucket{le=\""
+                  "+Inf\"} %" APR_UINT64_T_FMT "\n",
+                  cumulative);
+    }
+  }
+  page_printf(b,
+              "palette_director_selection_duration_seconds_sum %g\n"
+              "palette_director_selection_duration_seconds_count %"
+              APR_UINT64_T_FMT "\n",
+              (double)PAL__COUNTER_READ64(&latency->sum_us) / 1e6, cumulative);
+}
+
+/* Builds the metrics page */
+void status_page_metrics(request_rec* r, const routing_table* t,
+                         const uint32_t* counters,
+                         proxy_balancer* const* balancers,
+                         size_t balancer_count) {
+  const routing_latency* latency = routing_state_latency();
+  page_buffer b;
+
+  ap_set_content_type(r, "text/plain; version=0.0.4");
+  page_buffer_init_streaming(&b, r->pool, kMETRICS_BUFFER_SIZE, metrics_flush,
+                             r);
+
+  metrics_header(&b, "palette_director_config_generation", "gauge",
+                 "Generation of the routing table in use");
+  page_printf(&b, "palette_director_config_generation %u\n",
+              (t != NULL) ? t->generation : 0u);
+
+  metrics_header(&b, "palette_director_config_published_timestamp_seconds",
+                 "gauge", "When the routing table in use was published");
+  page_printf(&b,
+              "palette_director_config_published_timestamp_seconds %.3f\n",
+              (double)routing_state_published_at() / APR_USEC_PER_SEC);
+
+  metrics_header(&b, "palette_director_config_loaded_timestamp_seconds",
+                 "gauge",
+                 "When the bindings were first loaded after the last restart");
+  page_printf(&b, "palette_director_config_loaded_timestamp_seconds %.3f\n",
+              (double)routing_state_created_at() / APR_USEC_PER_SEC);
+
+  metrics_members(&b, "palette_director_worker_busy",
+                  "Requests the worker is busy with", balancers,
+                  balancer_count, 0);
+  metrics_members(&b, "palette_director_worker_lbstatus",
+                  "The lbstatus of the worker", balancers, balancer_count, 1);
+  metrics_members(&b, "palette_director_worker_usable",
+                  "1 if the worker can take requests", balancers,
+                  balancer_count, 2);
+
+  if (t != NULL && counters != NULL) metrics_decisions(&b, t, counters);
+  if (latency != NULL) metrics_latency(&b, latency);
+
+  page_buffer_flush(&b);
 }
@@ -20,19 +20,54 @@
 
 #include "palette-director-types.h"
 
+typedef struct apr_pool_t apr_pool_t;
 typedef struct request_rec request_rec;
+typedef struct routing_table routing_table;
+typedef struct proxy_balancer proxy_balancer;
+
+// Sets up the cache of the rendered binding tables in a child process
+void status_pages_child_init(apr_pool_t* pchild);
 
 /*
-        Builds an HTML status page.
+        Builds an HTML status page with the binding tables of the routing
+        table (which may be NULL).
+
+        The tables are rendered once per table generation and served from
+        the cache, gzipped if the client accepts it. Returns OK, or
+        HTTP_NOT_MODIFIED if the client has the current page (If-None-Match).
 
         If add_style is not 0, then add the styling css and other style data.
 
 */
-void status_page_html(request_rec* r, const binding_rows* vizql_b,
-                      const binding_rows* authoring_b,
-                      const binding_rows* backgrounder_b, const int add_style);
+int status_page_html(request_rec* r, const routing_table* t,
+                     const int add_style);
+
+/*
+        Builds an HTML page of the routing decisions counted for each
+        balancer (the table and the counters may be NULL).
+*/
+void status_page_decisions(request_rec* r, const routing_table* t,
+                           const uint32_t* counters);
+
+/*
+        Builds a JSON status page: the bindings of each binding set, the live
+        state of the members of each balancer and the decisions counted for
+        them. The table and the counters may be NULL.
+*/
+void status_page_json(request_rec* r, const routing_table* t,
+                      const uint32_t* counters,
+                      proxy_balancer* const* balancers,
+                      size_t balancer_count);
 
 /*
- * Builds a JSON status page
- */
-void status_page_json(request_rec* r, const binding_rows* b);
+        Builds a Prometheus (text format) metrics page: the live state of the
+        balancer members, the decision counters, the selection time
+        histogram and the config generation / reload times.
+
+        The page is streamed through a fixed size buffer, so a scrape does
+        not allocate in proportion to the number of sites.
+*/
+void status_page_metrics(request_rec* r, const routing_table* t,
+                         const uint32_t* counters,
+                         proxy_balancer* const* balancers,
+                         size_t balancer_count);
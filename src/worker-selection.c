@@ -0,0 +1,645 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include "worker-selection.h"
+
+#include <apr_portable.h>
+#include <mod_proxy.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "palette-macros.h"
+#include "routing-counters.h"
+
+// The cost of a member that has requests outstanding but no response time
+// yet: it is only picked when every other member is in the same state
+static const uint64_t kUNMEASURED_COST = UINT64_MAX / 2;
+
+/*
+ * Returns the cost of a worker (lower is better): its busyness or, with
+ * latency scoring, (busy + 1) * the peak EWMA of its response times.
+ */
+static uint64_t worker_cost(const selection_context* ctx, size_t worker_idx,
+                            const proxy_worker* worker) {
+  const latency_scoring* latency = ctx->latency;
+  uint32_t ewma;
+
+  if (latency == NULL) return worker->s->busy;
+
+  ewma = routing_counters_peak_ewma(latency->counters, latency->table,
+                                    latency->balancer_idx, worker_idx,
+                                    latency->now_ms, latency->decay_ms);
+  if (ewma == 0) return (worker->s->busy == 0) ? 0 : kUNMEASURED_COST;
+  return ((uint64_t)worker->s->busy + 1) * ewma;
+}
+
+// Returns 1 if the site of the request has as many requests in flight on the
+// worker as its limit allows
+static int is_over_quota(const selection_context* ctx, size_t worker_idx) {
+  const quota_scope* quota = ctx->quota;
+  uint32_t limit;
+
+  if (quota == NULL) return 0;
+  limit = routing_table_member_limit(quota->table, quota->site_idx,
+                                     quota->balancer_idx, worker_idx);
+  return limit > 0 &&
+         routing_counters_member_in_flight(quota->counters, quota->table,
+                                           quota->site_idx,
+                                           quota->balancer_idx,
+                                           worker_idx) >= limit;
+}
+
+// Returns 1 if the site of the request has as many requests in flight on its
+// preferred workers as its limit allows
+static int is_site_over_quota(const selection_context* ctx) {
+  const quota_scope* quota = ctx->quota;
+  uint32_t limit;
+
+  if (quota == NULL) return 0;
+  limit = routing_table_site_limit(quota->table, quota->site_idx);
+  return limit > 0 &&
+         routing_counters_site_in_flight(quota->counters, quota->table,
+                                         quota->site_idx) >= limit;
+}
+
+// Returns 1 if the member is known to be down
+static int is_known_down(const selection_context* ctx, size_t worker_idx) {
+  const worker_health* health = ctx->health;
+  return health != NULL &&
+         routing_counters_member_down(health->counters, health->table,
+                                      health->balancer_idx, worker_idx);
+}
+
+// Returns 1 if the worker can take requests (without retrying it)
+static int is_up(const selection_context* ctx, size_t worker_idx,
+                 const proxy_worker* worker) {
+  return !is_known_down(ctx, worker_idx) && PROXY_WORKER_IS_USABLE(worker);
+}
+
+/*
+ * Returns 1 if the worker can take requests. If the worker is in error state
+ * run retry on that worker: it will be marked as operational if the retry
+ * timeout is elapsed. With the health of the members a single request of all
+ * the processes retries a member (once every kRETRY_INTERVAL_MS), the others
+ * pass over it without looking at it, and the state found is kept in the
+ * down bit of the member.
+ */
+static int is_usable_after_retry(const selection_context* ctx,
+                                 size_t worker_idx, proxy_worker* worker) {
+  const worker_health* health = ctx->health;
+  int usable;
+
+  if (health == NULL) {
+    if (PROXY_WORKER_IS_USABLE(worker)) return 1;
+    ctx->retry_fn("BALANCER", worker, ctx->r->server);
+    return PROXY_WORKER_IS_USABLE(worker);
+  }
+
+  if (!routing_counters_member_down(health->counters, health->table,
+                                    health->balancer_idx, worker_idx)) {
+    if (PROXY_WORKER_IS_USABLE(worker)) return 1;
+    routing_counters_set_member_down(health->counters, health->table,
+                                     health->balancer_idx, worker_idx, 1);
+  }
+  if (!routing_counters_claim_retry(health->counters, health->table,
+                                    health->balancer_idx, worker_idx,
+                                    health->now_ms, kRETRY_INTERVAL_MS)) {
+    return 0;
+  }
+
+  ctx->retry_fn("BALANCER", worker, ctx->r->server);
+  usable = PROXY_WORKER_IS_USABLE(worker);
+  if (usable) {
+    routing_counters_set_member_down(health->counters, health->table,
+                                     health->balancer_idx, worker_idx, 0);
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->r->server,
+                 "proxy: worker \"%s\" is back after a retry",
+                 worker->s->name);
+  }
+  return usable;
+}
+
+/*
+ * Overflow with hysteresis: the site starts to spill over once every usable
+ * preferred worker is at spill_busy, and stops once the least busy of them
+ * is down to return_busy, so a queue hovering around the threshold does not
+ * flip the site between the tiers with every request. Returns 1 while the
+ * site spills over and stores the busyness of the least busy preferred
+ * worker in least_busy.
+ */
+static int is_overflowing(const selection_context* ctx,
+                          const routing_tiers* tiers, apr_size_t* least_busy) {
+  const overflow_scope* overflow = ctx->overflow;
+  worker_index_slice preferred;
+  size_t i, usable_count = 0;
+  apr_size_t busy = 0;
+  int overflowing;
+
+  // nothing to spill over to
+  if (overflow == NULL ||
+      (tiers->tier_mask & ~(1u << kTIER_PREFER)) == 0) {
+    return 0;
+  }
+
+  preferred = routing_tiers_slice(tiers, kTIER_PREFER);
+  for (i = 0; i < preferred.count; ++i) {
+    const size_t idx = WORKER_INDEX_AT(preferred, i);
+    const proxy_worker* worker = ctx->workers[idx];
+    if (PROXY_WORKER_IS_STANDBY(worker) || PROXY_WORKER_IS_DRAINING(worker) ||
+        !is_up(ctx, idx, worker) || is_over_quota(ctx, idx)) {
+      continue;
+    }
+    if (usable_count == 0 || worker->s->busy < busy) busy = worker->s->busy;
+    usable_count++;
+  }
+  // without usable preferred workers the tiers fall back anyway
+  if (usable_count == 0) return 0;
+
+  overflowing = routing_counters_overflowing(
+      overflow->counters, overflow->table, overflow->site_idx,
+      overflow->balancer_idx);
+  if (!overflowing && busy >= overflow->spill_busy) {
+    overflowing = 1;
+  } else if (overflowing && busy <= overflow->return_busy) {
+    overflowing = 0;
+  } else {
+    *least_busy = busy;
+    return overflowing;
+  }
+
+  routing_counters_set_overflowing(overflow->counters, overflow->table,
+                                   overflow->site_idx, overflow->balancer_idx,
+                                   overflowing);
+  ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->r->server,
+               "proxy: site %s its preferred workers : least busy %"
+               APR_SIZE_T_FMT,
+               overflowing ? "overflows" : "returns to", busy);
+  *least_busy = busy;
+  return overflowing;
+}
+
+// Returns the order of the rounds of the original bybusyness method inside a
+// tier: by lbset, then the standby workers after the others (a lower order is
+// checked earlier)
+static int64_t round_order(const proxy_worker* worker) {
+  return (int64_t)worker->s->lbset * 2 +
+         (PROXY_WORKER_IS_STANDBY(worker) ? 1 : 0);
+}
+
+// Returns 1 if the worker takes part in a round: it can be used and the site
+// of the request is under its limit on it
+static int is_round_worker(const selection_context* ctx, size_t worker_idx,
+                           const proxy_worker* worker) {
+  return !PROXY_WORKER_IS_DRAINING(worker) && is_up(ctx, worker_idx, worker) &&
+         !is_over_quota(ctx, worker_idx);
+}
+
+/*
+ * Searches the tiers from first_tier to last_tier in a single ordered pass
+ * over their candidates, finding the first round (tier, lbset, standby) with
+ * any usable worker, which the original bybusyness method did by scanning
+ * the whole list for every lbset and standby flag. The candidates are sorted
+ * by tier and by lbset within their tier, so the workers of the round are
+ * usually met first, and the pass stops at the end of its tier.
+ *
+ * If a worker of an earlier round turns up late (an lbset or standby flag
+ * changed since the table was built), the lbstatus credits given to the
+ * round it replaces are taken back. With latency scoring the workers of the
+ * round are compared in a second pass, once the busy bound of the round is
+ * known.
+ */
+proxy_worker* find_best_bybusyness_from_tiers(const selection_context* ctx,
+                                              const routing_tiers* tiers,
+                                              int first_tier, int last_tier,
+                                              worker_selection* selection) {
+  request_rec* r = ctx->r;
+  proxy_worker** workers = ctx->workers;
+  const worker_index_slice candidates = tiers->candidates;
+  // The non-empty tiers to search
+  unsigned tier_mask = tiers->tier_mask & ~((1u << first_tier) - 1) &
+                       ((2u << last_tier) - 1);
+  size_t i, j;
+  int tier = first_tier;
+  // The best round: its order inside its tier and where its workers start
+  int64_t best_order = 0;
+  size_t round_begin = 0;
+  // The busyness of the usable workers of the best round
+  apr_size_t round_busy = 0;
+  size_t round_count = 0;
+  proxy_worker* mycandidate = NULL;
+  size_t mycandidate_idx = 0;
+  uint64_t mycandidate_cost = 0;
+  int mycandidate_over = 0;
+  double busy_bound = 0.0;
+  int total_factor = 0;
+
+  // nothing after the tier of the first round found can win
+  while (tier_mask != 0 && round_count == 0) {
+    size_t tier_end;
+
+    tier = PAL__LOWEST_BIT(tier_mask);
+    tier_mask &= tier_mask - 1;
+    i = (tier > 0) ? tiers->ends[tier - 1] : 0;
+    tier_end = tiers->ends[tier];
+
+    for (; i < tier_end; ++i) {
+      const size_t idx = WORKER_INDEX_AT(candidates, i);
+      proxy_worker* worker = workers[idx];
+      int64_t order;
+
+      if (PROXY_WORKER_IS_DRAINING(worker) || is_over_quota(ctx, idx)) {
+        continue;
+      }
+      order = round_order(worker);
+      if (round_count > 0 && order > best_order) continue;
+
+      if (!is_usable_after_retry(ctx, idx, worker)) continue;
+
+      if (round_count == 0 || order < best_order) {
+        // an earlier round: take back the credits of the one it replaces
+        for (j = round_begin; round_count > 0 && j < i; ++j) {
+          proxy_worker* w = workers[WORKER_INDEX_AT(candidates, j)];
+          if (round_order(w) == best_order &&
+              is_round_worker(ctx, WORKER_INDEX_AT(candidates, j), w)) {
+            w->s->lbstatus -= w->s->lbfactor;
+          }
+        }
+        best_order = order;
+        round_begin = i;
+        round_busy = 0;
+        round_count = 0;
+        total_factor = 0;
+        mycandidate = NULL;
+      }
+
+      // ORIGINAL LB_BYBUSYNESS METHOD
+      // =============================
+      worker->s->lbstatus += worker->s->lbfactor;
+      total_factor += worker->s->lbfactor;
+      round_busy += worker->s->busy;
+      round_count++;
+
+      // with latency scoring the workers are compared once the round is known
+      if (ctx->latency == NULL &&
+          (!mycandidate || worker->s->busy < mycandidate_cost ||
+           (worker->s->busy == mycandidate_cost &&
+            worker->s->lbstatus > mycandidate->s->lbstatus))) {
+        mycandidate = worker;
+        mycandidate_idx = idx;
+        mycandidate_cost = worker->s->busy;
+      }
+    }
+  }
+
+  if (round_count == 0) return NULL;
+
+  // With latency scoring a worker over the bound only wins if every worker
+  // is over it: a worker that answered a few fast requests can look many
+  // times cheaper than its peers, the bound keeps it from collecting a queue
+  // before its average catches up.
+  if (ctx->latency != NULL) {
+    busy_bound = ctx->latency->load_factor * (double)(round_busy + 1) /
+                 (double)round_count;
+
+    for (j = round_begin; j < tiers->ends[tier]; ++j) {
+      const size_t idx = WORKER_INDEX_AT(candidates, j);
+      proxy_worker* worker = workers[idx];
+      uint64_t cost;
+      int over;
+
+      if (round_order(worker) != best_order ||
+          !is_round_worker(ctx, idx, worker)) {
+        continue;
+      }
+
+      cost = worker_cost(ctx, idx, worker);
+      over = (double)worker->s->busy >= busy_bound;
+      if (!mycandidate || (mycandidate_over && !over) ||
+          (over == mycandidate_over &&
+           (cost < mycandidate_cost ||
+            (cost == mycandidate_cost &&
+             worker->s->lbstatus > mycandidate->s->lbstatus)))) {
+        mycandidate = worker;
+        mycandidate_idx = idx;
+        mycandidate_cost = cost;
+        mycandidate_over = over;
+      }
+    }
+  }
+
+  if (mycandidate) {
+    mycandidate->s->lbstatus -= total_factor;
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                 APLOGNO(01212) "proxy: bybusyness selected worker \"%s\" : "
+                                "busy %" APR_SIZE_T_FMT " : lbstatus %d",
+                 mycandidate->s->name, mycandidate->s->busy,
+                 mycandidate->s->lbstatus);
+    if (selection != NULL) {
+      selection->tier = tier;
+      selection->worker = mycandidate_idx;
+    }
+  }
+
+  return mycandidate;
+}
+
+// Gives back the lbstatus credits find_best_bybusyness_from_tiers() handed
+// out to the round of a candidate that ends up not being used
+static void give_back_credits(const selection_context* ctx,
+                              const routing_tiers* tiers, int tier,
+                              proxy_worker* candidate) {
+  const worker_index_slice round = routing_tiers_slice(tiers, tier);
+  const int64_t order = round_order(candidate);
+  int total_factor = 0;
+  size_t i;
+
+  for (i = 0; i < round.count; ++i) {
+    const size_t idx = WORKER_INDEX_AT(round, i);
+    proxy_worker* worker = ctx->workers[idx];
+    if (round_order(worker) == order && is_round_worker(ctx, idx, worker)) {
+      worker->s->lbstatus -= worker->s->lbfactor;
+      total_factor += worker->s->lbfactor;
+    }
+  }
+  candidate->s->lbstatus += total_factor;
+}
+
+// The score of a worker for an affinity key (highest random weight hashing:
+// each key ranks the workers in its own stable order)
+static uint32_t affinity_score(uint32_t key, const proxy_worker* worker) {
+  // murmur3 finalizer
+  uint32_t h = key ^ worker->s->hash.def;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+// Returns 1 if the affine pick may choose the worker at all
+static int is_affine_candidate(const selection_context* ctx,
+                               size_t worker_idx, const proxy_worker* worker) {
+  return !PROXY_WORKER_IS_STANDBY(worker) &&
+         !PROXY_WORKER_IS_DRAINING(worker) && !is_over_quota(ctx, worker_idx);
+}
+
+/*
+ * Bounded-load consistent hashing: every worker of the lowest usable lbset
+ * gets a capacity of load_factor times the average busyness (counting the
+ * new request) and the request goes to the highest scoring worker still
+ * under it. The least busy worker is always under the bound, so this only
+ * trades some balance for cache locality, never availability.
+ */
+proxy_worker* find_affine_from_list(const selection_context* ctx,
+                                    worker_index_slice workers_matched,
+                                    size_t* worker_idx) {
+  proxy_worker** workers = ctx->workers;
+  size_t i, candidate_count = 0;
+  apr_size_t total_busy = 0;
+  proxy_worker* mycandidate = NULL;
+  size_t mycandidate_idx = 0;
+  uint32_t best_score = 0;
+  int lbset = 0;
+  double bound;
+
+  // Find the lowest lbset with usable workers and their total busyness
+  for (i = 0; i < workers_matched.count; ++i) {
+    const size_t idx = WORKER_INDEX_AT(workers_matched, i);
+    proxy_worker* worker = workers[idx];
+    if (!is_affine_candidate(ctx, idx, worker)) continue;
+
+    if (!is_usable_after_retry(ctx, idx, worker)) continue;
+
+    if (candidate_count == 0 || worker->s->lbset < lbset) {
+      lbset = worker->s->lbset;
+      candidate_count = 0;
+      total_busy = 0;
+    }
+    if (worker->s->lbset == lbset) {
+      candidate_count++;
+      total_busy += worker->s->busy;
+    }
+  }
+
+  if (candidate_count == 0) return NULL;
+
+  bound = ctx->load_factor * (double)(total_busy + 1) / (double)candidate_count;
+
+  for (i = 0; i < workers_matched.count; ++i) {
+    const size_t idx = WORKER_INDEX_AT(workers_matched, i);
+    proxy_worker* worker = workers[idx];
+    uint32_t score;
+
+    if (!is_affine_candidate(ctx, idx, worker) || !is_up(ctx, idx, worker) ||
+        worker->s->lbset != lbset || (double)worker->s->busy >= bound) {
+      continue;
+    }
+
+    score = affinity_score(ctx->affinity_key, worker);
+    if (!mycandidate || score > best_score) {
+      mycandidate = worker;
+      mycandidate_idx = idx;
+      best_score = score;
+    }
+  }
+
+  if (mycandidate) {
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->r->server,
+                 "proxy: affinity selected worker \"%s\" : "
+                 "busy %" APR_SIZE_T_FMT " : bound %.2f",
+                 mycandidate->s->name, mycandidate->s->busy, bound);
+    if (worker_idx != NULL) *worker_idx = mycandidate_idx;
+  }
+
+  return mycandidate;
+}
+
+// The random state of the sampled picks of each thread
+static PAL__THREAD_LOCAL uint64_t sample_rng_state = 0;
+
+// Returns a seed for the random state of the thread. The children of a
+// forking MPM share the memory layout (and the address of the state), so
+// the process, the thread and the time are mixed in.
+static uint64_t sample_seed(void) {
+  uint64_t x = ((uint64_t)getpid() << 32) ^ (uint64_t)apr_time_now() ^
+               ((uint64_t)(size_t)apr_os_thread_current() *
+                0x9E3779B97F4A7C15ull);
+  // splitmix64 finalizer, so close seeds start far apart
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  x ^= x >> 31;
+  // the state of xorshift must not be 0
+  return (x != 0) ? x : 1u;
+}
+
+// Returns a random number in [0, bound) (xorshift64*)
+static size_t sample_below(size_t bound) {
+  uint64_t x = sample_rng_state;
+  if (x == 0) x = sample_seed();
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  sample_rng_state = x;
+  return (size_t)(((x * 0x2545F4914F6CDD1Dull) >> 32) % bound);
+}
+
+proxy_worker* find_sampled_from_list(const selection_context* ctx,
+                                     worker_index_slice workers_matched,
+                                     size_t* worker_idx) {
+  size_t sampled[kMAX_SAMPLE_COUNT];
+  const size_t sample_count = ctx->sample_count < kMAX_SAMPLE_COUNT
+                                  ? ctx->sample_count
+                                  : kMAX_SAMPLE_COUNT;
+  size_t i, j, draws;
+  proxy_worker* mycandidate = NULL;
+  size_t mycandidate_idx = 0;
+  uint64_t mycandidate_cost = 0;
+
+  // Draw distinct list positions (a repeated draw is simply lost, the
+  // list is much larger than the sample)
+  for (i = 0, draws = 0; draws < sample_count; ++draws) {
+    const size_t pos = sample_below(workers_matched.count);
+    for (j = 0; j < i && sampled[j] != pos; ++j) {
+    }
+    if (j == i) sampled[i++] = pos;
+  }
+
+  for (j = 0; j < i; ++j) {
+    const size_t idx = WORKER_INDEX_AT(workers_matched, sampled[j]);
+    proxy_worker* worker = ctx->workers[idx];
+    uint64_t cost;
+
+    if (PROXY_WORKER_IS_STANDBY(worker) || PROXY_WORKER_IS_DRAINING(worker) ||
+        is_over_quota(ctx, idx)) {
+      continue;
+    }
+    if (!is_usable_after_retry(ctx, idx, worker)) continue;
+
+    cost = worker_cost(ctx, idx, worker);
+    if (!mycandidate || worker->s->lbset < mycandidate->s->lbset ||
+        (worker->s->lbset == mycandidate->s->lbset &&
+         cost < mycandidate_cost)) {
+      mycandidate = worker;
+      mycandidate_idx = idx;
+      mycandidate_cost = cost;
+    }
+  }
+
+  if (mycandidate) {
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->r->server,
+                 "proxy: sampled worker \"%s\" : busy %" APR_SIZE_T_FMT,
+                 mycandidate->s->name, mycandidate->s->busy);
+    if (worker_idx != NULL) *worker_idx = mycandidate_idx;
+  }
+
+  return mycandidate;
+}
+
+/*
+ * Helper that returns the first matching candidate worker from the candidate
+ * tiers of a request.
+ */
+proxy_worker* check_worker_sets(const selection_context* ctx,
+                                const routing_tiers* tiers,
+                                worker_selection* selection) {
+  worker_selection picked;
+  size_t* worker_idx = (selection != NULL) ? &selection->worker : NULL;
+  proxy_worker* candidate = NULL;
+  apr_size_t preferred_busy = 0;
+  int overflowing = 0;
+  // the candidate came with lbstatus credits to its round
+  int credited = 0;
+  int first_tier = kTIER_PREFER;
+  int tier;
+
+  // a site at its limit, or with its preferred workers saturated, spills
+  // over from them
+  if (is_site_over_quota(ctx)) {
+    first_tier = kTIER_PREFER + 1;
+  } else if (is_overflowing(ctx, tiers, &preferred_busy)) {
+    first_tier = kTIER_PREFER + 1;
+    overflowing = 1;
+  }
+
+  // stick to the preferred hosts of the site
+  if (first_tier == kTIER_PREFER && ctx->affinity_key != 0) {
+    const worker_index_slice preferred =
+        routing_tiers_slice(tiers, kTIER_PREFER);
+    if (preferred.count > 0) {
+      candidate = find_affine_from_list(ctx, preferred, worker_idx);
+    }
+    if (candidate != NULL) {
+      if (selection != NULL) selection->tier = kTIER_PREFER;
+      return candidate;
+    }
+  }
+
+  if (ctx->sample_count == 0) {
+    candidate = find_best_bybusyness_from_tiers(ctx, tiers, first_tier,
+                                                kTIER_ALLOW, &picked);
+    credited = (candidate != NULL);
+  } else {
+    // the tiers large enough are sampled one by one
+    for (tier = first_tier; tier <= kTIER_ALLOW && candidate == NULL;
+         ++tier) {
+      const worker_index_slice worker_list = routing_tiers_slice(tiers, tier);
+      if (worker_list.count == 0) continue;
+      if (worker_list.count >= ctx->sample_count * kSAMPLED_LIST_FACTOR) {
+        candidate = find_sampled_from_list(ctx, worker_list, &picked.worker);
+        picked.tier = tier;
+      }
+      if (candidate == NULL) {
+        candidate =
+            find_best_bybusyness_from_tiers(ctx, tiers, tier, tier, &picked);
+        credited = (candidate != NULL);
+      }
+    }
+  }
+  // Spilling over only pays off to a worker with a shorter queue, otherwise
+  // the preferred workers are searched after all, and the round passed over
+  // gets its credits back so that its lbstatus does not drift
+  if (overflowing &&
+      (candidate == NULL || candidate->s->busy >= preferred_busy)) {
+    selection_context saturated = *ctx;
+    if (credited) give_back_credits(ctx, tiers, picked.tier, candidate);
+    saturated.overflow = NULL;
+    return check_worker_sets(&saturated, tiers, selection);
+  }
+  if (candidate != NULL) {
+    if (selection != NULL) *selection = picked;
+    return candidate;
+  }
+
+  // The limits never turn a request away: if every usable worker is at the
+  // limit of the site, pick as if there were none
+  if (ctx->quota != NULL) {
+    selection_context unlimited = *ctx;
+    unlimited.quota = NULL;
+    return check_worker_sets(&unlimited, tiers, selection);
+  }
+
+  // If we get this far, no workers have matched, so we have
+  // to accept our faith.
+  return NULL;
+}
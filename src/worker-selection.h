@@ -0,0 +1,187 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#pragma once
+
+#include "routing-table.h"
+
+typedef struct request_rec request_rec;
+typedef struct server_rec server_rec;
+
+// The signature of ap_proxy_retry_worker()
+typedef int (*worker_retry_fn)(const char* proxy_function,
+                               proxy_worker* worker, server_rec* s);
+
+// Where the peak EWMA response times of the balancer members are read from
+typedef struct latency_scoring {
+  const routing_table* table;
+  const uint32_t* counters;
+  int balancer_idx;
+
+  // The current time and the decay time of the averages in milliseconds
+  uint32_t now_ms;
+  uint32_t decay_ms;
+
+  // The workers at this many times the average busyness of their lbset are
+  // passed over (at least 1.0)
+  double load_factor;
+} latency_scoring;
+
+enum {
+  // The most workers a sampled pick compares
+  kMAX_SAMPLE_COUNT = 8,
+
+  // Lists are only sampled if they have at least this many times the sample
+  // count of workers (smaller lists are scanned)
+  kSAMPLED_LIST_FACTOR = 4,
+};
+
+// The in-flight limits of the site a request is for
+typedef struct quota_scope {
+  const routing_table* table;
+  const uint32_t* counters;
+  int site_idx;
+  int balancer_idx;
+} quota_scope;
+
+// Where the overflow threshold of the site a request is for is applied
+typedef struct overflow_scope {
+  const routing_table* table;
+  uint32_t* counters;
+  int site_idx;
+  int balancer_idx;
+
+  // The site spills over once its least busy preferred worker is this busy,
+  // and returns once it is down to return_busy (below spill_busy)
+  size_t spill_busy;
+  size_t return_busy;
+} overflow_scope;
+
+// Where the balancer members known to be down and their retries are kept
+typedef struct worker_health {
+  const routing_table* table;
+  uint32_t* counters;
+  int balancer_idx;
+
+  // The current time in milliseconds
+  uint32_t now_ms;
+} worker_health;
+
+enum {
+  // A member in error state is retried at most once in this many
+  // milliseconds, by one request of all the processes
+  kRETRY_INTERVAL_MS = 100,
+};
+
+// The state shared by the steps of selecting a worker for a request
+typedef struct selection_context {
+  request_rec* r;
+
+  // The members of the balancer (balancer->workers)
+  proxy_worker** workers;
+
+  // Called for the workers in error state before checking them again
+  worker_retry_fn retry_fn;
+
+  // If not NULL, the members known to be down are skipped, and only the
+  // request that claims the retry of one calls retry_fn for it
+  const worker_health* health;
+
+  // The hash of the site (or site and workbook) the request sticks to, or 0
+  // to pick the least busy worker of each list
+  uint32_t affinity_key;
+
+  // The affine pick skips the workers that are already at this many times
+  // the average busyness of the candidates (at least 1.0)
+  double load_factor;
+
+  // If not NULL, the workers are compared by their outstanding requests
+  // times their peak EWMA response time instead of by busyness alone
+  const latency_scoring* latency;
+
+  // If not 0, large lists are not scanned: this many (at most
+  // kMAX_SAMPLE_COUNT) random workers are compared instead
+  size_t sample_count;
+
+  // If not NULL, the workers at the in-flight limit of the site are passed
+  // over, and the first (preferred) list is skipped once the site is at its
+  // own limit
+  const quota_scope* quota;
+
+  // If not NULL, the fallback tiers are also tried while the preferred
+  // workers of the site are saturated
+  const overflow_scope* overflow;
+} selection_context;
+
+// Where the worker returned by check_worker_sets() was found
+typedef struct worker_selection {
+  // The tier the worker is from
+  int tier;
+
+  // The index of the worker in balancer->workers
+  size_t worker;
+} worker_selection;
+
+/*
+ * Searches the candidate tiers from first_tier to last_tier (up to
+ * kTIER_ALLOW) and returns the least busy usable worker of the first tier,
+ * lbset and standby round that has any, like the original bybusyness method,
+ * in one ordered pass over the candidates. If selection is not NULL, the tier
+ * and the balancer->workers index of the candidate are stored there.
+ */
+proxy_worker* find_best_bybusyness_from_tiers(const selection_context* ctx,
+                                              const routing_tiers* tiers,
+                                              int first_tier, int last_tier,
+                                              worker_selection* selection);
+
+/*
+ * Picks the worker the affinity key of the context hashes to from a list with
+ * bounded-load consistent hashing, so the requests of a site keep landing on
+ * the same hosts as long as they are not overloaded. Returns NULL if the list
+ * has no usable (non-standby, non-draining) worker.
+ */
+proxy_worker* find_affine_from_list(const selection_context* ctx,
+                                    worker_index_slice workers_matched,
+                                    size_t* worker_idx);
+
+/*
+ * Power-of-d-choices: compares sample_count random workers of the list and
+ * returns the cheapest usable one of the lowest lbset among them, touching
+ * the shared state of none of the others (no lbstatus updates). Returns NULL
+ * if none of the sampled workers is usable, standby workers are never
+ * sampled.
+ */
+proxy_worker* find_sampled_from_list(const selection_context* ctx,
+                                     worker_index_slice workers_matched,
+                                     size_t* worker_idx);
+
+/*
+ * Helper that returns the first matching candidate worker from the candidate
+ * tiers of a request. If selection is not NULL, the position of the candidate
+ * is stored there. With an affinity key in the context the preferred tier is
+ * tried with find_affine_from_list() first, with a sample count the tiers
+ * large enough are tried with find_sampled_from_list() first (tier by tier),
+ * otherwise every tier is searched in a single pass. While the site overflows
+ * its preferred workers the search starts at the tier after them, and only
+ * keeps a fallback worker less busy than every preferred one. If the
+ * in-flight limits leave no candidate, the tiers are checked again without
+ * them.
+ */
+proxy_worker* check_worker_sets(const selection_context* ctx,
+                                const routing_tiers* tiers,
+                                worker_selection* selection);
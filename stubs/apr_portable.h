@@ -0,0 +1,28 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+// Stand-in for the thread handle of apr_portable.h (see mod_proxy.h)
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uintptr_t apr_os_thread_t;
+
+// Returns a value that differs between the threads of the process
+apr_os_thread_t apr_os_thread_current(void);
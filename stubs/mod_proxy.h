@@ -0,0 +1,181 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+/*
+        Lightweight stand-ins for the parts of httpd, APR and mod_proxy the
+        routing code uses, so the benchmarks and the tools can build the
+        routing engine outside of a running httpd.
+
+        Only the fields the routing code touches are declared.
+*/
+
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define strcasecmp _stricmp
+#define strncasecmp _strnicmp
+#else
+#include <netdb.h>
+#include <strings.h>
+#include <sys/socket.h>
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define APR_SUCCESS 0
+#define APR_SIZE_T_FMT "lu"
+
+typedef int apr_status_t;
+typedef int64_t apr_time_t;
+typedef size_t apr_size_t;
+
+// APR / HTTPD
+// ===========
+
+typedef struct apr_array_header_t {
+  int elt_size;
+  int nelts;
+  int nalloc;
+  char* elts;
+} apr_array_header_t;
+
+typedef struct server_rec {
+  const char* server_hostname;
+} server_rec;
+
+// A bump allocator over a chain of blocks: apr_pool_clear() releases
+// everything at once (and keeps the first block for reuse)
+typedef struct apr_pool_block {
+  struct apr_pool_block* next;
+  apr_size_t used;
+  apr_size_t size;
+} apr_pool_block;
+
+typedef struct apr_pool_t {
+  apr_pool_block* blocks;
+} apr_pool_t;
+
+apr_time_t apr_time_now(void);
+
+void* apr_palloc(apr_pool_t* p, apr_size_t size);
+void apr_pool_clear(apr_pool_t* p);
+void apr_pool_destroy(apr_pool_t* p);
+
+// Copies the word up to stop into the pool and moves *line past it
+// (and past any repeated stop characters), like httpd does
+char* ap_getword(apr_pool_t* p, const char** line, char stop);
+
+// Decodes the %XX sequences of url in place, like httpd does
+int ap_unescape_url(char* url);
+
+typedef struct request_rec {
+  apr_pool_t* pool;
+  server_rec* server;
+  const char* uri;
+  char* args;
+} request_rec;
+
+extern server_rec* ap_server_conf;
+
+#define APLOG_MARK __FILE__, __LINE__
+#define APLOG_EMERG 0
+#define APLOG_ALERT 1
+#define APLOG_CRIT 2
+#define APLOG_ERR 3
+#define APLOG_WARNING 4
+#define APLOG_NOTICE 5
+#define APLOG_INFO 6
+#define APLOG_DEBUG 7
+#define APLOGNO(n) "AH" #n ": "
+
+// Only prints when the level is at or under stub_log_level
+void ap_log_error(const char* file, int line, int level, apr_status_t status,
+                  const server_rec* s, const char* fmt, ...);
+
+extern int stub_log_level;
+
+// MOD_PROXY
+// =========
+
+typedef struct proxy_hashes {
+  unsigned int def;
+  unsigned int fnv;
+} proxy_hashes;
+
+typedef struct proxy_worker_shared {
+  char name[96];
+  char hostname[64];
+  char route[96];
+  unsigned int status;
+  int lbfactor;
+  int lbset;
+  int lbstatus;
+  apr_size_t busy;
+  proxy_hashes hash;
+} proxy_worker_shared;
+
+typedef struct proxy_worker {
+  proxy_hashes hash;
+  proxy_worker_shared* s;
+} proxy_worker;
+
+typedef struct proxy_balancer_shared {
+  char name[64];
+  char sticky[64];
+  proxy_hashes hash;
+} proxy_balancer_shared;
+
+typedef struct proxy_balancer {
+  apr_array_header_t* workers;
+  proxy_hashes hash;
+  proxy_balancer_shared* s;
+} proxy_balancer;
+
+#define PROXY_WORKER_INITIALIZED 0x0001
+#define PROXY_WORKER_DRAIN 0x0004
+#define PROXY_WORKER_IN_SHUTDOWN 0x0010
+#define PROXY_WORKER_DISABLED 0x0020
+#define PROXY_WORKER_STOPPED 0x0040
+#define PROXY_WORKER_IN_ERROR 0x0080
+#define PROXY_WORKER_HOT_STANDBY 0x0100
+
+#define PROXY_WORKER_NOT_USABLE_BITMAP                                         \
+  (PROXY_WORKER_IN_SHUTDOWN | PROXY_WORKER_DISABLED | PROXY_WORKER_STOPPED | \
+   PROXY_WORKER_IN_ERROR)
+
+#define PROXY_WORKER_IS_INITIALIZED(f) \
+  ((f)->s->status & PROXY_WORKER_INITIALIZED)
+#define PROXY_WORKER_IS_STANDBY(f) ((f)->s->status & PROXY_WORKER_HOT_STANDBY)
+#define PROXY_WORKER_IS_DRAINING(f) ((f)->s->status & PROXY_WORKER_DRAIN)
+#define PROXY_WORKER_IS_USABLE(f)                           \
+  ((!((f)->s->status & PROXY_WORKER_NOT_USABLE_BITMAP)) && \
+   PROXY_WORKER_IS_INITIALIZED(f))
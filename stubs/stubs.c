@@ -0,0 +1,150 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+#include <apr_portable.h>
+#include <mod_proxy.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "palette-macros.h"
+
+static server_rec stub_server = {"palette-director"};
+
+server_rec* ap_server_conf = &stub_server;
+
+// Stay quiet unless something is really wrong (the loader logs every
+// binding it cannot keep at APLOG_ERR)
+int stub_log_level = APLOG_CRIT;
+
+void ap_log_error(const char* file, int line, int level, apr_status_t status,
+                  const server_rec* s, const char* fmt, ...) {
+  va_list args;
+  if (level > stub_log_level) return;
+
+  va_start(args, fmt);
+  fprintf(stderr, "[%s:%d] ", file, line);
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+// Seconds are enough for seeding
+apr_time_t apr_time_now(void) { return (apr_time_t)time(NULL) * 1000000; }
+
+// The address of a thread local differs between the threads
+static PAL__THREAD_LOCAL char thread_marker;
+
+apr_os_thread_t apr_os_thread_current(void) {
+  return (apr_os_thread_t)&thread_marker;
+}
+
+// APR pools
+// =========
+
+enum { kPOOL_BLOCK_SIZE = 8192 };
+
+void* apr_palloc(apr_pool_t* p, apr_size_t size) {
+  apr_pool_block* block = p->blocks;
+  void* mem;
+  size = (size + 7) & ~(apr_size_t)7;
+
+  if (block == NULL || block->used + size > block->size) {
+    const apr_size_t block_size =
+        size > kPOOL_BLOCK_SIZE ? size : kPOOL_BLOCK_SIZE;
+    block = (apr_pool_block*)malloc(sizeof(apr_pool_block) + block_size);
+    block->next = p->blocks;
+    block->used = 0;
+    block->size = block_size;
+    p->blocks = block;
+  }
+
+  mem = (char*)(block + 1) + block->used;
+  block->used += size;
+  return mem;
+}
+
+void apr_pool_clear(apr_pool_t* p) {
+  // Keep the oldest block for the next round
+  while (p->blocks != NULL && p->blocks->next != NULL) {
+    apr_pool_block* next = p->blocks->next;
+    free(p->blocks);
+    p->blocks = next;
+  }
+  if (p->blocks != NULL) p->blocks->used = 0;
+}
+
+void apr_pool_destroy(apr_pool_t* p) {
+  apr_pool_clear(p);
+  free(p->blocks);
+  p->blocks = NULL;
+}
+
+// HTTPD utilities
+// ===============
+
+char* ap_getword(apr_pool_t* p, const char** line, char stop) {
+  const char* pos = *line;
+  size_t length;
+  char* res;
+
+  while (*pos != stop && *pos) ++pos;
+
+  length = (size_t)(pos - *line);
+  res = (char*)apr_palloc(p, length + 1);
+  memcpy(res, *line, length);
+  res[length] = '\0';
+
+  if (stop) {
+    while (*pos == stop) ++pos;
+  }
+  *line = pos;
+  return res;
+}
+
+static int is_hex_digit(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+         (c >= 'A' && c <= 'F');
+}
+
+static char hex_to_char(const char* what) {
+  char digit;
+  digit = (char)(what[0] >= 'A' ? ((what[0] & 0xdf) - 'A') + 10
+                                : (what[0] - '0'));
+  digit *= 16;
+  digit += (char)(what[1] >= 'A' ? ((what[1] & 0xdf) - 'A') + 10
+                                 : (what[1] - '0'));
+  return digit;
+}
+
+int ap_unescape_url(char* url) {
+  char* x;
+  const char* y;
+
+  for (x = url, y = url; *y; ++x, ++y) {
+    if (*y != '%') {
+      *x = *y;
+    } else if (!is_hex_digit(y[1]) || !is_hex_digit(y[2])) {
+      *x = '%';
+    } else {
+      *x = hex_to_char(y + 1);
+      y += 2;
+    }
+  }
+  *x = '\0';
+  return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * palette-director
+ * Copyright (C) 2016 brilliant-data.com
+ *
+ * This program is free software: you can redistribute it and//or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http:////www.gnu.org//licenses//>.
+ * */
+
+/*
+        Compiles a binding CSV into the binary format the module maps
+        instead of parsing (see compiled-config.h), or dumps a binding
+        config (compiled or CSV) as the CSV the module would see.
+
+        Usage: palette-director-compile <bindings.csv> <bindings.pdbc>
+               palette-director-compile --dump <bindings.pdbc>
+
+        The compiled config is written next to the output and renamed over
+        it, so the config watcher of a running httpd never sees half a
+        file.
+*/
+
+#include <mod_proxy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiled-config.h"
+#include "config-loader.h"
+#include "csv/csv.h"
+
+static int usage(void) {
+  fprintf(stderr,
+          "Usage: palette-director-compile <bindings.csv> <bindings.pdbc>\n"
+          "       palette-director-compile --dump <bindings.pdbc>\n");
+  return 2;
+}
+
+// Writes the data to path.tmp and renames it over path
+static int write_file_atomically(const char* path, const void* data,
+                                 size_t size) {
+  const size_t path_length = strlen(path);
+  char* tmp_path = (char*)malloc(path_length + sizeof(".tmp"));
+  FILE* f;
+  int ok;
+
+  if (tmp_path == NULL) return 0;
+  memcpy(tmp_path, path, path_length);
+  memcpy(tmp_path + path_length, ".tmp", sizeof(".tmp"));
+
+  f = fopen(tmp_path, "wb");
+  if (f == NULL) {
+    free(tmp_path);
+    return 0;
+  }
+  ok = fwrite(data, size, 1, f) == 1;
+  ok = (fclose(f) == 0) && ok;
+
+#ifdef _WIN32
+  // rename() does not replace an existing file on Windows
+  if (ok) remove(path);
+#endif
+  ok = ok && rename(tmp_path, path) == 0;
+  if (!ok) remove(tmp_path);
+  free(tmp_path);
+  return ok;
+}
+
+static int compile(const char* csv_path, const char* out_path) {
+  FILE* f = fopen(csv_path, "rb");
+  apr_pool_t pool = {NULL};
+  binding_config config;
+  compiled_config_header* compiled;
+  size_t size = 0, row_count;
+  const char* problem;
+
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open '%s'\n", csv_path);
+    return 1;
+  }
+  fclose(f);
+
+  config = parse_csv_config(&pool, csv_path);
+  row_count = config.rows.count;
+  compiled = compiled_config_build(&config.rows, &size);
+  apr_pool_destroy(&pool);
+  if (compiled == NULL) {
+    fprintf(stderr, "Out of memory compiling '%s'\n", csv_path);
+    return 1;
+  }
+
+  // never leave a file the module would reject
+  problem = compiled_config_validate(compiled, size);
+  if (problem != NULL) {
+    fprintf(stderr, "Cannot compile '%s': %s\n", csv_path, problem);
+    free(compiled);
+    return 1;
+  }
+
+  if (!write_file_atomically(out_path, compiled, size)) {
+    fprintf(stderr, "Cannot write '%s'\n", out_path);
+    free(compiled);
+    return 1;
+  }
+
+  printf("Compiled %lu bindings of %u sites on %u hosts (%u limits) into "
+         "'%s' (%lu bytes)\n",
+         (unsigned long)row_count, compiled->site_count, compiled->host_count,
+         compiled->limit_count, out_path, (unsigned long)size);
+  free(compiled);
+  return 0;
+}
+
+static void print_kind(binding_kind_t kind) {
+  if (kind == kBINDING_PREFER) {
+    printf("prefer");
+  } else if (kind == kBINDING_FORBID) {
+    printf("forbid");
+  } else if (kind > kBINDING_PREFER) {
+    printf("%d", kind);
+  }
+}
+
+static int dump(const char* path) {
+  apr_pool_t pool = {NULL};
+  binding_config config = load_binding_config(&pool, path);
+  const compiled_config_header* compiled =
+      (const compiled_config_header*)config.mapping;
+  size_t i;
+  int status = 0;
+
+  printf("site,host,binding,max_in_flight\n");
+  for (i = 0; i < config.rows.count; ++i) {
+    const binding_row* row = &config.rows.entries[i];
+
+    // every site must be found through the index
+    if (compiled != NULL &&
+        compiled_config_find_site(compiled, row->site_name,
+                                  strlen(row->site_name)) < 0) {
+      fprintf(stderr, "Site '%s' missing from the index\n", row->site_name);
+      status = 1;
+    }
+
+    // the names are quoted (and their quotes doubled) like the CSV writer
+    // of the loader does
+    csv_fwrite(stdout, row->site_name, strlen(row->site_name));
+    putchar(',');
+    csv_fwrite(stdout, row->worker_host, strlen(row->worker_host));
+    putchar(',');
+    print_kind(row->binding_kind);
+    if (row->max_in_flight > 0) {
+      printf(",%lu", (unsigned long)row->max_in_flight);
+    } else {
+      printf(",");
+    }
+    printf("\n");
+  }
+
+  if (config.rows.count == 0) {
+    fprintf(stderr, "No bindings loaded from '%s'\n", path);
+    status = 1;
+  }
+  unload_binding_config(&config);
+  apr_pool_destroy(&pool);
+  return status;
+}
+
+int main(int argc, char** argv) {
+  // show the problems of the loader
+  stub_log_level = APLOG_ERR;
+
+  if (argc == 3 && strcmp(argv[1], "--dump") == 0) return dump(argv[2]);
+  if (argc == 3 && argv[1][0] != '-') return compile(argv[1], argv[2]);
+  return usage();
+}